@@ -0,0 +1,181 @@
+// audit.cpp - Reader for the operation audit log (<omni>.audit.NNNNNN)
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <ctime>
+#include <cstdlib>
+#include <algorithm>
+#include "audit_log.hpp"
+#include "../include/ofs_functions.hpp"
+#include "../server/protocol.hpp"
+using namespace std;
+
+struct Filter {
+    string user;
+    int op = -1;
+    uint64_t since_us = 0;
+    uint64_t until_us = UINT64_MAX;
+    bool errors_only = false;
+
+    bool matches(const AuditEvent& event) const {
+        if (!user.empty() && event.user != user) return false;
+        if (op >= 0 && event.op != op) return false;
+        if (errors_only && event.result == SUCCESS) return false;
+        return event.time_us >= since_us && event.time_us < until_us;
+    }
+};
+
+struct OperationStats {
+    uint64_t count = 0;
+    uint64_t errors = 0;
+    uint64_t bytes = 0;
+    uint64_t total_us = 0;
+    uint32_t max_us = 0;
+};
+
+string operation_name(uint8_t op) {
+    return op < OPERATION_COUNT ? OPERATION_NAMES[op] : "op_" + to_string(op);
+}
+
+string format_time(uint64_t time_us) {
+    time_t seconds = time_us / 1000000;
+    tm local;
+    localtime_r(&seconds, &local);
+    char text[32];
+    strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &local);
+    char micros[8];
+    snprintf(micros, sizeof(micros), ".%06u", (unsigned)(time_us % 1000000));
+    return string(text) + micros;
+}
+
+void print_event(const AuditEvent& event) {
+    cout << format_time(event.time_us) << "  " << left << setw(10) << event.user << " "
+         << setw(12) << operation_name(event.op) << " " << right << event.path;
+    if (!event.path2.empty()) cout << " -> " << event.path2;
+    if (event.op == OP_FILE_CREATE || event.op == OP_FS_GROW || event.op == OP_FS_SHRINK) {
+        cout << "  " << event.size << " B";
+    }
+    if (event.result == SUCCESS) {
+        cout << "  ok";
+    } else {
+        cout << "  error " << event.result << " (" << get_error_message(event.result) << ")";
+    }
+    cout << "  " << event.duration_us << " us" << endl;
+}
+
+void print_usage() {
+    cout << "Usage: ofs_audit [--stats] [--errors] [--user NAME] [--op NAME]" << endl;
+    cout << "                 [--since UNIX_TIME] [--until UNIX_TIME] [omni_path]" << endl;
+    cout << "  --stats    per-operation and per-user totals instead of the records" << endl;
+    cout << "  --errors   only operations that failed" << endl;
+}
+
+int main(int argc, char** argv) {
+    string omni_path = "../compiled/test.omni";
+    Filter filter;
+    bool stats_mode = false;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--stats") {
+            stats_mode = true;
+        } else if (arg == "--errors") {
+            filter.errors_only = true;
+        } else if (arg == "--user" && i + 1 < argc) {
+            filter.user = argv[++i];
+        } else if (arg == "--op" && i + 1 < argc) {
+            string name = argv[++i];
+            const char* const* found = find(OPERATION_NAMES, OPERATION_NAMES + OPERATION_COUNT, name);
+            if (found == OPERATION_NAMES + OPERATION_COUNT) {
+                cerr << "Error: Unknown operation " << name << endl;
+                return 1;
+            }
+            filter.op = found - OPERATION_NAMES;
+        } else if (arg == "--since" && i + 1 < argc) {
+            filter.since_us = strtoull(argv[++i], nullptr, 10) * 1000000;
+        } else if (arg == "--until" && i + 1 < argc) {
+            filter.until_us = strtoull(argv[++i], nullptr, 10) * 1000000;
+        } else if (arg == "-h" || arg == "--help") {
+            print_usage();
+            return 0;
+        } else {
+            omni_path = arg;
+        }
+    }
+
+    vector<string> segments = audit_segments(omni_path);
+    if (segments.empty()) {
+        cerr << "Error: No audit log segments for " << omni_path << endl;
+        return 1;
+    }
+
+    auto start = chrono::steady_clock::now();
+    map<uint8_t, OperationStats> by_operation;
+    map<string, uint64_t> by_user;
+    uint64_t scanned = 0, matched = 0, first_us = UINT64_MAX, last_us = 0;
+
+    for (const string& path : segments) {
+        AuditReader reader;
+        if (!reader.open(path)) {
+            cerr << "Error: " << path << " is not an audit log segment" << endl;
+            continue;
+        }
+        AuditEvent event;
+        while (reader.next(event)) {
+            scanned++;
+            if (!filter.matches(event)) continue;
+            matched++;
+            first_us = min(first_us, event.time_us);
+            last_us = max(last_us, event.time_us);
+
+            if (!stats_mode) {
+                print_event(event);
+                continue;
+            }
+            OperationStats& s = by_operation[event.op];
+            s.count++;
+            if (event.result != SUCCESS) s.errors++;
+            if (event.op == OP_FILE_CREATE && event.result == SUCCESS) s.bytes += event.size;
+            s.total_us += event.duration_us;
+            s.max_us = max(s.max_us, event.duration_us);
+            by_user[string(event.user)]++;
+        }
+        if (reader.truncated()) {
+            cerr << "Warning: " << path << " ends in a partial entry" << endl;
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if (!stats_mode) return 0;
+
+    cout << "\n========================================" << endl;
+    cout << "  OFS AUDIT LOG" << endl;
+    cout << "  Segments: " << segments.size() << ", records: " << scanned << ", matching: " << matched << endl;
+    if (matched > 0) {
+        cout << "  From " << format_time(first_us) << " to " << format_time(last_us) << endl;
+    }
+    cout << "========================================\n" << endl;
+
+    cout << left << setw(14) << "operation" << right << setw(10) << "count" << setw(10) << "errors"
+         << setw(12) << "avg us" << setw(12) << "max us" << setw(14) << "bytes" << endl;
+    for (auto& entry : by_operation) {
+        const OperationStats& s = entry.second;
+        cout << left << setw(14) << operation_name(entry.first) << right << setw(10) << s.count
+             << setw(10) << s.errors << setw(12) << (s.count ? s.total_us / s.count : 0)
+             << setw(12) << s.max_us << setw(14) << s.bytes << endl;
+    }
+
+    vector<pair<uint64_t, string>> users;
+    for (auto& entry : by_user) users.push_back({entry.second, entry.first});
+    sort(users.rbegin(), users.rend());
+    cout << "\nBusiest users:" << endl;
+    for (size_t i = 0; i < users.size() && i < 10; i++) {
+        cout << "  " << left << setw(16) << users[i].second << right << users[i].first << endl;
+    }
+
+    cout << "\nScanned " << scanned << " records in " << seconds * 1000 << " ms" << endl;
+    return 0;
+}
@@ -0,0 +1,403 @@
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "audit_log.hpp"
+#include "logger.hpp"
+#include "../include/odf_types.hpp"
+using namespace std;
+
+const char AUDIT_MAGIC[8] = {'O', 'F', 'S', 'A', 'U', 'D', 'T', '1'};
+
+uint64_t audit_now_us() {
+    return chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+string audit_segment_path(const string& omni_path, uint32_t segment) {
+    char number[16];
+    snprintf(number, sizeof(number), "%06u", segment);
+    return omni_path + ".audit." + number;
+}
+
+vector<string> audit_segments(const string& omni_path) {
+    size_t slash = omni_path.rfind('/');
+    string dir = slash == string::npos ? "." : omni_path.substr(0, slash);
+    string prefix = (slash == string::npos ? omni_path : omni_path.substr(slash + 1)) + ".audit.";
+
+    vector<pair<uint32_t, string>> found;
+    DIR* listing = opendir(dir.c_str());
+    if (!listing) return {};
+    while (dirent* item = readdir(listing)) {
+        string name = item->d_name;
+        if (name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix) != 0) continue;
+        string number = name.substr(prefix.size());
+        if (number.find_first_not_of("0123456789") != string::npos) continue;
+        found.push_back({(uint32_t)stoul(number), dir + "/" + name});
+    }
+    closedir(listing);
+
+    sort(found.begin(), found.end());
+    vector<string> paths;
+    for (auto& segment : found) paths.push_back(segment.second);
+    return paths;
+}
+
+// ============================================================================
+// WRITER
+// ============================================================================
+
+AuditLog::AuditLog() : segment(0), segment_bytes(0), segment_limit(AUDIT_SEGMENT_SIZE), appended(0), running(false), fd(-1), fd_segment(0) {}
+
+AuditLog::~AuditLog() {
+    close();
+}
+
+int AuditLog::open(const string& path, uint64_t limit) {
+    close();
+
+    uint32_t last = 0;
+    for (const string& existing : audit_segments(path)) {
+        last = max(last, (uint32_t)stoul(existing.substr(existing.rfind('.') + 1)));
+    }
+
+    omni_path = path;
+    segment = last + 1;
+    segment_bytes = sizeof(AuditSegmentHeader);
+    segment_limit = limit;
+    string_ids.clear();
+    interned.clear();
+    buffer.clear();
+    buffer.reserve(AUDIT_BUFFER_SIZE);
+    running = true;
+    writer = thread(&AuditLog::run, this);
+
+    LOG_INFO("Audit: logging to " << audit_segment_path(omni_path, segment));
+    return SUCCESS;
+}
+
+void AuditLog::close() {
+    {
+        lock_guard<mutex> lock(log_mutex);
+        if (!running) return;
+        running = false;
+    }
+    wake.notify_one();
+    writer.join();
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+    fd_segment = 0;
+}
+
+uint32_t AuditLog::intern(string_view text) {
+    if (text.empty()) return 0;
+    if (text.size() > AUDIT_MAX_STRING) text = text.substr(0, AUDIT_MAX_STRING);
+
+    auto found = string_ids.find(text);
+    if (found != string_ids.end()) return found->second;
+
+    uint32_t id = string_ids.size() + 1;
+    interned.emplace_back(text);
+    string_ids.emplace(interned.back(), id);
+
+    AuditString entry = {AUDIT_STRING, 0, (uint16_t)text.size(), id};
+    buffer.append((const char*)&entry, sizeof(entry));
+    buffer.append(text.data(), text.size());
+    segment_bytes += sizeof(entry) + text.size();
+    return id;
+}
+
+void AuditLog::append(const AuditEvent& event) {
+    lock_guard<mutex> lock(log_mutex);
+    if (!running) return;
+
+    // The strings and the record stay in one segment
+    uint64_t needed = sizeof(AuditRecord) + 3 * sizeof(AuditString) +
+                      event.user.size() + event.path.size() + event.path2.size();
+    if (segment_bytes + needed > segment_limit && segment_bytes > sizeof(AuditSegmentHeader)) {
+        seal_buffer();
+        segment++;
+        segment_bytes = sizeof(AuditSegmentHeader);
+        string_ids.clear();
+        interned.clear();
+    }
+
+    AuditRecord record = {};
+    record.kind = AUDIT_OPERATION;
+    record.op = event.op;
+    record.result = event.result;
+    record.user_id = intern(event.user);
+    record.path_id = intern(event.path);
+    record.path2_id = intern(event.path2);
+    record.duration_us = event.duration_us;
+    record.time_us = event.time_us;
+    record.size = event.size;
+    buffer.append((const char*)&record, sizeof(record));
+    segment_bytes += sizeof(record);
+    appended++;
+
+    if (buffer.size() >= AUDIT_BUFFER_SIZE) {
+        seal_buffer();
+        wake.notify_one();
+    }
+}
+
+// Hands the buffer to the writer; log_mutex held
+void AuditLog::seal_buffer() {
+    if (buffer.empty()) return;
+    pending.push_back({segment, move(buffer)});
+    buffer = string();
+    buffer.reserve(AUDIT_BUFFER_SIZE);
+}
+
+void AuditLog::run() {
+    for (;;) {
+        deque<Chunk> chunks;
+        bool stopping;
+        {
+            unique_lock<mutex> lock(log_mutex);
+            wake.wait_for(lock, chrono::milliseconds(AUDIT_FLUSH_INTERVAL_MS),
+                          [this] { return !pending.empty() || !running; });
+            seal_buffer();
+            chunks.swap(pending);
+            stopping = !running;
+        }
+        for (const Chunk& chunk : chunks) write_chunk(chunk);
+        if (stopping) return;
+    }
+}
+
+void AuditLog::write_chunk(const Chunk& chunk) {
+    if (fd < 0 || fd_segment != chunk.segment) {
+        if (fd >= 0) ::close(fd);
+        string path = audit_segment_path(omni_path, chunk.segment);
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        fd_segment = chunk.segment;
+        if (fd < 0) {
+            LOG_ERROR("Error: Cannot open audit log " << path);
+            return;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size == 0) {
+            AuditSegmentHeader header = {};
+            memcpy(header.magic, AUDIT_MAGIC, sizeof(header.magic));
+            header.version = AUDIT_VERSION;
+            header.segment = chunk.segment;
+            header.created_us = audit_now_us();
+            if (::write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header)) {
+                LOG_ERROR("Error: Cannot write audit log " << path);
+            }
+        }
+    }
+    if (fd < 0) return;
+
+    size_t done = 0;
+    while (done < chunk.bytes.size()) {
+        ssize_t n = ::write(fd, chunk.bytes.data() + done, chunk.bytes.size() - done);
+        if (n <= 0) {
+            LOG_ERROR("Error: Cannot write audit log segment " << chunk.segment);
+            return;
+        }
+        done += n;
+    }
+}
+
+// ============================================================================
+// READER
+// ============================================================================
+
+bool AuditReader::open(const string& path) {
+    ifstream file(path, ios::binary | ios::ate);
+    if (!file) return false;
+
+    data.resize(file.tellg());
+    file.seekg(0, ios::beg);
+    file.read(&data[0], data.size());
+    if (!file || data.size() < sizeof(AuditSegmentHeader)) return false;
+
+    memcpy(&segment_header, data.data(), sizeof(segment_header));
+    if (memcmp(segment_header.magic, AUDIT_MAGIC, sizeof(AUDIT_MAGIC)) != 0 ||
+        segment_header.version != AUDIT_VERSION) {
+        return false;
+    }
+
+    position = sizeof(AuditSegmentHeader);
+    strings.assign(1, string_view());
+    cut_off = false;
+    return true;
+}
+
+bool AuditReader::next(AuditEvent& event) {
+    while (position < data.size()) {
+        uint8_t kind = data[position];
+
+        if (kind == AUDIT_STRING) {
+            AuditString entry;
+            if (data.size() - position < sizeof(entry)) break;
+            memcpy(&entry, data.data() + position, sizeof(entry));
+            if (data.size() - position - sizeof(entry) < entry.length) break;
+
+            // The writer numbers strings 1, 2, 3, ...; anything else is garbage
+            if (entry.id != strings.size()) break;
+            strings.emplace_back(data.data() + position + sizeof(entry), entry.length);
+            position += sizeof(entry) + entry.length;
+            continue;
+        }
+
+        if (kind == AUDIT_OPERATION) {
+            AuditRecord record;
+            if (data.size() - position < sizeof(record)) break;
+            memcpy(&record, data.data() + position, sizeof(record));
+            position += sizeof(record);
+
+            auto text = [this](uint32_t id) { return id < strings.size() ? strings[id] : string_view(); };
+            event.op = record.op;
+            event.result = record.result;
+            event.user = text(record.user_id);
+            event.path = text(record.path_id);
+            event.path2 = text(record.path2_id);
+            event.size = record.size;
+            event.time_us = record.time_us;
+            event.duration_us = record.duration_us;
+            return true;
+        }
+        break;
+    }
+
+    cut_off = position < data.size();
+    position = data.size();
+    return false;
+}
+
+// ============================================================================
+// TEST
+// ============================================================================
+
+int test_audit_log() {
+    string omni_file = "/tmp/ofs_audit_test.omni";
+    int failures = 0;
+
+    cout << "\n========================================" << endl;
+    cout << "  AUDIT LOG TEST" << endl;
+    cout << "========================================\n" << endl;
+
+    for (const string& old : audit_segments(omni_file)) remove(old.c_str());
+
+    // Test 1: Write enough records to rotate through several small segments
+    cout << "Test 1: Writing 2000 records into 8 KiB segments..." << endl;
+    const int total = 2000;
+    AuditLog log;
+    log.open(omni_file, 8 * 1024);
+    for (int i = 0; i < total; i++) {
+        string user = "user" + to_string(i % 7);
+        string path = "/dir/file" + to_string(i % 101);
+        AuditEvent event;
+        event.op = i % 20;
+        event.result = i % 3 == 0 ? ERROR_NOT_FOUND : SUCCESS;
+        event.user = user;
+        event.path = path;
+        event.size = i;
+        event.time_us = 1000 + i;
+        event.duration_us = i % 50;
+        log.append(event);
+    }
+    log.close();
+
+    vector<string> segments = audit_segments(omni_file);
+    if (segments.size() < 3) {
+        cerr << "FAILED: Only " << segments.size() << " segment(s) written" << endl;
+        failures++;
+    }
+
+    // Test 2: Read every segment back in order
+    cout << "\nTest 2: Reading all segments back..." << endl;
+    int seen = 0;
+    for (const string& segment : segments) {
+        AuditReader reader;
+        if (!reader.open(segment)) {
+            cerr << "FAILED: Cannot open " << segment << endl;
+            failures++;
+            continue;
+        }
+        AuditEvent event;
+        while (reader.next(event)) {
+            if (event.size != (uint64_t)seen || event.time_us != 1000 + (uint64_t)seen ||
+                event.user != "user" + to_string(seen % 7) || event.path != "/dir/file" + to_string(seen % 101) ||
+                !event.path2.empty() || event.result != (seen % 3 == 0 ? ERROR_NOT_FOUND : SUCCESS)) {
+                cerr << "FAILED: Record " << seen << " read back wrong" << endl;
+                failures++;
+                break;
+            }
+            seen++;
+        }
+        if (reader.truncated()) {
+            cerr << "FAILED: " << segment << " reported as cut off" << endl;
+            failures++;
+        }
+    }
+    if (seen != total) {
+        cerr << "FAILED: Read " << seen << " of " << total << " records" << endl;
+        failures++;
+    }
+
+    // Test 3: A last entry cut off by a crash ends the segment early
+    cout << "\nTest 3: Truncated last entry..." << endl;
+    string last = segments.empty() ? string() : segments.back();
+    int before = 0, after = 0;
+    AuditReader whole;
+    AuditEvent event;
+    if (whole.open(last)) {
+        while (whole.next(event)) before++;
+    }
+    struct stat st;
+    if (stat(last.c_str(), &st) != 0 || truncate(last.c_str(), st.st_size - 5) != 0) {
+        cerr << "FAILED: Cannot truncate " << last << endl;
+        failures++;
+    }
+    AuditReader cut;
+    if (cut.open(last)) {
+        while (cut.next(event)) after++;
+    }
+    if (after != before - 1 || !cut.truncated()) {
+        cerr << "FAILED: " << after << " of " << before << " records after truncation" << endl;
+        failures++;
+    }
+
+    // Test 4: A string id that is out of sequence is treated as the end
+    cout << "\nTest 4: Out-of-sequence string id..." << endl;
+    string bogus = audit_segment_path(omni_file, 999);
+    {
+        ofstream file(bogus, ios::binary | ios::trunc);
+        AuditSegmentHeader header = {};
+        memcpy(header.magic, AUDIT_MAGIC, sizeof(header.magic));
+        header.version = AUDIT_VERSION;
+        header.segment = 999;
+        AuditString entry = {AUDIT_STRING, 0, 1, 0xFFFFFFF0};
+        file.write((const char*)&header, sizeof(header));
+        file.write((const char*)&entry, sizeof(entry));
+        file.write("x", 1);
+    }
+    AuditReader corrupt;
+    if (!corrupt.open(bogus) || corrupt.next(event) || !corrupt.truncated()) {
+        cerr << "FAILED: Out-of-sequence id was accepted" << endl;
+        failures++;
+    }
+
+    for (const string& segment : audit_segments(omni_file)) remove(segment.c_str());
+
+    cout << "\n========================================" << endl;
+    if (failures == 0) {
+        cout << "  ✓ ALL TESTS PASSED!" << endl;
+    } else {
+        cout << "  ✗ " << failures << " CHECK(S) FAILED" << endl;
+    }
+    cout << "========================================\n" << endl;
+
+    return failures == 0 ? SUCCESS : ERROR_IO_ERROR;
+}
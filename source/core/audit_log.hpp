@@ -0,0 +1,161 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+using namespace std;
+
+/**
+ * Append-only binary log of the operations that change the file system
+ *
+ * The log is a series of segment files next to the container,
+ * <omni>.audit.000001, <omni>.audit.000002, ... Every server start opens a
+ * new segment, and a segment is closed once it reaches AUDIT_SEGMENT_SIZE,
+ * so old history can be archived or deleted a file at a time.
+ *
+ * Segment layout (integers in host byte order, like the container):
+ *   AuditSegmentHeader
+ *   entries, back to back, each starting with its kind byte:
+ *     AUDIT_STRING     AuditString, then length bytes of text
+ *     AUDIT_OPERATION  AuditRecord
+ *
+ * Usernames and paths are stored once per segment as AUDIT_STRING entries
+ * and referred to by id afterwards, so a record is a fixed 40 bytes and a
+ * reader can skip over a segment without parsing text. Ids start at 1 in
+ * every segment; 0 means "none". A string entry always comes before the
+ * first record that uses it.
+ *
+ * Writers only copy into a memory buffer under a mutex; a background
+ * thread writes full buffers at once and the rest every
+ * AUDIT_FLUSH_INTERVAL_MS. The log is not fsynced, so a crash can lose the
+ * last interval or leave a cut-off entry at the end of the newest
+ * segment, which readers treat as the end.
+ */
+
+struct AuditSegmentHeader {
+    char magic[8];              // "OFSAUDT1"
+    uint32_t version;
+    uint32_t segment;           // Number in the file name
+    uint64_t created_us;        // Unix microseconds
+    uint64_t reserved;
+};
+
+enum AuditEntryKind : uint8_t {
+    AUDIT_STRING = 1,
+    AUDIT_OPERATION = 2
+};
+
+struct AuditString {
+    uint8_t kind;               // AUDIT_STRING
+    uint8_t reserved;
+    uint16_t length;
+    uint32_t id;
+};
+
+struct AuditRecord {
+    uint8_t kind;               // AUDIT_OPERATION
+    uint8_t op;                 // OperationCode (server/protocol.hpp)
+    int16_t result;             // SUCCESS or an ERROR_* code
+    uint32_t user_id;           // Who ran it
+    uint32_t path_id;           // Path, or the username for user_create/delete
+    uint32_t path2_id;          // New path of a rename
+    uint32_t duration_us;
+    uint32_t reserved;
+    uint64_t time_us;           // Unix microseconds when it started
+    uint64_t size;              // Bytes written, new container size, or role
+};
+
+const uint32_t AUDIT_VERSION = 1;
+const uint64_t AUDIT_SEGMENT_SIZE = 64 * 1024 * 1024;
+const size_t AUDIT_BUFFER_SIZE = 256 * 1024;        // Written as soon as this much is pending
+const int AUDIT_FLUSH_INTERVAL_MS = 200;
+const size_t AUDIT_MAX_STRING = 0xFFFF;
+
+// One operation, as the writer takes it and the reader hands it back
+struct AuditEvent {
+    uint8_t op = 0;
+    int16_t result = 0;
+    string_view user;
+    string_view path;
+    string_view path2;
+    uint64_t size = 0;
+    uint64_t time_us = 0;
+    uint32_t duration_us = 0;
+};
+
+uint64_t audit_now_us();
+string audit_segment_path(const string& omni_path, uint32_t segment);
+// Segment files of omni_path, oldest first
+vector<string> audit_segments(const string& omni_path);
+
+class AuditLog {
+public:
+    AuditLog();
+    ~AuditLog();
+    AuditLog(const AuditLog&) = delete;
+    AuditLog& operator=(const AuditLog&) = delete;
+
+    // Starts a new segment after the newest one on disk; segments close
+    // once they reach segment_limit bytes
+    int open(const string& omni_path, uint64_t segment_limit = AUDIT_SEGMENT_SIZE);
+    // Writes what is buffered and stops the writer thread
+    void close();
+    bool is_open() const { return running; }
+
+    void append(const AuditEvent& event);
+    uint64_t records() const { return appended.load(); }
+
+private:
+    struct Chunk {
+        uint32_t segment;
+        string bytes;
+    };
+
+    mutex log_mutex;
+    condition_variable wake;
+    string buffer;                          // Entries not yet handed to the writer
+    deque<Chunk> pending;
+    unordered_map<string_view, uint32_t> string_ids;   // Of the current segment,
+    deque<string> interned;                             // pointing into these
+    uint32_t segment;
+    uint64_t segment_bytes;
+    uint64_t segment_limit;
+    atomic<uint64_t> appended;
+    atomic<bool> running;
+
+    string omni_path;
+    thread writer;
+    int fd;
+    uint32_t fd_segment;
+
+    // Id of text in the current segment, adding an AUDIT_STRING entry the
+    // first time; log_mutex held
+    uint32_t intern(string_view text);
+    void seal_buffer();
+    void run();
+    void write_chunk(const Chunk& chunk);
+};
+
+// Reads one segment into memory and walks its records
+class AuditReader {
+public:
+    bool open(const string& path);
+    const AuditSegmentHeader& header() const { return segment_header; }
+    // Next operation, false at the end of the segment
+    bool next(AuditEvent& event);
+    // True if the segment ended in a cut-off entry
+    bool truncated() const { return cut_off; }
+
+private:
+    string data;
+    size_t position = 0;
+    vector<string_view> strings;            // By id, which must come in order; [0] is empty
+    AuditSegmentHeader segment_header = {};
+    bool cut_off = false;
+};
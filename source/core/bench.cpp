@@ -0,0 +1,386 @@
+// bench.cpp - Microbenchmarks of the core API against a temporary container
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <ctime>
+#include <cstdio>
+#include <cctype>
+#include <unistd.h>
+#include "../include/odf_types.hpp"
+#include "../include/ofs_functions.hpp"
+#include "helper.hpp"
+#include "fs_index.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+using namespace std;
+
+/**
+ * Every scale gets a fresh sparse container with its file table grown to
+ * fit: `entries` files of PAYLOAD_SIZE bytes spread over directories of
+ * DIR_FANOUT, plus up to MAX_BENCH_USERS users. The lookups then hit random
+ * existing entries. The size sweep writes and reads back files of each size
+ * in a container of its own.
+ *
+ * Latencies are the time spent inside the call, kept in the same
+ * log-linear histograms as the server metrics (about 3% resolution), and
+ * ops/s is ops divided by that time. Results go to stdout (or --output) as
+ * one JSON document, progress to stderr.
+ */
+
+const uint64_t BENCH_CONTAINER_SIZE = 1ULL << 40;  // Sparse on disk
+const uint32_t DIR_FANOUT = 1000;                  // Files per directory
+const uint32_t MAX_BENCH_USERS = 1000;
+const size_t PAYLOAD_SIZE = 64;
+
+struct BenchOptions {
+    vector<uint64_t> scales = {1000, 100000, 1000000};
+    vector<uint64_t> sizes = {0, 1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024, 100 * 1024 * 1024};
+    uint64_t max_ops = 100000;                  // Per lookup benchmark
+    double seconds = 2.0;                       // Time budget per benchmark
+    uint64_t sweep_bytes = 512ULL << 20;        // Written per file size
+    string dir = "/tmp";
+    string output;
+    uint64_t seed = 42;
+};
+
+struct BenchResult {
+    string name;
+    string suite;
+    uint64_t entries;
+    uint64_t size;
+    uint64_t errors = 0;
+    uint64_t bytes = 0;
+    HistogramSnapshot latency;
+};
+
+// ============================================================================
+// MEASUREMENT
+// ============================================================================
+
+static void add_sample(HistogramSnapshot& h, uint64_t ns) {
+    h.count++;
+    h.sum += ns;
+    if (ns > h.maximum) h.maximum = ns;
+    h.buckets[histogram_bucket(ns)]++;
+}
+
+// Runs op(i) for i = 0.. until max_ops calls or the time budget is used up
+template <typename Op>
+static BenchResult measure(const string& name, const string& suite, uint64_t entries, uint64_t size,
+                           uint64_t max_ops, double seconds, Op op) {
+    BenchResult result;
+    result.name = name;
+    result.suite = suite;
+    result.entries = entries;
+    result.size = size;
+    uint64_t budget = (uint64_t)(seconds * 1e9);
+    uint64_t begin = metrics_now_ns();
+    for (uint64_t i = 0; i < max_ops; i++) {
+        if (i > 0 && metrics_now_ns() - begin > budget) break;
+        uint64_t start = metrics_now_ns();
+        int status = op(i);
+        add_sample(result.latency, metrics_now_ns() - start);
+        if (status != SUCCESS) result.errors++;
+    }
+    result.bytes = result.latency.count * size;
+    cerr << "  " << name << ": " << result.latency.count << " ops";
+    if (result.errors) cerr << ", " << result.errors << " errors";
+    cerr << endl;
+    return result;
+}
+
+// ============================================================================
+// CONTAINERS
+// ============================================================================
+
+static string container_path(const BenchOptions& options) {
+    return options.dir + "/ofs_bench_" + to_string(getpid()) + ".omni";
+}
+
+static void remove_container(const string& omni_path) {
+    remove(omni_path.c_str());
+    remove(snapshot_path(omni_path).c_str());
+}
+
+static int open_container(const string& omni_path, uint32_t files, uint32_t users, void** instance,
+                          SessionInfo& session) {
+    remove_container(omni_path);
+    int result = fs_format(omni_path, "BENCH", "2025-11-11", BENCH_CONTAINER_SIZE, 4096);
+    if (result != SUCCESS) {
+        cerr << "Error: Cannot format " << omni_path << endl;
+        return result;
+    }
+    result = fs_init(instance, omni_path.c_str(), nullptr);
+    if (result != SUCCESS) {
+        cerr << "Error: Cannot initialize " << omni_path << endl;
+        return result;
+    }
+    result = fs_grow(&session, 0, files, users);
+    if (result != SUCCESS) {
+        cerr << "Error: Cannot grow " << omni_path << " to " << files << " file slots" << endl;
+        fs_shutdown(*instance);
+    }
+    return result;
+}
+
+static string dir_name(uint64_t dir) {
+    char name[16];
+    snprintf(name, sizeof(name), "/d%05llu", (unsigned long long)dir);
+    return name;
+}
+
+static string file_name(uint64_t file) {
+    char name[32];
+    snprintf(name, sizeof(name), "/d%05llu/f%07llu", (unsigned long long)(file / DIR_FANOUT),
+             (unsigned long long)file);
+    return name;
+}
+
+// ============================================================================
+// SUITES
+// ============================================================================
+
+static int run_scale(const BenchOptions& options, uint64_t entries, vector<BenchResult>& results) {
+    string omni_path = container_path(options);
+    uint64_t dirs = (entries + DIR_FANOUT - 1) / DIR_FANOUT;
+    uint64_t users = min<uint64_t>(entries, MAX_BENCH_USERS);
+    // Root, the directories, the files and some slack
+    uint64_t slots = entries + dirs + 16;
+    if (slots > UINT32_MAX) {
+        cerr << "Error: " << entries << " entries do not fit in a file table" << endl;
+        return ERROR_INVALID_OPERATION;
+    }
+
+    cerr << "Scale: " << entries << " entries" << endl;
+    UserInfo admin("admin", "", ADMIN, time(nullptr));
+    SessionInfo session("SID_BENCH", admin, time(nullptr));
+    void* instance = nullptr;
+    int status = open_container(omni_path, (uint32_t)slots, (uint32_t)users + 1, &instance, session);
+    if (status != SUCCESS) {
+        remove_container(omni_path);
+        return status;
+    }
+
+    for (uint64_t dir = 0; dir < dirs; dir++) dir_create(&session, dir_name(dir));
+    string payload(PAYLOAD_SIZE, 'x');
+    results.push_back(measure("file_create", "scale", entries, PAYLOAD_SIZE, entries, 1e9,
+                              [&](uint64_t i) { return file_create(&session, file_name(i), payload); }));
+
+    for (uint64_t user = 0; user < users; user++) {
+        user_create(omni_path, "bench" + to_string(user), "pw" + to_string(user), NORMAL);
+    }
+
+    // Lookups of random existing entries, the same sequence for every run
+    mt19937_64 random(options.seed);
+    vector<uint64_t> picks(options.max_ops);
+    for (uint64_t& pick : picks) pick = random() % entries;
+
+    string content;
+    FileMetadata meta("", FileEntry());
+    vector<FileEntry> children;
+    FSStats stats(0, 0, 0);
+    results.push_back(measure("file_exists", "scale", entries, 0, picks.size(), options.seconds,
+                              [&](uint64_t i) { return file_exists(&session, file_name(picks[i])); }));
+    results.push_back(measure("get_metadata", "scale", entries, 0, picks.size(), options.seconds,
+                              [&](uint64_t i) { return get_metadata(&session, file_name(picks[i]), meta); }));
+    results.push_back(measure("file_read", "scale", entries, PAYLOAD_SIZE, picks.size(), options.seconds,
+                              [&](uint64_t i) { return file_read(&session, file_name(picks[i]), content); }));
+    results.push_back(measure("dir_list", "scale", entries, 0, picks.size(), options.seconds, [&](uint64_t i) {
+        children.clear();
+        return dir_list(&session, dir_name(picks[i] / DIR_FANOUT), children);
+    }));
+    results.push_back(measure("get_stats", "scale", entries, 0, picks.size(), options.seconds,
+                              [&](uint64_t) { return get_stats(&session, stats); }));
+    // Sessions are logged out afterwards so only the login is timed
+    vector<void*> logins;
+    logins.reserve(picks.size());
+    results.push_back(measure("user_login", "scale", entries, 0, picks.size(), options.seconds, [&](uint64_t i) {
+        uint64_t user = picks[i] % users;
+        void* login = nullptr;
+        int result = user_login(&login, "bench" + to_string(user), "pw" + to_string(user), omni_path);
+        if (result == SUCCESS) logins.push_back(login);
+        return result;
+    }));
+    for (void* login : logins) {
+        user_logout(login);
+        delete (SessionInfo*)login;
+    }
+
+    fs_shutdown(instance);
+    remove_container(omni_path);
+    return SUCCESS;
+}
+
+static int run_sizes(const BenchOptions& options, vector<BenchResult>& results) {
+    string omni_path = container_path(options);
+    cerr << "File sizes" << endl;
+    UserInfo admin("admin", "", ADMIN, time(nullptr));
+    SessionInfo session("SID_BENCH", admin, time(nullptr));
+    void* instance = nullptr;
+    int status = open_container(omni_path, FILE_TABLE_SLOTS * 2, 0, &instance, session);
+    if (status != SUCCESS) {
+        remove_container(omni_path);
+        return status;
+    }
+
+    for (uint64_t size : options.sizes) {
+        // At least 5 files of each size, at most FILE_TABLE_SLOTS
+        uint64_t files = size ? options.sweep_bytes / size : FILE_TABLE_SLOTS;
+        files = min<uint64_t>(max<uint64_t>(files, 5), FILE_TABLE_SLOTS);
+        string data(size, 'x');
+        string prefix = "/s" + to_string(size) + "_";
+        cerr << " " << size << " B x " << files << endl;
+
+        results.push_back(measure("file_create", "size", files, size, files, 1e9,
+                                  [&](uint64_t i) { return file_create(&session, prefix + to_string(i), data); }));
+        string content;
+        results.push_back(measure("file_read", "size", files, size, files, 1e9, [&](uint64_t i) {
+            int result = file_read(&session, prefix + to_string(i), content);
+            return result == SUCCESS && content.size() != size ? ERROR_IO_ERROR : result;
+        }));
+        for (uint64_t i = 0; i < files; i++) file_delete(&session, prefix + to_string(i));
+    }
+
+    fs_shutdown(instance);
+    remove_container(omni_path);
+    return SUCCESS;
+}
+
+// ============================================================================
+// REPORT
+// ============================================================================
+
+static string json_report(const BenchOptions& options, const vector<BenchResult>& results) {
+    ostringstream out;
+#ifdef __OPTIMIZE__
+    bool optimized = true;
+#else
+    bool optimized = false;
+#endif
+    out << "{\n  \"benchmark\": \"ofs_bench\",\n  \"time\": " << time(nullptr)
+        << ",\n  \"optimized\": " << (optimized ? "true" : "false") << ",\n  \"log_level\": " << OFS_LOG_MIN_LEVEL
+        << ",\n  \"seed\": " << options.seed << ",\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        const HistogramSnapshot& h = r.latency;
+        double seconds = h.sum / 1e9;
+        char rates[96];
+        snprintf(rates, sizeof(rates), "\"seconds\": %.6f, \"ops_per_sec\": %.1f, \"bytes_per_sec\": %.1f", seconds,
+                 seconds > 0 ? h.count / seconds : 0, seconds > 0 ? r.bytes / seconds : 0);
+        out << (i ? "," : "") << "\n    {\"name\": \"" << r.name << "\", \"suite\": \"" << r.suite
+            << "\", \"entries\": " << r.entries << ", \"size\": " << r.size << ", \"ops\": " << h.count
+            << ", \"errors\": " << r.errors << ", " << rates << ", \"mean_ns\": " << (uint64_t)h.mean()
+            << ", \"p50_ns\": " << h.percentile(0.50) << ", \"p99_ns\": " << h.percentile(0.99)
+            << ", \"max_ns\": " << h.maximum << "}";
+    }
+    out << "\n  ]\n}\n";
+    return out.str();
+}
+
+// ============================================================================
+// MAIN
+// ============================================================================
+
+// Byte counts take binary suffixes (64K = 65536), entry counts decimal ones (100k = 100000)
+static bool parse_number(const string& text, bool binary, uint64_t& value) {
+    size_t used = 0;
+    try {
+        value = stoull(text, &used);
+    } catch (...) {
+        return false;
+    }
+    if (used == text.size()) return true;
+    if (used + 1 != text.size()) return false;
+    int steps = 0;
+    switch (toupper(text[used])) {
+        case 'G': steps = 3; break;
+        case 'M': steps = 2; break;
+        case 'K': steps = 1; break;
+        default: return false;
+    }
+    while (steps-- > 0) value *= binary ? 1024 : 1000;
+    return true;
+}
+
+// An empty list skips that suite
+static bool parse_list(const string& text, bool binary, vector<uint64_t>& values) {
+    values.clear();
+    stringstream items(text);
+    string item;
+    while (getline(items, item, ',')) {
+        uint64_t value;
+        if (!parse_number(item, binary, value)) return false;
+        values.push_back(value);
+    }
+    return true;
+}
+
+static void usage() {
+    cerr << "Usage: ofs_bench [--quick] [--scales 1k,100k,1M] [--sizes 0,1K,64K,1M,16M,100M]\n"
+            "                 [--ops N] [--seconds S] [--dir DIR] [--output FILE] [--seed N]" << endl;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        bool ok = true;
+        if (arg == "--quick") {
+            options.scales = {1000};
+            options.sizes = {0, 1024, 1024 * 1024};
+            options.seconds = 0.2;
+        } else if (arg == "--scales" && has_value) {
+            ok = parse_list(argv[++i], false, options.scales);
+        } else if (arg == "--sizes" && has_value) {
+            ok = parse_list(argv[++i], true, options.sizes);
+        } else if (arg == "--ops" && has_value) {
+            ok = parse_number(argv[++i], false, options.max_ops) && options.max_ops > 0;
+        } else if (arg == "--seconds" && has_value) {
+            options.seconds = atof(argv[++i]);
+        } else if (arg == "--dir" && has_value) {
+            options.dir = argv[++i];
+        } else if (arg == "--output" && has_value) {
+            options.output = argv[++i];
+        } else if (arg == "--seed" && has_value) {
+            ok = parse_number(argv[++i], false, options.seed);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            usage();
+            return ERROR_INVALID_OPERATION;
+        }
+    }
+
+    // Only warnings and errors, on stderr, so stdout is just the report
+    app_log.set_level(LOG_LEVEL_WARN);
+
+    vector<BenchResult> results;
+    for (uint64_t entries : options.scales) {
+        if (entries == 0) continue;
+        int status = run_scale(options, entries, results);
+        if (status != SUCCESS) return status;
+    }
+    if (!options.sizes.empty()) {
+        int status = run_sizes(options, results);
+        if (status != SUCCESS) return status;
+    }
+
+    string report = json_report(options, results);
+    if (options.output.empty()) {
+        cout << report;
+    } else {
+        ofstream file(options.output);
+        file << report;
+        if (!file) {
+            cerr << "Error: Cannot write " << options.output << endl;
+            return ERROR_IO_ERROR;
+        }
+        cerr << "Wrote " << options.output << endl;
+    }
+    return SUCCESS;
+}
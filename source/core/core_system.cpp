@@ -1,7 +1,15 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <ctime>
+#include <cstdio>
+#include <algorithm>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "helper.hpp"
+#include "fs_index.hpp"
+#include "stripe_set.hpp"
+#include "logger.hpp"
 #include "../include/odf_types.hpp"
 #include "../include/ofs_functions.hpp"
 using namespace std;
@@ -20,16 +28,88 @@ struct FileSystem {
 
 
 
+/**
+ * Creates a new .omni file system
+ * Returns: 0 on success, negative error code on failure
+ */
+int fs_format(const string& omni_path,
+              const string& student_id,
+              const string& submission_date,
+              uint64_t total_size,
+              uint64_t block_size)
+{
+    // Step 1: Create new empty file
+    ofstream file(omni_path, ios::binary | ios::trunc);
+    if (!file) {
+        LOG_ERROR("Error: Cannot create file " << omni_path);
+        return ERROR_IO_ERROR;
+    }
+
+    OMNIHeader header(0x00010000, total_size, sizeof(OMNIHeader), block_size);  
+    
+    // Step 3: Fill basic info
+    std::memcpy(header.magic, "OMNIFS01", 8);
+    header.format_version = 0x00010000;  // Version 1.0
+    header.total_size = total_size;
+    header.header_size = sizeof(OMNIHeader);
+    header.block_size = block_size;
+
+    // Step 4: Add student info
+    copy_name(header.student_id, sizeof(header.student_id), student_id);
+    copy_name(header.submission_date, sizeof(header.submission_date), submission_date);
+
+    // Step 5: Set default values
+    copy_name(header.config_hash, sizeof(header.config_hash), "INIT_HASH");
+    header.config_timestamp = uint64_t(time(nullptr));
+    header.user_table_offset = uint32_t(sizeof(OMNIHeader));
+    header.max_users = 100;
+    header.file_state_storage_offset = 0;
+    header.change_log_offset = 0;
+
+    // Step 6: Write header to file
+    file.write((const char*)(&header), sizeof(header));
+
+    // Step 7: Allocate remaining space (fill file to total_size)
+    if (total_size > sizeof(header)) {
+        // Move the file pointer to the last position
+        uint64_t last_position = total_size - 1;
+        file.seekp(last_position);
+        file.put('\0');
+    }
+
+    file.close();
+
+    // Success message
+    double size_mb = total_size / (1024.0 * 1024.0);
+    LOG_INFO("SUCCESS: Created " << omni_path 
+          << " (" << size_mb << " MB)");
+
+    return SUCCESS;
+}
+
+uint64_t container_length(const string& omni_path) {
+    struct stat st;
+    if (stat(omni_path.c_str(), &st) != 0) return 0;
+    return st.st_size;
+}
+
+bool write_header(fstream& file, const OMNIHeader& header) {
+    file.seekp(0, ios::beg);
+    file.write((const char*)&header, sizeof(header));
+    file.flush();
+    return (bool)file;
+}
+
 int fs_init(void** instance, const char* omni_path, const char* config_path) {
   
     if (!instance || !omni_path) {
-        cerr << "Error: Invalid parameters" << endl;
+        LOG_ERROR("Error: Invalid parameters");
         return ERROR_INVALID_CONFIG;
     }
 
     ifstream file(omni_path, ios::binary);
     if (!file) {
-        cerr << "Error: Cannot open " << omni_path << endl;
+        LOG_ERROR("Error: Cannot open " << omni_path);
         return ERROR_NOT_FOUND;
     }
 
@@ -37,32 +117,63 @@ int fs_init(void** instance, const char* omni_path, const char* config_path) {
 
     file.read((char*)(&fs->header), sizeof(fs->header));
     if (!compare(fs->header.magic, "OMNIFS01", 8)) {
-        cerr << "Error: Invalid OMNI file format" << endl;
+        LOG_ERROR("Error: Invalid OMNI file format");
         delete fs;
         file.close();
         return ERROR_INVALID_CONFIG;
     }
-    file.seekg(fs->header.user_table_offset, ios::beg);
+    fs->omni_path = omni_path;
 
-    for (uint32_t i = 0; i < fs->header.max_users; i++) {
-        UserInfo user("", "", NORMAL, 0);
-        file.read((char*)(&user), sizeof(user));
+    file.close();
 
-        if (!file) 
-            break;
-        if (user.is_active == 1 && user.username[0] != '\0') {
-            fs->users.push_back(user);
-        }
+    // User index: the table is read once here and kept in memory from now on
+    if (load_users(omni_path) != SUCCESS) {
+        delete fs;
+        return ERROR_IO_ERROR;
     }
+    user_list(omni_path, fs->users);
 
-    fs->omni_path = omni_path;
+    // Path index: mapped from the saved snapshot when it is current, rebuilt otherwise
+    set_active_omni_path(omni_path);
+    if (file_index.load(omni_path) != SUCCESS) {
+        delete fs;
+        return ERROR_IO_ERROR;
+    }
 
-    file.close();
+    // Containers written before online resize appended file data past
+    // total_size. Adopt the container length as the capacity, so that data
+    // lies inside the data area and new files go in the gaps before it
+    if (file_index.data_end() > fs->header.total_size) {
+        uint64_t old_size = fs->header.total_size;
+        fs->header.total_size = max(container_length(omni_path), file_index.data_end());
+        fstream out(omni_path, ios::in | ios::out | ios::binary);
+        if (!out || !write_header(out, fs->header)) {
+            LOG_ERROR("Error: Cannot update the header of " << omni_path);
+            file_index.reset();
+            delete fs;
+            return ERROR_IO_ERROR;
+        }
+        file_index.set_layout(fs->header);
+        LOG_INFO("Migrated " << omni_path << ": data ran past total_size " << old_size
+              << ", capacity is now " << fs->header.total_size << " bytes");
+    }
+
+    // File data: this file, or the stripe files listed in <omni>.stripes
+    int stripe_result = data_stripes.open(omni_path);
+    if (stripe_result != SUCCESS) {
+        file_index.reset();
+        delete fs;
+        return stripe_result;
+    }
 
-    cout << "SUCCESS: Loaded OMNI file system" << endl;
-    cout << "  File: " << omni_path << endl;
-    cout << "  Users loaded: " << fs->users.size() << endl;
-    cout << "  Max users: " << fs->header.max_users << endl;
+    LOG_INFO("SUCCESS: Loaded OMNI file system");
+    LOG_INFO("  File: " << omni_path);
+    LOG_INFO("  Users loaded: " << fs->users.size());
+    LOG_INFO("  Max users: " << fs->header.max_users);
+    if (data_stripes.stripe_count() > 0) {
+        LOG_INFO("  Data stripes: " << data_stripes.stripe_count() << " (" << fs->header.getStripeUnit()
+              << "-byte units)");
+    }
 
     *instance = fs;
 
@@ -71,32 +182,379 @@ int fs_init(void** instance, const char* omni_path, const char* config_path) {
 
 void fs_shutdown(void* instance) {
     if (!instance) {
-        cerr << "Error: Invalid instance pointer" << endl;
+        LOG_ERROR("Error: Invalid instance pointer");
         return;
     }
 
     FileSystem* fs = (FileSystem*)instance;
-    fstream file(fs->omni_path, ios::in | ios::out | ios::binary);
+
+    // Users and entries are written through as they change; only the
+    // index image needs saving so the next fs_init can map it directly
+    file_index.save(fs->omni_path);
+    file_index.reset();
+    data_stripes.close();
+
+    LOG_INFO("SUCCESS: File system saved and closed");
+
+    delete fs;
+}
+
+// ============================================================================
+// ONLINE RESIZE
+// ============================================================================
+
+const uint64_t RELOCATE_CHUNK_SIZE = 1024 * 1024;
+const uint32_t MAX_FILE_TABLE_SLOTS = 1 << 24;
+const uint32_t MAX_USER_TABLE_SLOTS = 1 << 20;
+
+// A live byte range in the data area: file content, or the user table
+// once fs_grow has moved it out there
+const uint32_t USER_TABLE_EXTENT = UINT32_MAX;
+
+struct DataExtent {
+    uint64_t offset;
+    uint64_t size;
+    uint32_t slot;      // Metadata slot, or USER_TABLE_EXTENT
+};
+
+vector<DataExtent> collect_extents(FSIndex& index, const OMNIHeader& header) {
+    vector<DataExtent> extents;
+    for (uint32_t i = 0; i < index.slot_count(); i++) {
+        const IndexSlot& s = index.slot(i);
+        if (s.in_use && s.type != DIRECTORY && s.size > 0) {
+            extents.push_back({s.data_offset, s.size, i});
+        }
+    }
+    if (user_table_in_data_area(header)) {
+        extents.push_back({header.getUserTableOffset(), (uint64_t)header.max_users * sizeof(UserInfo), USER_TABLE_EXTENT});
+    }
+
+    sort(extents.begin(), extents.end(), [](const DataExtent& a, const DataExtent& b) {
+        return a.offset < b.offset;
+    });
+    return extents;
+}
+
+// File content goes through the stripe set, so it moves between stripe
+// files when the container is striped
+bool copy_data(uint64_t from, uint64_t to, uint64_t size) {
+    StripeSet& stripes = get_stripe_set();
+    vector<char> buffer(min(size, RELOCATE_CHUNK_SIZE));
+    for (uint64_t done = 0; done < size; ) {
+        uint64_t chunk = min<uint64_t>(size - done, buffer.size());
+        if (stripes.read(from + done, buffer.data(), chunk) != SUCCESS ||
+            stripes.write(to + done, buffer.data(), chunk) != SUCCESS) {
+            return false;
+        }
+        done += chunk;
+    }
+    return true;
+}
+
+// Metadata (the user table) always stays in the primary container
+bool copy_bytes(fstream& file, uint64_t from, uint64_t to, uint64_t size) {
+    vector<char> buffer(min(size, RELOCATE_CHUNK_SIZE));
+    for (uint64_t done = 0; done < size; ) {
+        uint64_t chunk = min<uint64_t>(size - done, buffer.size());
+        file.seekg(from + done, ios::beg);
+        file.read(buffer.data(), chunk);
+        file.seekp(to + done, ios::beg);
+        file.write(buffer.data(), chunk);
+        if (!file) return false;
+        done += chunk;
+    }
+    return true;
+}
+
+bool zero_bytes(fstream& file, uint64_t offset, uint64_t size) {
+    vector<char> zeros(min(size, RELOCATE_CHUNK_SIZE), 0);
+    file.seekp(offset, ios::beg);
+    for (uint64_t done = 0; done < size; ) {
+        uint64_t chunk = min<uint64_t>(size - done, zeros.size());
+        file.write(zeros.data(), chunk);
+        if (!file) return false;
+        done += chunk;
+    }
+    return true;
+}
+
+// Copies an extent to its new place, then points its owner at the copy.
+// The old bytes are left alone, so a crash in between still leaves the
+// owner pointing at valid data. The header is written by the caller.
+bool move_extent(fstream& file, FSIndex& index, OMNIHeader& header, const DataExtent& extent, uint64_t to) {
+    if (extent.slot == USER_TABLE_EXTENT) {
+        if (!copy_bytes(file, extent.offset, to, extent.size)) return false;
+        header.setUserTableOffset(to);
+        return true;
+    }
+
+    if (!copy_data(extent.offset, to, extent.size)) return false;
+
+    FileEntry entry;
+    file.seekg(file_slot_offset(extent.slot), ios::beg);
+    file.read((char*)&entry, sizeof(entry));
+    entry.setDataOffset(to);
+    file.seekp(file_slot_offset(extent.slot), ios::beg);
+    file.write((const char*)&entry, sizeof(entry));
+    if (!file) return false;
+
+    index.set_data_offset(extent.slot, to);
+    return true;
+}
+
+/**
+ * Grows the container while it is in use. Arguments left at 0 keep their
+ * current value.
+ *   new_total_size - capacity in bytes; the file is extended sparsely
+ *   new_max_files  - metadata table slots; the table grows in place and
+ *                    the extents in its way move to free space past it
+ *   new_max_users  - user table slots; the table is copied to a larger
+ *                    free region of the data area
+ * Returns: 0 on success, ERROR_NO_SPACE if the moved data would not fit
+ * in the new capacity (nothing is changed in that case)
+ */
+int fs_grow(void* session, uint64_t new_total_size, uint32_t new_max_files, uint32_t new_max_users) {
+    if (!session) {
+        LOG_ERROR("Error: Invalid session");
+        return ERROR_INVALID_OPERATION;
+    }
+    if (((SessionInfo*)session)->user.role != ADMIN) {
+        LOG_ERROR("Error: Only admins can resize the file system");
+        return ERROR_PERMISSION_DENIED;
+    }
+
+    const string& omni_path = active_omni_path();
+    OMNIHeader header(0, 0, 0, 0);
+    if (!read_header(omni_path, header)) {
+        LOG_ERROR("Error: Cannot read header of " << omni_path);
+        return ERROR_IO_ERROR;
+    }
+    FSIndex& index = get_file_index();
+
+    uint32_t old_slots = index.slot_count();
+    uint32_t old_max_users = header.max_users;
+    if (new_total_size == 0) new_total_size = header.total_size;
+    if (new_max_files == 0) new_max_files = old_slots;
+    if (new_max_users == 0) new_max_users = old_max_users;
+
+    if (new_total_size < header.total_size || new_max_files < old_slots || new_max_users < old_max_users) {
+        LOG_ERROR("Error: fs_grow cannot make anything smaller (use fs_shrink)");
+        return ERROR_INVALID_OPERATION;
+    }
+    if (new_max_files > MAX_FILE_TABLE_SLOTS || new_max_users > MAX_USER_TABLE_SLOTS) {
+        LOG_ERROR("Error: At most " << MAX_FILE_TABLE_SLOTS << " file slots and "
+               << MAX_USER_TABLE_SLOTS << " user slots are supported");
+        return ERROR_INVALID_OPERATION;
+    }
+
+    // Step 1: Plan every move and check it fits before touching the container
+    uint64_t old_table_end = file_table_end(old_slots);
+    uint64_t new_table_end = file_table_end(new_max_files);
+    uint64_t old_user_bytes = (uint64_t)old_max_users * sizeof(UserInfo);
+    uint64_t new_user_bytes = (uint64_t)new_max_users * sizeof(UserInfo);
+    bool users_grow = new_max_users > old_max_users;
+
+    vector<DataExtent> displaced;
+    uint64_t planned_end = max(index.data_end(), new_table_end);
+    for (const DataExtent& e : collect_extents(index, header)) {
+        if (e.offset >= new_table_end) continue;
+        // A user table that grows is copied to its new home in step 4 anyway
+        if (e.slot == USER_TABLE_EXTENT && users_grow) continue;
+        displaced.push_back(e);
+        planned_end += e.size;
+    }
+    if (users_grow) planned_end += new_user_bytes;
+
+    if (planned_end > new_total_size) {
+        LOG_ERROR("Error: Growing needs " << planned_end << " bytes, capacity would be " << new_total_size);
+        return ERROR_NO_SPACE;
+    }
+
+    // Step 2: Extend the container (and its stripes); the new space stays sparse until used
+    if ((container_length(omni_path) < new_total_size && truncate(omni_path.c_str(), new_total_size) != 0) ||
+        get_stripe_set().resize(new_total_size) != SUCCESS) {
+        LOG_ERROR("Error: Cannot extend " << omni_path << " to " << new_total_size << " bytes");
+        return ERROR_IO_ERROR;
+    }
+    header.total_size = new_total_size;
+
+    // Moved data has to land past the larger metadata table
+    OMNIHeader planned = header;
+    planned.setFileTableSlots(new_max_files);
+    index.set_layout(planned);
+
+    fstream file(omni_path, ios::in | ios::out | ios::binary);
     if (!file) {
-        cerr << "Error: Cannot open file for saving" << endl;
-        delete fs;
-        return;
+        LOG_ERROR("Error: Cannot open file system for writing");
+        return ERROR_IO_ERROR;
     }
 
-    file.seekp(fs->header.user_table_offset, ios::beg);
+    // Step 3: Move the data the larger metadata table will cover
+    for (const DataExtent& e : displaced) {
+        uint64_t to = 0;
+        if (!index.reserve_data(e.size, to) || !move_extent(file, index, header, e, to)) {
+            LOG_ERROR("Error: Cannot move data at offset " << e.offset);
+            write_header(file, header);
+            return ERROR_IO_ERROR;
+        }
+    }
 
-    for (size_t i = 0; i < fs->users.size(); i++) {
-        if (i >= fs->header.max_users) {
-            break;  
+    // Step 4: Copy the user table into a larger region
+    if (users_grow) {
+        uint64_t to = 0;
+        if (!index.reserve_data(new_user_bytes, to) ||
+            !copy_bytes(file, header.getUserTableOffset(), to, old_user_bytes) ||
+            !zero_bytes(file, to + old_user_bytes, new_user_bytes - old_user_bytes)) {
+            LOG_ERROR("Error: Cannot move the user table");
+            write_header(file, header);
+            return ERROR_IO_ERROR;
+        }
+        header.setUserTableOffset(to);
+        header.max_users = new_max_users;
+    }
+
+    // Everything now points at its new place; the old copies are free
+    if (!write_header(file, header)) {
+        LOG_ERROR("Error: Cannot write header");
+        return ERROR_IO_ERROR;
+    }
+
+    // The user index learns the new free slots
+    if (users_grow && load_users(omni_path) != SUCCESS) {
+        return ERROR_IO_ERROR;
+    }
+
+    // Step 5: Clear the new metadata slots (they still hold moved-out data)
+    // before the header makes them part of the table
+    if (new_max_files > old_slots) {
+        if (!zero_bytes(file, old_table_end, new_table_end - old_table_end)) {
+            LOG_ERROR("Error: Cannot clear the new metadata slots");
+            return ERROR_IO_ERROR;
         }
-        file.write((const char*)(&fs->users[i]), sizeof(UserInfo));
+        header.setFileTableSlots(new_max_files);
+        if (!write_header(file, header)) {
+            LOG_ERROR("Error: Cannot write header");
+            return ERROR_IO_ERROR;
+        }
+        index.grow_slots(new_max_files);
     }
 
     file.close();
-    cout << "SUCCESS: File system saved and closed" << endl;
-    cout << "  Users saved: " << fs->users.size() << endl;
+    // The old copies of the moved data and user table are free again
+    index.set_layout(header);
 
-    delete fs;
+    LOG_INFO("SUCCESS: Grew file system to " << new_total_size << " bytes, " << new_max_files
+          << " file slots, " << new_max_users << " user slots (" << displaced.size() << " extents moved)");
+    return SUCCESS;
+}
+
+/**
+ * Shrinks the container to new_total_size bytes while it is in use.
+ * Only the extents that end past the new size are moved, largest first,
+ * each into the smallest free gap below the new end that holds it.
+ * Table capacities are left as they are.
+ * Returns: 0 on success, ERROR_NO_SPACE if the tail data does not fit
+ * below the new end (nothing is changed in that case)
+ */
+int fs_shrink(void* session, uint64_t new_total_size) {
+    if (!session) {
+        LOG_ERROR("Error: Invalid session");
+        return ERROR_INVALID_OPERATION;
+    }
+    if (((SessionInfo*)session)->user.role != ADMIN) {
+        LOG_ERROR("Error: Only admins can resize the file system");
+        return ERROR_PERMISSION_DENIED;
+    }
+
+    const string& omni_path = active_omni_path();
+    OMNIHeader header(0, 0, 0, 0);
+    if (!read_header(omni_path, header)) {
+        LOG_ERROR("Error: Cannot read header of " << omni_path);
+        return ERROR_IO_ERROR;
+    }
+    FSIndex& index = get_file_index();
+
+    uint64_t table_end = file_table_end(index.slot_count());
+    if (new_total_size >= header.total_size || new_total_size < table_end) {
+        LOG_ERROR("Error: fs_shrink needs a size between " << table_end << " and "
+               << header.total_size << " bytes");
+        return ERROR_INVALID_OPERATION;
+    }
+
+    // Step 1: Find the free gaps below the new end and the extents past it
+    struct Gap {
+        uint64_t offset;
+        uint64_t size;
+    };
+    vector<Gap> gaps;
+    vector<DataExtent> tail;
+    uint64_t cursor = table_end;
+
+    for (const DataExtent& e : collect_extents(index, header)) {
+        if (e.offset > cursor && cursor < new_total_size) {
+            gaps.push_back({cursor, min(e.offset, new_total_size) - cursor});
+        }
+        cursor = max(cursor, e.offset + e.size);
+        if (e.offset + e.size > new_total_size) tail.push_back(e);
+    }
+    if (cursor < new_total_size) {
+        gaps.push_back({cursor, new_total_size - cursor});
+    }
+
+    // Step 2: Place the tail extents, largest first, into the tightest gap
+    sort(tail.begin(), tail.end(), [](const DataExtent& a, const DataExtent& b) {
+        return a.size > b.size;
+    });
+
+    vector<pair<DataExtent, uint64_t>> moves;
+    for (const DataExtent& e : tail) {
+        int best = -1;
+        for (size_t g = 0; g < gaps.size(); g++) {
+            if (gaps[g].size >= e.size && (best < 0 || gaps[g].size < gaps[best].size)) best = g;
+        }
+        if (best < 0) {
+            LOG_ERROR("Error: No room below " << new_total_size << " bytes for the " << e.size
+                   << " bytes at offset " << e.offset);
+            return ERROR_NO_SPACE;
+        }
+        moves.push_back({e, gaps[best].offset});
+        gaps[best].offset += e.size;
+        gaps[best].size -= e.size;
+    }
+
+    // Step 3: Move the tail
+    fstream file(omni_path, ios::in | ios::out | ios::binary);
+    if (!file) {
+        LOG_ERROR("Error: Cannot open file system for writing");
+        return ERROR_IO_ERROR;
+    }
+
+    for (const auto& move : moves) {
+        if (!move_extent(file, index, header, move.first, move.second)) {
+            LOG_ERROR("Error: Cannot move data at offset " << move.first.offset);
+            write_header(file, header);
+            return ERROR_IO_ERROR;
+        }
+    }
+
+    // Step 4: Publish the new size, then give the space back
+    header.total_size = new_total_size;
+    if (!write_header(file, header)) {
+        LOG_ERROR("Error: Cannot write header");
+        return ERROR_IO_ERROR;
+    }
+    file.close();
+    index.set_layout(header);
+
+    if ((container_length(omni_path) > new_total_size && truncate(omni_path.c_str(), new_total_size) != 0) ||
+        get_stripe_set().resize(new_total_size) != SUCCESS) {
+        LOG_ERROR("Error: Cannot truncate " << omni_path << " to " << new_total_size << " bytes");
+        return ERROR_IO_ERROR;
+    }
+
+    LOG_INFO("SUCCESS: Shrank file system to " << new_total_size << " bytes ("
+          << moves.size() << " extents moved)");
+    return SUCCESS;
 }
 
 int main_test_coresystem() {
@@ -141,4 +599,388 @@ int main_test_coresystem() {
     cout << "========================================\n" << endl;
 
     return SUCCESS;
-}
\ No newline at end of file
+}
+
+int test_large_container() {
+    string omni_file = "/tmp/ofs_large_test.omni";
+    uint64_t total_size = 5ULL << 40;           // 5 TiB, sparse on disk
+    uint64_t four_tib = 4ULL << 40;
+    int file_count = 64;
+    int failures = 0;
+
+    cout << "\n========================================" << endl;
+    cout << "  LARGE CONTAINER TEST (5 TiB sparse)" << endl;
+    cout << "========================================\n" << endl;
+
+    // Test 1: Format a container well past the 32-bit limits
+    cout << "Test 1: Formatting sparse container..." << endl;
+    remove(snapshot_path(omni_file).c_str());
+    if (fs_format(omni_file, "BSAI-24003", "2025-11-11", total_size, 4096) != SUCCESS) {
+        cerr << "FAILED: Could not format " << omni_file << endl;
+        return ERROR_IO_ERROR;
+    }
+
+    void* fs_instance = nullptr;
+    if (fs_init(&fs_instance, omni_file.c_str(), nullptr) != SUCCESS) {
+        cerr << "FAILED: Could not initialize file system" << endl;
+        return ERROR_IO_ERROR;
+    }
+
+    // Test 2: Create files whose content lands past 4 TiB. Nothing below
+    // that is written: the front of the data area is reserved and left sparse
+    cout << "\nTest 2: Creating " << file_count << " files of 1 MiB past 4 TiB..." << endl;
+    UserInfo user("admin", "", ADMIN, time(nullptr));
+    SessionInfo session("SID_LARGE", user, time(nullptr));
+    uint64_t skipped = 0;
+    if (!file_index.reserve_data(four_tib - file_index.data_end(), skipped)) {
+        cerr << "FAILED: Could not reserve the first 4 TiB" << endl;
+        failures++;
+    }
+
+    for (int i = 0; i < file_count; i++) {
+        string data(1024 * 1024, (char)('a' + i % 26));
+        data[0] = (char)i;
+        string path = "big" + to_string(i);
+
+        if (file_create(&session, path, data) != SUCCESS) {
+            cerr << "FAILED: Could not create " << path << endl;
+            failures++;
+            continue;
+        }
+
+        int slot = file_index.find(path, Entry_FILE);
+        if (slot < 0 || file_index.slot(slot).data_offset < four_tib) {
+            cerr << "FAILED: " << path << " was not placed past 4 TiB" << endl;
+            failures++;
+        }
+    }
+
+    // Test 3: Read everything back
+    cout << "\nTest 3: Verifying contents..." << endl;
+    for (int i = 0; i < file_count; i++) {
+        string expected(1024 * 1024, (char)('a' + i % 26));
+        expected[0] = (char)i;
+        string content;
+        if (file_read(&session, "big" + to_string(i), content) != SUCCESS || content != expected) {
+            cerr << "FAILED: Content mismatch in big" << i << endl;
+            failures++;
+        }
+    }
+
+    // Test 4: Statistics report the full 64-bit size
+    cout << "\nTest 4: Checking statistics..." << endl;
+    FSStats stats(0, 0, 0);
+    get_stats(&session, stats);
+    if (stats.total_size != total_size || stats.total_files != (uint32_t)file_count) {
+        cerr << "FAILED: Stats report " << stats.total_size << " bytes, " << stats.total_files << " files" << endl;
+        failures++;
+    }
+
+    // Test 5: Offsets survive a restart through the saved index
+    cout << "\nTest 5: Restarting and re-reading..." << endl;
+    fs_shutdown(fs_instance);
+    if (fs_init(&fs_instance, omni_file.c_str(), nullptr) != SUCCESS) {
+        cerr << "FAILED: Could not re-initialize file system" << endl;
+        return ERROR_IO_ERROR;
+    }
+    string content;
+    if (file_read(&session, "big7", content) != SUCCESS || content.size() != 1024 * 1024 || content[0] != 7) {
+        cerr << "FAILED: big7 unreadable after restart" << endl;
+        failures++;
+    }
+    fs_shutdown(fs_instance);
+
+    remove(omni_file.c_str());
+    remove(snapshot_path(omni_file).c_str());
+
+    cout << "\n========================================" << endl;
+    if (failures == 0) {
+        cout << "  ✓ ALL TESTS PASSED!" << endl;
+    } else {
+        cout << "  ✗ " << failures << " CHECK(S) FAILED" << endl;
+    }
+    cout << "========================================\n" << endl;
+
+    return failures == 0 ? SUCCESS : ERROR_IO_ERROR;
+}
+
+int test_space_reuse() {
+    string omni_file = "/tmp/ofs_reuse_test.omni";
+    int failures = 0;
+
+    cout << "\n========================================" << endl;
+    cout << "  SPACE REUSE TEST (4 MiB)" << endl;
+    cout << "========================================\n" << endl;
+
+    remove(snapshot_path(omni_file).c_str());
+    if (fs_format(omni_file, "BSAI-24003", "2025-11-11", 4 * 1024 * 1024, 4096) != SUCCESS) {
+        cerr << "FAILED: Could not format " << omni_file << endl;
+        return ERROR_IO_ERROR;
+    }
+
+    void* fs_instance = nullptr;
+    if (fs_init(&fs_instance, omni_file.c_str(), nullptr) != SUCCESS) {
+        cerr << "FAILED: Could not initialize file system" << endl;
+        return ERROR_IO_ERROR;
+    }
+
+    UserInfo user("admin", "", ADMIN, time(nullptr));
+    SessionInfo session("SID_REUSE", user, time(nullptr));
+    string block(100 * 1024, 'u');
+    FSStats fresh(0, 0, 0);
+    get_stats(&session, fresh);
+
+    // Test 1: Creating and deleting one file never runs out of space
+    cout << "Test 1: 200 create/delete cycles of 100 KB..." << endl;
+    for (int i = 0; i < 200; i++) {
+        if (file_create(&session, "cycle", block) != SUCCESS || file_delete(&session, "cycle") != SUCCESS) {
+            cerr << "FAILED: Cycle " << i << " ran out of space" << endl;
+            failures++;
+            break;
+        }
+    }
+    FSStats stats(0, 0, 0);
+    get_stats(&session, stats);
+    if (stats.free_space != fresh.free_space || file_index.data_end() != file_table_end(file_index.slot_count())) {
+        cerr << "FAILED: " << fresh.free_space - stats.free_space << " bytes leaked" << endl;
+        failures++;
+    }
+
+    // Test 2: Holes left by deletes are filled before the end of the data area
+    cout << "\nTest 2: Refilling holes..." << endl;
+    for (int i = 0; i < 20; i++) file_create(&session, "hole" + to_string(i), block);
+    uint64_t end_before = file_index.data_end();
+    for (int i = 1; i < 20; i += 2) file_delete(&session, "hole" + to_string(i));
+    get_stats(&session, stats);
+    if (stats.fragmentation <= 0.0) {
+        cerr << "FAILED: Holes not reported as fragmentation" << endl;
+        failures++;
+    }
+    for (int i = 1; i < 20; i += 2) {
+        if (file_create(&session, "refill" + to_string(i), block) != SUCCESS) {
+            cerr << "FAILED: Could not refill hole " << i << endl;
+            failures++;
+        }
+    }
+    if (file_index.data_end() != end_before) {
+        cerr << "FAILED: Refill grew the data area instead of using the holes" << endl;
+        failures++;
+    }
+
+    // Test 3: Free space is the same after a restart through the snapshot
+    cout << "\nTest 3: Restarting..." << endl;
+    get_stats(&session, stats);
+    fs_shutdown(fs_instance);
+    if (fs_init(&fs_instance, omni_file.c_str(), nullptr) != SUCCESS) {
+        cerr << "FAILED: Could not re-initialize file system" << endl;
+        return ERROR_IO_ERROR;
+    }
+    FSStats restarted(0, 0, 0);
+    get_stats(&session, restarted);
+    if (restarted.free_space != stats.free_space) {
+        cerr << "FAILED: " << restarted.free_space << " bytes free after restart, " << stats.free_space << " before" << endl;
+        failures++;
+    }
+    fs_shutdown(fs_instance);
+
+    remove(omni_file.c_str());
+    remove(snapshot_path(omni_file).c_str());
+
+    cout << "\n========================================" << endl;
+    if (failures == 0) {
+        cout << "  ✓ ALL TESTS PASSED!" << endl;
+    } else {
+        cout << "  ✗ " << failures << " CHECK(S) FAILED" << endl;
+    }
+    cout << "========================================\n" << endl;
+
+    return failures == 0 ? SUCCESS : ERROR_IO_ERROR;
+}
+
+int test_legacy_container() {
+    string omni_file = "/tmp/ofs_legacy_test.omni";
+    uint64_t total_size = 1024 * 1024;
+    int failures = 0;
+
+    cout << "\n========================================" << endl;
+    cout << "  PRE-RESIZE CONTAINER TEST" << endl;
+    cout << "========================================\n" << endl;
+
+    // Test 1: Lay out a container the way the old file_create did: content
+    // appended at the end of a file already extended to total_size, its
+    // position only in the 32-bit inode
+    cout << "Test 1: Writing a file past total_size..." << endl;
+    remove(snapshot_path(omni_file).c_str());
+    if (fs_format(omni_file, "BSAI-24003", "2025-11-11", total_size, 4096) != SUCCESS) {
+        cerr << "FAILED: Could not format " << omni_file << endl;
+        return ERROR_IO_ERROR;
+    }
+    string old_data(50 * 1024, 'o');
+    {
+        fstream file(omni_file, ios::in | ios::out | ios::binary);
+        file.seekp(0, ios::end);
+        uint64_t position = file.tellp();
+        file.write(old_data.data(), old_data.size());
+        FileEntry entry("old.txt", Entry_FILE, old_data.size(), 0644, "admin", (uint32_t)position);
+        file.seekp(file_slot_offset(0), ios::beg);
+        file.write((const char*)&entry, sizeof(entry));
+    }
+
+    void* fs_instance = nullptr;
+    if (fs_init(&fs_instance, omni_file.c_str(), nullptr) != SUCCESS) {
+        cerr << "FAILED: Could not initialize file system" << endl;
+        return ERROR_IO_ERROR;
+    }
+
+    // Test 2: The header now covers the appended data
+    cout << "\nTest 2: Checking the migrated header..." << endl;
+    OMNIHeader header(0, 0, 0, 0);
+    read_header(omni_file, header);
+    if (header.total_size != total_size + old_data.size() || file_index.capacity() != header.total_size) {
+        cerr << "FAILED: total_size is " << header.total_size << " after migration" << endl;
+        failures++;
+    }
+
+    // Test 3: Old content reads back and new files fit in the old data area
+    cout << "\nTest 3: Reading old data, creating and deleting new files..." << endl;
+    UserInfo user("admin", "", ADMIN, time(nullptr));
+    SessionInfo session("SID_LEGACY", user, time(nullptr));
+    string content;
+    if (file_read(&session, "old.txt", content) != SUCCESS || content != old_data) {
+        cerr << "FAILED: old.txt unreadable after migration" << endl;
+        failures++;
+    }
+    string block(100 * 1024, 'n');
+    for (int i = 0; i < 50; i++) {
+        if (file_create(&session, "new", block) != SUCCESS || file_delete(&session, "new") != SUCCESS) {
+            cerr << "FAILED: Cycle " << i << " ran out of space" << endl;
+            failures++;
+            break;
+        }
+    }
+    if (file_create(&session, "kept", block) != SUCCESS) {
+        cerr << "FAILED: No room for a new file" << endl;
+        failures++;
+    }
+
+    // Test 4: Both survive a restart
+    cout << "\nTest 4: Restarting..." << endl;
+    fs_shutdown(fs_instance);
+    if (fs_init(&fs_instance, omni_file.c_str(), nullptr) != SUCCESS) {
+        cerr << "FAILED: Could not re-initialize file system" << endl;
+        return ERROR_IO_ERROR;
+    }
+    string kept;
+    if (file_read(&session, "old.txt", content) != SUCCESS || content != old_data ||
+        file_read(&session, "kept", kept) != SUCCESS || kept != block) {
+        cerr << "FAILED: Content lost after restart" << endl;
+        failures++;
+    }
+    fs_shutdown(fs_instance);
+
+    remove(omni_file.c_str());
+    remove(snapshot_path(omni_file).c_str());
+
+    cout << "\n========================================" << endl;
+    if (failures == 0) {
+        cout << "  ✓ ALL TESTS PASSED!" << endl;
+    } else {
+        cout << "  ✗ " << failures << " CHECK(S) FAILED" << endl;
+    }
+    cout << "========================================\n" << endl;
+
+    return failures == 0 ? SUCCESS : ERROR_IO_ERROR;
+}
+
+int test_online_resize() {
+    string omni_file = "/tmp/ofs_resize_test.omni";
+    uint64_t small_size = 1024 * 1024;
+    int failures = 0;
+
+    cout << "\n========================================" << endl;
+    cout << "  ONLINE GROW/SHRINK TEST" << endl;
+    cout << "========================================\n" << endl;
+
+    remove(snapshot_path(omni_file).c_str());
+    if (fs_format(omni_file, "BSAI-24003", "2025-11-11", small_size, 4096) != SUCCESS) {
+        cerr << "FAILED: Could not format " << omni_file << endl;
+        return ERROR_IO_ERROR;
+    }
+
+    void* fs_instance = nullptr;
+    if (fs_init(&fs_instance, omni_file.c_str(), nullptr) != SUCCESS) {
+        cerr << "FAILED: Could not initialize file system" << endl;
+        return ERROR_IO_ERROR;
+    }
+
+    UserInfo user("admin", "", ADMIN, time(nullptr));
+    SessionInfo session("SID_RESIZE", user, time(nullptr));
+    string block(64 * 1024, 'r');
+
+    // Test 1: Fill the container until it reports no space
+    cout << "Test 1: Filling the container..." << endl;
+    int created = 0;
+    while (file_create(&session, "fill" + to_string(created), block) == SUCCESS) created++;
+    if (created == 0) {
+        cerr << "FAILED: No file fit in a fresh container" << endl;
+        failures++;
+    }
+
+    // Test 2: Grow every table and the data area while the index is live
+    cout << "\nTest 2: Growing to 4 MiB, 2000 file slots, 200 user slots..." << endl;
+    if (fs_grow(&session, 4 * small_size, 2000, 200) != SUCCESS) {
+        cerr << "FAILED: fs_grow" << endl;
+        failures++;
+    }
+    if (file_create(&session, "after_grow", block) != SUCCESS) {
+        cerr << "FAILED: No space after growing" << endl;
+        failures++;
+    }
+    if (user_create(omni_file, "resize_user", "pw", NORMAL) != SUCCESS) {
+        cerr << "FAILED: Could not add a user after growing" << endl;
+        failures++;
+    }
+
+    // Test 3: Free the front of the data area, then shrink; only the tail moves
+    cout << "\nTest 3: Shrinking to 1.25 MiB..." << endl;
+    for (int i = 0; i < created; i += 2) file_delete(&session, "fill" + to_string(i));
+    if (fs_shrink(&session, 5 * small_size / 4) != SUCCESS) {
+        cerr << "FAILED: fs_shrink" << endl;
+        failures++;
+    }
+
+    // Test 4: Everything left survives a restart
+    cout << "\nTest 4: Restarting and verifying contents..." << endl;
+    fs_shutdown(fs_instance);
+    remove(snapshot_path(omni_file).c_str());
+    if (fs_init(&fs_instance, omni_file.c_str(), nullptr) != SUCCESS) {
+        cerr << "FAILED: Could not re-initialize file system" << endl;
+        return ERROR_IO_ERROR;
+    }
+    for (int i = 1; i < created; i += 2) {
+        string content;
+        if (file_read(&session, "fill" + to_string(i), content) != SUCCESS || content != block) {
+            cerr << "FAILED: fill" << i << " lost in the resize" << endl;
+            failures++;
+        }
+    }
+    string content;
+    if (file_read(&session, "after_grow", content) != SUCCESS || content != block) {
+        cerr << "FAILED: after_grow lost in the resize" << endl;
+        failures++;
+    }
+    fs_shutdown(fs_instance);
+
+    remove(omni_file.c_str());
+    remove(snapshot_path(omni_file).c_str());
+
+    cout << "\n========================================" << endl;
+    if (failures == 0) {
+        cout << "  ✓ ALL TESTS PASSED!" << endl;
+    } else {
+        cout << "  ✗ " << failures << " CHECK(S) FAILED" << endl;
+    }
+    cout << "========================================\n" << endl;
+
+    return failures == 0 ? SUCCESS : ERROR_IO_ERROR;
+}
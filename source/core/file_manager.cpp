@@ -5,168 +5,144 @@
 #include "../include/odf_types.hpp"
 #include "../include/ofs_functions.hpp"
 #include "helper.hpp"
+#include "fs_index.hpp"
+#include "stripe_set.hpp"
+#include "logger.hpp"
 using namespace std;
 
 
-bool find_file(ifstream& file, const string& path, FileEntry& entry, uint64_t& position) {
-    uint64_t file_table_start = sizeof(OMNIHeader) + (100 * sizeof(UserInfo));
-    
-    file.clear();
-    file.seekg(file_table_start, ios::beg);
-    
-    for (int i = 0; i < 1000; i++) {
-        uint64_t current_pos = file_table_start + (i * sizeof(FileEntry));
-        file.seekg(current_pos, ios::beg);
-        
-        if (!file.read((char*)&entry, sizeof(entry))) {
-            break;
-        }
-        
-        if (entry.name[0] != '\0' && compare_name(entry.name, path) && entry.type == 0) {
-            position = current_pos;
-            return true;
-        }
+bool find_file(ifstream& file, const string& path, FileEntry& entry, uint32_t& slot) {
+    int found = get_file_index().find(path, Entry_FILE);
+    if (found < 0) {
+        return false;
     }
-    
-    return false;
-}
 
-bool find_empty_slot(ifstream& file, uint64_t& position) {
-    uint64_t file_table_start = sizeof(OMNIHeader) + (100 * sizeof(UserInfo));
-    FileEntry entry("", Entry_FILE, 0, 0, "", 0);
-    
+    slot = found;
     file.clear();
-    
-    for (int i = 0; i < 1000; i++) {
-        uint64_t current_pos = file_table_start + (i * sizeof(FileEntry));
-        file.seekg(current_pos, ios::beg);
-        
-        if (!file.read((char*)&entry, sizeof(entry))) {
-            position = current_pos;
-            return true;
-        }
-        
-        if (entry.name[0] == '\0') {
-            position = current_pos;
-            return true;
-        }
-    }
-    
-    return false; 
+    file.seekg(file_slot_offset(slot), ios::beg);
+    return (bool)file.read((char*)&entry, sizeof(entry));
 }
 
 int file_create(void* session, const string& path, const string& data) {
     if (!session) {
-        cerr << "Error: Invalid session" << endl;
+        LOG_ERROR("Error: Invalid session");
         return ERROR_INVALID_OPERATION;
     }
 
     SessionInfo* s = (SessionInfo*)session;
+    FSIndex& index = get_file_index();
 
-    ifstream check_file("../compiled/test.omni", ios::binary);
-    if (!check_file) {
-        cerr << "Error: Cannot open file system" << endl;
-        return ERROR_IO_ERROR;
-    }
-
-    FileEntry existing("", Entry_FILE, 0, 0, "", 0);
-    uint64_t pos;
-    if (find_file(check_file, path, existing, pos)) {
-        cerr << "Error: File already exists: " << path << endl;
-        check_file.close();
+    if (index.find(path, Entry_FILE) >= 0) {
+        LOG_ERROR("Error: File already exists: " << path);
         return ERROR_FILE_EXISTS;
     }
     
-    uint64_t slot_pos;
-    if (!find_empty_slot(check_file, slot_pos)) {
-        cerr << "Error: No space for new files" << endl;
-        check_file.close();
+    int slot = index.allocate_slot();
+    if (slot < 0) {
+        LOG_ERROR("Error: No space for new files");
         return ERROR_NO_SPACE;
     }
-    check_file.close();
 
-    fstream file("../compiled/test.omni", ios::in | ios::out | ios::binary);
+    fstream file(active_omni_path(), ios::in | ios::out | ios::binary);
     if (!file) {
-        cerr << "Error: Cannot open file system for writing" << endl;
+        LOG_ERROR("Error: Cannot open file system for writing");
+        index.release_slot(slot);
         return ERROR_IO_ERROR;
     }
 
-    // Get the position where data will be written (at end of file)
-    file.seekp(0, ios::end);
-    uint64_t data_position = file.tellp();
+    // Data goes in the smallest free gap that holds it
+    uint64_t data_position = 0;
+    if (!index.reserve_data(data.size(), data_position)) {
+        LOG_ERROR("Error: No space for " << data.size() << " bytes of data");
+        index.release_slot(slot);
+        return ERROR_NO_SPACE;
+    }
     
-    // Create entry with inode storing the data position
-    // Note: We cast uint64_t to uint32_t - this limits file system size but works for now
-    FileEntry entry(path, Entry_FILE, data.size(), 0644, string(s->user.username), (uint32_t)data_position);
+    // The entry records the full 64-bit data position (inode keeps the low 32 bits)
+    FileEntry entry(path, Entry_FILE, data.size(), 0644, string(s->user.username), 0);
+    entry.setDataOffset(data_position);
     entry.created_time = time(nullptr);
     entry.modified_time = time(nullptr);
 
-    // Write data at end of file FIRST
-    file.write(data.c_str(), data.size());
+    // Write data FIRST (to the stripe files when the container is striped)
+    if (get_stripe_set().write(data_position, data.data(), data.size()) != SUCCESS) {
+        LOG_ERROR("Error: Cannot write file data");
+        index.release_data(data_position, data.size());
+        index.release_slot(slot);
+        return ERROR_IO_ERROR;
+    }
     
-    // Then write entry to file table with the correct inode (data position)
-    file.seekp(slot_pos, ios::beg);
+    // Then write entry to file table with the correct data position
+    file.seekp(file_slot_offset(slot), ios::beg);
     file.write((const char*)&entry, sizeof(entry));
-    
     file.flush();
+    if (!file) {
+        LOG_ERROR("Error: Cannot write entry for " << path);
+        index.release_data(data_position, data.size());
+        index.release_slot(slot);
+        return ERROR_IO_ERROR;
+    }
     file.close();
 
-    cout << "SUCCESS: Created file '" << path << "' (" << data.size() << " bytes) at position " << data_position << endl;
+    index.insert(slot, entry, data_position);
+
+    LOG_DEBUG("SUCCESS: Created file '" << path << "' (" << data.size() << " bytes) at position " << data_position);
     return SUCCESS;
 }
 
 int file_read(void* session, const string& path, string& content) {
     if (!session) {
-        cerr << "Error: Invalid session" << endl;
+        LOG_ERROR("Error: Invalid session");
         return ERROR_INVALID_OPERATION;
     }
 
-    ifstream file("../compiled/test.omni", ios::binary);
+    ifstream file(active_omni_path(), ios::binary);
     if (!file) {
-        cerr << "Error: Cannot open file system" << endl;
+        LOG_ERROR("Error: Cannot open file system");
         return ERROR_IO_ERROR;
     }
 
     FileEntry entry("", Entry_FILE, 0, 0, "", 0);
-    uint64_t pos;
+    uint32_t slot;
     
-    if (!find_file(file, path, entry, pos)) {
-        cerr << "Error: File not found: " << path << endl;
+    if (!find_file(file, path, entry, slot)) {
+        LOG_ERROR("Error: File not found: " << path);
         file.close();
         return ERROR_NOT_FOUND;
     }
 
-    // Read from the stored data position (inode contains the data position)
-    vector<char> buffer(entry.size);
-    file.seekg(entry.inode, ios::beg);
-    file.read(buffer.data(), entry.size);
-    
-    content = string(buffer.begin(), buffer.end());
-    
+    // Read from the stored data position
+    uint64_t data_position = entry.getDataOffset();
     file.close();
 
-    cout << "SUCCESS: Read file '" << path << "' (" << entry.size << " bytes) from position " << entry.inode << endl;
+    content.assign(entry.size, '\0');
+    if (get_stripe_set().read(data_position, &content[0], entry.size) != SUCCESS) {
+        LOG_ERROR("Error: Cannot read data of " << path);
+        return ERROR_IO_ERROR;
+    }
+
+    LOG_DEBUG("SUCCESS: Read file '" << path << "' (" << entry.size << " bytes) from position " << data_position);
     return SUCCESS;
 }
 
 
 int file_delete(void* session, const string& path) {
     if (!session) {
-        cerr << "Error: Invalid session" << endl;
+        LOG_ERROR("Error: Invalid session");
         return ERROR_INVALID_OPERATION;
     }
 
-    ifstream check_file("../compiled/test.omni", ios::binary);
+    ifstream check_file(active_omni_path(), ios::binary);
     if (!check_file) {
-        cerr << "Error: Cannot open file system" << endl;
+        LOG_ERROR("Error: Cannot open file system");
         return ERROR_IO_ERROR;
     }
 
     FileEntry entry("", Entry_FILE, 0, 0, "", 0);
-    uint64_t pos;
+    uint32_t slot;
     
-    if (!find_file(check_file, path, entry, pos)) {
-        cerr << "Error: File not found: " << path << endl;
+    if (!find_file(check_file, path, entry, slot)) {
+        LOG_ERROR("Error: File not found: " << path);
         check_file.close();
         return ERROR_NOT_FOUND;
     }
@@ -175,43 +151,34 @@ int file_delete(void* session, const string& path) {
     // Mark entry as deleted by clearing the name
     entry.name[0] = '\0';
 
-    fstream file("../compiled/test.omni", ios::in | ios::out | ios::binary);
+    fstream file(active_omni_path(), ios::in | ios::out | ios::binary);
     if (!file) {
-        cerr << "Error: Cannot open file system for writing" << endl;
+        LOG_ERROR("Error: Cannot open file system for writing");
         return ERROR_IO_ERROR;
     }
     
-    file.seekp(pos, ios::beg);
+    file.seekp(file_slot_offset(slot), ios::beg);
     file.write((char*)&entry, sizeof(entry));
     file.close();
 
-    cout << "SUCCESS: Deleted file '" << path << "'" << endl;
+    get_file_index().remove(slot);
+
+    LOG_DEBUG("SUCCESS: Deleted file '" << path << "'");
     return SUCCESS;
 }
 
 int file_exists(void* session, const string& path) {
     if (!session) {
-        cerr << "Error: Invalid session" << endl;
+        LOG_ERROR("Error: Invalid session");
         return ERROR_INVALID_OPERATION;
     }
 
-    ifstream file("../compiled/test.omni", ios::binary);
-    if (!file) {
-        cerr << "Error: Cannot open file system" << endl;
-        return ERROR_IO_ERROR;
-    }
-
-    FileEntry entry("", Entry_FILE, 0, 0, "", 0);
-    uint64_t pos;
-    
-    if (find_file(file, path, entry, pos)) {
-        file.close();
-        cout << "File '" << path << "' exists" << endl;
+    if (get_file_index().find(path, Entry_FILE) >= 0) {
+        LOG_DEBUG("File '" << path << "' exists");
         return SUCCESS;
     }
 
-    file.close();
-    cout << "File '" << path << "' does not exist" << endl;
+    LOG_DEBUG("File '" << path << "' does not exist");
     return ERROR_NOT_FOUND;
 }
 
@@ -219,21 +186,21 @@ int file_exists(void* session, const string& path) {
 int file_rename(void* session, const string& old_path, const string& new_path) {
 
     if (!session) {
-        cerr << "Error: Invalid session" << endl;
+        LOG_ERROR("Error: Invalid session");
         return ERROR_INVALID_OPERATION;
     }
 
-    ifstream check_file("../compiled/test.omni", ios::binary);
+    ifstream check_file(active_omni_path(), ios::binary);
     if (!check_file) {
-        cerr << "Error: Cannot open file system" << endl;
+        LOG_ERROR("Error: Cannot open file system");
         return ERROR_IO_ERROR;
     }
 
     FileEntry entry("", Entry_FILE, 0, 0, "", 0);
-    uint64_t pos;
+    uint32_t slot;
     
-    if (!find_file(check_file, old_path, entry, pos)) {
-        cerr << "Error: File not found: " << old_path << endl;
+    if (!find_file(check_file, old_path, entry, slot)) {
+        LOG_ERROR("Error: File not found: " << old_path);
         check_file.close();
         return ERROR_NOT_FOUND;
     }
@@ -242,17 +209,19 @@ int file_rename(void* session, const string& old_path, const string& new_path) {
     // Update the name in the entry
     copy_name(entry.name, sizeof(entry.name), new_path);
 
-    fstream file("../compiled/test.omni", ios::in | ios::out | ios::binary);
+    fstream file(active_omni_path(), ios::in | ios::out | ios::binary);
     if (!file) {
-        cerr << "Error: Cannot open file system for writing" << endl;
+        LOG_ERROR("Error: Cannot open file system for writing");
         return ERROR_IO_ERROR;
     }
     
-    file.seekp(pos, ios::beg);
+    file.seekp(file_slot_offset(slot), ios::beg);
     file.write((char*)&entry, sizeof(entry));
     file.close();
 
-    cout << "SUCCESS: Renamed '" << old_path << "' to '" << new_path << "'" << endl;
+    get_file_index().rename(slot, new_path);
+
+    LOG_DEBUG("SUCCESS: Renamed '" << old_path << "' to '" << new_path << "'");
     return SUCCESS;
 }
 
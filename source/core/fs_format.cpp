@@ -1,83 +1,67 @@
 #include <iostream>
 #include <fstream>
-#include <ctime>
-#include <algorithm>
+#include <string>
+#include <vector>
+#include <cctype>
 #include "../include/odf_types.hpp"
 #include "../include/ofs_functions.hpp"
 #include "helper.hpp"
+#include "stripe_set.hpp"
 using namespace std;
 
 
 
-/**
- * Creates a new .omni file system
- * Returns: 0 on success, negative error code on failure
- */
-int fs_format(const string& omni_path,
-              const string& student_id,
-              const string& submission_date,
-              uint64_t total_size,
-              uint64_t block_size)
-{
-    // Step 1: Create new empty file
-    ofstream file(omni_path, ios::binary | ios::trunc);
-    if (!file) {
-        cerr << "Error: Cannot create file " << omni_path << endl;
-        return ERROR_IO_ERROR;
+// Accepts plain byte counts or K/M/G/T suffixes (e.g. 100M, 5T)
+uint64_t parse_size(const string& text) {
+    size_t used = 0;
+    uint64_t value = stoull(text, &used);
+    if (used < text.size()) {
+        switch (toupper(text[used])) {
+            case 'T': value <<= 10; // fall through
+            case 'G': value <<= 10; // fall through
+            case 'M': value <<= 10; // fall through
+            case 'K': value <<= 10; break;
+        }
     }
-
-    OMNIHeader header(0x00010000, total_size, sizeof(OMNIHeader), block_size);  
-    
-    // Step 3: Fill basic info
-    std::memcpy(header.magic, "OMNIFS01", 8);
-    header.format_version = 0x00010000;  // Version 1.0
-    header.total_size = total_size;
-    header.header_size = sizeof(OMNIHeader);
-    header.block_size = block_size;
-
-    // Step 4: Add student info
-    copy_name(header.student_id, sizeof(header.student_id), student_id);
-    copy_name(header.submission_date, sizeof(header.submission_date), submission_date);
-
-    // Step 5: Set default values
-    copy_name(header.config_hash, sizeof(header.config_hash), "INIT_HASH");
-    header.config_timestamp = uint64_t(time(nullptr));
-    header.user_table_offset = uint32_t(sizeof(OMNIHeader));
-    header.max_users = 100;
-    header.file_state_storage_offset = 0;
-    header.change_log_offset = 0;
-
-    // Step 6: Write header to file
-    file.write((const char*)(&header), sizeof(header));
-
-    // Step 7: Allocate remaining space (fill file to total_size)
-    if (total_size > sizeof(header)) {
-        // Move the file pointer to the last position
-        uint64_t last_position = total_size - 1;
-        file.seekp(last_position);
-        file.put('\0');
-    }
-
-    file.close();
-
-    // Success message
-    double size_mb = total_size / (1024.0 * 1024.0);
-    cout << "SUCCESS: Created " << omni_path 
-         << " (" << size_mb << " MB)" << endl;
-
-    return SUCCESS;
+    return value;
 }
 
-int main() {
-    // Configuration
+int main(int argc, char** argv) {
+    // Configuration (fs_format [omni_path] [total_size] [--stripe path]... [--stripe-unit size])
     string omni_file = "../compiled/test.omni";
     string student_id = "BSAI-24003";           // YOUR ID HERE
     string date = "2025-11-11";               // TODAY'S DATE
     uint64_t total_size = 5 * 1024 * 1024;    // 5 MB
     uint64_t block_size = 4096;               // 4 KB per block
+    vector<string> stripe_paths;              // Data files for a striped container
+    uint64_t stripe_unit = DEFAULT_STRIPE_UNIT;
+
+    int positional = 0;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--stripe" && i + 1 < argc) {
+            stripe_paths.push_back(argv[++i]);
+        } else if (arg == "--stripe-unit" && i + 1 < argc) {
+            stripe_unit = parse_size(argv[++i]);
+        } else if (positional == 0) {
+            omni_file = arg;
+            positional++;
+        } else if (positional == 1) {
+            total_size = parse_size(arg);
+            positional++;
+        }
+    }
 
     // Create the file system
     int result = fs_format(omni_file, student_id, date, total_size, block_size);
+    if (result == 0 && !stripe_paths.empty()) {
+        if (stripe_unit == 0 || stripe_unit > UINT32_MAX) {
+            cerr << "Error: Stripe unit must be between 1 byte and 4 GiB" << endl;
+            result = ERROR_INVALID_CONFIG;
+        } else {
+            result = create_stripe_set(omni_file, stripe_paths, (uint32_t)stripe_unit);
+        }
+    }
     
     if (result == 0) {
         cout << "\nFile system created successfully!" << endl;
@@ -86,4 +70,4 @@ int main() {
     }
 
     return result;
-}
\ No newline at end of file
+}
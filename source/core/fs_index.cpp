@@ -0,0 +1,627 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "fs_index.hpp"
+#include "helper.hpp"
+#include "logger.hpp"
+#include "trace.hpp"
+using namespace std;
+
+const uint32_t INDEX_IMAGE_VERSION = 2;
+
+FSIndex file_index;
+
+FSIndex& get_file_index() {
+    if (!file_index.loaded()) {
+        file_index.load(active_omni_path());
+    }
+    return file_index;
+}
+
+uint64_t fnv1a_hash(const char* data, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Key under which an entry is listed: everything before the last '/',
+// or "/" for names without one (root level)
+string parent_key(const string& path) {
+    size_t slash = path.find_last_of('/');
+    if (slash == string::npos) return "/";
+    return path.substr(0, slash);
+}
+
+string snapshot_path(const string& omni_path) {
+    return omni_path + ".idx";
+}
+
+bool stat_container(const string& omni_path, uint64_t& size, uint64_t& mtime_ns) {
+    struct stat st;
+    if (stat(omni_path.c_str(), &st) != 0) return false;
+    size = st.st_size;
+    mtime_ns = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+    return true;
+}
+
+uint32_t bucket_count_for(uint32_t slot_count) {
+    uint32_t buckets = 16;
+    while (buckets < slot_count * 2) buckets <<= 1;
+    return buckets;
+}
+
+// ============================================================================
+// IMAGE MANAGEMENT
+// ============================================================================
+
+FSIndex::FSIndex() : base(nullptr), size(0), mapped(false), capacity_bytes(0), data_start(0),
+                     users_offset(0), users_bytes(0), free_total(0) {}
+
+FSIndex::~FSIndex() {
+    reset();
+}
+
+void FSIndex::reset() {
+    if (base) {
+        if (mapped) munmap(base, size);
+        else delete[] base;
+    }
+    base = nullptr;
+    size = 0;
+    mapped = false;
+}
+
+uint32_t* FSIndex::name_buckets() const {
+    return (uint32_t*)(base + sizeof(IndexImageHeader));
+}
+
+uint32_t* FSIndex::parent_buckets() const {
+    return name_buckets() + header()->bucket_count;
+}
+
+IndexSlot* FSIndex::slots() const {
+    return (IndexSlot*)(parent_buckets() + header()->bucket_count);
+}
+
+const IndexSlot& FSIndex::slot(uint32_t index) const {
+    return slots()[index];
+}
+
+void FSIndex::create_empty(uint32_t slot_count) {
+    reset();
+
+    uint32_t buckets = bucket_count_for(slot_count);
+    size = sizeof(IndexImageHeader) + 2ULL * buckets * sizeof(uint32_t) + (uint64_t)slot_count * sizeof(IndexSlot);
+    base = new uint8_t[size]();
+
+    IndexImageHeader* h = header();
+    memcpy(h->magic, "OFSIDX01", 8);
+    h->version = INDEX_IMAGE_VERSION;
+    h->slot_count = slot_count;
+    h->bucket_count = buckets;
+    h->image_size = size;
+    h->data_end = file_table_end(slot_count);
+
+    // Push in reverse so the lowest slots are handed out first
+    for (uint32_t i = slot_count; i > 0; i--) {
+        push_free(i - 1);
+    }
+}
+
+uint64_t FSIndex::compute_checksum() const {
+    return fnv1a_hash((const char*)base + sizeof(IndexImageHeader), size - sizeof(IndexImageHeader));
+}
+
+int FSIndex::load(const string& omni_path) {
+    OMNIHeader omni_header(0, 0, 0, 0);
+    if (!read_header(omni_path, omni_header)) {
+        LOG_ERROR("Error: Cannot read header of " << omni_path << " to load index");
+        return ERROR_IO_ERROR;
+    }
+
+    if (map_snapshot(omni_path, file_table_slots(omni_header))) {
+        LOG_INFO("Index: mapped snapshot " << snapshot_path(omni_path) << " ("
+              << total_files() << " files, " << total_directories() << " directories)");
+    } else if (rebuild(omni_path, omni_header) != SUCCESS) {
+        return ERROR_IO_ERROR;
+    }
+    set_layout(omni_header);
+    return SUCCESS;
+}
+
+bool FSIndex::map_snapshot(const string& omni_path, uint32_t slot_count) {
+    string idx_path = snapshot_path(omni_path);
+
+    int fd = open(idx_path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(IndexImageHeader)) {
+        close(fd);
+        return false;
+    }
+
+    // Private mapping: pages are shared with the page cache until the
+    // index modifies them, and changes never reach the snapshot file
+    void* image = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) return false;
+
+    reset();
+    base = (uint8_t*)image;
+    size = st.st_size;
+    mapped = true;
+
+    const IndexImageHeader* h = header();
+    uint64_t omni_size = 0, omni_mtime = 0;
+    string reason;
+
+    if (!compare(h->magic, "OFSIDX01", 8) || h->version != INDEX_IMAGE_VERSION) {
+        reason = "unknown format";
+    } else if (h->image_size != size || h->slot_count != slot_count ||
+               h->bucket_count != bucket_count_for(h->slot_count) ||
+               size != sizeof(IndexImageHeader) + 2ULL * h->bucket_count * sizeof(uint32_t) +
+                       (uint64_t)h->slot_count * sizeof(IndexSlot)) {
+        reason = "size mismatch";
+    } else if (!stat_container(omni_path, omni_size, omni_mtime) ||
+               omni_size != h->omni_size || omni_mtime != h->omni_mtime_ns) {
+        reason = "container changed since it was saved";
+    } else if (compute_checksum() != h->checksum) {
+        reason = "checksum mismatch";
+    }
+
+    if (!reason.empty()) {
+        LOG_INFO("Index: ignoring snapshot " << idx_path << " (" << reason << ")");
+        reset();
+        return false;
+    }
+    return true;
+}
+
+int FSIndex::rebuild(const string& omni_path, const OMNIHeader& omni_header) {
+    ifstream file(omni_path, ios::binary);
+    if (!file) {
+        LOG_ERROR("Error: Cannot open " << omni_path << " to build index");
+        return ERROR_IO_ERROR;
+    }
+
+    uint32_t slot_count = file_table_slots(omni_header);
+    vector<FileEntry> table(slot_count);
+    file.seekg(FILE_TABLE_OFFSET, ios::beg);
+    file.read((char*)table.data(), table.size() * sizeof(FileEntry));
+    file.close();
+
+    // Free space is worked out by set_layout once every entry is in
+    create_empty(slot_count);
+
+    // Rebuild the free list from the slots that are actually empty
+    header()->free_head = 0;
+    header()->free_slots = 0;
+    for (uint32_t i = slot_count; i > 0; i--) {
+        const FileEntry& entry = table[i - 1];
+        if (entry.name[0] == '\0') {
+            push_free(i - 1);
+        } else {
+            insert(i - 1, entry, entry.getDataOffset());
+        }
+    }
+
+    LOG_INFO("Index: rebuilt from " << omni_path << " (" << total_files() << " files, "
+          << total_directories() << " directories)");
+    return SUCCESS;
+}
+
+int FSIndex::save(const string& omni_path) {
+    if (!loaded()) return ERROR_INVALID_OPERATION;
+
+    IndexImageHeader* h = header();
+    if (!stat_container(omni_path, h->omni_size, h->omni_mtime_ns)) {
+        LOG_ERROR("Error: Cannot stat " << omni_path);
+        return ERROR_IO_ERROR;
+    }
+    h->checksum = compute_checksum();
+
+    // Write beside the old image and swap it in, so a crash never leaves a torn snapshot
+    string idx_path = snapshot_path(omni_path);
+    string tmp_path = idx_path + ".tmp";
+
+    ofstream out(tmp_path, ios::binary | ios::trunc);
+    if (!out) {
+        LOG_ERROR("Error: Cannot write " << tmp_path);
+        return ERROR_IO_ERROR;
+    }
+    out.write((const char*)base, size);
+    out.close();
+
+    if (!out || ::rename(tmp_path.c_str(), idx_path.c_str()) != 0) {
+        LOG_ERROR("Error: Cannot replace " << idx_path);
+        ::remove(tmp_path.c_str());
+        return ERROR_IO_ERROR;
+    }
+
+    LOG_INFO("Index: saved snapshot " << idx_path << " (" << size << " bytes)");
+    return SUCCESS;
+}
+
+// ============================================================================
+// LOOKUP
+// ============================================================================
+
+int FSIndex::find(const string& path, int type) const {
+    TRACE_SCOPE("index_find", "storage", path);
+    shared_lock<shared_mutex> lock(index_mutex);
+    if (!loaded()) return -1;
+
+    uint64_t hash = fnv1a_hash(path.data(), path.size());
+    uint32_t link_value = name_buckets()[hash & (header()->bucket_count - 1)];
+
+    // The chain is unordered; keep the lowest matching slot like a table scan would
+    int found = -1;
+    while (link_value != 0) {
+        const IndexSlot& s = slots()[link_value - 1];
+        if (s.name_hash == hash && (type < 0 || s.type == type) && compare_name(s.name, path)) {
+            if (found < 0 || (int)(link_value - 1) < found) found = link_value - 1;
+        }
+        link_value = s.next_by_name;
+    }
+    return found;
+}
+
+vector<uint32_t> FSIndex::children(const string& dir_path) const {
+    TRACE_SCOPE("index_children", "storage", dir_path);
+    shared_lock<shared_mutex> lock(index_mutex);
+    vector<uint32_t> result;
+    if (!loaded()) return result;
+
+    string key = dir_path;
+    if (key.empty()) key = "/";
+    else if (key.size() > 1 && key.back() == '/') key.pop_back();
+
+    uint64_t hash = fnv1a_hash(key.data(), key.size());
+    uint32_t link_value = parent_buckets()[hash & (header()->bucket_count - 1)];
+
+    while (link_value != 0) {
+        const IndexSlot& s = slots()[link_value - 1];
+        if (s.parent_hash == hash) {
+            string name(s.name);
+            if (name.back() != '/' && parent_key(name) == key) {
+                result.push_back(link_value - 1);
+            }
+        }
+        link_value = s.next_by_parent;
+    }
+
+    sort(result.begin(), result.end());
+    return result;
+}
+
+// ============================================================================
+// UPDATES
+// ============================================================================
+
+void FSIndex::push_free(uint32_t index) {
+    IndexSlot& s = slots()[index];
+    s.next_free = header()->free_head;
+    header()->free_head = index + 1;
+    header()->free_slots++;
+}
+
+int FSIndex::allocate_slot() {
+    unique_lock<shared_mutex> lock(index_mutex);
+    if (!loaded() || header()->free_head == 0) return -1;
+
+    uint32_t index = header()->free_head - 1;
+    header()->free_head = slots()[index].next_free;
+    header()->free_slots--;
+    slots()[index].next_free = 0;
+    return index;
+}
+
+void FSIndex::release_slot(uint32_t index) {
+    unique_lock<shared_mutex> lock(index_mutex);
+    if (!slots()[index].in_use) push_free(index);
+}
+
+bool FSIndex::reserve_data(uint64_t bytes, uint64_t& offset) {
+    unique_lock<shared_mutex> lock(index_mutex);
+    if (bytes == 0) {
+        offset = header()->data_end;
+        return true;
+    }
+
+    auto best = free_by_size.lower_bound({bytes, 0});
+    if (best == free_by_size.end()) return false;
+
+    offset = best->second;
+    take_range(offset, bytes);
+    header()->data_end = max(header()->data_end, offset + bytes);
+    return true;
+}
+
+void FSIndex::release_data(uint64_t offset, uint64_t bytes) {
+    unique_lock<shared_mutex> lock(index_mutex);
+    if (bytes == 0) return;
+    free_range(offset, bytes);
+    update_data_end();
+}
+
+uint64_t FSIndex::free_bytes() const {
+    shared_lock<shared_mutex> lock(index_mutex);
+    return free_total;
+}
+
+uint64_t FSIndex::largest_free() const {
+    shared_lock<shared_mutex> lock(index_mutex);
+    return free_by_size.empty() ? 0 : free_by_size.rbegin()->first;
+}
+
+// ============================================================================
+// FREE SPACE
+// ============================================================================
+
+void FSIndex::set_layout(const OMNIHeader& omni_header) {
+    unique_lock<shared_mutex> lock(index_mutex);
+    capacity_bytes = omni_header.total_size;
+    data_start = file_table_end(file_table_slots(omni_header));
+    users_offset = users_bytes = 0;
+    if (user_table_in_data_area(omni_header)) {
+        users_offset = omni_header.getUserTableOffset();
+        users_bytes = (uint64_t)omni_header.max_users * sizeof(UserInfo);
+    }
+    rebuild_free_space();
+}
+
+// Gaps between the live extents, in one pass over the slots sorted by offset
+void FSIndex::rebuild_free_space() {
+    vector<pair<uint64_t, uint64_t>> used;
+    for (uint32_t i = 0; i < header()->slot_count; i++) {
+        const IndexSlot& s = slots()[i];
+        if (s.in_use && s.type != DIRECTORY && s.size > 0) used.push_back({s.data_offset, s.size});
+    }
+    if (users_bytes > 0) used.push_back({users_offset, users_bytes});
+    sort(used.begin(), used.end());
+
+    free_by_offset.clear();
+    free_by_size.clear();
+    free_total = 0;
+
+    uint64_t cursor = data_start;
+    for (const auto& extent : used) {
+        if (extent.first > cursor && cursor < capacity_bytes) {
+            add_gap(cursor, min(extent.first, capacity_bytes) - cursor);
+        }
+        cursor = max(cursor, extent.first + extent.second);
+    }
+    if (cursor < capacity_bytes) add_gap(cursor, capacity_bytes - cursor);
+    header()->data_end = cursor;
+}
+
+void FSIndex::add_gap(uint64_t offset, uint64_t length) {
+    free_by_offset.emplace(offset, length);
+    free_by_size.emplace(length, offset);
+    free_total += length;
+}
+
+map<uint64_t, uint64_t>::iterator FSIndex::erase_gap(map<uint64_t, uint64_t>::iterator gap) {
+    free_by_size.erase({gap->second, gap->first});
+    free_total -= gap->second;
+    return free_by_offset.erase(gap);
+}
+
+// Gives back a range that was in use, merging it with the gaps beside it
+void FSIndex::free_range(uint64_t offset, uint64_t length) {
+    uint64_t start = max(offset, data_start);
+    uint64_t end = min(offset + length, capacity_bytes);
+    if (start >= end) return;
+
+    auto next = free_by_offset.lower_bound(start);
+    if (next != free_by_offset.end() && next->first == end) {
+        end += next->second;
+        next = erase_gap(next);
+    }
+    if (next != free_by_offset.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == start) {
+            start = prev->first;
+            erase_gap(prev);
+        }
+    }
+    add_gap(start, end - start);
+}
+
+// Marks a range as used, splitting whatever gaps it overlaps
+void FSIndex::take_range(uint64_t offset, uint64_t length) {
+    uint64_t end = offset + length;
+    auto gap = free_by_offset.upper_bound(offset);
+    if (gap != free_by_offset.begin()) --gap;
+
+    while (gap != free_by_offset.end() && gap->first < end) {
+        uint64_t gap_start = gap->first;
+        uint64_t gap_end = gap->first + gap->second;
+        if (gap_end <= offset) {
+            ++gap;
+            continue;
+        }
+        gap = erase_gap(gap);
+        if (gap_start < offset) add_gap(gap_start, offset - gap_start);
+        if (gap_end > end) add_gap(end, gap_end - end);
+    }
+}
+
+// data_end drops back when the last extent goes away
+void FSIndex::update_data_end() {
+    IndexImageHeader* h = header();
+    if (h->data_end > capacity_bytes) return;
+
+    auto last = free_by_offset.rbegin();
+    if (last != free_by_offset.rend() && last->first + last->second == capacity_bytes) {
+        h->data_end = last->first;
+    } else {
+        h->data_end = capacity_bytes;
+    }
+}
+
+void FSIndex::link(uint32_t index) {
+    IndexSlot& s = slots()[index];
+    uint32_t mask = header()->bucket_count - 1;
+
+    uint32_t& name_head = name_buckets()[s.name_hash & mask];
+    s.prev_by_name = 0;
+    s.next_by_name = name_head;
+    if (name_head) slots()[name_head - 1].prev_by_name = index + 1;
+    name_head = index + 1;
+
+    uint32_t& parent_head = parent_buckets()[s.parent_hash & mask];
+    s.prev_by_parent = 0;
+    s.next_by_parent = parent_head;
+    if (parent_head) slots()[parent_head - 1].prev_by_parent = index + 1;
+    parent_head = index + 1;
+}
+
+void FSIndex::unlink(uint32_t index) {
+    IndexSlot& s = slots()[index];
+    uint32_t mask = header()->bucket_count - 1;
+
+    if (s.prev_by_name) slots()[s.prev_by_name - 1].next_by_name = s.next_by_name;
+    else name_buckets()[s.name_hash & mask] = s.next_by_name;
+    if (s.next_by_name) slots()[s.next_by_name - 1].prev_by_name = s.prev_by_name;
+
+    if (s.prev_by_parent) slots()[s.prev_by_parent - 1].next_by_parent = s.next_by_parent;
+    else parent_buckets()[s.parent_hash & mask] = s.next_by_parent;
+    if (s.next_by_parent) slots()[s.next_by_parent - 1].prev_by_parent = s.prev_by_parent;
+
+    s.next_by_name = s.prev_by_name = 0;
+    s.next_by_parent = s.prev_by_parent = 0;
+}
+
+void FSIndex::insert(uint32_t index, const FileEntry& entry, uint64_t data_offset) {
+    unique_lock<shared_mutex> lock(index_mutex);
+    IndexSlot& s = slots()[index];
+    if (s.in_use) detach(index);
+
+    copy_name(s.name, sizeof(s.name), string(entry.name));
+    string name(s.name);
+    string parent = parent_key(name);
+
+    s.name_hash = fnv1a_hash(name.data(), name.size());
+    s.parent_hash = fnv1a_hash(parent.data(), parent.size());
+    s.type = entry.type;
+    s.size = entry.size;
+    s.data_offset = data_offset;
+    s.in_use = 1;
+    link(index);
+
+    IndexImageHeader* h = header();
+    if (s.type == DIRECTORY) {
+        h->total_directories++;
+    } else {
+        h->total_files++;
+        h->used_bytes += s.size;
+        if (s.size > 0) {
+            take_range(data_offset, s.size);
+            h->data_end = max(h->data_end, data_offset + s.size);
+        }
+    }
+}
+
+void FSIndex::remove(uint32_t index) {
+    unique_lock<shared_mutex> lock(index_mutex);
+    if (!slots()[index].in_use) return;
+    detach(index);
+    push_free(index);
+}
+
+// Drops an entry from the chains and the summaries and frees its data,
+// but not its slot
+void FSIndex::detach(uint32_t index) {
+    IndexSlot& s = slots()[index];
+    unlink(index);
+
+    IndexImageHeader* h = header();
+    if (s.type == DIRECTORY) {
+        h->total_directories--;
+    } else {
+        h->total_files--;
+        h->used_bytes -= s.size;
+        if (s.size > 0) {
+            free_range(s.data_offset, s.size);
+            update_data_end();
+        }
+    }
+
+    s.in_use = 0;
+    s.name[0] = '\0';
+}
+
+void FSIndex::rename(uint32_t index, const string& new_name) {
+    unique_lock<shared_mutex> lock(index_mutex);
+    IndexSlot& s = slots()[index];
+    if (!s.in_use) return;
+
+    unlink(index);
+    copy_name(s.name, sizeof(s.name), new_name);
+    string name(s.name);
+    string parent = parent_key(name);
+    s.name_hash = fnv1a_hash(name.data(), name.size());
+    s.parent_hash = fnv1a_hash(parent.data(), parent.size());
+    link(index);
+}
+
+void FSIndex::set_data_offset(uint32_t index, uint64_t offset) {
+    unique_lock<shared_mutex> lock(index_mutex);
+    IndexSlot& s = slots()[index];
+    if (s.size > 0) {
+        free_range(s.data_offset, s.size);
+        take_range(offset, s.size);
+    }
+    s.data_offset = offset;
+    update_data_end();
+}
+
+void FSIndex::grow_slots(uint32_t slot_count) {
+    unique_lock<shared_mutex> lock(index_mutex);
+    IndexImageHeader old = *header();
+    if (slot_count <= old.slot_count) return;
+    vector<IndexSlot> old_slots(slots(), slots() + old.slot_count);
+
+    // A new image is needed anyway (the buckets grow with the table), so
+    // relink every live entry into it under its old slot number
+    create_empty(slot_count);
+    IndexImageHeader* h = header();
+    h->free_head = 0;
+    h->free_slots = 0;
+
+    for (uint32_t i = slot_count; i > 0; i--) {
+        uint32_t index = i - 1;
+        if (index < old.slot_count && old_slots[index].in_use) {
+            slots()[index] = old_slots[index];
+            slots()[index].next_free = 0;
+            link(index);
+        } else {
+            push_free(index);
+        }
+    }
+
+    h->data_end = old.data_end;
+    h->used_bytes = old.used_bytes;
+    h->total_files = old.total_files;
+    h->total_directories = old.total_directories;
+}
+
+bool read_slot_entry(uint32_t slot, FileEntry& entry) {
+    ifstream file(active_omni_path(), ios::binary);
+    if (!file) return false;
+
+    file.seekg(file_slot_offset(slot), ios::beg);
+    return (bool)file.read((char*)&entry, sizeof(entry));
+}
@@ -0,0 +1,170 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <cstdint>
+#include <shared_mutex>
+#include "../include/odf_types.hpp"
+using namespace std;
+
+/**
+ * In-memory index of the metadata table
+ *
+ * Maps full paths to metadata slots, keeps the children of every directory
+ * and the free-space summaries used by get_stats. The index lives in one
+ * flat, pointer-free image (all links are slot numbers), so the same bytes
+ * can be written to <omni>.idx at shutdown and mapped back at startup
+ * without rebuilding anything.
+ *
+ * The free gaps of the data area are kept beside the image, by offset and
+ * by size, and are recomputed from the live slots whenever the layout is
+ * set (load, fs_grow, fs_shrink). reserve_data takes the smallest gap that
+ * fits and deleting a file gives its bytes back, so space is reused.
+ *
+ * Lookups and updates lock the index internally, so managers running on
+ * several threads can share it. Whether the entry a slot describes may
+ * change underneath a caller is up to the caller's path locks (see
+ * lock_manager.hpp); load, save and reset run before or after the server
+ * and do not lock.
+ *
+ * Image layout:
+ *   IndexImageHeader
+ *   uint32_t name_buckets[bucket_count]     // slot+1 of first entry, 0 = empty
+ *   uint32_t parent_buckets[bucket_count]
+ *   IndexSlot slots[slot_count]
+ */
+
+struct IndexImageHeader {
+    char magic[8];              // "OFSIDX01"
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t bucket_count;
+    uint32_t free_head;         // slot+1 of first free slot, 0 if the table is full
+    uint64_t image_size;
+    uint64_t checksum;          // FNV-1a of everything after this header
+    uint64_t omni_size;         // Container length when the image was saved
+    uint64_t omni_mtime_ns;     // Container mtime when the image was saved
+
+    // Free-space and usage summaries
+    uint64_t data_end;          // End of the last extent in the data area
+    uint64_t used_bytes;        // Sum of all file sizes
+    uint32_t free_slots;
+    uint32_t total_files;
+    uint32_t total_directories;
+    uint32_t reserved;
+};
+
+struct IndexSlot {
+    uint64_t name_hash;
+    uint64_t parent_hash;
+    uint64_t data_offset;
+    uint64_t size;
+    uint32_t next_by_name;      // Chains are slot+1, 0 terminates
+    uint32_t prev_by_name;
+    uint32_t next_by_parent;
+    uint32_t prev_by_parent;
+    uint32_t next_free;
+    uint8_t type;
+    uint8_t in_use;
+    uint8_t pad[2];
+    char name[256];
+};
+
+class FSIndex {
+public:
+    FSIndex();
+    ~FSIndex();
+
+    // Maps <omni>.idx if it is current, otherwise rebuilds from the metadata table
+    int load(const string& omni_path);
+    int save(const string& omni_path);
+    void reset();
+    bool loaded() const { return base != nullptr; }
+    bool from_snapshot() const { return mapped; }
+
+    // Returns the slot holding path (optionally of the given type), or -1
+    int find(const string& path, int type = -1) const;
+    // Slots of the direct children of a directory path, in slot order
+    vector<uint32_t> children(const string& dir_path) const;
+    const IndexSlot& slot(uint32_t index) const;
+
+    // Reserves a free slot, or returns -1 when the table is full
+    int allocate_slot();
+    void release_slot(uint32_t index);
+    // Data area bounds from the container header: after the metadata table
+    // up to total_size, less the user table when it lives there. Recomputes
+    // the free gaps from the live extents
+    void set_layout(const OMNIHeader& omni_header);
+    // Reserves size bytes in the smallest free gap that holds them; false
+    // when no gap below the capacity is large enough
+    bool reserve_data(uint64_t size, uint64_t& offset);
+    // Gives back a reservation that never got an entry
+    void release_data(uint64_t offset, uint64_t size);
+
+    void insert(uint32_t index, const FileEntry& entry, uint64_t data_offset);
+    void remove(uint32_t index);
+    void rename(uint32_t index, const string& new_name);
+
+    // Used by fs_grow/fs_shrink when they move data; the old bytes are freed
+    void set_data_offset(uint32_t index, uint64_t offset);
+    // Rebuilds the image with more slots; every entry keeps its slot number
+    void grow_slots(uint32_t slot_count);
+
+    uint32_t slot_count() const { return header()->slot_count; }
+    uint64_t capacity() const { return capacity_bytes; }
+    uint64_t data_end() const { return header()->data_end; }
+    uint64_t used_bytes() const { return header()->used_bytes; }
+    uint32_t free_slots() const { return header()->free_slots; }
+    uint32_t total_files() const { return header()->total_files; }
+    uint32_t total_directories() const { return header()->total_directories; }
+    // Bytes reserve_data can still hand out, and the largest single gap
+    uint64_t free_bytes() const;
+    uint64_t largest_free() const;
+
+private:
+    uint8_t* base;
+    uint64_t size;
+    bool mapped;
+    uint64_t capacity_bytes;
+    mutable shared_mutex index_mutex;
+
+    // Free gaps of [data_start, capacity_bytes); not part of the image
+    uint64_t data_start;
+    uint64_t users_offset;                  // User table, when it lives in the data area
+    uint64_t users_bytes;
+    map<uint64_t, uint64_t> free_by_offset;         // offset -> length
+    set<pair<uint64_t, uint64_t>> free_by_size;     // (length, offset), for best fit
+    uint64_t free_total;
+
+    IndexImageHeader* header() const { return (IndexImageHeader*)base; }
+    uint32_t* name_buckets() const;
+    uint32_t* parent_buckets() const;
+    IndexSlot* slots() const;
+
+    void create_empty(uint32_t slot_count);
+    int rebuild(const string& omni_path, const OMNIHeader& omni_header);
+    bool map_snapshot(const string& omni_path, uint32_t slot_count);
+    void link(uint32_t index);
+    void unlink(uint32_t index);
+    void detach(uint32_t index);
+    void push_free(uint32_t index);
+    void rebuild_free_space();
+    void add_gap(uint64_t offset, uint64_t length);
+    map<uint64_t, uint64_t>::iterator erase_gap(map<uint64_t, uint64_t>::iterator gap);
+    void free_range(uint64_t offset, uint64_t length);
+    void take_range(uint64_t offset, uint64_t length);
+    void update_data_end();
+    uint64_t compute_checksum() const;
+};
+
+uint64_t fnv1a_hash(const char* data, size_t length);
+string parent_key(const string& path);
+string snapshot_path(const string& omni_path);
+
+// Shared index for the managers, loaded on first use from active_omni_path()
+extern FSIndex file_index;
+FSIndex& get_file_index();
+
+// Reads the on-disk FileEntry stored in a metadata slot
+bool read_slot_entry(uint32_t slot, FileEntry& entry);
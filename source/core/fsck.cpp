@@ -0,0 +1,528 @@
+// fsck.cpp - Offline consistency checker and repair tool for .omni files
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <unordered_map>
+#include <algorithm>
+#include "../include/odf_types.hpp"
+#include "helper.hpp"
+#include "stripe_set.hpp"
+using namespace std;
+
+// Exit codes follow the usual fsck convention
+const int FSCK_CLEAN = 0;
+const int FSCK_CORRECTED = 1;
+const int FSCK_UNCORRECTED = 4;
+const int FSCK_OPERATIONAL_ERROR = 8;
+
+const uint64_t SCAN_CHUNK_SIZE = 1024 * 1024;
+
+// ============================================================================
+// SCAN RESULTS
+// ============================================================================
+
+struct Problem {
+    string area;        // "header", "user", "entry" or "data"
+    uint32_t slot;      // Slot index inside the area (0 for header)
+    string message;
+    bool repairable;
+};
+
+struct Extent {
+    uint64_t offset;
+    uint64_t size;
+    uint32_t slot;
+};
+
+// Everything one worker found in its share of the metadata table.
+// Workers never share state; results are merged after join.
+struct MetadataResult {
+    vector<Problem> problems;
+    vector<Extent> extents;
+    vector<pair<string, uint32_t>> names;
+    vector<uint8_t> types;
+    uint32_t files = 0;
+    uint32_t directories = 0;
+};
+
+struct DataResult {
+    vector<Problem> problems;
+    uint64_t bytes_read = 0;
+};
+
+bool is_terminated(const char* field, size_t size) {
+    return memchr(field, '\0', size) != nullptr;
+}
+
+double seconds_since(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+double megabytes_per_second(uint64_t bytes, double seconds) {
+    if (seconds <= 0.0) return 0.0;
+    return (bytes / (1024.0 * 1024.0)) / seconds;
+}
+
+// ============================================================================
+// HEADER AND USER TABLE
+// ============================================================================
+
+bool check_header(const OMNIHeader& header, uint64_t file_length, vector<Problem>& problems) {
+    if (!compare(header.magic, "OMNIFS01", 8)) {
+        problems.push_back({"header", 0, "bad magic number (not an OMNI file)", false});
+        return false;
+    }
+    if (header.format_version != 0x00010000) {
+        problems.push_back({"header", 0, "unknown format version " + to_string(header.format_version), false});
+    }
+    if (header.header_size != sizeof(OMNIHeader)) {
+        problems.push_back({"header", 0, "header_size is " + to_string(header.header_size) +
+                            ", expected " + to_string(sizeof(OMNIHeader)), true});
+    }
+    uint64_t table_end = file_table_end(file_table_slots(header));
+    if (!user_table_in_data_area(header)) {
+        if (header.max_users == 0 || header.max_users > USER_TABLE_SLOTS) {
+            problems.push_back({"header", 0, "max_users is " + to_string(header.max_users) +
+                                ", table holds " + to_string(USER_TABLE_SLOTS), true});
+        }
+    } else {
+        // Moved there by fs_grow; the original table area may be stale, so
+        // a bad offset cannot be repaired by pointing back at it
+        uint64_t offset = header.getUserTableOffset();
+        uint64_t end = offset + (uint64_t)header.max_users * sizeof(UserInfo);
+        if (header.max_users == 0 || offset < table_end || end > file_length) {
+            problems.push_back({"header", 0, "user table [" + to_string(offset) + ", +" +
+                                to_string(header.max_users) + " slots) lies outside the data area", false});
+            return false;
+        }
+    }
+    if (header.block_size == 0 || (header.block_size & (header.block_size - 1)) != 0) {
+        problems.push_back({"header", 0, "block_size " + to_string(header.block_size) +
+                            " is not a power of two", false});
+    }
+    if (header.total_size > file_length) {
+        problems.push_back({"header", 0, "total_size " + to_string(header.total_size) +
+                            " exceeds container length " + to_string(file_length), false});
+    }
+    if (file_length < table_end) {
+        problems.push_back({"header", 0, "container is shorter than the metadata table", false});
+        return false;
+    }
+    return true;
+}
+
+void check_users(ifstream& file, const OMNIHeader& header, vector<Problem>& problems, uint32_t& active_users) {
+    uint32_t slots = user_table_in_data_area(header) ? header.max_users : USER_TABLE_SLOTS;
+    vector<UserInfo> table(slots, UserInfo("", "", NORMAL, 0));
+    file.seekg(header.getUserTableOffset(), ios::beg);
+    file.read((char*)table.data(), table.size() * sizeof(UserInfo));
+
+    unordered_map<string, uint32_t> seen;
+    active_users = 0;
+
+    for (uint32_t i = 0; i < slots; i++) {
+        const UserInfo& user = table[i];
+
+        if (user.is_active > 1) {
+            problems.push_back({"user", i, "is_active flag is " + to_string(user.is_active), true});
+            continue;
+        }
+        if (user.is_active == 0) continue;
+
+        if (user.username[0] == '\0' || !is_terminated(user.username, sizeof(user.username))) {
+            problems.push_back({"user", i, "active user has an empty or unterminated name", true});
+            continue;
+        }
+        if (!is_terminated(user.password_hash, sizeof(user.password_hash))) {
+            problems.push_back({"user", i, "password hash is unterminated", true});
+            continue;
+        }
+        if (user.role != NORMAL && user.role != ADMIN) {
+            problems.push_back({"user", i, "unknown role " + to_string(user.role), true});
+            continue;
+        }
+
+        string name(user.username);
+        if (seen.count(name)) {
+            problems.push_back({"user", i, "duplicate of user '" + name + "' in slot " +
+                                to_string(seen[name]), true});
+            continue;
+        }
+        seen[name] = i;
+        active_users++;
+    }
+}
+
+// ============================================================================
+// METADATA SCAN (one worker per slot range)
+// ============================================================================
+
+void scan_metadata_range(const string& omni_path, uint32_t first, uint32_t last,
+                         uint64_t table_end, uint64_t file_length, MetadataResult* result) {
+    ifstream file(omni_path, ios::binary);
+    if (!file) {
+        result->problems.push_back({"entry", first, "worker cannot open container", false});
+        return;
+    }
+
+    vector<FileEntry> slots(last - first);
+    file.seekg(FILE_TABLE_OFFSET + (uint64_t)first * sizeof(FileEntry), ios::beg);
+    file.read((char*)slots.data(), slots.size() * sizeof(FileEntry));
+
+    for (uint32_t i = first; i < last; i++) {
+        const FileEntry& entry = slots[i - first];
+        if (entry.name[0] == '\0') continue;
+
+        if (!is_terminated(entry.name, sizeof(entry.name))) {
+            result->problems.push_back({"entry", i, "name is not null-terminated", true});
+            continue;
+        }
+        if (entry.type != Entry_FILE && entry.type != DIRECTORY) {
+            result->problems.push_back({"entry", i, "'" + string(entry.name) + "' has unknown type " +
+                                        to_string(entry.type), true});
+            continue;
+        }
+        if (!is_terminated(entry.owner, sizeof(entry.owner))) {
+            result->problems.push_back({"entry", i, "'" + string(entry.name) + "' owner is unterminated", true});
+            continue;
+        }
+
+        if (entry.type == Entry_FILE) {
+            if (entry.size > 0) {
+                uint64_t start = entry.getDataOffset();
+                if (start < table_end || start + entry.size > file_length || start + entry.size < start) {
+                    result->problems.push_back({"entry", i, "'" + string(entry.name) + "' data extent [" +
+                                                to_string(start) + ", +" + to_string(entry.size) +
+                                                ") lies outside the data area", true});
+                    continue;
+                }
+                result->extents.push_back({start, entry.size, i});
+            }
+            result->files++;
+        } else {
+            result->directories++;
+        }
+
+        result->names.push_back({string(entry.name), i});
+        result->types.push_back(entry.type);
+    }
+}
+
+// ============================================================================
+// DATA SCAN (extents are split across workers by byte count)
+// ============================================================================
+
+void scan_extents(const string& omni_path, const vector<Extent>* extents, DataResult* result) {
+    // Reads go through the stripe set so striped containers are checked too
+    StripeSet data;
+    if (data.open(omni_path) != SUCCESS) {
+        result->problems.push_back({"data", 0, "worker cannot open container", false});
+        return;
+    }
+
+    vector<char> buffer(SCAN_CHUNK_SIZE);
+
+    for (const Extent& extent : *extents) {
+        uint64_t remaining = extent.size;
+        uint64_t position = extent.offset;
+
+        while (remaining > 0) {
+            uint64_t chunk = min<uint64_t>(remaining, SCAN_CHUNK_SIZE);
+            if (data.read(position, buffer.data(), chunk) != SUCCESS) {
+                result->problems.push_back({"data", extent.slot, "short read at offset " +
+                                            to_string(position), true});
+                break;
+            }
+            result->bytes_read += chunk;
+            position += chunk;
+            remaining -= chunk;
+        }
+    }
+}
+
+// ============================================================================
+// REPAIR
+// ============================================================================
+
+int repair(const string& omni_path, OMNIHeader header, const vector<Problem>& problems) {
+    fstream file(omni_path, ios::in | ios::out | ios::binary);
+    if (!file) {
+        cerr << "Error: Cannot open " << omni_path << " for repair" << endl;
+        return 0;
+    }
+
+    int fixed = 0;
+    bool header_dirty = false;
+
+    for (const Problem& p : problems) {
+        if (!p.repairable) continue;
+
+        if (p.area == "header") {
+            header.header_size = sizeof(OMNIHeader);
+            if (!user_table_in_data_area(header) &&
+                (header.max_users == 0 || header.max_users > USER_TABLE_SLOTS)) {
+                header.max_users = USER_TABLE_SLOTS;
+            }
+            header_dirty = true;
+        } else if (p.area == "user") {
+            UserInfo cleared("", "", NORMAL, 0);
+            cleared.is_active = 0;
+            file.seekp(header.getUserTableOffset() + (uint64_t)p.slot * sizeof(UserInfo), ios::beg);
+            file.write((const char*)&cleared, sizeof(cleared));
+        } else {
+            // Entries and unreadable extents: release the metadata slot
+            FileEntry cleared;
+            file.seekp(FILE_TABLE_OFFSET + (uint64_t)p.slot * sizeof(FileEntry), ios::beg);
+            file.write((const char*)&cleared, sizeof(cleared));
+        }
+        fixed++;
+    }
+
+    if (header_dirty) {
+        file.seekp(0, ios::beg);
+        file.write((const char*)&header, sizeof(header));
+    }
+
+    file.flush();
+    file.close();
+    return fixed;
+}
+
+// ============================================================================
+// MAIN
+// ============================================================================
+
+void print_usage() {
+    cout << "Usage: ofs_fsck [-j threads] [--repair] [omni_path]" << endl;
+    cout << "  -j N       number of worker threads (default: hardware concurrency)" << endl;
+    cout << "  --repair   clear corrupt slots and fix header fields in place" << endl;
+}
+
+int main(int argc, char** argv) {
+    string omni_path = "../compiled/test.omni";
+    bool repair_mode = false;
+    unsigned threads = max(1u, thread::hardware_concurrency());
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--repair") {
+            repair_mode = true;
+        } else if (arg == "-j" && i + 1 < argc) {
+            threads = max(1, atoi(argv[++i]));
+        } else if (arg == "-h" || arg == "--help") {
+            print_usage();
+            return FSCK_CLEAN;
+        } else {
+            omni_path = arg;
+        }
+    }
+
+    ifstream file(omni_path, ios::binary | ios::ate);
+    if (!file) {
+        cerr << "Error: Cannot open " << omni_path << endl;
+        return FSCK_OPERATIONAL_ERROR;
+    }
+    uint64_t file_length = file.tellg();
+
+    cout << "\n========================================" << endl;
+    cout << "  OFS CONSISTENCY CHECK" << endl;
+    cout << "  File: " << omni_path << endl;
+    cout << "  Threads: " << threads << (repair_mode ? " (repair mode)" : "") << endl;
+    cout << "========================================\n" << endl;
+
+    auto start = chrono::steady_clock::now();
+    vector<Problem> problems;
+
+    // Pass 1: header
+    OMNIHeader header(0, 0, 0, 0);
+    file.seekg(0, ios::beg);
+    file.read((char*)&header, sizeof(header));
+    if (!file || !check_header(header, file_length, problems)) {
+        for (const Problem& p : problems) {
+            cerr << "  [header] " << p.message << endl;
+        }
+        cerr << "Error: Header is unusable, nothing else can be checked" << endl;
+        return FSCK_OPERATIONAL_ERROR;
+    }
+    if (header.getStripeCount() > 0) {
+        StripeSet stripes;
+        if (stripes.open(omni_path) != SUCCESS) {
+            cerr << "Error: Stripe set listed in " << stripe_manifest_path(omni_path)
+                 << " is incomplete, data cannot be checked" << endl;
+            return FSCK_OPERATIONAL_ERROR;
+        }
+        cout << "Pass 1: Header ok (data striped across " << stripes.stripe_count() << " files)" << endl;
+    } else {
+        cout << "Pass 1: Header ok" << endl;
+    }
+
+    // Pass 2: user table
+    uint32_t active_users = 0;
+    check_users(file, header, problems, active_users);
+    file.close();
+    cout << "Pass 2: User table (" << active_users << " active users)" << endl;
+
+    // Pass 3: metadata slots, fanned out across workers
+    auto meta_start = chrono::steady_clock::now();
+    uint32_t table_slots = file_table_slots(header);
+    uint64_t table_end = file_table_end(table_slots);
+    unsigned meta_workers = min<unsigned>(threads, table_slots);
+    vector<MetadataResult> meta_results(meta_workers);
+    vector<thread> workers;
+
+    uint32_t per_worker = (table_slots + meta_workers - 1) / meta_workers;
+    for (unsigned w = 0; w < meta_workers; w++) {
+        uint32_t first = w * per_worker;
+        uint32_t last = min(table_slots, first + per_worker);
+        if (first >= last) break;
+        workers.push_back(thread(scan_metadata_range, omni_path, first, last, table_end, file_length,
+                                 &meta_results[w]));
+    }
+    for (auto& t : workers) t.join();
+    workers.clear();
+    double meta_seconds = seconds_since(meta_start);
+
+    vector<Extent> extents;
+    unordered_map<string, uint32_t> seen_names;
+    unordered_map<string, bool> directories;
+    vector<pair<string, uint32_t>> all_names;
+    uint32_t total_files = 0;
+    uint32_t total_dirs = 0;
+
+    for (MetadataResult& r : meta_results) {
+        problems.insert(problems.end(), r.problems.begin(), r.problems.end());
+        extents.insert(extents.end(), r.extents.begin(), r.extents.end());
+        total_files += r.files;
+        total_dirs += r.directories;
+        for (size_t i = 0; i < r.names.size(); i++) {
+            const string& name = r.names[i].first;
+            string key = name + (r.types[i] == DIRECTORY ? "/d" : "/f");
+            if (seen_names.count(key)) {
+                problems.push_back({"entry", r.names[i].second, "duplicate of '" + name + "' in slot " +
+                                    to_string(seen_names[key]), true});
+                continue;
+            }
+            seen_names[key] = r.names[i].second;
+            if (r.types[i] == DIRECTORY) directories[name] = true;
+            all_names.push_back(r.names[i]);
+        }
+    }
+
+    uint32_t orphans = 0;
+    for (const auto& named : all_names) {
+        size_t slash = named.first.find_last_of('/');
+        if (slash == string::npos || slash == 0) continue;
+        if (!directories.count(named.first.substr(0, slash))) orphans++;
+    }
+
+    uint64_t meta_bytes = (uint64_t)table_slots * sizeof(FileEntry);
+    cout << "Pass 3: Metadata table (" << total_files << " files, " << total_dirs << " directories, "
+         << table_slots << " slots in " << meta_seconds * 1000.0 << " ms, "
+         << megabytes_per_second(meta_bytes, meta_seconds) << " MB/s)" << endl;
+    if (orphans > 0) {
+        cout << "  Warning: " << orphans << " entries have no parent directory entry" << endl;
+    }
+
+    // Pass 4: overlapping extents, then read every extent in parallel
+    sort(extents.begin(), extents.end(), [](const Extent& a, const Extent& b) {
+        return a.offset < b.offset;
+    });
+
+    uint64_t referenced = 0;
+    uint64_t covered_end = 0;
+    uint64_t users_start = header.getUserTableOffset();
+    uint64_t users_end = users_start + (uint64_t)header.max_users * sizeof(UserInfo);
+    for (size_t i = 0; i < extents.size(); i++) {
+        const Extent& e = extents[i];
+        if (i > 0 && e.offset < covered_end) {
+            problems.push_back({"data", e.slot, "extent at offset " + to_string(e.offset) +
+                                " overlaps an earlier file", false});
+        }
+        if (user_table_in_data_area(header) && e.offset < users_end && e.offset + e.size > users_start) {
+            problems.push_back({"data", e.slot, "extent at offset " + to_string(e.offset) +
+                                " overlaps the user table", false});
+        }
+        uint64_t end = e.offset + e.size;
+        if (end > covered_end) {
+            referenced += end - max(e.offset, covered_end);
+            covered_end = end;
+        }
+    }
+
+    auto data_start = chrono::steady_clock::now();
+    unsigned data_workers = max<unsigned>(1, min<unsigned>(threads, extents.size()));
+    vector<vector<Extent>> shares(data_workers);
+    vector<uint64_t> share_bytes(data_workers, 0);
+
+    // Largest extents first, each to the least loaded worker
+    vector<Extent> by_size = extents;
+    sort(by_size.begin(), by_size.end(), [](const Extent& a, const Extent& b) {
+        return a.size > b.size;
+    });
+    for (const Extent& e : by_size) {
+        size_t target = min_element(share_bytes.begin(), share_bytes.end()) - share_bytes.begin();
+        shares[target].push_back(e);
+        share_bytes[target] += e.size;
+    }
+
+    vector<DataResult> data_results(data_workers);
+    for (unsigned w = 0; w < data_workers; w++) {
+        workers.push_back(thread(scan_extents, omni_path, &shares[w], &data_results[w]));
+    }
+    for (auto& t : workers) t.join();
+    double data_seconds = seconds_since(data_start);
+
+    uint64_t bytes_read = 0;
+    for (DataResult& r : data_results) {
+        problems.insert(problems.end(), r.problems.begin(), r.problems.end());
+        bytes_read += r.bytes_read;
+    }
+
+    cout << "Pass 4: Data extents (" << extents.size() << " extents, " << bytes_read << " bytes in "
+         << data_seconds * 1000.0 << " ms, " << megabytes_per_second(bytes_read, data_seconds)
+         << " MB/s)" << endl;
+
+    // Pass 5: space accounting (data is appended, deleted files leave their bytes behind)
+    uint64_t data_area = file_length > table_end ? file_length - table_end : 0;
+    cout << "Pass 5: Space accounting (" << referenced << " of " << data_area
+         << " data bytes referenced, " << (data_area - min(data_area, referenced))
+         << " unreferenced)" << endl;
+
+    // Summary
+    double total_seconds = seconds_since(start);
+    cout << "\n========================================" << endl;
+    if (problems.empty()) {
+        cout << "  CLEAN: no problems found" << endl;
+    } else {
+        cout << "  " << problems.size() << " PROBLEM(S) FOUND" << endl;
+    }
+    cout << "  Checked " << (meta_bytes + bytes_read) << " bytes in " << total_seconds * 1000.0
+         << " ms (" << megabytes_per_second(meta_bytes + bytes_read, total_seconds) << " MB/s)" << endl;
+    cout << "========================================\n" << endl;
+
+    if (problems.empty()) return FSCK_CLEAN;
+
+    uint32_t uncorrectable = 0;
+    for (const Problem& p : problems) {
+        cout << "  [" << p.area << " " << p.slot << "] " << p.message
+             << (p.repairable ? "" : " (not repairable)") << endl;
+        if (!p.repairable) uncorrectable++;
+    }
+
+    if (!repair_mode) {
+        cout << "\nRun with --repair to clear the repairable slots" << endl;
+        return FSCK_UNCORRECTED;
+    }
+
+    int fixed = repair(omni_path, header, problems);
+    cout << "\nRepaired " << fixed << " problem(s)";
+    if (uncorrectable > 0) cout << ", " << uncorrectable << " left uncorrected";
+    cout << endl;
+
+    return uncorrectable > 0 ? FSCK_UNCORRECTED : FSCK_CORRECTED;
+}
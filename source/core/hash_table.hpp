@@ -1,134 +1,181 @@
 #pragma once
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <algorithm>
+#include <cstdint>
 #include "odf_types.hpp"
 using namespace std;
 
+/**
+ * In-memory index of the user table, keyed by username
+ *
+ * Open addressing with linear probing over a power-of-two array that is
+ * kept at most 70% full (tombstones included) and doubles when it would
+ * pass that. Usernames are hashed with 64-bit FNV-1a followed by the
+ * MurmurHash3 finalizer, so names that differ only in their last byte
+ * still land far apart. Deleting leaves a tombstone, which keeps later
+ * entries of the same probe chain reachable; tombstones are reused by
+ * inserts and dropped when the table is rebuilt.
+ *
+ * Each entry remembers the slot of its record in the on-disk user table,
+ * so a change is written straight to that slot.
+ */
 
 struct UserNode {
+    enum State : uint8_t { EMPTY, ACTIVE, DELETED };
+
     string username;
     UserInfo info;
-    bool active;  
+    uint32_t slot;              // Index in the on-disk user table
+    State state;
+
+    UserNode() : info("", "", NORMAL, 0), slot(0), state(EMPTY) {}
 };
 
 
 class UserHashTable {
 private:
-    vector<UserNode> users;  
-    int max_users;
-    
-    int hash(const string& username) {
-        int sum = 0;
-        for (char c : username) {
-            sum += c;  
-        }
-        return sum % max_users;
-    }
-    
-public:
+    vector<UserNode> users;
+    size_t active;
+    size_t deleted;
 
-    UserHashTable(int size = 100) {
-        max_users = size;
-        users.resize(max_users);
-        
-
-        for (int i = 0; i < max_users; i++) {
-            users[i].active = false;
+    static uint64_t hash(string_view username) {
+        uint64_t h = 1469598103934665603ULL;
+        for (unsigned char c : username) {
+            h ^= c;
+            h *= 1099511628211ULL;
         }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
     }
-    
-    void insert(const string& username, const UserInfo& info) {
-        int index = hash(username);
-        int start = index;
-        
-        while (true) {
-            if (!users[index].active || users[index].username == username) {
-                users[index].username = username;
-                users[index].info = info;
-                users[index].active = true;
-                return;
+
+    // Slot holding username, or the slot an insert should use; -1 if neither
+    long find_slot(string_view username, bool for_insert) const {
+        size_t mask = users.size() - 1;
+        long reusable = -1;
+        for (size_t i = hash(username) & mask, probes = 0; probes < users.size(); i = (i + 1) & mask, probes++) {
+            const UserNode& node = users[i];
+            if (node.state == UserNode::EMPTY) {
+                if (!for_insert) return -1;
+                return reusable >= 0 ? reusable : (long)i;
             }
-            
-            index = (index + 1) % max_users;
-            
-            if (index == start) {
-                cout << "ERROR: Hash table is full!" << endl;
-                return;
+            if (node.state == UserNode::DELETED) {
+                if (reusable < 0) reusable = i;
+            } else if (node.username == username) {
+                return i;
             }
         }
+        return for_insert ? reusable : -1;
     }
-    
-    UserInfo* get(const string& username) {
-        int index = hash(username);
-        int start = index;
-        
-        while (users[index].active) {
-            if (users[index].username == username) {
-                return &users[index].info;
-            }
-            
-            index = (index + 1) % max_users;
-            
-            // Searched full circle
-            if (index == start) break;
+
+    void rebuild(size_t capacity) {
+        vector<UserNode> old;
+        old.swap(users);
+        users.resize(capacity);
+        active = deleted = 0;
+        for (UserNode& node : old) {
+            if (node.state == UserNode::ACTIVE) insert(node.username, node.info, node.slot);
         }
-        
-        return nullptr;
     }
-    
-    bool remove(const string& username) {
-        int index = hash(username);
-        int start = index;
-        
-        while (users[index].active) {
-            if (users[index].username == username) {
-                users[index].active = false;
-                users[index].username = "";
-                return true;
-            }
-            
-            index = (index + 1) % max_users;
-            
-            if (index == start) break;
+
+public:
+
+    UserHashTable(size_t size = 64) : active(0), deleted(0) {
+        size_t capacity = 16;
+        while (capacity * 7 < size * 10) capacity *= 2;
+        users.resize(capacity);
+    }
+
+    // Adds username, or updates it if it is already there
+    void insert(const string& username, const UserInfo& info, uint32_t slot) {
+        long index = find_slot(username, true);
+        if (index >= 0 && users[index].state == UserNode::ACTIVE) {
+            users[index].info = info;
+            users[index].slot = slot;
+            return;
         }
-        
-        return false;
+
+        if ((active + deleted + 1) * 10 > users.size() * 7) {
+            size_t capacity = users.size();
+            while ((active + 1) * 10 > capacity * 7 / 2) capacity *= 2;
+            rebuild(capacity);
+            index = find_slot(username, true);
+        }
+
+        UserNode& node = users[index];
+        if (node.state == UserNode::DELETED) deleted--;
+        node.username = username;
+        node.info = info;
+        node.slot = slot;
+        node.state = UserNode::ACTIVE;
+        active++;
     }
-    
-    vector<UserInfo> getAllUsers() {
-        vector<UserInfo> result;
-        
-        for (int i = 0; i < max_users; i++) {
-            if (users[i].active) {
-                result.push_back(users[i].info);
-            }
+
+    UserNode* get(string_view username) {
+        long index = find_slot(username, false);
+        return index >= 0 ? &users[index] : nullptr;
+    }
+
+    bool remove(string_view username) {
+        long index = find_slot(username, false);
+        if (index < 0) return false;
+
+        users[index].state = UserNode::DELETED;
+        users[index].username.clear();
+        active--;
+        deleted++;
+        return true;
+    }
+
+    void clear() {
+        users.assign(users.size(), UserNode());
+        active = deleted = 0;
+    }
+
+    // In on-disk slot order
+    vector<UserInfo> getAllUsers() const {
+        vector<const UserNode*> nodes;
+        nodes.reserve(active);
+        for (const UserNode& node : users) {
+            if (node.state == UserNode::ACTIVE) nodes.push_back(&node);
         }
-        
+        sort(nodes.begin(), nodes.end(), [](const UserNode* a, const UserNode* b) { return a->slot < b->slot; });
+
+        vector<UserInfo> result;
+        result.reserve(nodes.size());
+        for (const UserNode* node : nodes) result.push_back(node->info);
         return result;
     }
-    
-    int count() {
-        int total = 0;
-        for (int i = 0; i < max_users; i++) {
-            if (users[i].active) {
-                total++;
-            }
-        }
-        return total;
+
+    size_t count() const {
+        return active;
+    }
+
+    size_t capacity() const {
+        return users.size();
     }
-    
 
-    void print() {
+    // Where the probe for username starts (tests use it to build collisions)
+    size_t home_slot(string_view username) const {
+        return hash(username) & (users.size() - 1);
+    }
+
+
+    void print() const {
         cout << "\n=== USERS IN HASH TABLE ===" << endl;
         cout << "Total users: " << count() << endl;
-        
-        for (int i = 0; i < max_users; i++) {
-            if (users[i].active) {
-                cout << "[" << i << "] " << users[i].username << endl;
+
+        for (size_t i = 0; i < users.size(); i++) {
+            if (users[i].state == UserNode::ACTIVE) {
+                cout << "[" << i << "] " << users[i].username << " (slot " << users[i].slot << ")" << endl;
             }
         }
         cout << "===========================\n" << endl;
     }
 };
-
@@ -1,11 +1,22 @@
 
 #include "../include/odf_types.hpp"
+#include "helper.hpp"
 #include <string>
 #include <vector>
 #include <fstream>
 #include <algorithm>
 using namespace std;
 
+string active_omni = "../compiled/test.omni";
+
+void set_active_omni_path(const string& path) {
+    active_omni = path;
+}
+
+const string& active_omni_path() {
+    return active_omni;
+}
+
 bool compare(const char* a, const char* b, size_t len) {
     for (size_t i = 0; i < len; i++) {
         if (a[i] != b[i]) return false;
@@ -30,17 +41,31 @@ void copy_name(char* dest, size_t dest_size, const string& src) {
     }
     dest[len] = '\0';
 }
+
+bool read_header(const string& omni_path, OMNIHeader& header) {
+    ifstream file(omni_path, ios::binary);
+    if (!file) return false;
+
+    file.read((char*)&header, sizeof(header));
+    return file && compare(header.magic, "OMNIFS01", 8);
+}
+
 vector<FileEntry> load_all_entries() {
     vector<FileEntry> entries;
     
-    ifstream file("../compiled/test.omni", ios::binary);
+    OMNIHeader header(0, 0, 0, 0);
+    if (!read_header(active_omni_path(), header)) {
+        return entries;
+    }
+
+    ifstream file(active_omni_path(), ios::binary);
     if (!file) {
         return entries;
     }
-    uint64_t start_pos = sizeof(OMNIHeader) + (100 * sizeof(UserInfo));
-    file.seekg(start_pos, ios::beg);
+    file.seekg(FILE_TABLE_OFFSET, ios::beg);
 
-    for (int i = 0; i < 1000; i++) {
+    uint32_t slots = file_table_slots(header);
+    for (uint32_t i = 0; i < slots; i++) {
         FileEntry entry("", Entry_FILE, 0, 0, "", 0);
         
         if (!file.read((char*)&entry, sizeof(entry))) {
@@ -1,12 +1,51 @@
+#pragma once
 #include "../include/odf_types.hpp"
 #include <string>
+#include <vector>
 #include <algorithm>
 using namespace std;
 
+// On-disk layout: header, then the user table, then the file table, then data.
+// These are the sizes fs_format lays down; fs_grow can enlarge the file table
+// in place and move the user table into the data area (see OMNIHeader).
+const uint32_t USER_TABLE_SLOTS = 100;
+const uint32_t FILE_TABLE_SLOTS = 1000;
+const uint64_t FILE_TABLE_OFFSET = sizeof(OMNIHeader) + (USER_TABLE_SLOTS * sizeof(UserInfo));
+const uint64_t FILE_TABLE_END = FILE_TABLE_OFFSET + (FILE_TABLE_SLOTS * sizeof(FileEntry));
+
+inline uint64_t file_slot_offset(uint32_t slot) {
+    return FILE_TABLE_OFFSET + (uint64_t)slot * sizeof(FileEntry);
+}
+
+inline uint32_t file_table_slots(const OMNIHeader& header) {
+    uint32_t slots = header.getFileTableSlots();
+    return slots != 0 ? slots : FILE_TABLE_SLOTS;
+}
+
+inline uint64_t file_table_end(uint32_t slots) {
+    return FILE_TABLE_OFFSET + (uint64_t)slots * sizeof(FileEntry);
+}
+
+// True once fs_grow has moved the user table out of its original place
+inline bool user_table_in_data_area(const OMNIHeader& header) {
+    return header.getUserTableOffset() != sizeof(OMNIHeader);
+}
+
+bool read_header(const std::string& omni_path, OMNIHeader& header);
+
+// Container the managers operate on (set by fs_init)
+void set_active_omni_path(const std::string& path);
+const std::string& active_omni_path();
+
+// Reads the user table into the in-memory user index (user_manager.cpp);
+// fs_init calls it, and fs_grow again when the table gains slots
+int load_users(const std::string& omni_path);
+
 bool compare(const char* a, const char* b, size_t len);
 bool compare_name(const char* stored, const std::string& given);
 void copy_name(char* dest, size_t dest_size, const std::string& src);
 
-vector<FileEntry> load_all_entries(); 
+vector<FileEntry> load_all_entries();
+
 
 
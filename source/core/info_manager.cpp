@@ -2,9 +2,13 @@
 #include <fstream>
 #include <vector>
 #include <ctime>
+#include <cstring>
 #include "../include/odf_types.hpp"
 #include "../include/ofs_functions.hpp"
 #include "helper.hpp"
+#include "fs_index.hpp"
+#include "session_table.hpp"
+#include "logger.hpp"
 using namespace std;
 
 
@@ -12,16 +16,22 @@ using namespace std;
 
 // Find entry by path
 bool find_entry(const string& path, FileEntry& entry) {
-    vector<FileEntry> entries = load_all_entries();
-    
-    for (size_t i = 0; i < entries.size(); i++) {
-        if (compare_name(entries[i].name, path)) {
-            entry = entries[i];
-            return true;
-        }
+    int slot = get_file_index().find(path);
+    return slot >= 0 && read_slot_entry(slot, entry);
+}
+
+// Writes entry back to its metadata slot
+static int write_entry(int slot, const FileEntry& entry) {
+    fstream file(active_omni_path(), ios::in | ios::out | ios::binary);
+    if (!file) {
+        LOG_ERROR("Error: Cannot open file system");
+        return ERROR_IO_ERROR;
     }
-    
-    return false;
+
+    file.seekp(file_slot_offset(slot), ios::beg);
+    file.write((const char*)&entry, sizeof(entry));
+    file.flush();
+    return file ? SUCCESS : ERROR_IO_ERROR;
 }
 
 // ============================================================================
@@ -31,14 +41,14 @@ bool find_entry(const string& path, FileEntry& entry) {
 int get_metadata(void* session, const string& path, FileMetadata& meta) {
     // Step 1: Validate inputs
     if (!session) {
-        cerr << "Error: Invalid session" << endl;
+        LOG_ERROR("Error: Invalid session");
         return ERROR_INVALID_OPERATION;
     }
 
     // Step 2: Find the file/directory
     FileEntry entry("", Entry_FILE, 0, 0, "", 0);
     if (!find_entry(path, entry)) {
-        cerr << "Error: File not found: " << path << endl;
+        LOG_ERROR("Error: File not found: " << path);
         return ERROR_NOT_FOUND;
     }
 
@@ -49,11 +59,11 @@ int get_metadata(void* session, const string& path, FileMetadata& meta) {
     meta.blocks_used = (entry.size + 4095) / 4096;
     meta.actual_size = entry.size;
 
-    cout << "SUCCESS: Metadata fetched for '" << path << "'" << endl;
-    cout << "  Size: " << entry.size << " bytes" << endl;
-    cout << "  Blocks: " << meta.blocks_used << endl;
-    cout << "  Owner: " << entry.owner << endl;
-    cout << "  Permissions: " << entry.permissions << endl;
+    LOG_DEBUG("SUCCESS: Metadata fetched for '" << path << "'");
+    LOG_DEBUG("  Size: " << entry.size << " bytes");
+    LOG_DEBUG("  Blocks: " << meta.blocks_used);
+    LOG_DEBUG("  Owner: " << entry.owner);
+    LOG_DEBUG("  Permissions: " << entry.permissions);
 
     return SUCCESS;
 }
@@ -65,107 +75,99 @@ int get_metadata(void* session, const string& path, FileMetadata& meta) {
 int set_permissions(void* session, const string& path, uint32_t permissions) {
     // Step 1: Validate inputs
     if (!session) {
-        cerr << "Error: Invalid session" << endl;
+        LOG_ERROR("Error: Invalid session");
         return ERROR_INVALID_OPERATION;
     }
 
-    // Step 2: Open file
-    fstream file("../compiled/test.omni", ios::in | ios::out | ios::binary);
-    if (!file) {
-        cerr << "Error: Cannot open file system" << endl;
-        return ERROR_IO_ERROR;
+    // Step 2: Find the entry
+    int slot = get_file_index().find(path);
+    FileEntry entry("", Entry_FILE, 0, 0, "", 0);
+    if (slot < 0 || !read_slot_entry(slot, entry)) {
+        LOG_ERROR("Error: File not found: " << path);
+        return ERROR_NOT_FOUND;
     }
 
-    // Step 3: Search through slots
-    uint64_t start_pos = sizeof(OMNIHeader) + (100 * sizeof(UserInfo));
-
-    for (int i = 0; i < 1000; i++) {
-        uint64_t current_pos = start_pos + (i * sizeof(FileEntry));
-        file.seekg(current_pos, ios::beg);
-        
-        FileEntry entry("", Entry_FILE, 0, 0, "", 0);
-        if (!file.read((char*)&entry, sizeof(entry))) {
-            break;
-        }
-
-        // Step 4: Check if this is the entry we want
-        if (compare_name(entry.name, path)) {
-            // Update permissions
-            entry.permissions = permissions;
-            
-            // Write back
-            file.seekp(current_pos, ios::beg);
-            file.write((char*)&entry, sizeof(entry));
-            file.flush();
-            file.close();
-            
-            cout << "SUCCESS: Permissions updated for '" << path << "'" << endl;
-            cout << "  New permissions: " << permissions << endl;
-            return SUCCESS;
-        }
+    // Step 3: Update permissions and write back
+    entry.permissions = permissions;
+    int result = write_entry(slot, entry);
+    if (result != SUCCESS) {
+        return result;
     }
 
-    file.close();
-    cerr << "Error: File not found: " << path << endl;
-    return ERROR_NOT_FOUND;
+    LOG_DEBUG("SUCCESS: Permissions updated for '" << path << "'");
+    LOG_DEBUG("  New permissions: " << permissions);
+    return SUCCESS;
 }
 
 // ============================================================================
-// GET_STATS
+// RESTORE_METADATA
 // ============================================================================
 
-int get_stats(void* session, FSStats& stats) {
-    // Step 1: Validate session
+int restore_metadata(void* session, const string& path, const FileEntry& saved) {
+    // Step 1: Validate inputs
     if (!session) {
-        cerr << "Error: Invalid session" << endl;
+        LOG_ERROR("Error: Invalid session");
         return ERROR_INVALID_OPERATION;
     }
 
-    // Step 2: Load all entries
-    vector<FileEntry> entries = load_all_entries();
-
-    // Step 3: Count files and directories
-    uint64_t total_files = 0;
-    uint64_t total_dirs = 0;
-    uint64_t used_space = 0;
-
-    for (size_t i = 0; i < entries.size(); i++) {
-        if (entries[i].type == 0) {  // File
-            total_files++;
-            used_space += entries[i].size;
-        } else if (entries[i].type == 1) {  // Directory
-            total_dirs++;
-        }
+    // Step 2: Find the entry that was recreated
+    int slot = get_file_index().find(path, saved.getType());
+    FileEntry entry("", Entry_FILE, 0, 0, "", 0);
+    if (slot < 0 || !read_slot_entry(slot, entry)) {
+        LOG_ERROR("Error: File not found: " << path);
+        return ERROR_NOT_FOUND;
     }
 
-    // Step 4: Load header to get total size
-    ifstream file("../compiled/test.omni", ios::binary);
-    if (!file) {
-        cerr << "Error: Cannot open file system" << endl;
-        return ERROR_IO_ERROR;
+    // Step 3: Put back who owns it, its mode and its times; the name, size
+    // and data position belong to the new entry
+    memcpy(entry.owner, saved.owner, sizeof(entry.owner));
+    entry.permissions = saved.permissions;
+    entry.created_time = saved.created_time;
+    entry.modified_time = saved.modified_time;
+    int result = write_entry(slot, entry);
+    if (result != SUCCESS) {
+        return result;
     }
 
-    OMNIHeader header(0, 0, 0, 0);
-    file.read((char*)&header, sizeof(header));
-    file.close();
+    LOG_DEBUG("SUCCESS: Metadata restored for '" << path << "' (owner " << entry.owner << ")");
+    return SUCCESS;
+}
 
-    // Step 5: Calculate free space
-    uint64_t free_space = 0;
-    if (header.total_size > used_space) {
-        free_space = header.total_size - used_space;
+// ============================================================================
+// GET_STATS
+// ============================================================================
+
+int get_stats(void* session, FSStats& stats) {
+    // Step 1: Validate session
+    if (!session) {
+        LOG_ERROR("Error: Invalid session");
+        return ERROR_INVALID_OPERATION;
     }
 
-    // Step 6: Fill stats structure
-    stats = FSStats(header.total_size, used_space, free_space);
+    // Step 2: Counters are kept up to date by the index
+    FSIndex& index = get_file_index();
+    uint64_t total_files = index.total_files();
+    uint64_t total_dirs = index.total_directories();
+    uint64_t used_space = index.used_bytes();
+
+    // Step 3: Free space is what reserve_data can still hand out; the
+    // tables and the gaps between files do not count twice
+    uint64_t free_space = index.free_bytes();
+    uint64_t largest_gap = index.largest_free();
+
+    // Step 4: Fill stats structure
+    stats = FSStats(index.capacity(), used_space, free_space);
     stats.total_files = total_files;
     stats.total_directories = total_dirs;
-    stats.fragmentation = 0.0;  // Can implement later
+    stats.active_sessions = active_sessions.size();
+    // Share of the free space outside the largest gap
+    stats.fragmentation = free_space > 0 ? 100.0 * (free_space - largest_gap) / free_space : 0.0;
 
-    cout << "SUCCESS: File system statistics computed" << endl;
-    cout << "  Total files: " << total_files << endl;
-    cout << "  Total directories: " << total_dirs << endl;
-    cout << "  Used space: " << used_space << " bytes" << endl;
-    cout << "  Free space: " << free_space << " bytes" << endl;
+    LOG_DEBUG("SUCCESS: File system statistics computed");
+    LOG_DEBUG("  Total files: " << total_files);
+    LOG_DEBUG("  Total directories: " << total_dirs);
+    LOG_DEBUG("  Used space: " << used_space << " bytes");
+    LOG_DEBUG("  Free space: " << free_space << " bytes");
 
     return SUCCESS;
 }
@@ -200,6 +202,10 @@ string get_error_message(int error_code) {
             return "Directory not empty";
         case ERROR_INVALID_OPERATION:
             return "Invalid operation";
+        case ERROR_TIMEOUT:
+            return "Request timed out in queue";
+        case ERROR_BUSY:
+            return "Server busy, retry later";
         default:
             return "Unknown error code";
     }
@@ -0,0 +1,312 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include "lock_manager.hpp"
+#include "helper.hpp"
+#include "fs_index.hpp"
+#include "../include/ofs_functions.hpp"
+using namespace std;
+
+bool modes_compatible(LockMode a, LockMode b) {
+    static const bool table[4][4] = {
+        //           IS     IX     S      X
+        /* IS */ { true,  true,  true,  false },
+        /* IX */ { true,  true,  false, false },
+        /* S  */ { true,  false, true,  false },
+        /* X  */ { false, false, false, false },
+    };
+    return table[a][b];
+}
+
+// Weakest mode that covers both; there is no SIX mode, so S + IX becomes X
+LockMode combine_modes(LockMode a, LockMode b) {
+    if (a == b) return a;
+    if (a == LOCK_X || b == LOCK_X) return LOCK_X;
+    if ((a == LOCK_S && b == LOCK_IX) || (a == LOCK_IX && b == LOCK_S)) return LOCK_X;
+    if (a == LOCK_IS) return b;
+    if (b == LOCK_IS) return a;
+    return LOCK_X;
+}
+
+void plan_path_lock(vector<LockRequest>& plan, const string& path, LockMode mode) {
+    // Names without a leading '/' live at the root level too
+    string key = path;
+    if (key.empty() || key[0] != '/') key = "/" + key;
+    while (key.size() > 1 && key.back() == '/') key.pop_back();
+
+    LockMode intention = (mode == LOCK_S || mode == LOCK_IS) ? LOCK_IS : LOCK_IX;
+    plan.push_back({"/", key == "/" ? mode : intention});
+    for (size_t slash = key.find('/', 1); slash != string::npos; slash = key.find('/', slash + 1)) {
+        plan.push_back({key.substr(0, slash), intention});
+    }
+    if (key != "/") plan.push_back({key, mode});
+}
+
+// ============================================================================
+// LOCK MANAGER
+// ============================================================================
+
+LockManager::LockManager() : next_ticket(1) {}
+
+uint64_t LockManager::enqueue(const vector<LockRequest>& plan) {
+    return enqueue(plan, nullptr);
+}
+
+uint64_t LockManager::enqueue(const vector<LockRequest>& plan, function<void(uint64_t)> on_grant) {
+    // One entry per key, in key order, with the modes of duplicates combined
+    vector<LockRequest> merged = plan;
+    sort(merged.begin(), merged.end(), [](const LockRequest& a, const LockRequest& b) { return a.key < b.key; });
+    size_t kept = 0;
+    for (size_t i = 0; i < merged.size(); i++) {
+        if (kept > 0 && merged[kept - 1].key == merged[i].key) {
+            merged[kept - 1].mode = combine_modes(merged[kept - 1].mode, merged[i].mode);
+        } else {
+            merged[kept++] = merged[i];
+        }
+    }
+    merged.resize(kept);
+
+    uint64_t ticket;
+    {
+        lock_guard<mutex> lock(lock_mutex);
+        ticket = next_ticket++;
+        for (const LockRequest& request : merged) {
+            queues[request.key].push_back({ticket, request.mode});
+        }
+        tickets[ticket] = move(merged);
+        if (on_grant && !grantable(ticket)) {
+            waiting[ticket] = move(on_grant);
+            return ticket;
+        }
+    }
+    if (on_grant) on_grant(ticket);
+    return ticket;
+}
+
+// True when every lock of ticket is compatible with everything queued ahead of it
+bool LockManager::grantable(uint64_t ticket) const {
+    for (const LockRequest& request : tickets.at(ticket)) {
+        for (const QueuedLock& ahead : queues.at(request.key)) {
+            if (ahead.ticket == ticket) break;
+            if (!modes_compatible(ahead.mode, request.mode)) return false;
+        }
+    }
+    return true;
+}
+
+void LockManager::wait(uint64_t ticket) {
+    unique_lock<mutex> lock(lock_mutex);
+    lock_cv.wait(lock, [this, ticket] { return grantable(ticket); });
+}
+
+void LockManager::release(uint64_t ticket) {
+    vector<pair<uint64_t, function<void(uint64_t)>>> granted;
+    {
+        lock_guard<mutex> lock(lock_mutex);
+        auto held = tickets.find(ticket);
+        if (held == tickets.end()) return;
+
+        vector<uint64_t> behind;
+        for (const LockRequest& request : held->second) {
+            auto queue = queues.find(request.key);
+            deque<QueuedLock>& entries = queue->second;
+            for (auto it = entries.begin(); it != entries.end(); ++it) {
+                if (it->ticket == ticket) {
+                    entries.erase(it);
+                    break;
+                }
+            }
+            for (const QueuedLock& entry : entries) behind.push_back(entry.ticket);
+            if (entries.empty()) queues.erase(queue);
+        }
+        tickets.erase(held);
+
+        // Only tickets sharing a key with the released one can have become grantable
+        sort(behind.begin(), behind.end());
+        behind.erase(unique(behind.begin(), behind.end()), behind.end());
+        for (uint64_t candidate : behind) {
+            auto callback = waiting.find(candidate);
+            if (callback != waiting.end() && grantable(candidate)) {
+                granted.push_back({candidate, move(callback->second)});
+                waiting.erase(callback);
+            }
+        }
+        lock_cv.notify_all();
+    }
+    for (auto& grant : granted) grant.second(grant.first);
+}
+
+// ============================================================================
+// TEST
+// ============================================================================
+
+int test_lock_manager() {
+    int failures = 0;
+
+    cout << "\n========================================" << endl;
+    cout << "  PATH LOCK TEST" << endl;
+    cout << "========================================\n" << endl;
+
+    // Test 1: Writers in disjoint subtrees hold their locks at the same time
+    cout << "Test 1: Disjoint writers..." << endl;
+    {
+        LockManager locks;
+        vector<LockRequest> a, b;
+        plan_path_lock(a, "/docs/a.txt", LOCK_X);
+        plan_path_lock(b, "/music/b.mp3", LOCK_X);
+        uint64_t first = locks.acquire(a);
+        atomic<bool> granted(false);
+        thread other([&] { LockGuard guard(locks, locks.acquire(b)); granted = true; });
+        other.join();
+        if (!granted) {
+            cerr << "FAILED: Writer in /music waited for /docs" << endl;
+            failures++;
+        }
+        locks.release(first);
+    }
+
+    // Test 2: A directory listing waits for a writer inside that directory,
+    // and a later writer waits for the listing
+    cout << "\nTest 2: Directory reader between two writers..." << endl;
+    {
+        LockManager locks;
+        vector<LockRequest> write1, list, write2;
+        plan_path_lock(write1, "/docs/a.txt", LOCK_X);
+        plan_path_lock(list, "/docs", LOCK_S);
+        plan_path_lock(write2, "/docs/b.txt", LOCK_X);
+
+        uint64_t w1 = locks.enqueue(write1);
+        uint64_t l = locks.enqueue(list);
+        uint64_t w2 = locks.enqueue(write2);
+
+        vector<int> order;
+        mutex order_mutex;
+        auto run = [&](uint64_t ticket, int id) {
+            locks.wait(ticket);
+            {
+                lock_guard<mutex> lock(order_mutex);
+                order.push_back(id);
+            }
+            this_thread::sleep_for(chrono::milliseconds(20));
+            locks.release(ticket);
+        };
+        // Start them backwards so only the queue order can explain the result
+        thread t3(run, w2, 3), t2(run, l, 2), t1(run, w1, 1);
+        t1.join(); t2.join(); t3.join();
+        if (order != vector<int>({1, 2, 3})) {
+            cerr << "FAILED: Operations ran out of queue order" << endl;
+            failures++;
+        }
+    }
+
+    // Test 3: Renames in opposite directions do not deadlock
+    cout << "\nTest 3: Crossing renames..." << endl;
+    {
+        LockManager locks;
+        atomic<int> done(0);
+        auto rename_loop = [&](const string& from, const string& to) {
+            for (int i = 0; i < 1000; i++) {
+                vector<LockRequest> plan;
+                plan_path_lock(plan, from, LOCK_X);
+                plan_path_lock(plan, to, LOCK_X);
+                LockGuard guard(locks, locks.acquire(plan));
+            }
+            done++;
+        };
+        thread t1(rename_loop, "/a/x", "/b/y");
+        thread t2(rename_loop, "/b/y", "/a/x");
+        t1.join(); t2.join();
+        if (done != 2) {
+            cerr << "FAILED: Renames did not finish" << endl;
+            failures++;
+        }
+    }
+
+    // Test 4: Callbacks fire when the blocking ticket is released, in queue order
+    cout << "\nTest 4: Grant callbacks..." << endl;
+    {
+        LockManager locks;
+        vector<LockRequest> write, read1, read2;
+        plan_path_lock(write, "/docs", LOCK_X);
+        plan_path_lock(read1, "/docs/a.txt", LOCK_S);
+        plan_path_lock(read2, "/docs/b.txt", LOCK_S);
+
+        vector<uint64_t> order;
+        auto record = [&](uint64_t ticket) { order.push_back(ticket); };
+        uint64_t w = locks.enqueue(write, record);
+        uint64_t r1 = locks.enqueue(read1, record);
+        uint64_t r2 = locks.enqueue(read2, record);
+        bool waited = order == vector<uint64_t>({w});
+        locks.release(w);
+        if (!waited || order != vector<uint64_t>({w, r1, r2})) {
+            cerr << "FAILED: Callbacks ran early or out of order" << endl;
+            failures++;
+        }
+        locks.release(r1);
+        locks.release(r2);
+    }
+
+    // Test 5: Concurrent creates in separate directories keep the index intact
+    cout << "\nTest 5: Concurrent file_create in separate directories..." << endl;
+    {
+        string omni_file = "/tmp/ofs_lock_test.omni";
+        remove(snapshot_path(omni_file).c_str());
+        void* fs_instance = nullptr;
+        if (fs_format(omni_file, "BSAI-24003", "2025-11-11", 16 * 1024 * 1024, 4096) != SUCCESS ||
+            fs_init(&fs_instance, omni_file.c_str(), nullptr) != SUCCESS) {
+            cerr << "FAILED: Could not create test container" << endl;
+            return ERROR_IO_ERROR;
+        }
+
+        UserInfo user("admin", "", ADMIN, time(nullptr));
+        SessionInfo session("SID_LOCK", user, time(nullptr));
+        LockManager locks;
+        const int writers = 4, files_each = 50;
+
+        vector<thread> threads;
+        for (int w = 0; w < writers; w++) {
+            threads.push_back(thread([&, w] {
+                string dir = "/dir" + to_string(w);
+                for (int i = 0; i < files_each; i++) {
+                    string path = dir + "/f" + to_string(i);
+                    vector<LockRequest> plan;
+                    plan_path_lock(plan, path, LOCK_X);
+                    LockGuard guard(locks, locks.acquire(plan));
+                    file_create(&session, path, path);
+                }
+            }));
+        }
+        for (auto& t : threads) t.join();
+
+        for (int w = 0; w < writers; w++) {
+            for (int i = 0; i < files_each; i++) {
+                string path = "/dir" + to_string(w) + "/f" + to_string(i);
+                string content;
+                if (file_read(&session, path, content) != SUCCESS || content != path) {
+                    cerr << "FAILED: " << path << " is missing or corrupt" << endl;
+                    failures++;
+                }
+            }
+        }
+        if (file_index.total_files() != (uint32_t)(writers * files_each)) {
+            cerr << "FAILED: Index counts " << file_index.total_files() << " files" << endl;
+            failures++;
+        }
+
+        fs_shutdown(fs_instance);
+        remove(omni_file.c_str());
+        remove(snapshot_path(omni_file).c_str());
+    }
+
+    cout << "\n========================================" << endl;
+    if (failures == 0) {
+        cout << "  ✓ ALL TESTS PASSED!" << endl;
+    } else {
+        cout << "  ✗ " << failures << " CHECK(S) FAILED" << endl;
+    }
+    cout << "========================================\n" << endl;
+
+    return failures == 0 ? SUCCESS : ERROR_IO_ERROR;
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+using namespace std;
+
+/**
+ * Hierarchical path locks for running operations concurrently
+ *
+ * An operation on /a/b/c takes an intention lock (IS or IX) on "/", "/a"
+ * and "/a/b" and a shared or exclusive lock on "/a/b/c" itself. Intention
+ * locks are compatible with each other, so writers in disjoint subtrees
+ * run side by side, while anything that covers a whole directory (S or X
+ * on it, e.g. dir_list or dir_delete) conflicts with every operation
+ * below it.
+ *
+ * Mode compatibility:
+ *          IS  IX  S   X
+ *     IS   y   y   y   -
+ *     IX   y   y   -   -
+ *     S    y   -   y   -
+ *     X    -   -   -   -
+ *
+ * Every lock of an operation is queued in one step (enqueue) and each key
+ * grants strictly in arrival order, so an operation only ever waits for
+ * operations queued before it. That makes multi-path operations such as
+ * file_rename deadlock free, and conflicting operations run in the order
+ * they were queued.
+ *
+ * A caller can either block in wait() or pass a callback to enqueue that
+ * runs once the locks are granted, so nothing has to sit on a thread
+ * while it waits its turn.
+ */
+
+enum LockMode : uint8_t {
+    LOCK_IS = 0,    // Intention to read something below this key
+    LOCK_IX = 1,    // Intention to modify something below this key
+    LOCK_S = 2,     // Read this key and everything below it
+    LOCK_X = 3      // Modify this key and everything below it
+};
+
+struct LockRequest {
+    string key;
+    LockMode mode;
+};
+
+// Adds the locks for path: intention locks on every ancestor, mode on the path
+void plan_path_lock(vector<LockRequest>& plan, const string& path, LockMode mode);
+
+class LockManager {
+public:
+    LockManager();
+
+    // Queues every lock in plan and returns its ticket; never blocks
+    uint64_t enqueue(const vector<LockRequest>& plan);
+    // As above, and calls on_grant(ticket) once every lock is granted:
+    // right away on this thread, or later on the thread that releases the
+    // last conflicting ticket. Never called with lock_mutex held.
+    uint64_t enqueue(const vector<LockRequest>& plan, function<void(uint64_t)> on_grant);
+    // Blocks until every lock queued under ticket is granted
+    void wait(uint64_t ticket);
+    void release(uint64_t ticket);
+
+    uint64_t acquire(const vector<LockRequest>& plan) {
+        uint64_t ticket = enqueue(plan);
+        wait(ticket);
+        return ticket;
+    }
+
+private:
+    struct QueuedLock {
+        uint64_t ticket;
+        LockMode mode;
+    };
+
+    mutex lock_mutex;
+    condition_variable lock_cv;
+    uint64_t next_ticket;
+    unordered_map<string, deque<QueuedLock>> queues;            // Per key, arrival order
+    unordered_map<uint64_t, vector<LockRequest>> tickets;       // Locks held or awaited
+    unordered_map<uint64_t, function<void(uint64_t)>> waiting;  // Callbacks not yet granted
+
+    bool grantable(uint64_t ticket) const;
+};
+
+// Releases a ticket when it goes out of scope
+class LockGuard {
+public:
+    LockGuard(LockManager& manager, uint64_t ticket) : manager(manager), ticket(ticket) {}
+    ~LockGuard() { manager.release(ticket); }
+    LockGuard(const LockGuard&) = delete;
+    LockGuard& operator=(const LockGuard&) = delete;
+
+private:
+    LockManager& manager;
+    uint64_t ticket;
+};
@@ -0,0 +1,148 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include "logger.hpp"
+using namespace std;
+
+Logger app_log;
+
+// Whole buffer, retrying short writes; a failing stream is given up on
+static void write_all(int fd, const string& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+        if (n <= 0) return;
+        done += n;
+    }
+}
+
+Logger::Logger() : threshold(LOG_LEVEL_INFO), stopped(false), sleeping(false), head(0), tail(0),
+                   written(0), dropped_lines(0), running(false) {
+    for (size_t i = 0; i < LOG_RING_SIZE; i++) {
+        ring[i].sequence.store(i, memory_order_relaxed);
+    }
+}
+
+Logger::~Logger() {
+    if (running.exchange(false)) {
+        {
+            lock_guard<mutex> lock(wake_mutex);
+        }
+        wake.notify_one();
+        writer.join();
+    }
+    drain();
+    stopped.store(true);
+}
+
+// The writer starts with the first line, so tools that never log have no thread
+void Logger::start() {
+    // cout is flushed first so lines from before the logger keep their place
+    fflush(stdout);
+    running.store(true);
+    writer = thread(&Logger::run, this);
+}
+
+void Logger::push(LogLevel level, const char* text, size_t length) {
+    if (stopped.load(memory_order_relaxed)) {
+        string line(text, length);
+        line += '\n';
+        write_all(level >= LOG_LEVEL_WARN ? STDERR_FILENO : STDOUT_FILENO, line);
+        return;
+    }
+    call_once(started, [this] { start(); });
+
+    uint64_t position = head.load(memory_order_relaxed);
+    Entry* entry;
+    for (;;) {
+        entry = &ring[position & (LOG_RING_SIZE - 1)];
+        uint64_t sequence = entry->sequence.load(memory_order_acquire);
+        int64_t diff = (int64_t)sequence - (int64_t)position;
+        if (diff == 0) {
+            if (head.compare_exchange_weak(position, position + 1, memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            // Full: the writer is behind by a whole ring
+            dropped_lines.fetch_add(1, memory_order_relaxed);
+            return;
+        } else {
+            position = head.load(memory_order_relaxed);
+        }
+    }
+
+    entry->level = level;
+    entry->length = length;
+    memcpy(entry->text, text, length);
+    entry->sequence.store(position + 1, memory_order_release);
+
+    // Half full: do not wait for the interval (checked every 64 lines)
+    if ((position & 63) == 0 && position - written.load(memory_order_relaxed) >= LOG_RING_SIZE / 2 &&
+        sleeping.load(memory_order_relaxed) && sleeping.exchange(false)) {
+        wake.notify_one();
+    }
+}
+
+size_t Logger::drain() {
+    string out, err;
+    size_t count = 0;
+    for (;;) {
+        Entry& entry = ring[tail & (LOG_RING_SIZE - 1)];
+        if (entry.sequence.load(memory_order_acquire) != tail + 1) break;
+
+        string& stream = entry.level >= LOG_LEVEL_WARN ? err : out;
+        stream.append(entry.text, entry.length);
+        stream += '\n';
+        entry.sequence.store(tail + LOG_RING_SIZE, memory_order_release);
+        tail++;
+        count++;
+    }
+    if (!out.empty()) write_all(STDOUT_FILENO, out);
+    if (!err.empty()) write_all(STDERR_FILENO, err);
+    written.fetch_add(count, memory_order_release);
+    return count;
+}
+
+void Logger::run() {
+    while (running.load()) {
+        if (drain() == 0) {
+            unique_lock<mutex> lock(wake_mutex);
+            sleeping.store(true);
+            wake.wait_for(lock, chrono::milliseconds(LOG_WRITE_INTERVAL_MS));
+            sleeping.store(false);
+        }
+    }
+}
+
+void Logger::flush() {
+    uint64_t target = head.load(memory_order_acquire);
+    while (running.load() && written.load(memory_order_acquire) < target) {
+        wake.notify_one();
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+}
+
+LogLevel Logger::parse_level(const string& name, LogLevel fallback) {
+    if (name == "debug") return LOG_LEVEL_DEBUG;
+    if (name == "info") return LOG_LEVEL_INFO;
+    if (name == "warn" || name == "warning") return LOG_LEVEL_WARN;
+    if (name == "error") return LOG_LEVEL_ERROR;
+    if (name == "off") return LOG_LEVEL_OFF;
+    return fallback;
+}
+
+LogLine& LogLine::append_unsigned(unsigned long long value) {
+    char digits[20];
+    size_t n = 0;
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    while (n > 0 && length < LOG_LINE_SIZE) text[length++] = digits[--n];
+    return *this;
+}
+
+LogLine& LogLine::operator<<(double value) {
+    char buffer[32];
+    int n = snprintf(buffer, sizeof(buffer), "%g", value);
+    return *this << string_view(buffer, n > 0 ? n : 0);
+}
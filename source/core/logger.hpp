@@ -0,0 +1,153 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+using namespace std;
+
+/**
+ * Leveled logger with a background writer
+ *
+ * LOG_DEBUG/LOG_INFO/LOG_WARN/LOG_ERROR format a line into a buffer on the
+ * caller's stack (no allocation, no locks) and push it into a fixed ring
+ * shared by all threads. Producers claim entries with one compare-and-swap
+ * on the head and publish them through a per-entry sequence number
+ * (bounded multi-producer queue after Vyukov); the one consumer is a
+ * writer thread that wakes every LOG_WRITE_INTERVAL_MS, or sooner once the
+ * ring is half full, and writes all pending lines with a single write()
+ * per stream: debug and info go to stdout, warnings and errors to stderr.
+ *
+ * A line never blocks its caller: when the ring is full it is dropped and
+ * counted. Lines longer than LOG_LINE_SIZE are cut.
+ *
+ * Levels below OFS_LOG_MIN_LEVEL are removed at compile time (arguments are
+ * not even evaluated); set_level raises the threshold at run time.
+ */
+
+enum LogLevel {
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_OFF
+};
+
+// Build with -DOFS_LOG_MIN_LEVEL=0 (make LOG_LEVEL=0) to keep debug lines
+#ifndef OFS_LOG_MIN_LEVEL
+#define OFS_LOG_MIN_LEVEL 1
+#endif
+
+const size_t LOG_LINE_SIZE = 240;           // Bytes of text per line
+const size_t LOG_RING_SIZE = 4096;          // Lines; a power of two
+const int LOG_WRITE_INTERVAL_MS = 20;
+
+class Logger {
+public:
+    Logger();
+    // Writes what is still queued and stops the writer
+    ~Logger();
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    bool enabled(LogLevel level) const {
+        return level >= threshold.load(memory_order_relaxed);
+    }
+    void set_level(LogLevel level) { threshold.store(level, memory_order_relaxed); }
+    LogLevel level() const { return threshold.load(memory_order_relaxed); }
+
+    // Queues one line (without its newline)
+    void push(LogLevel level, const char* text, size_t length);
+    // Returns once every line queued before the call has been written
+    void flush();
+    uint64_t dropped() const { return dropped_lines.load(memory_order_relaxed); }
+
+    // "debug", "info", "warn", "error" or "off"; fallback for anything else
+    static LogLevel parse_level(const string& name, LogLevel fallback);
+
+private:
+    struct Entry {
+        atomic<uint64_t> sequence;
+        LogLevel level;
+        uint32_t length;
+        char text[LOG_LINE_SIZE];
+    };
+
+    // Read on every line, rarely written
+    atomic<LogLevel> threshold;
+    atomic<bool> stopped;                   // After shutdown lines go out directly
+    atomic<bool> sleeping;                  // Writer is waiting for the next interval
+    once_flag started;
+
+    // Producer and writer state on separate cache lines
+    alignas(64) atomic<uint64_t> head;      // Next entry to claim
+    alignas(64) uint64_t tail;              // Next entry to write; writer only
+    atomic<uint64_t> written;               // Lines written so far
+    alignas(64) atomic<uint64_t> dropped_lines;
+    atomic<bool> running;
+    Entry ring[LOG_RING_SIZE];
+    thread writer;
+    mutex wake_mutex;
+    condition_variable wake;
+
+    void start();
+    void run();
+    // Writes every published line; returns how many
+    size_t drain();
+};
+
+extern Logger app_log;
+
+// One line being built; queued when it goes out of scope
+class LogLine {
+public:
+    explicit LogLine(LogLevel level) : level(level), length(0) {}
+    ~LogLine() { app_log.push(level, text, length); }
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+
+    LogLine& operator<<(string_view s) {
+        size_t n = s.size() < LOG_LINE_SIZE - length ? s.size() : LOG_LINE_SIZE - length;
+        memcpy(text + length, s.data(), n);
+        length += n;
+        return *this;
+    }
+    LogLine& operator<<(const char* s) { return *this << string_view(s ? s : "(null)"); }
+    LogLine& operator<<(const string& s) { return *this << string_view(s); }
+    LogLine& operator<<(char c) { return *this << string_view(&c, 1); }
+    LogLine& operator<<(bool b) { return *this << (b ? "true" : "false"); }
+    LogLine& operator<<(double value);
+
+    template <typename T, typename enable_if<is_integral<T>::value || is_enum<T>::value, int>::type = 0>
+    LogLine& operator<<(T value) {
+        if (is_enum<T>::value || is_signed<T>::value) {
+            long long v = (long long)value;
+            if (v < 0) *this << '-';
+            return append_unsigned(v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v);
+        }
+        return append_unsigned((unsigned long long)value);
+    }
+
+private:
+    LogLevel level;
+    size_t length;
+    char text[LOG_LINE_SIZE];
+
+    LogLine& append_unsigned(unsigned long long value);
+};
+
+#define OFS_LOG(level, message) \
+    do { \
+        if ((level) >= OFS_LOG_MIN_LEVEL && app_log.enabled(level)) { \
+            LogLine(level) << message; \
+        } \
+    } while (0)
+
+#define LOG_DEBUG(message) OFS_LOG(LOG_LEVEL_DEBUG, message)
+#define LOG_INFO(message)  OFS_LOG(LOG_LEVEL_INFO, message)
+#define LOG_WARN(message)  OFS_LOG(LOG_LEVEL_WARN, message)
+#define LOG_ERROR(message) OFS_LOG(LOG_LEVEL_ERROR, message)
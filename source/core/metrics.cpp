@@ -0,0 +1,174 @@
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include "metrics.hpp"
+using namespace std;
+
+uint64_t HistogramSnapshot::percentile(double q) const {
+    if (count == 0) return 0;
+    uint64_t rank = max<uint64_t>(1, (uint64_t)(q * count + 0.999999));
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+        seen += buckets[bucket];
+        if (seen >= rank) return min(histogram_bucket_high(bucket), maximum);
+    }
+    return maximum;
+}
+
+uint64_t HistogramSnapshot::count_at_most(uint64_t limit) const {
+    uint64_t total = 0;
+    for (int bucket = 0; bucket < HISTOGRAM_BUCKETS && histogram_bucket_high(bucket) <= limit; bucket++) {
+        total += buckets[bucket];
+    }
+    return total;
+}
+
+// ============================================================================
+// SHARDS
+// ============================================================================
+
+// Shards of the current thread, given back when it exits
+struct ThreadShards {
+    Metrics* last_owner = nullptr;          // Most threads record into one Metrics
+    atomic<uint64_t>* last_cells = nullptr;
+    vector<pair<Metrics*, Metrics::Shard*>> held;
+
+    ~ThreadShards() {
+        for (auto& entry : held) entry.first->release(entry.second);
+    }
+};
+
+static thread_local ThreadShards thread_shards;
+
+Metrics::Metrics(size_t histograms, size_t counters) : histogram_count(histograms), counter_count(counters) {}
+
+atomic<uint64_t>* Metrics::local() {
+    if (thread_shards.last_owner == this) return thread_shards.last_cells;
+
+    Shard* shard = nullptr;
+    for (auto& entry : thread_shards.held) {
+        if (entry.first == this) shard = entry.second;
+    }
+    if (!shard) {
+        shard = acquire();
+        thread_shards.held.push_back({this, shard});
+    }
+    thread_shards.last_owner = this;
+    thread_shards.last_cells = shard->cells.get();
+    return thread_shards.last_cells;
+}
+
+Metrics::Shard* Metrics::acquire() {
+    lock_guard<mutex> lock(shards_mutex);
+    for (auto& shard : shards) {
+        if (!shard->in_use) {
+            shard->in_use = true;
+            return shard.get();
+        }
+    }
+    size_t cells = histogram_count * HISTOGRAM_STRIDE + counter_count;
+    unique_ptr<Shard> shard(new Shard());
+    shard->cells.reset(new atomic<uint64_t>[cells]);
+    for (size_t i = 0; i < cells; i++) shard->cells[i].store(0, memory_order_relaxed);
+    shard->in_use = true;
+    shards.push_back(move(shard));
+    return shards.back().get();
+}
+
+void Metrics::release(Shard* shard) {
+    lock_guard<mutex> lock(shards_mutex);
+    shard->in_use = false;
+}
+
+HistogramSnapshot Metrics::histogram(size_t index) const {
+    HistogramSnapshot snapshot;
+    lock_guard<mutex> lock(shards_mutex);
+    for (auto& shard : shards) {
+        const atomic<uint64_t>* cells = shard->cells.get() + index * HISTOGRAM_STRIDE;
+        snapshot.count += cells[0].load(memory_order_relaxed);
+        snapshot.sum += cells[1].load(memory_order_relaxed);
+        snapshot.maximum = max(snapshot.maximum, cells[2].load(memory_order_relaxed));
+        for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+            snapshot.buckets[bucket] += cells[3 + bucket].load(memory_order_relaxed);
+        }
+    }
+    return snapshot;
+}
+
+uint64_t Metrics::counter(size_t index) const {
+    uint64_t total = 0;
+    lock_guard<mutex> lock(shards_mutex);
+    for (auto& shard : shards) {
+        total += shard->cells[histogram_count * HISTOGRAM_STRIDE + index].load(memory_order_relaxed);
+    }
+    return total;
+}
+
+// ============================================================================
+// PROMETHEUS TEXT
+// ============================================================================
+
+// Upper bounds of the exported buckets, in seconds
+static const double PROMETHEUS_BOUNDS[] = {
+    0.000005, 0.00001, 0.000025, 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025,
+    0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+
+static void append_number(string& out, double value) {
+    char text[32];
+    // Whole numbers exactly, so large counters keep every digit
+    bool whole = value > -9e15 && value < 9e15 && value == (double)(int64_t)value;
+    int n = snprintf(text, sizeof(text), whole ? "%.0f" : "%.9g", value);
+    out.append(text, n > 0 ? n : 0);
+}
+
+// name{labels,extra} with the braces left out when both are empty
+static void append_series(string& out, const string& name, const string& labels, const string& extra) {
+    out += name;
+    if (labels.empty() && extra.empty()) return;
+    out += '{';
+    out += labels;
+    if (!labels.empty() && !extra.empty()) out += ',';
+    out += extra;
+    out += '}';
+}
+
+void prometheus_header(string& out, const char* name, const char* type, const char* help) {
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+void prometheus_histogram(string& out, const char* name, const string& labels, const HistogramSnapshot& h) {
+    string base = name;
+    for (double bound : PROMETHEUS_BOUNDS) {
+        string le = "le=\"";
+        append_number(le, bound);
+        le += '"';
+        append_series(out, base + "_bucket", labels, le);
+        out += ' ';
+        out += to_string(h.count_at_most(llround(bound * 1e9)));
+        out += '\n';
+    }
+    append_series(out, base + "_bucket", labels, "le=\"+Inf\"");
+    out += ' ' + to_string(h.count) + '\n';
+    append_series(out, base + "_sum", labels, "");
+    out += ' ';
+    append_number(out, h.sum / 1e9);
+    out += '\n';
+    append_series(out, base + "_count", labels, "");
+    out += ' ' + to_string(h.count) + '\n';
+}
+
+void prometheus_value(string& out, const char* name, const string& labels, double value) {
+    append_series(out, name, labels, "");
+    out += ' ';
+    append_number(out, value);
+    out += '\n';
+}
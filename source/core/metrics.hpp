@@ -0,0 +1,122 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+using namespace std;
+
+/**
+ * Latency histograms and counters that cost the hot path almost nothing
+ *
+ * Histograms are log-linear like HdrHistogram: values below
+ * 2 * HISTOGRAM_SUB_BUCKETS get a bucket each, and every power of two above
+ * that is split into HISTOGRAM_SUB_BUCKETS equal buckets, so any recorded
+ * value is known to within about 3% whatever its size. Values are
+ * nanoseconds by convention.
+ *
+ * Every thread that records gets its own shard of all histograms and
+ * counters. Only that thread writes the shard, so recording is a plain
+ * load and store of a relaxed atomic (no read-modify-write, no lock, no
+ * cache line shared with another writer). Readers sum the shards. A shard
+ * outlives its thread and is handed to the next new thread, so totals only
+ * ever grow.
+ */
+
+const int HISTOGRAM_SUB_BITS = 5;
+const int HISTOGRAM_SUB_BUCKETS = 1 << HISTOGRAM_SUB_BITS;
+const int HISTOGRAM_MAX_BITS = 36;          // Values up to 2^36 ns (about 69 s); larger ones are clamped
+const int HISTOGRAM_BUCKETS = (HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS;
+
+inline int histogram_bucket(uint64_t value) {
+    if (value >= (1ULL << HISTOGRAM_MAX_BITS)) value = (1ULL << HISTOGRAM_MAX_BITS) - 1;
+    if (value < 2 * HISTOGRAM_SUB_BUCKETS) return (int)value;
+    int shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+    return shift * HISTOGRAM_SUB_BUCKETS + (int)(value >> shift);
+}
+
+// Smallest value that lands in bucket
+inline uint64_t histogram_bucket_low(int bucket) {
+    if (bucket < 2 * HISTOGRAM_SUB_BUCKETS) return bucket;
+    int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    return (uint64_t)(bucket - shift * HISTOGRAM_SUB_BUCKETS) << shift;
+}
+
+// Largest value that lands in bucket
+inline uint64_t histogram_bucket_high(int bucket) {
+    int shift = bucket < 2 * HISTOGRAM_SUB_BUCKETS ? 0 : bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    return histogram_bucket_low(bucket) + (1ULL << shift) - 1;
+}
+
+inline uint64_t metrics_now_ns() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// One histogram summed over every shard
+struct HistogramSnapshot {
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t maximum = 0;
+    vector<uint64_t> buckets = vector<uint64_t>(HISTOGRAM_BUCKETS);
+
+    double mean() const { return count ? (double)sum / count : 0; }
+    // Value at or below which a fraction q of the recorded values lie
+    uint64_t percentile(double q) const;
+    // Recorded values that are certainly <= limit
+    uint64_t count_at_most(uint64_t limit) const;
+};
+
+class Metrics {
+public:
+    Metrics(size_t histograms, size_t counters);
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    void record(size_t histogram, uint64_t value) {
+        atomic<uint64_t>* cells = local() + histogram * HISTOGRAM_STRIDE;
+        bump(cells[0], 1);
+        bump(cells[1], value);
+        if (value > cells[2].load(memory_order_relaxed)) cells[2].store(value, memory_order_relaxed);
+        bump(cells[3 + histogram_bucket(value)], 1);
+    }
+
+    void add(size_t counter, uint64_t amount = 1) {
+        bump(local()[histogram_count * HISTOGRAM_STRIDE + counter], amount);
+    }
+
+    HistogramSnapshot histogram(size_t index) const;
+    uint64_t counter(size_t index) const;
+
+private:
+    // count, sum, max, then the buckets
+    static const size_t HISTOGRAM_STRIDE = 3 + HISTOGRAM_BUCKETS;
+
+    struct Shard {
+        unique_ptr<atomic<uint64_t>[]> cells;
+        bool in_use = false;
+    };
+
+    size_t histogram_count;
+    size_t counter_count;
+    mutable mutex shards_mutex;             // Taken when a thread first records and by readers
+    vector<unique_ptr<Shard>> shards;
+
+    // Only the owning thread writes a cell, so no read-modify-write is needed
+    static void bump(atomic<uint64_t>& cell, uint64_t amount) {
+        cell.store(cell.load(memory_order_relaxed) + amount, memory_order_relaxed);
+    }
+
+    atomic<uint64_t>* local();
+    Shard* acquire();
+    void release(Shard* shard);
+
+    friend struct ThreadShards;
+};
+
+// Prometheus text format (version 0.0.4)
+void prometheus_header(string& out, const char* name, const char* type, const char* help);
+// A histogram in seconds; labels like "op=\"file_read\"" or empty
+void prometheus_histogram(string& out, const char* name, const string& labels, const HistogramSnapshot& h);
+void prometheus_value(string& out, const char* name, const string& labels, double value);
@@ -0,0 +1,346 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <ctime>
+#include <cstdio>
+#include <chrono>
+#include <new>
+#include <algorithm>
+#include "session_table.hpp"
+using namespace std;
+
+static const size_t INITIAL_SLOTS = 64;
+
+SessionTable::SessionTable()
+    : slots(INITIAL_SLOTS), used(0), deleted(0), timers(time(nullptr)), idle_timeout(0), lifetime(0), expired(0) {}
+
+SessionTable::~SessionTable() {
+    for (SessionNode* slab : slabs) ::operator delete(slab);
+}
+
+void SessionTable::set_timeouts(uint64_t idle, uint64_t max_lifetime) {
+    lock_guard<mutex> lock(table_mutex);
+    idle_timeout = idle;
+    lifetime = max_lifetime;
+}
+
+uint64_t SessionTable::deadline(const SessionNode& node) const {
+    uint64_t idle_end = idle_timeout ? node.info.last_activity + idle_timeout : 0;
+    uint64_t lifetime_end = lifetime ? node.info.login_time + lifetime : 0;
+    if (!idle_end) return lifetime_end;
+    if (!lifetime_end) return idle_end;
+    return min(idle_end, lifetime_end);
+}
+
+size_t SessionTable::advance(uint64_t now) {
+    size_t ended = 0;
+    timers.advance(now, [this, &ended](TimerNode& timer) {
+        SessionNode* node = (SessionNode*)timer.owner;
+        uint64_t due = deadline(*node);
+        if (due > timers.now()) {
+            // Used since the timer was set, or the limits changed
+            timers.schedule(timer, due);
+        } else if (due != 0) {
+            erase(*lookup(node->high, node->low));
+            expired++;
+            ended++;
+        }
+    });
+    return ended;
+}
+
+size_t SessionTable::expire(uint64_t now) {
+    lock_guard<mutex> lock(table_mutex);
+    return advance(now);
+}
+
+bool SessionTable::parse_token(const string& token, uint64_t& high, uint64_t& low) {
+    if (token.size() != SESSION_TOKEN_LENGTH) return false;
+    high = low = 0;
+    for (size_t i = 0; i < SESSION_TOKEN_LENGTH; i++) {
+        char c = token[i];
+        uint64_t digit;
+        if (c >= '0' && c <= '9') digit = c - '0';
+        else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else return false;
+        uint64_t& half = i < SESSION_TOKEN_LENGTH / 2 ? high : low;
+        half = (half << 4) | digit;
+    }
+    return true;
+}
+
+SessionTable::Slot* SessionTable::lookup(uint64_t high, uint64_t low) {
+    size_t mask = slots.size() - 1;
+    for (size_t i = low & mask; ; i = (i + 1) & mask) {
+        Slot& slot = slots[i];
+        if (slot.state == SLOT_EMPTY) return nullptr;
+        if (slot.state == SLOT_USED && slot.high == high && slot.low == low) return &slot;
+    }
+}
+
+void SessionTable::rehash(size_t capacity) {
+    vector<Slot> old;
+    old.swap(slots);
+    slots.assign(capacity, Slot());
+    size_t mask = capacity - 1;
+    for (const Slot& entry : old) {
+        if (entry.state != SLOT_USED) continue;
+        size_t i = entry.low & mask;
+        while (slots[i].state != SLOT_EMPTY) i = (i + 1) & mask;
+        slots[i] = entry;
+    }
+    deleted = 0;
+}
+
+SessionInfo SessionTable::create(const UserInfo& user) {
+    lock_guard<mutex> lock(table_mutex);
+    uint64_t now = time(nullptr);
+    advance(now);
+
+    // Keep at least half the slots empty so probes stay short
+    if ((used + deleted + 1) * 2 > slots.size()) {
+        size_t capacity = slots.size();
+        while ((used + 1) * 2 > capacity) capacity *= 2;
+        rehash(capacity);
+    }
+
+    uint64_t high, low;
+    do {
+        high = ((uint64_t)entropy() << 32) | entropy();
+        low = ((uint64_t)entropy() << 32) | entropy();
+    } while (lookup(high, low));
+
+    if (free_nodes.empty()) {
+        SessionNode* slab = static_cast<SessionNode*>(::operator new(SESSION_SLAB_SIZE * sizeof(SessionNode)));
+        slabs.push_back(slab);
+        for (size_t i = SESSION_SLAB_SIZE; i > 0; i--) free_nodes.push_back(slab + i - 1);
+    }
+    SessionNode* memory = free_nodes.back();
+    free_nodes.pop_back();
+
+    char token[SESSION_TOKEN_LENGTH + 1];
+    snprintf(token, sizeof(token), "%016llx%016llx", (unsigned long long)high, (unsigned long long)low);
+    SessionNode* node = new (memory) SessionNode{SessionInfo(token, user, now), TimerNode(), high, low};
+    node->timer.owner = node;
+    if (uint64_t due = deadline(*node)) timers.schedule(node->timer, due);
+
+    size_t mask = slots.size() - 1;
+    size_t i = low & mask;
+    while (slots[i].state == SLOT_USED) i = (i + 1) & mask;
+    if (slots[i].state == SLOT_DELETED) deleted--;
+    slots[i].high = high;
+    slots[i].low = low;
+    slots[i].node = node;
+    slots[i].state = SLOT_USED;
+    used++;
+    return node->info;
+}
+
+bool SessionTable::validate(const string& token, SessionInfo& out) {
+    uint64_t high, low;
+    if (!parse_token(token, high, low)) return false;
+
+    lock_guard<mutex> lock(table_mutex);
+    uint64_t now = time(nullptr);
+    advance(now);
+    Slot* slot = lookup(high, low);
+    if (!slot) return false;
+    uint64_t due = deadline(*slot->node);
+    if (due != 0 && due <= now) {
+        erase(*slot);
+        expired++;
+        return false;
+    }
+    SessionInfo& session = slot->node->info;
+    session.last_activity = now;
+    session.operations_count++;
+    out = session;
+    return true;
+}
+
+bool SessionTable::find(const string& token, SessionInfo& out) {
+    uint64_t high, low;
+    if (!parse_token(token, high, low)) return false;
+
+    lock_guard<mutex> lock(table_mutex);
+    Slot* slot = lookup(high, low);
+    if (!slot) return false;
+    out = slot->node->info;
+    return true;
+}
+
+void SessionTable::erase(Slot& slot) {
+    timers.cancel(slot.node->timer);
+    slot.node->~SessionNode();
+    free_nodes.push_back(slot.node);
+    slot.node = nullptr;
+    slot.state = SLOT_DELETED;
+    used--;
+    deleted++;
+}
+
+bool SessionTable::remove(const string& token) {
+    uint64_t high, low;
+    if (!parse_token(token, high, low)) return false;
+
+    lock_guard<mutex> lock(table_mutex);
+    Slot* slot = lookup(high, low);
+    if (!slot) return false;
+    erase(*slot);
+    return true;
+}
+
+size_t SessionTable::remove_user(const string& username) {
+    lock_guard<mutex> lock(table_mutex);
+    size_t removed = 0;
+    for (Slot& slot : slots) {
+        if (slot.state == SLOT_USED && username == slot.node->info.user.username) {
+            erase(slot);
+            removed++;
+        }
+    }
+    return removed;
+}
+
+size_t SessionTable::size() {
+    lock_guard<mutex> lock(table_mutex);
+    return used;
+}
+
+uint64_t SessionTable::expired_total() {
+    lock_guard<mutex> lock(table_mutex);
+    return expired;
+}
+
+vector<SessionInfo> SessionTable::list() {
+    lock_guard<mutex> lock(table_mutex);
+    vector<SessionInfo> sessions;
+    sessions.reserve(used);
+    for (const Slot& slot : slots) {
+        if (slot.state == SLOT_USED) sessions.push_back(slot.node->info);
+    }
+    return sessions;
+}
+
+// ============================================================================
+// TEST
+// ============================================================================
+
+int test_session_table() {
+    int failures = 0;
+
+    cout << "\n========================================" << endl;
+    cout << "  SESSION TABLE TEST" << endl;
+    cout << "========================================\n" << endl;
+
+    // Test 1: Tokens are unique, well formed and found again
+    cout << "Test 1: Create and validate 10000 sessions..." << endl;
+    SessionTable table;
+    vector<string> tokens;
+    for (int i = 0; i < 10000; i++) {
+        UserInfo user("user" + to_string(i % 10), "", i % 10 == 0 ? ADMIN : NORMAL, 0);
+        tokens.push_back(table.create(user).session_id);
+    }
+    for (size_t i = 0; i < tokens.size(); i++) {
+        SessionInfo copy("", UserInfo("", "", NORMAL, 0), 0);
+        SessionInfo found("", UserInfo("", "", NORMAL, 0), 0);
+        if (tokens[i].size() != SESSION_TOKEN_LENGTH || !table.validate(tokens[i], copy) ||
+            copy.user.role != (i % 10 == 0 ? ADMIN : NORMAL) || !table.find(tokens[i], found) ||
+            tokens[i] != found.session_id || found.operations_count != 1) {
+            cerr << "FAILED: Session " << i << " (" << tokens[i] << ") lost" << endl;
+            failures++;
+            break;
+        }
+    }
+    if (table.size() != tokens.size()) {
+        cerr << "FAILED: Table counts " << table.size() << " sessions" << endl;
+        failures++;
+    }
+
+    // Test 2: Sessions survive growth; removed tokens stop validating
+    cout << "\nTest 2: Remove half, check the rest..." << endl;
+    for (size_t i = 0; i < tokens.size(); i += 2) table.remove(tokens[i]);
+    for (size_t i = 0; i < tokens.size(); i++) {
+        SessionInfo found("", UserInfo("", "", NORMAL, 0), 0);
+        bool live = table.find(tokens[i], found);
+        if (live != (i % 2 == 1) || (live && tokens[i] != found.session_id)) {
+            cerr << "FAILED: Session " << i << " in the wrong state after removal" << endl;
+            failures++;
+            break;
+        }
+    }
+
+    // Test 3: Malformed and deleted-user tokens are refused
+    cout << "\nTest 3: Malformed tokens and deleted users..." << endl;
+    SessionInfo copy("", UserInfo("", "", NORMAL, 0), 0);
+    if (table.validate("", copy) || table.validate("session_admin", copy) ||
+        table.validate(string(SESSION_TOKEN_LENGTH, 'g'), copy)) {
+        cerr << "FAILED: Malformed token accepted" << endl;
+        failures++;
+    }
+    size_t removed = table.remove_user("user1");
+    if (removed != 1000 || table.validate(tokens[1], copy)) {
+        cerr << "FAILED: remove_user dropped " << removed << " sessions" << endl;
+        failures++;
+    }
+
+    // Test 4: Concurrent logins and lookups
+    cout << "\nTest 4: Concurrent create/validate/remove..." << endl;
+    atomic<int> lost(0);
+    vector<thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.push_back(thread([&table, &lost, t] {
+            SessionInfo local("", UserInfo("", "", NORMAL, 0), 0);
+            for (int i = 0; i < 2000; i++) {
+                string token = table.create(UserInfo("worker" + to_string(t), "", NORMAL, 0)).session_id;
+                if (!table.validate(token, local) || !table.remove(token)) lost++;
+            }
+        }));
+    }
+    for (auto& t : threads) t.join();
+    if (lost != 0) {
+        cerr << "FAILED: " << lost << " sessions lost under concurrency" << endl;
+        failures++;
+    }
+
+    // Test 5: Idle and lifetime expiry, across every level of the wheel
+    cout << "\nTest 5: Expiry..." << endl;
+    for (uint64_t idle : {30ULL, 1000ULL, 100000ULL}) {
+        SessionTable expiring;
+        expiring.set_timeouts(idle, idle * 3);
+        uint64_t start = time(nullptr);
+        vector<string> live;
+        for (int i = 0; i < 100; i++) live.push_back(expiring.create(UserInfo("u", "", NORMAL, 0)).session_id);
+        size_t early = expiring.expire(start + idle - 1);
+        size_t due = expiring.expire(start + idle + 1);
+        SessionInfo found("", UserInfo("", "", NORMAL, 0), 0);
+        if (early != 0 || due != live.size() || expiring.size() != 0 || expiring.find(live[0], found)) {
+            cerr << "FAILED: Idle timeout " << idle << "s ended " << early << " early and "
+                 << due << " on time" << endl;
+            failures++;
+        }
+    }
+    {
+        // Every request moves the idle deadline; the lifetime still ends the session
+        SessionTable expiring;
+        expiring.set_timeouts(3600, 1);
+        string token = expiring.create(UserInfo("u", "", NORMAL, 0)).session_id;
+        SessionInfo copy("", UserInfo("", "", NORMAL, 0), 0);
+        bool valid = expiring.validate(token, copy) && copy.operations_count == 1;
+        this_thread::sleep_for(chrono::milliseconds(2100));
+        if (!valid || expiring.validate(token, copy) || expiring.size() != 0 || expiring.expired_total() != 1) {
+            cerr << "FAILED: Session outlived its lifetime" << endl;
+            failures++;
+        }
+    }
+
+    cout << "\n========================================" << endl;
+    if (failures == 0) {
+        cout << "  ✓ ALL TESTS PASSED!" << endl;
+    } else {
+        cout << "  ✗ " << failures << " CHECK(S) FAILED" << endl;
+    }
+    cout << "========================================\n" << endl;
+
+    return failures == 0 ? SUCCESS : ERROR_IO_ERROR;
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <random>
+#include <cstdint>
+#include "../include/odf_types.hpp"
+#include "timer_wheel.hpp"
+using namespace std;
+
+/**
+ * Logged-in sessions, keyed by random 128-bit tokens
+ *
+ * A session id is 32 lowercase hex digits drawn from the system's random
+ * source, so it cannot be derived from the username or the login time.
+ * Lookups go through an open-addressing table (linear probing, power-of-two
+ * size, kept under half full); the tokens are uniformly random already, so
+ * their low bits serve as the hash and a lookup touches one or two slots.
+ *
+ * The sessions themselves live in fixed slabs of SESSION_SLAB_SIZE, and
+ * removed sessions go on a free list for reuse. A session can end on any
+ * thread (logout, user deletion, or a timer fired by someone else's
+ * request), so callers only ever get copies taken under the table lock.
+ *
+ * Sessions end after idle_timeout seconds without a request or lifetime
+ * seconds after login, whichever comes first (0 turns either off). Each
+ * session has one timer in a TimerWheel, set for the earlier of the two.
+ * Requests only bump last_activity; when the timer fires, a session that
+ * was used since is rescheduled for its new deadline instead of removed.
+ * The wheel is advanced to the current second on every create and
+ * validate, and validate also refuses a session past its deadline that
+ * the wheel has not reached yet.
+ */
+
+const size_t SESSION_SLAB_SIZE = 64;
+const size_t SESSION_TOKEN_LENGTH = 32;     // Hex digits
+
+class SessionTable {
+public:
+    SessionTable();
+    // Seconds; 0 = no limit. Applies to sessions created afterwards too.
+    void set_timeouts(uint64_t idle_timeout, uint64_t lifetime);
+    ~SessionTable();
+    SessionTable(const SessionTable&) = delete;
+    SessionTable& operator=(const SessionTable&) = delete;
+
+    // New session for user under a fresh token; returns a copy of it
+    SessionInfo create(const UserInfo& user);
+    // Copies the session for token into out and counts one operation on it;
+    // false for unknown or malformed tokens
+    bool validate(const string& token, SessionInfo& out);
+    // Like validate, without counting an operation or checking the deadline
+    bool find(const string& token, SessionInfo& out);
+    bool remove(const string& token);
+    // Drops every session of username, e.g. when the user is deleted
+    size_t remove_user(const string& username);
+    // Ends every session whose deadline is at or before now (Unix seconds)
+    size_t expire(uint64_t now);
+    size_t size();
+    uint64_t expired_total();
+    vector<SessionInfo> list();
+
+private:
+    enum SlotState : uint8_t { SLOT_EMPTY, SLOT_USED, SLOT_DELETED };
+
+    struct SessionNode {
+        SessionInfo info;
+        TimerNode timer;
+        uint64_t high, low;     // Token, to find the slot again when the timer fires
+    };
+
+    struct Slot {
+        uint64_t high = 0;
+        uint64_t low = 0;
+        SessionNode* node = nullptr;
+        SlotState state = SLOT_EMPTY;
+    };
+
+    mutex table_mutex;
+    vector<Slot> slots;             // Size is a power of two
+    size_t used;
+    size_t deleted;                 // Tombstones, reclaimed on the next rehash
+    vector<SessionNode*> slabs;     // Raw storage for SESSION_SLAB_SIZE sessions each
+    vector<SessionNode*> free_nodes;
+    random_device entropy;
+    TimerWheel timers;
+    uint64_t idle_timeout;
+    uint64_t lifetime;
+    uint64_t expired;
+
+    static bool parse_token(const string& token, uint64_t& high, uint64_t& low);
+    // Slot holding the token, or nullptr; table_mutex held
+    Slot* lookup(uint64_t high, uint64_t low);
+    void erase(Slot& slot);
+    void rehash(size_t capacity);
+    // When node's session ends, or 0 for never
+    uint64_t deadline(const SessionNode& node) const;
+    // Runs the wheel up to now; table_mutex held
+    size_t advance(uint64_t now);
+};
+
+extern SessionTable active_sessions;
@@ -0,0 +1,388 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <thread>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "stripe_set.hpp"
+#include "helper.hpp"
+#include "fs_index.hpp"
+#include "logger.hpp"
+#include "trace.hpp"
+#include "../include/ofs_functions.hpp"
+using namespace std;
+
+StripeSet data_stripes;
+
+StripeSet& get_stripe_set() {
+    if (!data_stripes.is_open()) {
+        data_stripes.open(active_omni_path());
+    }
+    return data_stripes;
+}
+
+string stripe_manifest_path(const string& omni_path) {
+    return omni_path + ".stripes";
+}
+
+vector<string> read_stripe_manifest(const string& omni_path) {
+    vector<string> paths;
+    ifstream manifest(stripe_manifest_path(omni_path));
+    string line;
+    while (getline(manifest, line)) {
+        if (!line.empty()) paths.push_back(line);
+    }
+    return paths;
+}
+
+// pread/pwrite until the whole range is done; short transfers are retried
+bool transfer_all(int fd, char* buffer, uint64_t size, uint64_t offset, bool writing) {
+    while (size > 0) {
+        ssize_t n = writing ? pwrite(fd, buffer, size, offset) : pread(fd, buffer, size, offset);
+        if (n <= 0) return false;
+        buffer += n;
+        offset += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Vectored variant: the pieces are contiguous in the file, scattered in memory
+bool transfer_vector(int fd, vector<iovec>& pieces, uint64_t offset, bool writing) {
+    size_t first = 0;
+    while (first < pieces.size()) {
+        int count = min<size_t>(pieces.size() - first, IOV_MAX);
+        ssize_t n = writing ? pwritev(fd, &pieces[first], count, offset)
+                            : preadv(fd, &pieces[first], count, offset);
+        if (n <= 0) return false;
+        offset += n;
+
+        // Skip the pieces that are done and trim a partly done one
+        while (n > 0 && first < pieces.size()) {
+            if ((size_t)n >= pieces[first].iov_len) {
+                n -= pieces[first].iov_len;
+                first++;
+            } else {
+                pieces[first].iov_base = (char*)pieces[first].iov_base + n;
+                pieces[first].iov_len -= n;
+                n = 0;
+            }
+        }
+    }
+    return true;
+}
+
+// ============================================================================
+// STRIPE SET
+// ============================================================================
+
+StripeSet::StripeSet() : primary_fd(-1), unit(0) {}
+
+StripeSet::~StripeSet() {
+    close();
+}
+
+void StripeSet::close() {
+    if (primary_fd >= 0) ::close(primary_fd);
+    for (int fd : stripe_fds) ::close(fd);
+    primary_fd = -1;
+    stripe_fds.clear();
+    unit = 0;
+}
+
+int StripeSet::open(const string& omni_path) {
+    close();
+
+    primary_fd = ::open(omni_path.c_str(), O_RDWR);
+    if (primary_fd < 0) {
+        LOG_ERROR("Error: Cannot open " << omni_path);
+        return ERROR_IO_ERROR;
+    }
+
+    OMNIHeader header(0, 0, 0, 0);
+    if (!transfer_all(primary_fd, (char*)&header, sizeof(header), 0, false)) {
+        LOG_ERROR("Error: Cannot read header of " << omni_path);
+        close();
+        return ERROR_IO_ERROR;
+    }
+
+    uint32_t count = header.getStripeCount();
+    if (count == 0) return SUCCESS;
+
+    vector<string> paths = read_stripe_manifest(omni_path);
+    if (paths.size() != count || header.getStripeUnit() == 0) {
+        LOG_ERROR("Error: " << stripe_manifest_path(omni_path) << " lists " << paths.size()
+               << " stripe files, header expects " << count);
+        close();
+        return ERROR_INVALID_CONFIG;
+    }
+    unit = header.getStripeUnit();
+
+    // Every stripe must belong to this set and sit at its own position
+    for (uint32_t i = 0; i < count; i++) {
+        int fd = ::open(paths[i].c_str(), O_RDWR);
+        if (fd < 0) {
+            LOG_ERROR("Error: Cannot open stripe " << paths[i]);
+            close();
+            return ERROR_IO_ERROR;
+        }
+        stripe_fds.push_back(fd);
+
+        StripeHeader stripe;
+        if (!transfer_all(fd, (char*)&stripe, sizeof(stripe), 0, false) ||
+            !compare(stripe.magic, "OFSSTRP1", 8) || stripe.set_id != header.getStripeSetId() ||
+            stripe.index != i || stripe.count != count || stripe.stripe_unit != unit) {
+            LOG_ERROR("Error: " << paths[i] << " is not stripe " << i << " of this container");
+            close();
+            return ERROR_INVALID_CONFIG;
+        }
+    }
+
+    return SUCCESS;
+}
+
+int StripeSet::read(uint64_t offset, char* buffer, uint64_t size) const {
+    return transfer(offset, buffer, size, false);
+}
+
+int StripeSet::write(uint64_t offset, const char* buffer, uint64_t size) const {
+    return transfer(offset, (char*)buffer, size, true);
+}
+
+int StripeSet::transfer(uint64_t offset, char* buffer, uint64_t size, bool writing) const {
+    if (!is_open()) return ERROR_IO_ERROR;
+    if (size == 0) return SUCCESS;
+    TRACE_SCOPE(writing ? "stripe_write" : "stripe_read", "storage");
+
+    if (stripe_fds.empty()) {
+        return transfer_all(primary_fd, buffer, size, offset, writing) ? SUCCESS : ERROR_IO_ERROR;
+    }
+
+    // Split the range into stripe units. Unit k sits on stripe k % N at
+    // (k / N) * unit, so the units a stripe gets from one range are adjacent
+    // in its file and go out as a single vectored request.
+    uint32_t count = stripe_fds.size();
+    vector<vector<iovec>> pieces(count);
+    vector<uint64_t> start(count, 0);
+
+    for (uint64_t done = 0; done < size; ) {
+        uint64_t logical = offset + done;
+        uint64_t unit_index = logical / unit;
+        uint64_t within = logical % unit;
+        uint64_t chunk = min(unit - within, size - done);
+        uint32_t stripe = unit_index % count;
+
+        if (pieces[stripe].empty()) {
+            start[stripe] = STRIPE_DATA_OFFSET + (unit_index / count) * unit + within;
+        }
+        pieces[stripe].push_back({buffer + done, (size_t)chunk});
+        done += chunk;
+    }
+
+    vector<char> ok(count, 1);
+    auto run = [&](uint32_t stripe) {
+        if (!pieces[stripe].empty()) {
+            ok[stripe] = transfer_vector(stripe_fds[stripe], pieces[stripe], start[stripe], writing);
+        }
+    };
+
+    if (size < PARALLEL_IO_THRESHOLD) {
+        for (uint32_t i = 0; i < count; i++) run(i);
+    } else {
+        vector<thread> workers;
+        for (uint32_t i = 1; i < count; i++) {
+            if (!pieces[i].empty()) workers.push_back(thread(run, i));
+        }
+        run(0);
+        for (auto& t : workers) t.join();
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (!ok[i]) {
+            LOG_ERROR("Error: I/O failed on stripe " << i);
+            return ERROR_IO_ERROR;
+        }
+    }
+    return SUCCESS;
+}
+
+int StripeSet::resize(uint64_t total_size) const {
+    if (stripe_fds.empty()) return SUCCESS;
+
+    uint32_t count = stripe_fds.size();
+    uint64_t total_units = (total_size + unit - 1) / unit;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t units = total_units / count + (i < total_units % count ? 1 : 0);
+        if (ftruncate(stripe_fds[i], STRIPE_DATA_OFFSET + units * unit) != 0) {
+            LOG_ERROR("Error: Cannot resize stripe " << i);
+            return ERROR_IO_ERROR;
+        }
+    }
+    return SUCCESS;
+}
+
+// ============================================================================
+// CREATION
+// ============================================================================
+
+int create_stripe_set(const string& omni_path, const vector<string>& stripe_paths, uint32_t stripe_unit) {
+    if (stripe_paths.empty() || stripe_paths.size() > MAX_STRIPES || stripe_unit == 0) {
+        LOG_ERROR("Error: A stripe set needs 1 to " << MAX_STRIPES << " files and a non-zero unit");
+        return ERROR_INVALID_CONFIG;
+    }
+
+    OMNIHeader header(0, 0, 0, 0);
+    if (!read_header(omni_path, header)) {
+        LOG_ERROR("Error: Cannot read header of " << omni_path);
+        return ERROR_IO_ERROR;
+    }
+
+    uint32_t count = stripe_paths.size();
+    random_device entropy;
+    uint64_t set_id = ((uint64_t)entropy() << 32) | entropy();
+
+    // Step 1: Stamp every stripe file with its place in the set
+    ofstream manifest(stripe_manifest_path(omni_path), ios::trunc);
+    for (uint32_t i = 0; i < count; i++) {
+        ofstream stripe(stripe_paths[i], ios::binary | ios::trunc);
+        if (!stripe) {
+            LOG_ERROR("Error: Cannot create stripe " << stripe_paths[i]);
+            return ERROR_IO_ERROR;
+        }
+
+        vector<char> page(STRIPE_DATA_OFFSET, 0);
+        StripeHeader* stripe_header = (StripeHeader*)page.data();
+        memcpy(stripe_header->magic, "OFSSTRP1", 8);
+        stripe_header->set_id = set_id;
+        stripe_header->index = i;
+        stripe_header->count = count;
+        stripe_header->stripe_unit = stripe_unit;
+        stripe.write(page.data(), page.size());
+
+        manifest << stripe_paths[i] << "\n";
+    }
+    manifest.close();
+
+    // Step 2: Record the layout in the primary; from here on its data area is unused
+    header.setStripeLayout(count, stripe_unit, set_id);
+    fstream file(omni_path, ios::in | ios::out | ios::binary);
+    file.write((const char*)&header, sizeof(header));
+    file.close();
+
+    // Step 3: Back the whole logical data area (sparse)
+    StripeSet stripes;
+    int result = stripes.open(omni_path);
+    if (result == SUCCESS) result = stripes.resize(header.total_size);
+    if (result != SUCCESS) return result;
+
+    LOG_INFO("SUCCESS: Striped " << omni_path << " across " << count << " files ("
+          << stripe_unit << "-byte units)");
+    return SUCCESS;
+}
+
+int test_stripe_set() {
+    string omni_file = "/tmp/ofs_stripe_test.omni";
+    uint64_t total_size = 256ULL * 1024 * 1024;
+    uint32_t stripe_count = 4;
+    uint64_t file_size = 32ULL * 1024 * 1024;
+    int failures = 0;
+
+    cout << "\n========================================" << endl;
+    cout << "  STRIPED CONTAINER TEST (" << stripe_count << " stripes)" << endl;
+    cout << "========================================\n" << endl;
+
+    // Test 1: Format and stripe the container
+    cout << "Test 1: Formatting striped container..." << endl;
+    vector<string> paths;
+    for (uint32_t i = 0; i < stripe_count; i++) {
+        paths.push_back(omni_file + ".s" + to_string(i));
+    }
+    remove(snapshot_path(omni_file).c_str());
+    if (fs_format(omni_file, "BSAI-24003", "2025-11-11", total_size, 4096) != SUCCESS ||
+        create_stripe_set(omni_file, paths, DEFAULT_STRIPE_UNIT) != SUCCESS) {
+        cerr << "FAILED: Could not create striped container" << endl;
+        return ERROR_IO_ERROR;
+    }
+
+    void* fs_instance = nullptr;
+    if (fs_init(&fs_instance, omni_file.c_str(), nullptr) != SUCCESS) {
+        cerr << "FAILED: Could not initialize file system" << endl;
+        return ERROR_IO_ERROR;
+    }
+
+    // Test 2: A large file is written to every stripe at once
+    cout << "\nTest 2: Writing a " << (file_size >> 20) << " MiB file..." << endl;
+    UserInfo user("admin", "", ADMIN, time(nullptr));
+    SessionInfo session("SID_STRIPE", user, time(nullptr));
+
+    string data(file_size, '\0');
+    for (uint64_t i = 0; i < file_size; i++) data[i] = (char)(i * 131 + (i >> 16));
+
+    auto write_start = chrono::steady_clock::now();
+    if (file_create(&session, "striped.bin", data) != SUCCESS) {
+        cerr << "FAILED: Could not create striped.bin" << endl;
+        failures++;
+    }
+    double write_seconds = chrono::duration<double>(chrono::steady_clock::now() - write_start).count();
+
+    // Test 3: Every stripe holds its share of the content, unit by unit
+    cout << "\nTest 3: Checking the stripe files..." << endl;
+    uint64_t file_offset = file_index.slot(file_index.find("striped.bin")).data_offset;
+    uint64_t first_unit = (file_offset + DEFAULT_STRIPE_UNIT - 1) / DEFAULT_STRIPE_UNIT;
+    for (uint64_t u = first_unit; u < first_unit + stripe_count; u++) {
+        ifstream stripe(paths[u % stripe_count], ios::binary);
+        string unit_bytes(DEFAULT_STRIPE_UNIT, '\0');
+        stripe.seekg(STRIPE_DATA_OFFSET + (u / stripe_count) * DEFAULT_STRIPE_UNIT, ios::beg);
+        stripe.read(&unit_bytes[0], unit_bytes.size());
+        if (unit_bytes != data.substr(u * DEFAULT_STRIPE_UNIT - file_offset, DEFAULT_STRIPE_UNIT)) {
+            cerr << "FAILED: Stripe " << (u % stripe_count) << " does not hold unit " << u << endl;
+            failures++;
+        }
+    }
+
+    // Test 4: Read it back, before and after a restart
+    cout << "\nTest 4: Reading back..." << endl;
+    string content;
+    auto read_start = chrono::steady_clock::now();
+    if (file_read(&session, "striped.bin", content) != SUCCESS || content != data) {
+        cerr << "FAILED: Content mismatch" << endl;
+        failures++;
+    }
+    double read_seconds = chrono::duration<double>(chrono::steady_clock::now() - read_start).count();
+
+    fs_shutdown(fs_instance);
+    if (fs_init(&fs_instance, omni_file.c_str(), nullptr) != SUCCESS) {
+        cerr << "FAILED: Could not re-initialize file system" << endl;
+        return ERROR_IO_ERROR;
+    }
+    content.clear();
+    if (file_read(&session, "striped.bin", content) != SUCCESS || content != data) {
+        cerr << "FAILED: Content mismatch after restart" << endl;
+        failures++;
+    }
+    fs_shutdown(fs_instance);
+
+    cout << "  Write: " << (file_size >> 20) / write_seconds << " MB/s, read: "
+         << (file_size >> 20) / read_seconds << " MB/s" << endl;
+
+    remove(omni_file.c_str());
+    remove(snapshot_path(omni_file).c_str());
+    remove(stripe_manifest_path(omni_file).c_str());
+    for (const string& path : paths) remove(path.c_str());
+
+    cout << "\n========================================" << endl;
+    if (failures == 0) {
+        cout << "  ✓ ALL TESTS PASSED!" << endl;
+    } else {
+        cout << "  ✗ " << failures << " CHECK(S) FAILED" << endl;
+    }
+    cout << "========================================\n" << endl;
+
+    return failures == 0 ? SUCCESS : ERROR_IO_ERROR;
+}
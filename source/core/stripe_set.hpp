@@ -0,0 +1,72 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "../include/odf_types.hpp"
+using namespace std;
+
+/**
+ * File data I/O, optionally striped across several container files
+ *
+ * A plain container keeps file content in the .omni file itself. A striped
+ * container keeps only the header, user table and metadata table in the
+ * primary .omni file and spreads file content round-robin over N stripe
+ * files in units of stripe_unit bytes, so large reads and writes go to all
+ * devices at once. The stripe files are listed, one path per line, in
+ * <omni>.stripes.
+ *
+ * Data offsets stored in FileEntry are logical offsets either way; the
+ * index, the allocator and fs_grow/fs_shrink never see the striping.
+ *
+ * Stripe file layout:
+ *   StripeHeader (padded to STRIPE_DATA_OFFSET)
+ *   unit 0 of this stripe, unit 1, ...     // logical unit k*N + index
+ */
+
+struct StripeHeader {
+    char magic[8];              // "OFSSTRP1"
+    uint64_t set_id;            // Same as OMNIHeader::getStripeSetId()
+    uint32_t index;             // Position of this file in the set
+    uint32_t count;             // Files in the set
+    uint64_t stripe_unit;
+};
+
+const uint64_t STRIPE_DATA_OFFSET = 4096;
+const uint32_t DEFAULT_STRIPE_UNIT = 64 * 1024;
+const uint32_t MAX_STRIPES = 64;
+
+// Transfers at least this large are issued to all stripes in parallel
+const uint64_t PARALLEL_IO_THRESHOLD = 1024 * 1024;
+
+class StripeSet {
+public:
+    StripeSet();
+    ~StripeSet();
+
+    // Opens the primary container and, if it is striped, every stripe file
+    int open(const string& omni_path);
+    void close();
+    bool is_open() const { return primary_fd >= 0; }
+    uint32_t stripe_count() const { return stripe_fds.size(); }
+
+    int read(uint64_t offset, char* buffer, uint64_t size) const;
+    int write(uint64_t offset, const char* buffer, uint64_t size) const;
+    // Sizes the stripe files so they back logical offsets [0, total_size)
+    int resize(uint64_t total_size) const;
+
+private:
+    int primary_fd;
+    vector<int> stripe_fds;
+    uint64_t unit;
+
+    int transfer(uint64_t offset, char* buffer, uint64_t size, bool writing) const;
+};
+
+string stripe_manifest_path(const string& omni_path);
+
+// Turns a freshly formatted container into a striped one
+int create_stripe_set(const string& omni_path, const vector<string>& stripe_paths, uint32_t stripe_unit);
+
+// Shared data store for the managers, opened on first use from active_omni_path()
+extern StripeSet data_stripes;
+StripeSet& get_stripe_set();
@@ -0,0 +1,130 @@
+#pragma once
+#include <cstdint>
+using namespace std;
+
+/**
+ * Hierarchical timer wheel with one-second ticks
+ *
+ * Four levels of 64 slots each. Level 0 holds timers due within the next
+ * 64 ticks, one slot per tick; level 1 covers the next 64 * 64 ticks in
+ * 64-tick slots, and so on, for about 194 days in all (later deadlines
+ * wait in the last level and are looked at again when they come up).
+ * Scheduling and cancelling are O(1) list operations. Every tick fires
+ * one level-0 slot, and every 64th tick also redistributes one slot of the
+ * level above into the finer level, so the work per tick does not depend
+ * on how many timers are pending.
+ *
+ * Nodes are intrusive: the owner embeds a TimerNode and gets it back
+ * through owner when it fires. The wheel does no locking.
+ */
+
+struct TimerNode {
+    uint64_t expires = 0;       // Tick the timer is due
+    TimerNode* prev = nullptr;
+    TimerNode* next = nullptr;
+    void* owner = nullptr;
+    bool linked() const { return prev != nullptr; }
+};
+
+class TimerWheel {
+public:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const uint64_t SLOTS = 1 << SLOT_BITS;
+
+    explicit TimerWheel(uint64_t start = 0) : current(start), pending(0) {
+        for (int level = 0; level < LEVELS; level++) {
+            for (uint64_t slot = 0; slot < SLOTS; slot++) {
+                TimerNode& head = slots[level][slot];
+                head.prev = head.next = &head;
+            }
+        }
+    }
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    uint64_t now() const { return current; }
+    size_t size() const { return pending; }
+
+    // Deadlines at or before the current tick fire on the next tick
+    void schedule(TimerNode& node, uint64_t expires) {
+        if (node.linked()) cancel(node);
+        node.expires = expires;
+        link(node);
+        pending++;
+    }
+
+    void cancel(TimerNode& node) {
+        if (!node.linked()) return;
+        node.prev->next = node.next;
+        node.next->prev = node.prev;
+        node.prev = node.next = nullptr;
+        pending--;
+    }
+
+    // Moves time forward to tick, calling fire(node) for every timer that
+    // comes due on the way; fire may schedule or cancel timers
+    template <typename Fire>
+    void advance(uint64_t tick, Fire fire) {
+        // Nothing pending: no slot can need work, skip straight there
+        if (pending == 0 && tick > current) current = tick;
+        while (current < tick) {
+            current++;
+            // Refill finer levels from coarser ones as their slots come up
+            for (int level = 1; level < LEVELS; level++) {
+                if ((current & ((1ULL << (SLOT_BITS * level)) - 1)) != 0) break;
+                cascade(level, (current >> (SLOT_BITS * level)) & (SLOTS - 1));
+            }
+
+            TimerNode& head = slots[0][current & (SLOTS - 1)];
+            while (head.next != &head) {
+                TimerNode* node = head.next;
+                cancel(*node);
+                fire(*node);
+            }
+            if (pending == 0 && tick > current) current = tick;
+        }
+    }
+
+private:
+    TimerNode slots[LEVELS][SLOTS];
+    uint64_t current;
+    size_t pending;
+
+    void link(TimerNode& node) {
+        uint64_t delta = node.expires > current ? node.expires - current : 0;
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= (1ULL << (SLOT_BITS * (level + 1)))) level++;
+
+        // Past the last level's range it waits in the furthest slot
+        uint64_t at = node.expires > current ? node.expires : current + 1;
+        uint64_t range = 1ULL << (SLOT_BITS * LEVELS);
+        if (delta >= range) at = current + range - 1;
+
+        TimerNode& head = slots[level][(at >> (SLOT_BITS * level)) & (SLOTS - 1)];
+        node.prev = head.prev;
+        node.next = &head;
+        head.prev->next = &node;
+        head.prev = &node;
+    }
+
+    void cascade(int level, uint64_t slot) {
+        TimerNode& head = slots[level][slot];
+        TimerNode list;
+        if (head.next == &head) return;
+        // Detach the whole slot, then put each node where it now belongs
+        list.next = head.next;
+        list.prev = head.prev;
+        list.next->prev = &list;
+        list.prev->next = &list;
+        head.prev = head.next = &head;
+        while (list.next != &list) {
+            TimerNode* node = list.next;
+            list.next = node->next;
+            node->next->prev = &list;
+            node->prev = node->next = nullptr;
+            link(*node);
+        }
+    }
+};
@@ -0,0 +1,195 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "trace.hpp"
+using namespace std;
+
+Tracer tracer;
+thread_local uint64_t current_trace = 0;
+
+// Lanes: a small number per thread, named by name_thread
+const uint32_t TRACE_MAX_THREADS = 256;
+static atomic<uint32_t> next_thread{1};
+static atomic<const char*> thread_names[TRACE_MAX_THREADS];
+static thread_local uint32_t thread_number = 0;
+
+static uint32_t trace_thread() {
+    if (thread_number == 0) thread_number = next_thread.fetch_add(1, memory_order_relaxed);
+    return thread_number;
+}
+
+static uint64_t now_ns() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Tracer::Tracer() : period(0), capacity(0), arrivals(0), head(0) {}
+
+void Tracer::configure(double sample_rate, size_t span_capacity) {
+    if (sample_rate <= 0 || span_capacity == 0) {
+        period = 0;
+        return;
+    }
+    period = max<uint64_t>(1, llround(1 / min(sample_rate, 1.0)));
+    capacity = span_capacity;
+    ring.reset(new TraceSpan[capacity]);
+}
+
+void Tracer::name_thread(const char* name) {
+    uint32_t number = trace_thread();
+    if (number < TRACE_MAX_THREADS) thread_names[number].store(name, memory_order_relaxed);
+}
+
+void Tracer::record(uint64_t trace_id, const char* name, const char* category, uint64_t start_ns, uint64_t end_ns,
+                    string_view detail, TraceSpanKind kind) {
+    if (trace_id == 0 || !ring) return;
+
+    uint64_t position = head.fetch_add(1, memory_order_relaxed);
+    TraceSpan& span = ring[position % capacity];
+    span.sequence.store(2 * position + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    TraceSpanData& data = span.data;
+    data.trace_id = trace_id;
+    data.start_ns = start_ns;
+    data.duration_ns = end_ns > start_ns ? end_ns - start_ns : 0;
+    data.name = name;
+    data.category = category;
+    data.thread = trace_thread();
+    data.kind = kind;
+    data.detail_length = min(detail.size(), TRACE_DETAIL_SIZE);
+    memcpy(data.detail, detail.data(), data.detail_length);
+
+    span.sequence.store(2 * position + 2, memory_order_release);
+}
+
+// ============================================================================
+// SCOPES
+// ============================================================================
+
+TraceScope::TraceScope(const char* name, const char* category, string_view detail)
+    : trace_id(current_trace), name(name), category(category), detail(detail),
+      start_ns(trace_id ? now_ns() : 0) {}
+
+TraceScope::~TraceScope() {
+    if (trace_id) tracer.record(trace_id, name, category, start_ns, now_ns(), detail);
+}
+
+// ============================================================================
+// CHROME TRACE EXPORT
+// ============================================================================
+
+static void append_escaped(string& out, const char* text, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = text[i];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+        } else if (c < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            out += code;
+        } else {
+            out += (char)c;
+        }
+    }
+}
+
+// Microseconds with nanosecond digits, as the format expects
+static void append_time(string& out, uint64_t ns) {
+    char text[32];
+    snprintf(text, sizeof(text), "%llu.%03u", (unsigned long long)(ns / 1000), (unsigned)(ns % 1000));
+    out += text;
+}
+
+static void append_event(string& out, const TraceSpanData& span, char phase, uint64_t ts_ns, uint64_t origin_ns) {
+    out += "{\"name\":\"";
+    append_escaped(out, span.name, strlen(span.name));
+    out += "\",\"cat\":\"";
+    append_escaped(out, span.category, strlen(span.category));
+    out += "\",\"ph\":\"";
+    out += phase;
+    out += "\",\"pid\":1,\"tid\":";
+    out += to_string(span.kind == TRACE_REQUEST ? 0 : span.thread);
+    out += ",\"ts\":";
+    append_time(out, ts_ns - origin_ns);
+    if (phase == 'X') {
+        out += ",\"dur\":";
+        append_time(out, span.duration_ns);
+    } else {
+        out += ",\"id\":\"0x";
+        char id[24];
+        snprintf(id, sizeof(id), "%llx", (unsigned long long)span.trace_id);
+        out += id;
+        out += '"';
+    }
+    if (phase != 'e') {
+        out += ",\"args\":{\"trace\":" + to_string(span.trace_id);
+        if (span.detail_length > 0) {
+            out += ",\"detail\":\"";
+            append_escaped(out, span.detail, span.detail_length);
+            out += '"';
+        }
+        out += '}';
+    }
+    out += "},\n";
+}
+
+string Tracer::export_chrome() const {
+    // Copy out every slot that is not being written, then check the
+    // sequence again to throw away slots overwritten meanwhile
+    vector<TraceSpanData> spans;
+    uint64_t end = head.load(memory_order_acquire);
+    uint64_t begin = end > capacity ? end - capacity : 0;
+    spans.reserve(end - begin);
+    for (uint64_t position = begin; position < end; position++) {
+        const TraceSpan& slot = ring[position % capacity];
+        uint64_t before = slot.sequence.load(memory_order_acquire);
+        if (before != 2 * position + 2) continue;
+
+        spans.push_back(slot.data);
+        atomic_thread_fence(memory_order_acquire);
+        if (slot.sequence.load(memory_order_relaxed) != before) spans.pop_back();
+    }
+    // Outer spans before the ones they contain, so equal timestamps still nest
+    sort(spans.begin(), spans.end(), [](const TraceSpanData& a, const TraceSpanData& b) {
+        return a.start_ns != b.start_ns ? a.start_ns < b.start_ns : a.duration_ns > b.duration_ns;
+    });
+
+    uint64_t origin = spans.empty() ? 0 : spans.front().start_ns;
+    string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    out += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"requests\"}},\n";
+    uint32_t threads = min(next_thread.load(memory_order_relaxed), TRACE_MAX_THREADS);
+    for (uint32_t number = 1; number < threads; number++) {
+        const char* name = thread_names[number].load(memory_order_relaxed);
+        if (!name) continue;
+        out += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + to_string(number) +
+               ",\"args\":{\"name\":\"";
+        append_escaped(out, name, strlen(name));
+        out += "\"}},\n";
+    }
+
+    for (const TraceSpanData& span : spans) {
+        if (span.kind == TRACE_REQUEST) {
+            append_event(out, span, 'b', span.start_ns, origin);
+        } else {
+            append_event(out, span, 'X', span.start_ns, origin);
+        }
+    }
+    // Async ends go after every begin, inner ones first
+    vector<const TraceSpanData*> ends;
+    for (const TraceSpanData& span : spans) {
+        if (span.kind == TRACE_REQUEST) ends.push_back(&span);
+    }
+    sort(ends.begin(), ends.end(), [](const TraceSpanData* a, const TraceSpanData* b) {
+        uint64_t a_end = a->start_ns + a->duration_ns, b_end = b->start_ns + b->duration_ns;
+        return a_end != b_end ? a_end < b_end : a->duration_ns < b->duration_ns;
+    });
+    for (const TraceSpanData* span : ends) append_event(out, *span, 'e', span->start_ns + span->duration_ns, origin);
+
+    if (out.compare(out.size() - 2, 2, ",\n") == 0) out.erase(out.size() - 2, 1);
+    out += "]}\n";
+    return out;
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+using namespace std;
+
+/**
+ * Sampled request tracing, exported as Chrome trace-event JSON
+ *
+ * One request in every 1/sample_rate gets a trace id when it arrives. Its
+ * spans (parse, queue wait, handler, storage calls, encode, send) are
+ * timestamped with the steady clock and land in one ring of TraceSpan
+ * slots allocated when tracing is configured, so recording a span never
+ * allocates: a slot is claimed with one fetch_add and guarded by a
+ * sequence number (seqlock) while it is filled. Once the ring wraps, the
+ * oldest spans are overwritten.
+ *
+ * Code that does not know which request it serves (storage, the index)
+ * opens a TRACE_SCOPE; it records only while the thread's current_trace is
+ * set, which costs one thread-local load otherwise.
+ *
+ * export_chrome() writes what the ring holds in the trace-event format
+ * chrome://tracing and Perfetto load: each request is an async track
+ * (ph "b"/"e") with its queue wait nested in it, and the work done for it
+ * are complete events (ph "X") on the lane of the thread that did it.
+ */
+
+const size_t TRACE_DETAIL_SIZE = 64;        // Bytes of path or other detail kept per span
+
+enum TraceSpanKind : uint8_t {
+    TRACE_THREAD,               // Work on the recording thread
+    TRACE_REQUEST               // Part of the request's own track, not tied to a thread
+};
+
+struct TraceSpanData {
+    uint64_t trace_id;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    const char* name;               // Static strings only
+    const char* category;
+    uint32_t thread;
+    uint8_t kind;
+    uint8_t detail_length;
+    char detail[TRACE_DETAIL_SIZE];
+};
+
+struct TraceSpan {
+    atomic<uint64_t> sequence{0};   // Odd while being written, 0 if never used
+    TraceSpanData data;
+};
+
+// Trace id of the request this thread is working on; 0 = none
+extern thread_local uint64_t current_trace;
+
+class Tracer {
+public:
+    Tracer();
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    // Call once before any thread traces; rate 0 turns tracing off
+    void configure(double sample_rate, size_t capacity);
+    bool enabled() const { return period != 0; }
+
+    // A trace id for the next request, or 0 if it is not sampled
+    uint64_t sample() {
+        if (period == 0) return 0;
+        uint64_t n = arrivals.fetch_add(1, memory_order_relaxed);
+        return n % period == 0 ? n + 1 : 0;
+    }
+
+    void record(uint64_t trace_id, const char* name, const char* category, uint64_t start_ns, uint64_t end_ns,
+                string_view detail = string_view(), TraceSpanKind kind = TRACE_THREAD);
+
+    // Names the calling thread's lane in exported traces (static string)
+    static void name_thread(const char* name);
+
+    string export_chrome() const;
+    uint64_t recorded() const { return head.load(memory_order_relaxed); }
+
+private:
+    uint64_t period;                // Every period-th request is traced; 0 = off
+    size_t capacity;
+    unique_ptr<TraceSpan[]> ring;
+    atomic<uint64_t> arrivals;
+    atomic<uint64_t> head;          // Spans recorded so far
+};
+
+extern Tracer tracer;
+
+// Records the enclosing block as a span of the thread's current request
+class TraceScope {
+public:
+    TraceScope(const char* name, const char* category, string_view detail = string_view());
+    ~TraceScope();
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    uint64_t trace_id;
+    const char* name;
+    const char* category;
+    string_view detail;
+    uint64_t start_ns;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name, category, ...) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name, category, ##__VA_ARGS__)
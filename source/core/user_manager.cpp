@@ -4,31 +4,34 @@
 #include <ctime>
 #include <algorithm>
 #include <map>
+#include <mutex>
+#include <functional>
 #include "../include/odf_types.hpp"
 #include "../include/ofs_functions.hpp"
 #include "helper.hpp"
+#include "session_table.hpp"
+#include "hash_table.hpp"
+#include "logger.hpp"
 using namespace std;
 
-vector<UserInfo> user_list_internal;
+// The server calls into this module from several worker threads; every
+// function that touches the globals below holds user_mutex (recursive, as
+// they call each other)
+recursive_mutex user_mutex;
+
+// The user table is read once (by fs_init, or on first use) into an index
+// keyed by username; afterwards logins and lookups never touch the disk,
+// and create/delete write only the one slot they change
+UserHashTable user_index;
+vector<uint32_t> free_user_slots;       // Descending, so back() is the lowest
 bool users_loaded = false;
 
-vector<SessionInfo> active_sessions;
+SessionTable active_sessions;
 
 // Map to store actual passwords (username -> password)
 // In production, this should be encrypted, but for your requirement we'll keep it
 map<string, string> actual_passwords;
 
-bool compare_username(const char* username_array, const string& username) {
-    size_t i = 0;
-    while (i < username.length() && username_array[i] != '\0') {
-        if (username_array[i] != username[i]) {
-            return false;
-        }
-        i++;
-    }
-    return (i == username.length() && username_array[i] == '\0');
-}
-
 string hash_password(const string& password) {
     int hash = 0;
     for (size_t i = 0; i < password.length(); i++) {
@@ -37,37 +40,24 @@ string hash_password(const string& password) {
     return to_string(hash);
 }
 
-string generate_session_id(const string& username) {
-    return username + "_" + to_string(time(nullptr));
-}
-
 UserInfo* find_user(const string& username) {
-    for (size_t i = 0; i < user_list_internal.size(); i++) {
-        if (compare_username(user_list_internal[i].username, username)) {
-            return &user_list_internal[i];
-        }
-    }
-    return nullptr;
+    lock_guard<recursive_mutex> lock(user_mutex);
+    UserNode* node = user_index.get(username);
+    return node ? &node->info : nullptr;
 }
 
 bool user_exists(const string& username) {
     return find_user(username) != nullptr;
 }
 
-SessionInfo* find_session(const string& session_id) {
-    for (size_t i = 0; i < active_sessions.size(); i++) {
-        string current_id(active_sessions[i].session_id);
-        if (current_id == session_id) {
-            return &active_sessions[i];
-        }
-    }
-    return nullptr;
+bool find_session(const string& session_id, SessionInfo& out) {
+    return active_sessions.find(session_id, out);
 }
 
 int load_users(const string& omni_path) {
     ifstream file(omni_path, ios::binary);
     if (!file) {
-        cerr << "Error: Cannot open file" << endl;
+        LOG_ERROR("Error: Cannot open file");
         return ERROR_IO_ERROR;
     }
 
@@ -75,36 +65,70 @@ int load_users(const string& omni_path) {
     file.read((char*)&header, sizeof(header));
 
     if (!compare(header.magic, "OMNIFS01", 8)) {
-        cerr << "Error: Invalid file format" << endl;
+        LOG_ERROR("Error: Invalid file format");
         return ERROR_INVALID_CONFIG;
     }
 
-    file.seekg(header.user_table_offset, ios::beg);
-
-    user_list_internal.clear();
+    // The whole table in one read
+    vector<UserInfo> table(header.max_users, UserInfo("", "", NORMAL, 0));
+    file.seekg(header.getUserTableOffset(), ios::beg);
+    file.read((char*)table.data(), (streamsize)table.size() * sizeof(UserInfo));
+    if (!file) {
+        LOG_ERROR("Error: Cannot read user table");
+        return ERROR_IO_ERROR;
+    }
+    file.close();
 
-    for (uint32_t i = 0; i < header.max_users; i++) {
-        UserInfo user("", "", NORMAL, 0);
-        file.read((char*)&user, sizeof(user));
+    lock_guard<recursive_mutex> lock(user_mutex);
+    user_index.clear();
+    free_user_slots.clear();
 
+    for (uint32_t i = header.max_users; i-- > 0; ) {
+        UserInfo& user = table[i];
         if (user.is_active == 1 && user.username[0] != '\0') {
-            user_list_internal.push_back(user);
-            
+            user_index.insert(string(user.username), user, i);
+
             // Store the password hash as the "actual password" for now
             // Note: In real systems you'd store encrypted passwords separately
             actual_passwords[string(user.username)] = string(user.password_hash);
+        } else {
+            free_user_slots.push_back(i);
         }
     }
 
     users_loaded = true;
-    cout << "Loaded " << user_list_internal.size() << " users into memory" << endl;
-    
-    file.close();
+    LOG_INFO("Loaded " << user_index.count() << " users into memory");
+    return SUCCESS;
+}
+
+// Writes user into its slot of the on-disk table
+static int write_user_slot(const string& omni_path, uint32_t slot, const UserInfo& user) {
+    fstream file(omni_path, ios::in | ios::out | ios::binary);
+    if (!file) {
+        LOG_ERROR("Error: Cannot open file");
+        return ERROR_IO_ERROR;
+    }
+
+    OMNIHeader header(0, 0, 0, 0);
+    file.read((char*)&header, sizeof(header));
+    if (!file || slot >= header.max_users) {
+        LOG_ERROR("Error: User slot " << slot << " is outside the user table");
+        return ERROR_IO_ERROR;
+    }
+
+    file.seekp(header.getUserTableOffset() + (uint64_t)slot * sizeof(UserInfo), ios::beg);
+    file.write((const char*)&user, sizeof(user));
+    file.flush();
+    if (!file) {
+        LOG_ERROR("Error: Cannot write user slot " << slot);
+        return ERROR_IO_ERROR;
+    }
     return SUCCESS;
 }
 
 // Returns user list with actual passwords for admin
 int user_list(const string& omni_path, vector<UserInfo>& users, bool include_passwords) {
+    lock_guard<recursive_mutex> lock(user_mutex);
     if (!users_loaded) {
         int result = load_users(omni_path);
         if (result != SUCCESS) {
@@ -112,7 +136,7 @@ int user_list(const string& omni_path, vector<UserInfo>& users, bool include_pas
         }
     }
     
-    users = user_list_internal;
+    users = user_index.getAllUsers();
     return SUCCESS;
 }
 
@@ -121,123 +145,84 @@ int user_create(const string& omni_path,
                 const string& password, 
                 uint32_t role) 
 {
+    lock_guard<recursive_mutex> lock(user_mutex);
     if (!users_loaded) {
         load_users(omni_path);
     }
 
     if (user_exists(username)) {
-        cerr << "Error: User '" << username << "' already exists" << endl;
+        LOG_ERROR("Error: User '" << username << "' already exists");
         return ERROR_FILE_EXISTS;
     }
 
+    if (free_user_slots.empty()) {
+        LOG_ERROR("Error: No free user slots available");
+        return ERROR_NO_SPACE;
+    }
+
     string hashed_pw = hash_password(password);
     UserInfo new_user(username, hashed_pw, (UserRole)role, (uint64_t)time(nullptr));
 
-    fstream file(omni_path, ios::in | ios::out | ios::binary);
-    if (!file) {
-        cerr << "Error: Cannot open file" << endl;
-        return ERROR_IO_ERROR;
+    uint32_t slot = free_user_slots.back();
+    int result = write_user_slot(omni_path, slot, new_user);
+    if (result != SUCCESS) {
+        return result;
     }
+    free_user_slots.pop_back();
+    user_index.insert(username, new_user, slot);
 
-    OMNIHeader header(0, 0, 0, 0);
-    file.read((char*)&header, sizeof(header));
+    LOG_INFO("SUCCESS: User '" << username << "' created at slot " << slot);
 
-    file.seekp(header.user_table_offset, ios::beg);
-
-    for (uint32_t i = 0; i < header.max_users; i++) {
-        UserInfo temp("", "", NORMAL, 0);
-        
-        uint64_t current_pos = header.user_table_offset + (i * sizeof(UserInfo));
-        file.seekg(current_pos, ios::beg);
-        file.read((char*)&temp, sizeof(temp));
-
-        if (temp.username[0] == '\0' || temp.is_active == 0) {
-            file.seekp(current_pos, ios::beg);
-            file.write((char*)&new_user, sizeof(new_user));
-            
-            cout << "SUCCESS: User '" << username << "' created at slot " << i << endl;
-            file.close();
-            
-            user_list_internal.push_back(new_user);
-            
-            // Store actual password in memory
-            actual_passwords[username] = password;
-            
-            return SUCCESS;
-        }
-    }
+    // Store actual password in memory
+    actual_passwords[username] = password;
 
-    file.close();
-    cerr << "Error: No free user slots available" << endl;
-    return ERROR_NO_SPACE;
+    return SUCCESS;
 }
 
 int user_delete(const string& omni_path, const string& username) {
+    lock_guard<recursive_mutex> lock(user_mutex);
     if (!users_loaded) {
         load_users(omni_path);
     }
 
-    if (!user_exists(username)) {
-        cerr << "Error: User '" << username << "' not found" << endl;
+    UserNode* node = user_index.get(username);
+    if (!node) {
+        LOG_ERROR("Error: User '" << username << "' not found");
         return ERROR_NOT_FOUND;
     }
 
     // Don't allow deleting admin user
     if (username == "admin") {
-        cerr << "Error: Cannot delete admin user" << endl;
+        LOG_ERROR("Error: Cannot delete admin user");
         return ERROR_PERMISSION_DENIED;
     }
 
-    fstream file(omni_path, ios::in | ios::out | ios::binary);
-    if (!file) {
-        cerr << "Error: Cannot open file" << endl;
-        return ERROR_IO_ERROR;
+    // Mark user as inactive
+    UserInfo user = node->info;
+    user.is_active = 0;
+    user.username[0] = '\0';
+
+    uint32_t slot = node->slot;
+    int result = write_user_slot(omni_path, slot, user);
+    if (result != SUCCESS) {
+        return result;
     }
 
-    OMNIHeader header(0, 0, 0, 0);
-    file.read((char*)&header, sizeof(header));
+    user_index.remove(username);
+    free_user_slots.insert(upper_bound(free_user_slots.begin(), free_user_slots.end(), slot, greater<uint32_t>()), slot);
 
-    file.seekg(header.user_table_offset, ios::beg);
-
-    for (uint32_t i = 0; i < header.max_users; i++) {
-        UserInfo user("", "", NORMAL, 0);
-        
-        uint64_t current_pos = header.user_table_offset + (i * sizeof(UserInfo));
-        file.seekg(current_pos, ios::beg);
-        file.read((char*)&user, sizeof(user));
-
-        if (user.is_active == 1 && compare_username(user.username, username)) {
-            // Mark user as inactive
-            user.is_active = 0;
-            user.username[0] = '\0';
-            
-            file.seekp(current_pos, ios::beg);
-            file.write((char*)&user, sizeof(user));
-            file.flush();
-            file.close();
-            
-            // Remove from internal list
-            for (size_t j = 0; j < user_list_internal.size(); j++) {
-                if (compare_username(user_list_internal[j].username, username)) {
-                    user_list_internal.erase(user_list_internal.begin() + j);
-                    break;
-                }
-            }
-            
-            // Remove from password map
-            actual_passwords.erase(username);
-            
-            cout << "SUCCESS: User '" << username << "' deleted" << endl;
-            return SUCCESS;
-        }
-    }
+    // Remove from password map
+    actual_passwords.erase(username);
 
-    file.close();
-    cerr << "Error: User not found in file system" << endl;
-    return ERROR_NOT_FOUND;
+    size_t ended = active_sessions.remove_user(username);
+    if (ended > 0) LOG_INFO("Ended " << ended << " session(s) of '" << username << "'");
+
+    LOG_INFO("SUCCESS: User '" << username << "' deleted");
+    return SUCCESS;
 }
 
 string get_user_password(const string& username) {
+    lock_guard<recursive_mutex> lock(user_mutex);
     if (actual_passwords.find(username) != actual_passwords.end()) {
         return actual_passwords[username];
     }
@@ -245,11 +230,13 @@ string get_user_password(const string& username) {
 }
 
 void user_list_all() {
+    lock_guard<recursive_mutex> lock(user_mutex);
     cout << "\n=== All Users ===" << endl;
-    cout << "Total: " << user_list_internal.size() << " users\n" << endl;
+    vector<UserInfo> users = user_index.getAllUsers();
+    cout << "Total: " << users.size() << " users\n" << endl;
     
-    for (size_t i = 0; i < user_list_internal.size(); i++) {
-        UserInfo& u = user_list_internal[i];
+    for (size_t i = 0; i < users.size(); i++) {
+        UserInfo& u = users[i];
         cout << (i + 1) << ". " << u.username;
         cout << " (Role: " << (u.role == ADMIN ? "Admin" : "Normal") << ")";
         cout << endl;
@@ -258,87 +245,68 @@ void user_list_all() {
 }
 
 int user_login(void** session, const string& username, const string& password, const string& omni_path) {
-    ifstream file(omni_path, ios::binary);
-    if (!file) {
-        cerr << "Error: Cannot open file " << omni_path << endl;
-        return ERROR_IO_ERROR;
+    lock_guard<recursive_mutex> lock(user_mutex);
+    if (!users_loaded) {
+        int result = load_users(omni_path);
+        if (result != SUCCESS) {
+            return result;
+        }
     }
 
-    OMNIHeader header(0, 0, 0, 0);
-    file.read((char*)&header, sizeof(header));
-
-    file.seekg(header.user_table_offset, ios::beg);
-
-    for (uint32_t i = 0; i < header.max_users; i++) {
-        UserInfo user("", "", NORMAL, 0);
-        file.read((char*)&user, sizeof(user));
-
-        if (!file) 
-            break;
-
-        if (user.is_active == 1 && compare_username(user.username, username)) {
-            
-            string input_hash = hash_password(password);
-            string stored_hash(user.password_hash);
-
-            if (input_hash != stored_hash) {
-                cerr << "Error: Invalid password for user '" << username << "'" << endl;
-                file.close();
-                return ERROR_PERMISSION_DENIED;
-            }
-
-            string session_id = generate_session_id(username);
-            SessionInfo new_session(session_id, user, time(nullptr));
+    UserNode* node = user_index.get(username);
+    if (!node) {
+        LOG_ERROR("Error: User '" << username << "' not found");
+        return ERROR_NOT_FOUND;
+    }
 
-            active_sessions.push_back(new_session);
-            *session = &active_sessions[active_sessions.size() - 1];
+    string input_hash = hash_password(password);
+    string stored_hash(node->info.password_hash);
 
-            // Store actual password when user logs in
-            if (actual_passwords.find(username) == actual_passwords.end()) {
-                actual_passwords[username] = password;
-            }
+    if (input_hash != stored_hash) {
+        LOG_ERROR("Error: Invalid password for user '" << username << "'");
+        return ERROR_PERMISSION_DENIED;
+    }
 
-            cout << "SUCCESS: User '" << username << "' logged in (Role: " 
-                 << (user.role == ADMIN ? "ADMIN" : "USER") << ")" << endl;
+    node->info.last_login = time(nullptr);
+    // A copy: the session itself can end on another thread at any time
+    *session = new SessionInfo(active_sessions.create(node->info));
 
-            file.close();
-            return SUCCESS;
-        }
+    // Store actual password when user logs in
+    if (actual_passwords.find(username) == actual_passwords.end()) {
+        actual_passwords[username] = password;
     }
 
-    cerr << "Error: User '" << username << "' not found" << endl;
-    file.close();
-    return ERROR_NOT_FOUND;
+    LOG_DEBUG("SUCCESS: User '" << username << "' logged in (Role: " 
+           << (node->info.role == ADMIN ? "ADMIN" : "USER") << ")");
+
+    return SUCCESS;
 }
 
 int user_logout(void* session) {
     if (!session) {
-        cerr << "Error: Invalid session pointer" << endl;
+        LOG_ERROR("Error: Invalid session pointer");
         return ERROR_INVALID_SESSION;
     }
 
     SessionInfo* session_ptr = (SessionInfo*)session;
     string session_id(session_ptr->session_id);
 
-    for (size_t i = 0; i < active_sessions.size(); i++) {
-        string current_id(active_sessions[i].session_id);
-        if (current_id == session_id) {
-            cout << "SUCCESS: Logged out session " << session_id << endl;
-            active_sessions.erase(active_sessions.begin() + i);
-            return SUCCESS;
-        }
+    if (active_sessions.remove(session_id)) {
+        LOG_DEBUG("SUCCESS: Logged out session " << session_id);
+        return SUCCESS;
     }
 
-    cerr << "Error: Session not found" << endl;
+    LOG_ERROR("Error: Session not found");
     return ERROR_INVALID_SESSION;
 }
 
 int get_session_info(void* session, SessionInfo* out_info) {
     if (!session || !out_info) {
-        cerr << "Error: Invalid session or output pointer" << endl;
+        LOG_ERROR("Error: Invalid session or output pointer");
         return ERROR_INVALID_SESSION;
     }
 
+    lock_guard<recursive_mutex> lock(user_mutex);
     SessionInfo* session_ptr = (SessionInfo*)session;
     *out_info = *session_ptr;
 
@@ -347,13 +315,128 @@ int get_session_info(void* session, SessionInfo* out_info) {
 
 void list_active_sessions() {
     cout << "\n=== Active Sessions ===" << endl;
-    cout << "Total: " << active_sessions.size() << " sessions\n" << endl;
+    vector<SessionInfo> sessions = active_sessions.list();
+    cout << "Total: " << sessions.size() << " sessions\n" << endl;
 
-    for (size_t i = 0; i < active_sessions.size(); i++) {
-        SessionInfo& s = active_sessions[i];
-        cout << (i + 1) << ". " << s.user.username;
+    size_t i = 0;
+    for (SessionInfo& s : sessions) {
+        cout << (++i) << ". " << s.user.username;
         cout << " (Session: " << s.session_id << ")";
         cout << endl;
     }
     cout << "======================\n" << endl;
-}
\ No newline at end of file
+}
+// ============================================================================
+// TEST
+// ============================================================================
+
+int test_user_hash_table() {
+    int failures = 0;
+
+    cout << "\n========================================" << endl;
+    cout << "  USER HASH TABLE TEST" << endl;
+    cout << "========================================\n" << endl;
+
+    // Test 1: Deleting from the middle of a probe chain keeps the rest reachable
+    cout << "Test 1: Delete and reinsert along one probe chain..." << endl;
+    UserHashTable table(8);
+    size_t capacity = table.capacity();
+    vector<string> chain;
+    size_t home = table.home_slot("chain0");
+    for (int i = 0; chain.size() < 3; i++) {
+        string name = "chain" + to_string(i);
+        if (table.home_slot(name) == home) chain.push_back(name);
+    }
+    for (size_t i = 0; i < chain.size(); i++) table.insert(chain[i], UserInfo(chain[i], "", NORMAL, 0), i);
+    table.remove(chain[1]);
+    if (table.get(chain[1]) || !table.get(chain[2]) || table.get(chain[2])->slot != 2) {
+        cerr << "FAILED: Entry behind a tombstone lost" << endl;
+        failures++;
+    }
+    table.insert(chain[1], UserInfo(chain[1], "", NORMAL, 0), 7);
+    table.remove(chain[0]);
+    if (!table.get(chain[1]) || table.get(chain[1])->slot != 7 || !table.get(chain[2]) || table.get(chain[0]) ||
+        table.count() != 2 || table.capacity() != capacity) {
+        cerr << "FAILED: Reinsert into the chain went wrong" << endl;
+        failures++;
+    }
+    table.insert(chain[2], UserInfo(chain[2], "", ADMIN, 0), 9);
+    if (table.count() != 2 || table.get(chain[2])->slot != 9 || table.get(chain[2])->info.role != ADMIN) {
+        cerr << "FAILED: Inserting an existing name did not update it in place" << endl;
+        failures++;
+    }
+
+    // Test 2: Growth keeps the table at most 70% full and every entry reachable
+    cout << "\nTest 2: Grow past 70% load..." << endl;
+    UserHashTable grown(4);
+    size_t growths = 0;
+    for (uint32_t i = 0; i < 5000; i++) {
+        size_t before = grown.capacity();
+        string name = "user" + to_string(i);
+        grown.insert(name, UserInfo(name, "", NORMAL, 0), i);
+        if (grown.capacity() != before) growths++;
+        if (grown.count() * 10 > grown.capacity() * 7) {
+            cerr << "FAILED: " << grown.count() << " users in " << grown.capacity() << " slots" << endl;
+            failures++;
+            break;
+        }
+    }
+    for (uint32_t i = 0; i < 5000; i++) {
+        UserNode* node = grown.get("user" + to_string(i));
+        if (!node || node->slot != i) {
+            cerr << "FAILED: user" << i << " lost after growing" << endl;
+            failures++;
+            break;
+        }
+    }
+    if (growths == 0) {
+        cerr << "FAILED: Table never grew" << endl;
+        failures++;
+    }
+
+    // Test 3: Churn through tombstones without growing without bound
+    cout << "\nTest 3: Insert/delete churn..." << endl;
+    UserHashTable churn(8);
+    for (int i = 0; i < 20000; i++) {
+        string name = "churn" + to_string(i);
+        churn.insert(name, UserInfo(name, "", NORMAL, 0), i);
+        if (i >= 8) churn.remove("churn" + to_string(i - 8));
+    }
+    bool live = true;
+    for (int i = 20000 - 8; i < 20000; i++) live = live && churn.get("churn" + to_string(i));
+    if (!live || churn.count() != 8 || churn.capacity() > 64) {
+        cerr << "FAILED: After churn " << churn.count() << " users in " << churn.capacity() << " slots" << endl;
+        failures++;
+    }
+
+    // Test 4: getAllUsers returns on-disk slot order, skipping deleted users
+    cout << "\nTest 4: getAllUsers order after deletes..." << endl;
+    UserHashTable ordered;
+    for (uint32_t i = 0; i < 100; i++) {
+        uint32_t slot = (i * 37) % 100;
+        string name = "slot" + to_string(slot);
+        ordered.insert(name, UserInfo(name, "", NORMAL, 0), slot);
+    }
+    for (uint32_t slot = 0; slot < 100; slot += 3) ordered.remove("slot" + to_string(slot));
+    vector<UserInfo> all = ordered.getAllUsers();
+    vector<string> expected;
+    for (uint32_t slot = 0; slot < 100; slot++) {
+        if (slot % 3 != 0) expected.push_back("slot" + to_string(slot));
+    }
+    bool in_order = all.size() == expected.size();
+    for (size_t i = 0; in_order && i < all.size(); i++) in_order = expected[i] == all[i].username;
+    if (!in_order) {
+        cerr << "FAILED: getAllUsers returned " << all.size() << " users out of slot order" << endl;
+        failures++;
+    }
+
+    cout << "\n========================================" << endl;
+    if (failures == 0) {
+        cout << "  ✓ ALL TESTS PASSED!" << endl;
+    } else {
+        cout << "  ✗ " << failures << " CHECK(S) FAILED" << endl;
+    }
+    cout << "========================================\n" << endl;
+
+    return failures == 0 ? SUCCESS : ERROR_IO_ERROR;
+}
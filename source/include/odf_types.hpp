@@ -36,7 +36,9 @@ enum OFSErrorCodes : int32_t {
     ERROR_NOT_IMPLEMENTED = -8,      // Feature not yet implemented
     ERROR_INVALID_SESSION = -9,      // Session is invalid or expired
     ERROR_DIRECTORY_NOT_EMPTY = -10, // Cannot delete non-empty directory
-    ERROR_INVALID_OPERATION = -11    // Operation not allowed
+    ERROR_INVALID_OPERATION = -11,   // Operation not allowed
+    ERROR_TIMEOUT = -12,             // Request expired before it could run
+    ERROR_BUSY = -13                 // Server saturated, retry later
 };
 
 /**
@@ -107,6 +109,60 @@ struct OMNIHeader {
         std::memset(config_hash, 0, sizeof(config_hash));
         std::memset(reserved, 0, sizeof(reserved));
     }
+
+    // Number of metadata table slots, kept in reserved[0..3]. 0 means the
+    // container still has the table size it was formatted with.
+    uint32_t getFileTableSlots() const {
+        uint32_t slots;
+        std::memcpy(&slots, reserved, sizeof(slots));
+        return slots;
+    }
+
+    void setFileTableSlots(uint32_t slots) {
+        std::memcpy(reserved, &slots, sizeof(slots));
+    }
+
+    // Byte offset of the user table. fs_grow can move the table into the
+    // data area, past what user_table_offset can hold, so the full value
+    // lives in reserved[8..15] and falls back to user_table_offset.
+    uint64_t getUserTableOffset() const {
+        uint64_t offset;
+        std::memcpy(&offset, reserved + 8, sizeof(offset));
+        return offset != 0 ? offset : user_table_offset;
+    }
+
+    void setUserTableOffset(uint64_t offset) {
+        user_table_offset = static_cast<uint32_t>(offset);
+        std::memcpy(reserved + 8, &offset, sizeof(offset));
+    }
+
+    // Striped containers keep file data in separate stripe files (see
+    // core/stripe_set.hpp). reserved[16..19] holds the stripe count (0 when
+    // data lives in this file), [20..23] the stripe unit in bytes and
+    // [24..31] the id written into every stripe file of the set.
+    uint32_t getStripeCount() const {
+        uint32_t count;
+        std::memcpy(&count, reserved + 16, sizeof(count));
+        return count;
+    }
+
+    uint32_t getStripeUnit() const {
+        uint32_t unit;
+        std::memcpy(&unit, reserved + 20, sizeof(unit));
+        return unit;
+    }
+
+    uint64_t getStripeSetId() const {
+        uint64_t id;
+        std::memcpy(&id, reserved + 24, sizeof(id));
+        return id;
+    }
+
+    void setStripeLayout(uint32_t count, uint32_t unit, uint64_t set_id) {
+        std::memcpy(reserved + 16, &count, sizeof(count));
+        std::memcpy(reserved + 20, &unit, sizeof(unit));
+        std::memcpy(reserved + 24, &set_id, sizeof(set_id));
+    }
 };  // Total: 512 bytes
 
 /**
@@ -149,7 +205,7 @@ struct FileEntry {
     uint64_t modified_time;     // Last modification timestamp (Unix epoch)
     char owner[32];             // Username of owner
     uint32_t inode;             // Internal file identifier
-    uint8_t reserved[47];       // Reserved for future use
+    uint8_t reserved[47];       // [0..7] 64-bit data offset, rest reserved
 
     // Default constructor
     // FileEntry() = default;
@@ -173,6 +229,21 @@ struct FileEntry {
     
     // Setter for type as enum
     void setType(EntryType entry_type) { type = static_cast<uint8_t>(entry_type); }
+
+    // Byte offset of the file content inside the container. The full value
+    // lives in reserved[0..7]; inode keeps the low 32 bits for readers that
+    // only know the standard layout. Entries written before the offset was
+    // stored there fall back to inode.
+    uint64_t getDataOffset() const {
+        uint64_t offset;
+        std::memcpy(&offset, reserved, sizeof(offset));
+        return offset != 0 ? offset : inode;
+    }
+
+    void setDataOffset(uint64_t offset) {
+        inode = static_cast<uint32_t>(offset);
+        std::memcpy(reserved, &offset, sizeof(offset));
+    }
 };  // Total: 416 bytes
 
 /**
@@ -10,8 +10,12 @@ int fs_init(void** instance, const char* omni_path, const char* config_path);
 void fs_shutdown(void* instance);
 int fs_format(const std::string& omni_path, const std::string& student_id, 
               const std::string& submission_date, uint64_t total_size, uint64_t block_size);
+int fs_grow(void* session, uint64_t new_total_size, uint32_t new_max_files, uint32_t new_max_users);
+int fs_shrink(void* session, uint64_t new_total_size);
 
 // User Management
+// *session receives a SessionInfo copy of the new session, owned by the caller
+// (delete it when done); user_logout ends the session a copy names
 int user_login(void** session, const std::string& username, const std::string& password, const std::string& omni_path);
 int user_logout(void* session);
 int user_create(const std::string& omni_path, const std::string& username, 
@@ -37,6 +41,8 @@ int dir_exists(void* session, const std::string& path);
 // Information Functions
 int get_metadata(void* session, const std::string& path, FileMetadata& meta);
 int set_permissions(void* session, const std::string& path, uint32_t permissions);
+// Owner, permissions and times of saved onto the entry now at path (undo of a delete)
+int restore_metadata(void* session, const std::string& path, const FileEntry& saved);
 int get_stats(void* session, FSStats& stats);
 std::string get_error_message(int error_code);
 
@@ -1,22 +1,105 @@
 // client.cpp - Comprehensive OFS Test Client
 #include <iostream>
+#include <fstream>
 #include <string>
+#include <vector>
+#include <unordered_map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <random>
+#include <cstdlib>
+#include <cstdio>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include "protocol.hpp"
+#include "../include/odf_types.hpp"
+#include "../core/metrics.hpp"
 
 using namespace std;
 
+// One request, encoded for whichever protocol the client negotiated
+struct ClientRequest {
+    string operation;
+    string session_id;                          // Empty: the client's login session
+    vector<pair<string, string>> params;        // Text and byte parameters
+    vector<pair<string, uint64_t>> numbers;     // Numeric parameters
+    vector<ClientRequest> operations;           // batch only
+    bool atomic = false;
+    
+    ClientRequest(const string& op, const string& session = "") : operation(op), session_id(session) {}
+    
+    ClientRequest& param(const string& name, const string& value) {
+        params.push_back({name, value});
+        return *this;
+    }
+    
+    ClientRequest& number(const string& name, uint64_t value) {
+        numbers.push_back({name, value});
+        return *this;
+    }
+    
+    ClientRequest& add(const ClientRequest& operation) {
+        operations.push_back(operation);
+        return *this;
+    }
+    
+    ClientRequest& all_or_nothing() {
+        atomic = true;
+        return *this;
+    }
+};
+
+struct ClientResponse {
+    bool ok = false;
+    int error_code = 0;
+    string error_message;
+    uint64_t retry_after_ms = 0;    // ERROR_BUSY (binary protocol)
+    string content;             // file_read content (binary protocol)
+    bool has_content = false;
+    string request_id;          // Echoed by the server
+    string text;                // The whole response as JSON, for printing
+};
+
+string escape_json(const string& input) {
+    string output;
+    output.reserve(input.size() + 2);
+    for (unsigned char c : input) {
+        if (c == '"' || c == '\\') {
+            output += '\\';
+            output += c;
+        } else if (c < 0x20) {
+            char buf[7];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            output += buf;
+        } else {
+            output += c;
+        }
+    }
+    return output;
+}
+
 class OFSClient {
 private:
     int sock;
     bool connected;
+    bool binary;
+    uint64_t next_request_id;
+    string session_id;          // From the last successful user_login
 
 public:
-    OFSClient() : sock(-1), connected(false) {}
+    bool quiet = false;         // No connection message, for output that is piped on
+
+    // binary selects the binary protocol, otherwise requests are framed JSON
+    OFSClient(bool use_binary = false) : sock(-1), connected(false), binary(use_binary), next_request_id(1) {}
     
     ~OFSClient() { disconnect(); }
     
+    bool logged_in() const { return !session_id.empty(); }
+    
     bool connect_to_server(const string& host, int port) {
         sock = socket(AF_INET, SOCK_STREAM, 0);
         if (sock < 0) {
@@ -34,8 +117,28 @@ public:
             return false;
         }
         
+        // Every request and response after the preamble is length-prefixed
+        string preamble = binary ? string(BINARY_PREAMBLE, sizeof(BINARY_PREAMBLE)) + (char)BINARY_VERSION
+                                 : string(FRAMED_PREAMBLE, sizeof(FRAMED_PREAMBLE));
+        if (!send_all(preamble.data(), preamble.size())) {
+            cerr << "Error: Cannot reach server" << endl;
+            return false;
+        }
+        
+        if (binary) {
+            char version = 0;
+            if (!recv_all(&version, 1) || version == '{') {
+                cerr << "Error: Server refused the connection" << endl;
+                return false;
+            }
+            if ((uint8_t)version != BINARY_VERSION) {
+                cerr << "Error: Server does not speak binary protocol version " << (int)BINARY_VERSION << endl;
+                return false;
+            }
+        }
+        
         connected = true;
-        cout << "✓ Connected to " << host << ":" << port << endl;
+        if (!quiet) cout << "✓ Connected to " << host << ":" << port << (binary ? " (binary protocol)" : "") << endl;
         return true;
     }
     
@@ -46,124 +149,773 @@ public:
         }
     }
     
-    string send_request(const string& json_request) {
-        if (!connected) return "{\"status\":\"error\"}";
+    ClientResponse call(const ClientRequest& request) {
+        return send_pipelined(vector<ClientRequest>(1, request))[0];
+    }
+    
+    // Sends every request in one write and then collects the responses.
+    // The server answers each one as soon as it finishes, so they arrive
+    // in any order; each is put back in the slot of the request whose
+    // request_id it echoes.
+    vector<ClientResponse> send_pipelined(const vector<ClientRequest>& requests) {
+        vector<ClientResponse> responses(requests.size());
+        for (ClientResponse& response : responses) response.text = "{\"status\":\"error\"}";
+        if (!connected) return responses;
         
-        send(sock, json_request.c_str(), json_request.length(), 0);
+        string frames;
+        unordered_map<string, size_t> outstanding;
+        for (size_t i = 0; i < requests.size(); i++) {
+            string request_id = to_string(next_request_id++);
+            outstanding[request_id] = i;
+            string payload = binary ? encode_binary(requests[i], request_id) : encode_json(requests[i], request_id);
+            append_frame_header(frames, payload.size());
+            frames += payload;
+        }
+        if (!send_all(frames.data(), frames.size())) return responses;
         
-        char buffer[4096];
-        int bytes = recv(sock, buffer, sizeof(buffer) - 1, 0);
-        if (bytes <= 0) return "{\"status\":\"error\"}";
+        string payload;
+        while (!outstanding.empty()) {
+            if (!recv_frame(payload)) break;
+            ClientResponse response;
+            if (binary && payload[0] != '{') {
+                decode_binary(payload, response);
+            } else {
+                response.text = move(payload);
+                response.ok = response.text.find("\"status\":\"success\"") != string::npos;
+                response.request_id = json_string_field(response.text, "request_id");
+            }
+            
+            // A connection-limit rejection answers no request in particular
+            auto slot = outstanding.find(response.request_id);
+            if (slot == outstanding.end()) slot = outstanding.begin();
+            responses[slot->second] = move(response);
+            outstanding.erase(slot);
+        }
+        return responses;
+    }
+    
+private:
+    const string& session_for(const ClientRequest& request) const {
+        return request.session_id.empty() ? session_id : request.session_id;
+    }
+    
+    string encode_json(const ClientRequest& request, const string& request_id) {
+        string json = "{\"operation\":\"" + request.operation + "\",";
+        json += "\"session_id\":\"" + escape_json(session_for(request)) + "\",";
+        json += "\"request_id\":\"" + escape_json(request_id) + "\",\"parameters\":{";
+        bool first = true;
+        for (const auto& param : request.params) {
+            json += (first ? "\"" : ",\"") + param.first + "\":\"" + escape_json(param.second) + "\"";
+            first = false;
+        }
+        for (const auto& number : request.numbers) {
+            json += (first ? "\"" : ",\"") + number.first + "\":" + to_string(number.second);
+            first = false;
+        }
+        if (!request.operations.empty()) {
+            json += first ? "\"operations\":[" : ",\"operations\":[";
+            for (size_t i = 0; i < request.operations.size(); i++) {
+                if (i > 0) json += ",";
+                json += encode_json(request.operations[i], "");
+            }
+            json += request.atomic ? "],\"atomic\":true" : "]";
+        }
+        json += "}}";
+        return json;
+    }
+    
+    string encode_binary(const ClientRequest& request, const string& request_id) {
+        string out;
+        BinaryWriter writer(out);
+        writer.put_u8(BINARY_VERSION);
+        writer.put_u8(operation_code(request.operation));
+        writer.put_bytes(TAG_SESSION_ID, session_for(request));
+        writer.put_bytes(TAG_REQUEST_ID, request_id);
+        for (const auto& param : request.params) {
+            int tag = field_tag(param.first);
+            if (tag > 0) writer.put_bytes(tag, param.second);
+        }
+        for (const auto& number : request.numbers) {
+            int tag = field_tag(number.first);
+            if (tag > 0) writer.put_number(tag, number.second);
+        }
+        if (!request.operations.empty()) {
+            string operations;
+            for (const ClientRequest& operation : request.operations) {
+                string message = encode_binary(operation, "");
+                append_frame_header(operations, message.size());
+                operations += message;
+            }
+            writer.put_bytes(TAG_OPERATIONS, operations);
+            if (request.atomic) writer.put_number(TAG_ATOMIC, 1);
+        }
+        return out;
+    }
+    
+    void decode_binary(const string& payload, ClientResponse& response) {
+        BinaryReader reader(payload.data(), payload.size());
+        uint8_t version, code, status;
+        uint32_t error_code;
+        if (!reader.get_u8(version) || !reader.get_u8(code) || !reader.get_u8(status) || !reader.get_u32(error_code)) {
+            return;
+        }
+        response.ok = status == 0;
+        response.error_code = (int32_t)error_code;
         
-        buffer[bytes] = '\0';
-        return string(buffer);
+        string& request_id = response.request_id;
+        string result;
+        uint8_t tag, type;
+        string text;
+        uint64_t number;
+        while (!reader.at_end() && reader.next_field(tag, type, text, number)) {
+            if (tag == TAG_REQUEST_ID) request_id = text;
+            else if (tag == TAG_ERROR_MESSAGE) response.error_message = text;
+            else if (tag == TAG_RETRY_AFTER_MS) response.retry_after_ms = number;
+            else if (tag == TAG_RESULT) result = text;
+            else if (tag == TAG_CONTENT) {
+                response.content = text;
+                response.has_content = true;
+            }
+        }
+        
+        // Same shape as the JSON protocol's responses
+        string operation = code < OPERATION_COUNT ? OPERATION_NAMES[code] : "";
+        response.text = "{\"status\":\"" + string(response.ok ? "success" : "error") + "\",";
+        response.text += "\"operation\":\"" + operation + "\",\"request_id\":\"" + escape_json(request_id) + "\"";
+        if (!response.ok) {
+            response.text += ",\"error_code\":" + to_string(response.error_code);
+            response.text += ",\"error_message\":\"" + escape_json(response.error_message) + "\"";
+            if (response.retry_after_ms) response.text += ",\"retry_after_ms\":" + to_string(response.retry_after_ms);
+        } else if (response.has_content) {
+            response.text += ",\"data\":{\"content\":\"" + escape_json(response.content) + "\"}";
+        } else if (!result.empty()) {
+            response.text += ",\"data\":" + result;
+        }
+        response.text += "}";
+    }
+    
+    // Value of a top-level string member; enough for the ids this client sends
+    static string json_string_field(const string& json, const string& name) {
+        string key = "\"" + name + "\":\"";
+        size_t start = json.find(key);
+        if (start == string::npos) return "";
+        start += key.size();
+        size_t end = json.find('"', start);
+        return end == string::npos ? "" : json.substr(start, end - start);
+    }
+    
+    bool send_all(const char* data, size_t length) {
+        while (length > 0) {
+            ssize_t sent = send(sock, data, length, MSG_NOSIGNAL);
+            if (sent <= 0) return false;
+            data += sent;
+            length -= sent;
+        }
+        return true;
+    }
+    
+    bool recv_all(char* data, size_t length) {
+        while (length > 0) {
+            ssize_t bytes = recv(sock, data, length, 0);
+            if (bytes <= 0) return false;
+            data += bytes;
+            length -= bytes;
+        }
+        return true;
+    }
+    
+    bool recv_frame(string& payload) {
+        char header[FRAME_HEADER_SIZE];
+        if (!recv_all(header, sizeof(header))) return false;
+        
+        // A server at its connection limit answers with one bare JSON
+        // object before it has seen the preamble
+        if (header[0] == '{') {
+            payload.assign(header, sizeof(header));
+            char buffer[4096];
+            ssize_t bytes;
+            while ((bytes = recv(sock, buffer, sizeof(buffer), 0)) > 0) payload.append(buffer, bytes);
+            return true;
+        }
+        
+        payload.resize(read_frame_length(header));
+        return payload.empty() || recv_all(&payload[0], payload.size());
     }
     
+public:
+    
     // User operations
     string user_login(const string& username, const string& password) {
-        string json = "{\"operation\":\"user_login\",\"session_id\":\"\",";
-        json += "\"request_id\":\"1\",\"parameters\":{";
-        json += "\"username\":\"" + username + "\",";
-        json += "\"password\":\"" + password + "\"}}";
-        return send_request(json);
+        ClientResponse response = call(ClientRequest("user_login").param("username", username).param("password", password));
+        if (response.ok) session_id = json_string_field(response.text, "session_id");
+        return response.text;
     }
     
     string user_create(const string& username, const string& password) {
-        string json = "{\"operation\":\"user_create\",\"session_id\":\"\",";
-        json += "\"request_id\":\"2\",\"parameters\":{";
-        json += "\"username\":\"" + username + "\",";
-        json += "\"password\":\"" + password + "\"}}";
-        return send_request(json);
+        return call(ClientRequest("user_create").param("username", username).param("password", password)).text;
     }
     
     // File operations
     string file_create(const string& path, const string& data) {
-        string json = "{\"operation\":\"file_create\",\"session_id\":\"s1\",";
-        json += "\"request_id\":\"3\",\"parameters\":{";
-        json += "\"path\":\"" + path + "\",";
-        json += "\"data\":\"" + data + "\"}}";
-        return send_request(json);
+        return call(ClientRequest("file_create").param("path", path).param("data", data)).text;
     }
     
     string file_read(const string& path) {
-        string json = "{\"operation\":\"file_read\",\"session_id\":\"s1\",";
-        json += "\"request_id\":\"4\",\"parameters\":{";
-        json += "\"path\":\"" + path + "\"}}";
-        return send_request(json);
+        return call(ClientRequest("file_read").param("path", path)).text;
     }
     
     string file_delete(const string& path) {
-        string json = "{\"operation\":\"file_delete\",\"session_id\":\"s1\",";
-        json += "\"request_id\":\"5\",\"parameters\":{";
-        json += "\"path\":\"" + path + "\"}}";
-        return send_request(json);
+        return call(ClientRequest("file_delete").param("path", path)).text;
     }
     
     string file_exists(const string& path) {
-        string json = "{\"operation\":\"file_exists\",\"session_id\":\"s1\",";
-        json += "\"request_id\":\"6\",\"parameters\":{";
-        json += "\"path\":\"" + path + "\"}}";
-        return send_request(json);
+        return call(ClientRequest("file_exists").param("path", path)).text;
     }
     
     string file_rename(const string& old_path, const string& new_path) {
-        string json = "{\"operation\":\"file_rename\",\"session_id\":\"s1\",";
-        json += "\"request_id\":\"7\",\"parameters\":{";
-        json += "\"old_path\":\"" + old_path + "\",";
-        json += "\"new_path\":\"" + new_path + "\"}}";
-        return send_request(json);
+        return call(ClientRequest("file_rename").param("old_path", old_path).param("new_path", new_path)).text;
     }
     
     // Directory operations
     string dir_create(const string& path) {
-        string json = "{\"operation\":\"dir_create\",\"session_id\":\"s1\",";
-        json += "\"request_id\":\"8\",\"parameters\":{";
-        json += "\"path\":\"" + path + "\"}}";
-        return send_request(json);
+        return call(ClientRequest("dir_create").param("path", path)).text;
     }
     
     string dir_list(const string& path) {
-        string json = "{\"operation\":\"dir_list\",\"session_id\":\"s1\",";
-        json += "\"request_id\":\"9\",\"parameters\":{";
-        json += "\"path\":\"" + path + "\"}}";
-        return send_request(json);
+        return call(ClientRequest("dir_list").param("path", path)).text;
     }
     
     string dir_delete(const string& path) {
-        string json = "{\"operation\":\"dir_delete\",\"session_id\":\"s1\",";
-        json += "\"request_id\":\"10\",\"parameters\":{";
-        json += "\"path\":\"" + path + "\"}}";
-        return send_request(json);
+        return call(ClientRequest("dir_delete").param("path", path)).text;
     }
     
     string dir_exists(const string& path) {
-        string json = "{\"operation\":\"dir_exists\",\"session_id\":\"s1\",";
-        json += "\"request_id\":\"11\",\"parameters\":{";
-        json += "\"path\":\"" + path + "\"}}";
-        return send_request(json);
+        return call(ClientRequest("dir_exists").param("path", path)).text;
     }
     
     // Info operations
     string get_stats() {
-        string json = "{\"operation\":\"get_stats\",\"session_id\":\"s1\",";
-        json += "\"request_id\":\"12\",\"parameters\":{}}";
-        return send_request(json);
+        return call(ClientRequest("get_stats")).text;
     }
     
     string get_metadata(const string& path) {
-        string json = "{\"operation\":\"get_metadata\",\"session_id\":\"s1\",";
-        json += "\"request_id\":\"13\",\"parameters\":{";
-        json += "\"path\":\"" + path + "\"}}";
-        return send_request(json);
+        return call(ClientRequest("get_metadata").param("path", path)).text;
     }
 };
 
-int main() {
+// --metrics prints the server's get_metrics JSON, --prometheus the same
+// counters as Prometheus text (e.g. for node_exporter's textfile collector)
+int print_metrics(bool prometheus) {
+    // Binary, so the Prometheus text arrives as raw content
+    OFSClient client(true);
+    client.quiet = true;
+    if (!client.connect_to_server("127.0.0.1", 8080)) {
+        return 1;
+    }
+    
+    ClientRequest request("get_metrics");
+    if (prometheus) request.param("format", "prometheus");
+    ClientResponse response = client.call(request);
+    if (!response.ok) {
+        cerr << "Error: " << response.text << endl;
+        return 1;
+    }
+    if (prometheus) {
+        cout << response.content;
+    } else {
+        cout << response.text << endl;
+    }
+    return 0;
+}
+
+// --trace FILE saves the server's sampled request traces as Chrome
+// trace-event JSON; get_trace is for admins
+int save_trace(const string& path, const string& username, const string& password) {
+    OFSClient client(true);
+    client.quiet = true;
+    if (!client.connect_to_server("127.0.0.1", 8080)) {
+        return 1;
+    }
+    
+    client.user_login(username, password);
+    ClientResponse response = client.call(ClientRequest("get_trace"));
+    if (!response.ok) {
+        cerr << "Error: " << response.text << endl;
+        return 1;
+    }
+    
+    ofstream out(path, ios::binary);
+    out.write(response.content.data(), response.content.size());
+    if (!out) {
+        cerr << "Error: Cannot write " << path << endl;
+        return 1;
+    }
+    cout << "Saved " << response.content.size() << " bytes of trace to " << path
+         << " (open it in chrome://tracing or ui.perfetto.dev)" << endl;
+    return 0;
+}
+
+// ============================================================================
+// LOAD GENERATOR
+// ============================================================================
+
+// --load drives the server from many connections with a mix of operations.
+// Arrivals are open loop: every connection follows its own Poisson schedule
+// and never waits for the server to catch up. A connection has one request
+// outstanding at a time, so when the server falls behind the next request
+// goes out late, but its latency is still counted from when it was due (as
+// wrk2 does); a stall then shows in the percentiles instead of silently
+// lowering the request rate (coordinated omission). The time from send to
+// response is reported next to it as the service time.
+
+enum LoadOp {
+    LOAD_READ, LOAD_WRITE, LOAD_DELETE, LOAD_EXISTS, LOAD_METADATA, LOAD_LIST, LOAD_STATS,
+    LOAD_LARGE_WRITE, LOAD_LARGE_READ,
+    LOAD_OP_COUNT
+};
+
+const char* const LOAD_OP_NAMES[LOAD_OP_COUNT] = {
+    "read", "write", "delete", "exists", "metadata", "list", "stats", "large_write", "large_read"
+};
+
+struct LoadMix {
+    const char* name;
+    int weights[LOAD_OP_COUNT];     // Percent, in LoadOp order
+};
+
+// A delete removes the connection's oldest write, so mixes that write about
+// as often as they delete keep the file count steady. Written bytes are not
+// reclaimed by deletes, so give write mixes a container with room to spare.
+const LoadMix LOAD_MIXES[] = {
+    {"read-heavy",     {70, 5, 5, 10, 5, 5, 0, 0, 0}},
+    {"write-heavy",    {20, 40, 40, 0, 0, 0, 0, 0, 0}},
+    {"metadata-storm", {0, 0, 0, 30, 30, 25, 15, 0, 0}},
+    {"large-file",     {0, 0, 25, 0, 0, 0, 0, 25, 50}},
+};
+
+struct LoadOptions {
+    string host = "127.0.0.1";
+    int port = 8080;
+    bool binary = false;
+    string username = "admin";
+    string password = "admin123";
+    string mix = "read-heavy";
+    vector<int> weights;
+    int connections = 8;
+    double rate = 200;              // Requests per second over all connections
+    double duration = 10;           // Seconds
+    int files = 100;                // Read by read, exists and metadata
+    uint64_t file_size = 4096;
+    int large_files = 4;            // Read by large_read
+    uint64_t large_size = 4 << 20;
+    uint64_t seed = 1;
+    bool json = false;
+};
+
+// Histograms: latency from the due time by op, then service time by op.
+// Counters: errors by op, then busy rejections, then bytes moved.
+struct LoadRun {
+    const LoadOptions& options;
+    Metrics metrics;
+    mutex start_mutex;
+    condition_variable start_signal;
+    int ready = 0;
+    int failed = 0;
+    uint64_t start_ns = 0;          // Set once every connection has logged in
+    uint64_t end_ns = 0;
+    uint64_t finish_ns = 0;         // Last response of any connection
+
+    LoadRun(const LoadOptions& options) : options(options), metrics(2 * LOAD_OP_COUNT, 3 * LOAD_OP_COUNT) {}
+};
+
+static bool uses(const LoadOptions& options, LoadOp op) {
+    return options.weights[op] > 0;
+}
+
+static bool is_busy(const ClientResponse& response) {
+    return response.error_code == ERROR_BUSY ||
+           response.text.find("\"error_code\":" + to_string(ERROR_BUSY)) != string::npos;
+}
+
+// Pipelines requests LOAD_SETUP_BATCH at a time; returns how many failed
+static size_t send_in_batches(OFSClient& client, const vector<ClientRequest>& requests) {
+    const size_t LOAD_SETUP_BATCH = 32;
+    size_t failed = 0;
+    for (size_t i = 0; i < requests.size(); i += LOAD_SETUP_BATCH) {
+        vector<ClientRequest> batch(requests.begin() + i, requests.begin() + min(requests.size(), i + LOAD_SETUP_BATCH));
+        for (const ClientResponse& response : client.send_pipelined(batch)) {
+            if (!response.ok) failed++;
+        }
+    }
+    return failed;
+}
+
+static void load_connection(LoadRun& run, int id) {
+    const LoadOptions& options = run.options;
+    OFSClient client(options.binary);
+    client.quiet = true;
+    bool ok = client.connect_to_server(options.host, options.port);
+    if (ok) {
+        client.user_login(options.username, options.password);
+        ok = client.logged_in();
+    }
+    {
+        unique_lock<mutex> lock(run.start_mutex);
+        if (ok) run.ready++;
+        else run.failed++;
+        run.start_signal.notify_all();
+        run.start_signal.wait(lock, [&] { return run.start_ns != 0; });
+    }
+    if (!ok) return;
+
+    mt19937_64 random(options.seed * 1000003 + id);
+    exponential_distribution<double> gap_seconds(options.rate / options.connections);
+    discrete_distribution<int> pick(options.weights.begin(), options.weights.end());
+    uniform_int_distribution<int> small_file(0, max(options.files, 1) - 1);
+    uniform_int_distribution<int> large_file(0, max(options.large_files, 1) - 1);
+    string small_data(uses(options, LOAD_WRITE) ? options.file_size : 0, 'w');
+    string large_data(uses(options, LOAD_LARGE_WRITE) ? options.large_size : 0, 'L');
+    string own_dir = "/load/c" + to_string(id);
+    deque<string> written;
+    uint64_t sequence = 0;
+
+    uint64_t due = run.start_ns + (uint64_t)(gap_seconds(random) * 1e9);
+    while (due < run.end_ns) {
+        uint64_t now = metrics_now_ns();
+        if (due > now) this_thread::sleep_for(chrono::nanoseconds(due - now));
+
+        int op = pick(random);
+        if (op == LOAD_DELETE && written.empty()) op = LOAD_WRITE;
+        string path;
+        uint64_t bytes = 0;
+        ClientRequest request("");
+        switch (op) {
+            case LOAD_READ:
+                request = ClientRequest("file_read").param("path", "/load/f" + to_string(small_file(random)));
+                bytes = options.file_size;
+                break;
+            case LOAD_WRITE:
+                path = own_dir + "/w" + to_string(sequence++);
+                request = ClientRequest("file_create").param("path", path).param("data", small_data);
+                bytes = small_data.size();
+                break;
+            case LOAD_DELETE:
+                request = ClientRequest("file_delete").param("path", written.front());
+                written.pop_front();
+                break;
+            case LOAD_EXISTS:
+                request = ClientRequest("file_exists").param("path", "/load/f" + to_string(small_file(random)));
+                break;
+            case LOAD_METADATA:
+                request = ClientRequest("get_metadata").param("path", "/load/f" + to_string(small_file(random)));
+                break;
+            case LOAD_LIST:
+                request = ClientRequest("dir_list").param("path", "/load");
+                break;
+            case LOAD_STATS:
+                request = ClientRequest("get_stats");
+                break;
+            case LOAD_LARGE_WRITE:
+                path = own_dir + "/L" + to_string(sequence++);
+                request = ClientRequest("file_create").param("path", path).param("data", large_data);
+                bytes = large_data.size();
+                break;
+            case LOAD_LARGE_READ:
+                request = ClientRequest("file_read").param("path", "/load/large" + to_string(large_file(random)));
+                bytes = options.large_size;
+                break;
+        }
+
+        uint64_t sent = metrics_now_ns();
+        ClientResponse response = client.call(request);
+        uint64_t done = metrics_now_ns();
+        run.metrics.record(op, done - due);
+        run.metrics.record(LOAD_OP_COUNT + op, done - sent);
+        if (response.ok) {
+            run.metrics.add(2 * LOAD_OP_COUNT + op, bytes);
+            if (!path.empty()) written.push_back(path);
+        } else {
+            run.metrics.add(op);
+            if (is_busy(response)) run.metrics.add(LOAD_OP_COUNT + op);
+        }
+        due += (uint64_t)(gap_seconds(random) * 1e9);
+    }
+    {
+        lock_guard<mutex> lock(run.start_mutex);
+        run.finish_ns = max(run.finish_ns, metrics_now_ns());
+    }
+
+    // Leave the container as it was found
+    vector<ClientRequest> deletes;
+    for (const string& leftover : written) deletes.push_back(ClientRequest("file_delete").param("path", leftover));
+    if (!deletes.empty()) send_in_batches(client, deletes);
+}
+
+// Creates /load, a directory per connection and the files that are read.
+// Files left over from an earlier run count as created.
+static bool prepare_load(OFSClient& client, const LoadOptions& options) {
+    client.dir_create("/load");
+    vector<ClientRequest> requests;
+    for (int id = 0; id < options.connections; id++) {
+        requests.push_back(ClientRequest("dir_create").param("path", "/load/c" + to_string(id)));
+    }
+    if (uses(options, LOAD_READ) || uses(options, LOAD_EXISTS) || uses(options, LOAD_METADATA)) {
+        string data(options.file_size, 'r');
+        for (int i = 0; i < options.files; i++) {
+            requests.push_back(ClientRequest("file_create").param("path", "/load/f" + to_string(i)).param("data", data));
+        }
+    }
+    if (uses(options, LOAD_LARGE_READ)) {
+        string data(options.large_size, 'R');
+        for (int i = 0; i < options.large_files; i++) {
+            requests.push_back(ClientRequest("file_create").param("path", "/load/large" + to_string(i)).param("data", data));
+        }
+    }
+    send_in_batches(client, requests);
+    return client.dir_exists("/load").find("\"exists\":true") != string::npos;
+}
+
+static void cleanup_load(OFSClient& client, const LoadOptions& options) {
+    vector<ClientRequest> requests;
+    for (int i = 0; i < options.files; i++) {
+        requests.push_back(ClientRequest("file_delete").param("path", "/load/f" + to_string(i)));
+    }
+    for (int i = 0; i < options.large_files; i++) {
+        requests.push_back(ClientRequest("file_delete").param("path", "/load/large" + to_string(i)));
+    }
+    for (int id = 0; id < options.connections; id++) {
+        requests.push_back(ClientRequest("dir_delete").param("path", "/load/c" + to_string(id)));
+    }
+    send_in_batches(client, requests);
+    client.dir_delete("/load");
+}
+
+static string load_latency_json(const HistogramSnapshot& latency) {
+    return "{\"count\":" + to_string(latency.count) + ",\"mean_ns\":" + to_string((uint64_t)latency.mean()) +
+           ",\"p50_ns\":" + to_string(latency.percentile(0.50)) + ",\"p90_ns\":" + to_string(latency.percentile(0.90)) +
+           ",\"p99_ns\":" + to_string(latency.percentile(0.99)) + ",\"p999_ns\":" + to_string(latency.percentile(0.999)) +
+           ",\"max_ns\":" + to_string(latency.maximum) + "}";
+}
+
+static void print_load_report(const LoadRun& run, double seconds) {
+    const LoadOptions& options = run.options;
+    const Metrics& metrics = run.metrics;
+    uint64_t requests = 0, errors = 0, busy = 0;
+    for (int op = 0; op < LOAD_OP_COUNT; op++) {
+        requests += metrics.histogram(op).count;
+        errors += metrics.counter(op);
+        busy += metrics.counter(LOAD_OP_COUNT + op);
+    }
+    char number[64];
+
+    if (options.json) {
+        snprintf(number, sizeof(number), "%.3f", seconds);
+        string json = "{\"mix\":\"" + escape_json(options.mix) + "\",\"connections\":" + to_string(options.connections);
+        json += ",\"protocol\":\"" + string(options.binary ? "binary" : "json") + "\",\"seconds\":" + number;
+        snprintf(number, sizeof(number), "%.1f", options.rate);
+        json += ",\"offered_rate\":" + string(number);
+        snprintf(number, sizeof(number), "%.1f", requests / seconds);
+        json += ",\"achieved_rate\":" + string(number) + ",\"requests\":" + to_string(requests);
+        json += ",\"errors\":" + to_string(errors) + ",\"busy\":" + to_string(busy) + ",\"operations\":{";
+        bool first = true;
+        for (int op = 0; op < LOAD_OP_COUNT; op++) {
+            if (!uses(options, (LoadOp)op)) continue;
+            HistogramSnapshot latency = metrics.histogram(op);
+            json += (first ? "\"" : ",\"") + string(LOAD_OP_NAMES[op]) + "\":{\"errors\":" + to_string(metrics.counter(op));
+            json += ",\"busy\":" + to_string(metrics.counter(LOAD_OP_COUNT + op));
+            snprintf(number, sizeof(number), "%.1f", latency.count / seconds);
+            json += ",\"ops_per_sec\":" + string(number);
+            snprintf(number, sizeof(number), "%.1f", metrics.counter(2 * LOAD_OP_COUNT + op) / seconds);
+            json += ",\"bytes_per_sec\":" + string(number);
+            json += ",\"latency\":" + load_latency_json(latency);
+            json += ",\"service\":" + load_latency_json(metrics.histogram(LOAD_OP_COUNT + op)) + "}";
+            first = false;
+        }
+        cout << json << "}}" << endl;
+        return;
+    }
+
+    printf("\nMix %s: %d connections, %.1f req/s offered (Poisson), %.1f s to answer, %s protocol\n", options.mix.c_str(),
+           options.connections, options.rate, seconds, options.binary ? "binary" : "JSON");
+    printf("Completed %llu requests (%.1f/s), %llu errors, %llu busy\n\n", (unsigned long long)requests,
+           requests / seconds, (unsigned long long)errors, (unsigned long long)busy);
+    printf("Latency from the scheduled send time, in ms; service = send to response\n");
+    printf("%-12s %8s %7s %9s %9s %8s %8s %8s %8s %8s %9s %9s\n", "operation", "count", "errors", "ops/s", "MB/s",
+           "p50", "p90", "p99", "p99.9", "max", "svc p50", "svc p99");
+    for (int op = 0; op < LOAD_OP_COUNT; op++) {
+        if (!uses(options, (LoadOp)op)) continue;
+        HistogramSnapshot latency = metrics.histogram(op);
+        HistogramSnapshot service = metrics.histogram(LOAD_OP_COUNT + op);
+        printf("%-12s %8llu %7llu %9.1f %9.2f %8.3f %8.3f %8.3f %8.3f %8.3f %9.3f %9.3f\n", LOAD_OP_NAMES[op],
+               (unsigned long long)latency.count, (unsigned long long)metrics.counter(op), latency.count / seconds,
+               metrics.counter(2 * LOAD_OP_COUNT + op) / seconds / 1e6, latency.percentile(0.50) / 1e6,
+               latency.percentile(0.90) / 1e6, latency.percentile(0.99) / 1e6, latency.percentile(0.999) / 1e6,
+               latency.maximum / 1e6, service.percentile(0.50) / 1e6, service.percentile(0.99) / 1e6);
+    }
+    if (requests < options.rate * seconds * 0.9) {
+        printf("\nThe server completed under 90%% of the offered load; it is saturated at this rate\n");
+    }
+}
+
+// Byte counts with an optional K, M or G suffix
+static bool parse_load_size(const string& text, uint64_t& value) {
+    char* end = nullptr;
+    value = strtoull(text.c_str(), &end, 10);
+    if (end == text.c_str()) return false;
+    switch (toupper(*end)) {
+        case 'G': value <<= 10; // fall through
+        case 'M': value <<= 10; // fall through
+        case 'K': value <<= 10; end++; break;
+    }
+    return *end == '\0';
+}
+
+// A preset name, or weights like "read=80,write=10,delete=10"
+static bool parse_load_mix(const string& text, vector<int>& weights) {
+    weights.assign(LOAD_OP_COUNT, 0);
+    for (const LoadMix& mix : LOAD_MIXES) {
+        if (text == mix.name) {
+            weights.assign(mix.weights, mix.weights + LOAD_OP_COUNT);
+            return true;
+        }
+    }
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find(',', start);
+        if (end == string::npos) end = text.size();
+        string item = text.substr(start, end - start);
+        size_t equals = item.find('=');
+        int op = 0;
+        while (op < LOAD_OP_COUNT && (equals == string::npos || item.compare(0, equals, LOAD_OP_NAMES[op]) != 0)) op++;
+        if (op == LOAD_OP_COUNT) return false;
+        weights[op] = atoi(item.c_str() + equals + 1);
+        if (weights[op] < 0) return false;
+        start = end + 1;
+    }
+    for (int weight : weights) {
+        if (weight > 0) return true;
+    }
+    return false;
+}
+
+static void load_usage() {
+    cerr << "Usage: ofs_client --load [--binary] [--connections N] [--rate REQ_PER_S] [--duration S]\n"
+            "                  [--mix read-heavy|write-heavy|metadata-storm|large-file|op=weight,...]\n"
+            "                  [--files N] [--file-size BYTES] [--large-files N] [--large-size BYTES]\n"
+            "                  [--host IP] [--port N] [--user NAME] [--password PASS] [--seed N] [--json]\n"
+            "Operations: read write delete exists metadata list stats large_write large_read" << endl;
+}
+
+int run_load(int argc, char** argv, bool binary) {
+    LoadOptions options;
+    options.binary = binary;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        bool ok = true;
+        if (arg == "--load") {
+            continue;
+        } else if (arg == "--binary") {
+            options.binary = true;
+        } else if (arg == "--json") {
+            options.json = true;
+        } else if (arg == "--connections" && has_value) {
+            options.connections = atoi(argv[++i]);
+            ok = options.connections > 0 && options.connections <= 10000;
+        } else if (arg == "--rate" && has_value) {
+            options.rate = atof(argv[++i]);
+            ok = options.rate > 0;
+        } else if (arg == "--duration" && has_value) {
+            options.duration = atof(argv[++i]);
+            ok = options.duration > 0;
+        } else if (arg == "--mix" && has_value) {
+            options.mix = argv[++i];
+        } else if (arg == "--files" && has_value) {
+            options.files = atoi(argv[++i]);
+            ok = options.files > 0;
+        } else if (arg == "--file-size" && has_value) {
+            ok = parse_load_size(argv[++i], options.file_size);
+        } else if (arg == "--large-files" && has_value) {
+            options.large_files = atoi(argv[++i]);
+            ok = options.large_files > 0;
+        } else if (arg == "--large-size" && has_value) {
+            ok = parse_load_size(argv[++i], options.large_size) && options.large_size < MAX_FRAME_SIZE;
+        } else if (arg == "--host" && has_value) {
+            options.host = argv[++i];
+        } else if (arg == "--port" && has_value) {
+            options.port = atoi(argv[++i]);
+        } else if (arg == "--user" && has_value) {
+            options.username = argv[++i];
+        } else if (arg == "--password" && has_value) {
+            options.password = argv[++i];
+        } else if (arg == "--seed" && has_value) {
+            options.seed = strtoull(argv[++i], nullptr, 10);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            load_usage();
+            return 1;
+        }
+    }
+    if (!parse_load_mix(options.mix, options.weights)) {
+        cerr << "Error: Unknown mix '" << options.mix << "'" << endl;
+        load_usage();
+        return 1;
+    }
+
+    OFSClient setup(options.binary);
+    setup.quiet = true;
+    if (!setup.connect_to_server(options.host, options.port)) return 1;
+    setup.user_login(options.username, options.password);
+    if (!setup.logged_in()) {
+        cerr << "Error: Cannot log in as " << options.username << endl;
+        return 1;
+    }
+    if (!prepare_load(setup, options)) {
+        cerr << "Error: Cannot create /load on the server" << endl;
+        return 1;
+    }
+
+    LoadRun run(options);
+    vector<thread> connections;
+    for (int id = 0; id < options.connections; id++) connections.emplace_back(load_connection, ref(run), id);
+    {
+        unique_lock<mutex> lock(run.start_mutex);
+        run.start_signal.wait(lock, [&] { return run.ready + run.failed == options.connections; });
+        run.start_ns = metrics_now_ns();
+        run.end_ns = run.start_ns + (uint64_t)(options.duration * 1e9);
+        run.start_signal.notify_all();
+    }
+    if (run.failed > 0) {
+        cerr << "Warning: " << run.failed << " of " << options.connections
+             << " connections could not connect and log in (see max_connections)" << endl;
+    }
+    for (thread& connection : connections) connection.join();
+
+    // A saturated server answers the last scheduled requests after the end
+    cleanup_load(setup, options);
+    print_load_report(run, max(options.duration, (run.finish_ns - run.start_ns) / 1e9));
+    return run.ready > 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    bool binary = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--binary") binary = true;
+        else if (arg == "--load") return run_load(argc, argv, binary);
+        else if (arg == "--metrics" || arg == "--prometheus") return print_metrics(arg == "--prometheus");
+        else if (arg == "--trace" && i + 1 < argc) {
+            return save_trace(argv[i + 1], i + 2 < argc ? argv[i + 2] : "admin", i + 3 < argc ? argv[i + 3] : "admin123");
+        }
+    }
+    
     cout << "\n================================================" << endl;
     cout << "     OFS COMPREHENSIVE SYSTEM TEST" << endl;
     cout << "================================================\n" << endl;
     
-    OFSClient client;
+    OFSClient client(binary);
     
     if (!client.connect_to_server("127.0.0.1", 8080)) {
         return 1;
@@ -202,13 +954,56 @@ int main() {
     cout << "10. List directory..." << endl;
     cout << client.dir_list("/documents") << "\n" << endl;
     
+    cout << "\n--- Large and Pipelined Requests ---\n" << endl;
+    cout << "11. Create and read back a 1 MiB file..." << endl;
+    // Every byte value, which the JSON protocol has to escape
+    string large(1024 * 1024, '\0');
+    for (size_t i = 0; i < large.size(); i++) large[i] = (char)(i * 7);
+    if (!binary) {
+        for (char& c : large) c = 'a' + (unsigned char)c % 26;
+    }
+    cout << client.call(ClientRequest("file_create").param("path", "/documents/large.bin").param("data", large)).text << endl;
+    ClientResponse large_read = client.call(ClientRequest("file_read").param("path", "/documents/large.bin"));
+    bool intact = large_read.has_content ? large_read.content == large
+                                         : large_read.text.find("\"" + large + "\"") != string::npos;
+    cout << "Read " << large.size() << " bytes, content " << (intact ? "intact" : "CORRUPT") << "\n" << endl;
+    
+    cout << "12. Pipeline 100 existence checks in one round trip..." << endl;
+    vector<ClientRequest> checks(100, ClientRequest("file_exists"));
+    for (ClientRequest& check : checks) check.param("path", "/documents/note.txt");
+    vector<ClientResponse> results = client.send_pipelined(checks);
+    size_t found = 0;
+    for (const ClientResponse& result : results) {
+        if (result.text.find("\"exists\":true") != string::npos) found++;
+    }
+    cout << found << " of " << results.size() << " responses report the file\n" << endl;
+    
+    cout << "\n--- Batches ---\n" << endl;
+    cout << "13. Upload a folder in one batch..." << endl;
+    cout << client.call(ClientRequest("batch")
+        .add(ClientRequest("dir_create").param("path", "/upload"))
+        .add(ClientRequest("file_create").param("path", "/upload/a.txt").param("data", "first"))
+        .add(ClientRequest("file_create").param("path", "/upload/b.txt").param("data", "second"))).text << "\n" << endl;
+    
+    cout << "14. Atomic batch that fails part way..." << endl;
+    cout << client.call(ClientRequest("batch").all_or_nothing()
+        .add(ClientRequest("dir_create").param("path", "/upload2"))
+        .add(ClientRequest("file_create").param("path", "/upload2/c.txt").param("data", "third"))
+        .add(ClientRequest("file_create").param("path", "/upload/a.txt").param("data", "duplicate"))).text << endl;
+    cout << "After rollback: " << client.dir_exists("/upload2") << "\n" << endl;
+    
     cout << "\n--- System Statistics ---\n" << endl;
-    cout << "11. Get file system stats..." << endl;
+    cout << "15. Get file system stats..." << endl;
     cout << client.get_stats() << "\n" << endl;
     
     cout << "\n--- Cleanup ---\n" << endl;
-    cout << "12. Delete file..." << endl;
-    cout << client.file_delete("/renamed.txt") << "\n" << endl;
+    cout << "16. Delete files..." << endl;
+    cout << client.file_delete("/renamed.txt") << endl;
+    cout << client.file_delete("/documents/large.bin") << endl;
+    cout << client.call(ClientRequest("batch").all_or_nothing()
+        .add(ClientRequest("file_delete").param("path", "/upload/a.txt"))
+        .add(ClientRequest("file_delete").param("path", "/upload/b.txt"))
+        .add(ClientRequest("dir_delete").param("path", "/upload"))).text << "\n" << endl;
     
     cout << "================================================" << endl;
     cout << "     ALL TESTS COMPLETED!" << endl;
@@ -1,32 +1,52 @@
+#pragma once
+#include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <unordered_map>
+#include <cstdint>
 
 using namespace std;
 
 struct Config {
     struct Filesystem {
-        size_t total_size;
-        size_t header_size;
-        size_t block_size;
+        uint64_t total_size;
+        uint64_t header_size;
+        uint64_t block_size;
         int max_files;
         int max_filename_length;
     } filesystem;
 
     struct Security {
         int max_users;
-        string admin_username;
-        string admin_password;
-        bool require_auth;
+        string admin_username = "admin";    // Created at startup if the container has no such user
+        string admin_password = "admin123";
+        bool require_auth = true;           // Reject requests without a valid session_id
+        int session_idle_timeout = 1800;    // Seconds without a request before a session ends (0 = never)
+        int session_lifetime = 86400;       // Seconds after login a session ends regardless (0 = never)
     } security;
 
+    // Used when the config file leaves a value out
     struct Server {
-        int port;
-        int max_connections;
-        int queue_timeout;
+        int port = 8080;
+        int max_connections = 20;
+        int queue_timeout = 30;
+        int max_queue_depth = 1024;     // Requests held at once before new ones are refused as busy
+        int max_in_flight = 64;         // Unanswered requests per connection before reading pauses
+        string log_level = "info";      // debug, info, warn, error or off
+        bool audit_log = true;          // Record mutating operations in <container>.audit.NNNNNN
+        double trace_sample_rate = 0;   // Share of requests traced (0 = off, 1 = all)
+        int trace_buffer = 65536;       // Spans kept for get_trace; the oldest are overwritten
     } server;
 
+    // Values may be followed by a "# comment" and padded with spaces
+    static string trim(const string& text) {
+        size_t first = text.find_first_not_of(" \t\r");
+        if (first == string::npos) return "";
+        size_t last = text.find_last_not_of(" \t\r");
+        return text.substr(first, last - first + 1);
+    }
+
     bool load(const string& filename) {
         ifstream config_file(filename);
         if (!config_file) {
@@ -41,16 +61,20 @@ struct Config {
             istringstream iss(line);
             string key, value;
             if (getline(iss, key, '=') && getline(iss, value)) {
-                key = key.substr(key.find_first_not_of(" \t"));
-                value = value.substr(value.find_first_not_of(" \t"));
+                key = trim(key);
+                value = trim(value.substr(0, value.find('#')));
+                if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+                    value = value.substr(1, value.size() - 2);
+                }
                 
                 // Parse each section of the config
+                // Sizes are parsed as 64-bit so containers above 2 GiB work
                 if (key == "total_size") 
-                    filesystem.total_size = stoi(value);
+                    filesystem.total_size = stoull(value);
                 else if (key == "header_size") 
-                    filesystem.header_size = stoi(value);
+                    filesystem.header_size = stoull(value);
                 else if (key == "block_size")
-                    filesystem.block_size = stoi(value);
+                    filesystem.block_size = stoull(value);
                 else if (key == "max_files") 
                     filesystem.max_files = stoi(value);
                 else if (key == "max_filename_length") 
@@ -63,12 +87,28 @@ struct Config {
                     security.admin_password = value;
                 else if (key == "require_auth") 
                     security.require_auth = (value == "true");
+                else if (key == "session_idle_timeout") 
+                    security.session_idle_timeout = stoi(value);
+                else if (key == "session_lifetime") 
+                    security.session_lifetime = stoi(value);
                 else if (key == "port") 
                     server.port = stoi(value);
                 else if (key == "max_connections") 
                     server.max_connections = stoi(value);
                 else if (key == "queue_timeout") 
                     server.queue_timeout = stoi(value);
+                else if (key == "max_queue_depth") 
+                    server.max_queue_depth = stoi(value);
+                else if (key == "max_in_flight") 
+                    server.max_in_flight = stoi(value);
+                else if (key == "log_level") 
+                    server.log_level = value;
+                else if (key == "audit_log") 
+                    server.audit_log = (value == "true");
+                else if (key == "trace_sample_rate") 
+                    server.trace_sample_rate = stod(value);
+                else if (key == "trace_buffer") 
+                    server.trace_buffer = stoi(value);
             }
         }
         
@@ -0,0 +1,202 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+using namespace std;
+
+/**
+ * Wire framing shared by ofs_server and ofs_client
+ *
+ * The format is picked by the first bytes a client sends:
+ *
+ *   '{'      Original protocol: bare JSON objects back to back, answered
+ *            the same way. The web-ui proxy speaks this.
+ *   "OFSF"   Framed protocol: after the 4-byte preamble every request and
+ *            every response is a 4-byte big-endian payload length followed
+ *            by that many bytes of JSON.
+ *   "OFSB"   Binary protocol: the preamble is followed by one byte, the
+ *            highest binary version the client speaks. The server answers
+ *            with one byte, the version it will use (0 = none, and it
+ *            closes the connection). After that, frames as above carry
+ *            binary messages.
+ *
+ * Framing lets a client send multi-megabyte bodies and pipeline any number
+ * of requests without the server having to scan the JSON for its end.
+ *
+ * Every response echoes the operation and request_id it answers. A request
+ * that carries a request_id is answered as soon as it finishes, so
+ * responses can overtake each other and clients match them by id. Requests
+ * without one are answered in the order they were sent.
+ *
+ * Binary messages (all integers big-endian):
+ *   request:   u8 version, u8 operation code, fields...
+ *   response:  u8 version, u8 operation code, u8 status (0 = success),
+ *              i32 error code, fields...
+ *   field:     u8 tag, u8 type, u32 length, value
+ *
+ * A FIELD_BYTES value is raw bytes (file content goes over unescaped), a
+ * FIELD_U64 value is 8 bytes. Readers skip tags they do not know, so newer
+ * peers can add fields without a version bump. Structured results such as
+ * directory listings travel as one TAG_RESULT field holding the JSON data
+ * object.
+ *
+ * A batch request carries its sub-requests in one TAG_OPERATIONS field:
+ * each is a u32 length followed by a complete binary request message.
+ */
+
+const char FRAMED_PREAMBLE[4] = {'O', 'F', 'S', 'F'};
+const size_t FRAME_HEADER_SIZE = 4;
+const uint32_t MAX_FRAME_SIZE = 64 * 1024 * 1024;      // Largest request the server accepts
+
+const char BINARY_PREAMBLE[4] = {'O', 'F', 'S', 'B'};
+const uint8_t BINARY_VERSION = 1;
+
+// Operation codes: sent as-is by the binary protocol and used by the
+// server to dispatch JSON requests too. Append only.
+enum OperationCode : uint8_t {
+    OP_USER_LOGIN, OP_USER_LOGOUT, OP_USER_CREATE, OP_USER_DELETE, OP_USER_LIST,
+    OP_FILE_CREATE, OP_FILE_READ, OP_FILE_DELETE, OP_FILE_EXISTS, OP_FILE_RENAME,
+    OP_DIR_CREATE, OP_DIR_LIST, OP_DIR_DELETE, OP_DIR_EXISTS,
+    OP_GET_STATS, OP_GET_METADATA, OP_FS_GROW, OP_FS_SHRINK, OP_BATCH, OP_GET_METRICS,
+    OP_GET_TRACE,
+    OPERATION_COUNT,
+    UNKNOWN_OPERATION = 0xFF
+};
+
+const char* const OPERATION_NAMES[OPERATION_COUNT] = {
+    "user_login", "user_logout", "user_create", "user_delete", "user_list",
+    "file_create", "file_read", "file_delete", "file_exists", "file_rename",
+    "dir_create", "dir_list", "dir_delete", "dir_exists",
+    "get_stats", "get_metadata", "fs_grow", "fs_shrink", "batch", "get_metrics",
+    "get_trace"
+};
+
+enum BinaryFieldType : uint8_t {
+    FIELD_BYTES = 0,
+    FIELD_U64 = 1
+};
+
+// Field tags: binary field ids, named like the JSON keys. Append only.
+enum FieldTag : uint8_t {
+    TAG_SESSION_ID = 1, TAG_REQUEST_ID, TAG_USERNAME, TAG_PASSWORD, TAG_PATH, TAG_OLD_PATH,
+    TAG_NEW_PATH, TAG_DATA, TAG_ROLE, TAG_TOTAL_SIZE, TAG_MAX_FILES, TAG_MAX_USERS,
+    TAG_ERROR_MESSAGE, TAG_CONTENT, TAG_RESULT, TAG_OPERATIONS, TAG_ATOMIC, TAG_RETRY_AFTER_MS, TAG_FORMAT,
+    FIELD_COUNT
+};
+
+const char* const FIELD_NAMES[FIELD_COUNT] = {
+    "", "session_id", "request_id", "username", "password", "path", "old_path",
+    "new_path", "data", "role", "total_size", "max_files", "max_users",
+    "error_message", "content", "result", "operations", "atomic", "retry_after_ms", "format"
+};
+
+inline OperationCode operation_code(string_view operation) {
+    for (uint8_t code = 0; code < OPERATION_COUNT; code++) {
+        if (operation == OPERATION_NAMES[code]) return (OperationCode)code;
+    }
+    return UNKNOWN_OPERATION;
+}
+
+inline int field_tag(string_view name) {
+    for (uint8_t tag = 1; tag < FIELD_COUNT; tag++) {
+        if (name == FIELD_NAMES[tag]) return tag;
+    }
+    return -1;
+}
+
+inline void append_frame_header(string& out, uint32_t length) {
+    char header[FRAME_HEADER_SIZE] = {
+        (char)(length >> 24), (char)(length >> 16), (char)(length >> 8), (char)length
+    };
+    out.append(header, FRAME_HEADER_SIZE);
+}
+
+inline uint32_t read_frame_length(const char* header) {
+    const unsigned char* bytes = (const unsigned char*)header;
+    return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) |
+           ((uint32_t)bytes[2] << 8) | (uint32_t)bytes[3];
+}
+
+// ============================================================================
+// BINARY MESSAGES
+// ============================================================================
+
+class BinaryWriter {
+public:
+    explicit BinaryWriter(string& out) : out(out) {}
+
+    void put_u8(uint8_t value) { out += (char)value; }
+
+    void put_u32(uint32_t value) { append_frame_header(out, value); }
+
+    void put_u64(uint64_t value) {
+        put_u32((uint32_t)(value >> 32));
+        put_u32((uint32_t)value);
+    }
+
+    void put_bytes(uint8_t tag, string_view value) {
+        begin_bytes(tag, value.size());
+        put_raw(value);
+    }
+
+    // For a bytes field assembled from pieces: the header, then exactly
+    // length bytes of put_raw
+    void begin_bytes(uint8_t tag, uint32_t length) {
+        put_u8(tag);
+        put_u8(FIELD_BYTES);
+        put_u32(length);
+    }
+
+    void put_raw(string_view bytes) { out.append(bytes.data(), bytes.size()); }
+
+    void put_number(uint8_t tag, uint64_t value) {
+        put_u8(tag);
+        put_u8(FIELD_U64);
+        put_u32(sizeof(uint64_t));
+        put_u64(value);
+    }
+
+private:
+    string& out;
+};
+
+class BinaryReader {
+public:
+    BinaryReader(const char* data, size_t size) : pos(data), end(data + size) {}
+
+    bool get_u8(uint8_t& value) {
+        if (end - pos < 1) return false;
+        value = (uint8_t)*pos++;
+        return true;
+    }
+
+    bool get_u32(uint32_t& value) {
+        if (end - pos < 4) return false;
+        value = read_frame_length(pos);
+        pos += 4;
+        return true;
+    }
+
+    bool at_end() const { return pos == end; }
+
+    // Reads the next field; bytes fields fill text, numbers fill number
+    bool next_field(uint8_t& tag, uint8_t& type, string& text, uint64_t& number) {
+        uint32_t length;
+        if (!get_u8(tag) || !get_u8(type) || !get_u32(length)) return false;
+        if ((size_t)(end - pos) < length) return false;
+
+        if (type == FIELD_U64) {
+            if (length != sizeof(uint64_t)) return false;
+            number = ((uint64_t)read_frame_length(pos) << 32) | read_frame_length(pos + 4);
+        } else {
+            text.assign(pos, length);
+        }
+        pos += length;
+        return true;
+    }
+
+private:
+    const char* pos;
+    const char* end;
+};
@@ -1,20 +1,44 @@
 // server.cpp - Complete OFS Socket Server with RBAC
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <queue>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <map>
+#include <deque>
+#include <functional>
+#include <chrono>
+#include <charconv>
+#include <algorithm>
+#include <csignal>
+#include <cerrno>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
 #include <cstring>
 #include <cstdio>
 #include "../include/odf_types.hpp"
 #include "../include/ofs_functions.hpp"
 #include "../core/helper.hpp"
+#include "../core/lock_manager.hpp"
+#include "../core/session_table.hpp"
+#include "../core/logger.hpp"
+#include "../core/audit_log.hpp"
+#include "../core/metrics.hpp"
+#include "../core/trace.hpp"
+#include "config.hpp"
+#include "protocol.hpp"
 
 using namespace std;
 
@@ -22,11 +46,19 @@ using namespace std;
 // JSON HELPER FUNCTIONS
 // ============================================================================
 
-string escape_json_string(const string& input) {
-    string output;
-    output.reserve(input.length() * 2);
+// Appends input with JSON string escaping (no quotes). Runs of plain
+// characters are copied in one append.
+void append_json_escaped(string& output, string_view input) {
+    const char* p = input.data();
+    const char* end = p + input.size();
+    const char* run = p;
     
-    for (char c : input) {
+    for (; p < end; p++) {
+        unsigned char c = *p;
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+        
+        output.append(run, p - run);
+        run = p + 1;
         switch (c) {
             case '"':  output += "\\\""; break;
             case '\\': output += "\\\\"; break;
@@ -35,24 +67,110 @@ string escape_json_string(const string& input) {
             case '\n': output += "\\n"; break;
             case '\r': output += "\\r"; break;
             case '\t': output += "\\t"; break;
-            default:
-                if (c < 0x20) {
-                    char buf[7];
-                    snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)c);
-                    output += buf;
-                } else {
-                    output += c;
-                }
+            default: {
+                char buf[7];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                output += buf;
+            }
         }
     }
+    output.append(run, p - run);
+}
+
+string escape_json_string(const string& input) {
+    string output;
+    output.reserve(input.length() + input.length() / 8 + 8);
+    append_json_escaped(output, input);
     return output;
 }
 
+/**
+ * Appends JSON straight into a caller-owned string
+ *
+ * Commas between members and array elements are written automatically,
+ * numbers are formatted with to_chars, and strings are escaped in place,
+ * so a response is built with no temporaries. Callers that know roughly
+ * how big the result gets reserve() first and the string never regrows.
+ */
+class JSONWriter {
+public:
+    explicit JSONWriter(string& out) : out(out) {}
+    
+    void reserve(size_t bytes) { out.reserve(out.size() + bytes); }
+    
+    // Starts a member; the value call that follows completes it
+    JSONWriter& key(string_view name) {
+        separate();
+        out += '"';
+        out.append(name.data(), name.size());
+        out += "\":";
+        need_comma = false;
+        return *this;
+    }
+    
+    void begin_object() { separate(); out += '{'; need_comma = false; }
+    void end_object() { out += '}'; need_comma = true; }
+    void begin_array() { separate(); out += '['; need_comma = false; }
+    void end_array() { out += ']'; need_comma = true; }
+    
+    void value(string_view text) {
+        separate();
+        out += '"';
+        append_json_escaped(out, text);
+        out += '"';
+        need_comma = true;
+    }
+    
+    void number(uint64_t n) { integer(n); }
+    void number(int64_t n) { integer(n); }
+    void number(uint32_t n) { integer(n); }
+    void number(int n) { integer(n); }
+    
+    void boolean(bool b) {
+        separate();
+        out += b ? "true" : "false";
+        need_comma = true;
+    }
+    
+    // Starts a value the caller appends to the returned string itself
+    string& element() {
+        separate();
+        need_comma = true;
+        return out;
+    }
+    
+    // Already-encoded JSON
+    void raw(string_view json) {
+        separate();
+        out.append(json.data(), json.size());
+        need_comma = true;
+    }
+    
+private:
+    string& out;
+    bool need_comma = false;
+    
+    void separate() {
+        if (need_comma) out += ',';
+        need_comma = false;
+    }
+    
+    template <typename T>
+    void integer(T n) {
+        separate();
+        char buf[24];
+        auto result = to_chars(buf, buf + sizeof(buf), n);
+        out.append(buf, result.ptr - buf);
+        need_comma = true;
+    }
+};
+
 // ============================================================================
 // JSON PARSING
 // ============================================================================
 
 struct JSONRequest {
+    OperationCode op = UNKNOWN_OPERATION;
     string operation;
     string session_id;
     string request_id;
@@ -62,129 +180,946 @@ struct JSONRequest {
     string old_path;
     string new_path;
     string data;
-    uint32_t role;
-    uint32_t permissions;
+    string format;              // get_metrics: "prometheus" for the text exposition format
+    uint32_t role = 0;
+    uint32_t permissions = 0;
+    uint64_t total_size = 0;    // fs_grow / fs_shrink, 0 keeps the current value
+    uint32_t max_files = 0;
+    uint32_t max_users = 0;
+    
+    // batch: the sub-operations, run in order in one queue slot
+    vector<JSONRequest> batch;
+    bool atomic = false;
 };
 
 struct JSONResponse {
     string status;
     string operation;
     string request_id;
-    int error_code;
+    int error_code = 0;
     string error_message;
     string data;
+    // file_read content, kept raw so binary responses can send it unescaped
+    string content;
+    bool has_content = false;
+    uint32_t retry_after_ms = 0;    // ERROR_BUSY: when the client may try again
 };
 
-string extract_json_value(const string& json, const string& key) {
-    string search = "\"" + key + "\":\"";
-    size_t pos = json.find(search);
-    if (pos == string::npos) return "";
-    
-    size_t start = pos + search.length();
-    size_t end = json.find("\"", start);
-    if (end == string::npos) return "";
-    
-    return json.substr(start, end - start);
+// Request members by field tag (protocol.hpp), shared by both decoders
+const size_t MAX_BATCH_SIZE = 10000;     // Sub-operations one batch may carry
+
+string* request_text_field(JSONRequest& req, uint8_t tag) {
+    switch (tag) {
+        case TAG_SESSION_ID: return &req.session_id;
+        case TAG_REQUEST_ID: return &req.request_id;
+        case TAG_USERNAME:   return &req.username;
+        case TAG_PASSWORD:   return &req.password;
+        case TAG_PATH:       return &req.path;
+        case TAG_OLD_PATH:   return &req.old_path;
+        case TAG_NEW_PATH:   return &req.new_path;
+        case TAG_DATA:       return &req.data;
+        case TAG_FORMAT:     return &req.format;
+        default:             return nullptr;
+    }
 }
 
-string extract_json_data(const string& json) {
-    string search = "\"data\":\"";
-    size_t pos = json.find(search);
-    if (pos == string::npos) return "";
-    
-    size_t start = pos + search.length();
-    string result;
-    bool escaped = false;
-    
-    for (size_t i = start; i < json.length(); i++) {
-        char c = json[i];
-        
-        if (escaped) {
-            switch (c) {
-                case 'n': result += '\n'; break;
-                case 't': result += '\t'; break;
-                case 'r': result += '\r'; break;
-                case '"': result += '"'; break;
-                case '\\': result += '\\'; break;
-                case 'b': result += '\b'; break;
-                case 'f': result += '\f'; break;
-                default: result += c;
+bool is_number_field(uint8_t tag) {
+    return tag == TAG_ROLE || tag == TAG_TOTAL_SIZE || tag == TAG_MAX_FILES || tag == TAG_MAX_USERS ||
+           tag == TAG_ATOMIC;
+}
+
+// False when value does not fit the member; the decoders treat that as malformed
+bool set_request_number(JSONRequest& req, uint8_t tag, uint64_t value) {
+    bool fits_u32 = value <= UINT32_MAX;
+    switch (tag) {
+        case TAG_ROLE:       req.role = value; return fits_u32;
+        case TAG_TOTAL_SIZE: req.total_size = value; return true;
+        case TAG_MAX_FILES:  req.max_files = value; return fits_u32;
+        case TAG_MAX_USERS:  req.max_users = value; return fits_u32;
+        case TAG_ATOMIC:     req.atomic = value != 0; return true;
+        default:             return true;
+    }
+}
+
+void set_request_operation(JSONRequest& req, string_view name) {
+    req.op = operation_code(name);
+    req.operation = name;
+}
+
+void append_utf8(string& out, uint32_t code_point) {
+    if (code_point < 0x80) {
+        out += (char)code_point;
+    } else if (code_point < 0x800) {
+        out += (char)(0xC0 | (code_point >> 6));
+        out += (char)(0x80 | (code_point & 0x3F));
+    } else if (code_point < 0x10000) {
+        out += (char)(0xE0 | (code_point >> 12));
+        out += (char)(0x80 | ((code_point >> 6) & 0x3F));
+        out += (char)(0x80 | (code_point & 0x3F));
+    } else {
+        out += (char)(0xF0 | (code_point >> 18));
+        out += (char)(0x80 | ((code_point >> 12) & 0x3F));
+        out += (char)(0x80 | ((code_point >> 6) & 0x3F));
+        out += (char)(0x80 | (code_point & 0x3F));
+    }
+}
+
+/**
+ * Single-pass parser for request objects
+ *
+ * Walks the message once. Keys and values are string_views into the
+ * message; a value is copied into its request member exactly once, and
+ * only values that contain escapes go through the decoder. Keys may sit
+ * at the top level or inside "parameters"; unknown keys and values of
+ * any type are skipped.
+ */
+class JSONRequestParser {
+public:
+    explicit JSONRequestParser(string_view text) : pos(text.data()), end(text.data() + text.size()) {}
+
+    // False for malformed JSON or anything after the object; fields parsed
+    // up to the error are kept, so the request must not be run
+    bool parse(JSONRequest& req) {
+        if (!parse_object(req, 0)) return false;
+        skip_space();
+        return pos == end;
+    }
+
+private:
+    const char* pos;
+    const char* end;
+    bool in_batch = false;      // Batches do not nest
+
+    static const int MAX_DEPTH = 64;
+
+    void skip_space() {
+        while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\n' || *pos == '\r')) pos++;
+    }
+
+    bool consume(char c) {
+        skip_space();
+        if (pos < end && *pos == c) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    // Leaves raw pointing between the quotes
+    bool scan_string(string_view& raw, bool& escaped) {
+        skip_space();
+        if (pos >= end || *pos != '"') return false;
+        const char* start = ++pos;
+        escaped = false;
+        while (pos < end && *pos != '"') {
+            if (*pos == '\\') {
+                escaped = true;
+                pos++;
             }
-            escaped = false;
-        } else if (c == '\\') {
-            escaped = true;
-        } else if (c == '"') {
-            break;
-        } else {
-            result += c;
+            pos++;
         }
+        if (pos >= end) return false;
+        raw = string_view(start, pos - start);
+        pos++;
+        return true;
     }
-    
-    return result;
-}
 
-int extract_json_number(const string& json, const string& key) {
-    string search = "\"" + key + "\":";
-    size_t pos = json.find(search);
-    if (pos == string::npos) return 0;
-    
-    size_t start = pos + search.length();
-    size_t end = json.find_first_of(",}", start);
-    if (end == string::npos) return 0;
-    
-    string num_str = json.substr(start, end - start);
-    return atoi(num_str.c_str());
+    static bool read_hex4(const char*& p, const char* limit, uint32_t& value) {
+        if (limit - p < 4) return false;
+        value = 0;
+        for (int i = 0; i < 4; i++, p++) {
+            char c = *p;
+            value <<= 4;
+            if (c >= '0' && c <= '9') value |= c - '0';
+            else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+            else return false;
+        }
+        return true;
+    }
+
+    static bool unescape(string_view raw, string& out) {
+        out.clear();
+        out.reserve(raw.size());
+        const char* p = raw.data();
+        const char* limit = p + raw.size();
+        while (p < limit) {
+            const char* backslash = (const char*)memchr(p, '\\', limit - p);
+            if (!backslash) {
+                out.append(p, limit - p);
+                break;
+            }
+            out.append(p, backslash - p);
+            p = backslash + 1;
+            if (p >= limit) return false;
+            switch (*p++) {
+                case '"':  out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/':  out += '/'; break;
+                case 'b':  out += '\b'; break;
+                case 'f':  out += '\f'; break;
+                case 'n':  out += '\n'; break;
+                case 'r':  out += '\r'; break;
+                case 't':  out += '\t'; break;
+                case 'u': {
+                    uint32_t code_point;
+                    if (!read_hex4(p, limit, code_point)) return false;
+                    // A high surrogate followed by a low one is a single code point
+                    if (code_point >= 0xD800 && code_point < 0xDC00 && limit - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+                        const char* low_start = p + 2;
+                        uint32_t low;
+                        if (read_hex4(low_start, limit, low) && low >= 0xDC00 && low < 0xE000) {
+                            code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+                            p = low_start;
+                        }
+                    }
+                    append_utf8(out, code_point);
+                    break;
+                }
+                default: return false;
+            }
+        }
+        return true;
+    }
+
+    // Numeric fields are non-negative integers; a sign, a fraction, an
+    // exponent or more than 64 bits makes the request malformed
+    bool parse_number(uint64_t& value) {
+        const char* start = pos;
+        value = 0;
+        while (pos < end && *pos >= '0' && *pos <= '9') {
+            uint64_t digit = *pos - '0';
+            if (value > (UINT64_MAX - digit) / 10) return false;
+            value = value * 10 + digit;
+            pos++;
+        }
+        if (pos == start) return false;
+        return pos == end || (*pos != '.' && *pos != 'e' && *pos != 'E');
+    }
+
+    // Numbers of keys the request does not use may be any JSON number
+    bool skip_number() {
+        if (pos < end && *pos == '-') pos++;
+        const char* start = pos;
+        while (pos < end && (*pos == '.' || *pos == 'e' || *pos == 'E' || *pos == '+' || *pos == '-' ||
+                             (*pos >= '0' && *pos <= '9'))) pos++;
+        return pos != start;
+    }
+
+    bool skip_value(int depth) {
+        skip_space();
+        if (pos >= end || depth > MAX_DEPTH) return false;
+        string_view raw;
+        bool escaped;
+        switch (*pos) {
+            case '"':
+                return scan_string(raw, escaped);
+            case '{':
+            case '[': {
+                char close = *pos == '{' ? '}' : ']';
+                pos++;
+                if (consume(close)) return true;
+                do {
+                    if (close == '}' && (!scan_string(raw, escaped) || !consume(':'))) return false;
+                    if (!skip_value(depth + 1)) return false;
+                } while (consume(','));
+                return consume(close);
+            }
+            default:
+                if (*pos == '-' || (*pos >= '0' && *pos <= '9')) return skip_number();
+                for (const char* word : {"true", "false", "null"}) {
+                    size_t length = strlen(word);
+                    if ((size_t)(end - pos) >= length && memcmp(pos, word, length) == 0) {
+                        pos += length;
+                        return true;
+                    }
+                }
+                return false;
+        }
+    }
+
+    bool parse_object(JSONRequest& req, int depth) {
+        if (!consume('{')) return false;
+        if (consume('}')) return true;
+
+        do {
+            string_view key;
+            bool key_escaped;
+            if (!scan_string(key, key_escaped) || !consume(':')) return false;
+            skip_space();
+            if (pos >= end) return false;
+
+            if (*pos == '{' && key == "parameters" && depth == 0) {
+                if (!parse_object(req, depth + 1)) return false;
+            } else if (*pos == '[' && key == "operations" && !in_batch) {
+                if (!parse_batch(req)) return false;
+            } else if (key == "atomic" && (*pos == 't' || *pos == 'f')) {
+                req.atomic = *pos == 't';
+                if (!skip_value(depth + 1)) return false;
+            } else if (*pos == '"') {
+                string_view raw;
+                bool escaped;
+                if (!scan_string(raw, escaped)) return false;
+
+                if (key == "operation") {
+                    set_request_operation(req, raw);
+                } else if (string* target = request_text_field(req, field_tag(key))) {
+                    if (!escaped) target->assign(raw.data(), raw.size());
+                    else if (!unescape(raw, *target)) return false;
+                }
+            } else if (is_number_field(field_tag(key)) && (*pos == '-' || (*pos >= '0' && *pos <= '9'))) {
+                uint64_t number;
+                if (!parse_number(number) || !set_request_number(req, field_tag(key), number)) return false;
+            } else if (!skip_value(depth + 1)) {
+                return false;
+            }
+        } while (consume(','));
+
+        return consume('}');
+    }
+
+    bool parse_batch(JSONRequest& req) {
+        pos++;
+        if (consume(']')) return true;
+        in_batch = true;
+        do {
+            if (req.batch.size() >= MAX_BATCH_SIZE) return false;
+            req.batch.emplace_back();
+            if (!parse_object(req.batch.back(), 0)) return false;
+        } while (consume(','));
+        in_batch = false;
+        return consume(']');
+    }
+};
+
+// False for a malformed request, which must be answered without running it
+bool parse_json_request(const string& json, JSONRequest& req) {
+    if (!JSONRequestParser(json).parse(req)) {
+        LOG_WARN("[PARSER] Malformed request: " << json.substr(0, 80));
+        return false;
+    }
+    return true;
 }
 
-JSONRequest parse_json_request(const string& json) {
+int test_json_parser() {
+    int failures = 0;
+
+    cout << "\n========================================" << endl;
+    cout << "  JSON REQUEST PARSER TEST" << endl;
+    cout << "========================================\n" << endl;
+
+    // Test 1: Fields at the top level and in parameters, numbers, unknown keys
+    cout << "Test 1: Well-formed request..." << endl;
     JSONRequest req;
-    
-    req.operation = extract_json_value(json, "operation");
-    req.session_id = extract_json_value(json, "session_id");
-    req.request_id = extract_json_value(json, "request_id");
-    
-    size_t params_start = json.find("\"parameters\":{");
-    if (params_start != string::npos) {
-        string params = json.substr(params_start);
-        req.username = extract_json_value(params, "username");
-        req.password = extract_json_value(params, "password");
-        req.path = extract_json_value(params, "path");
-        req.old_path = extract_json_value(params, "old_path");
-        req.new_path = extract_json_value(params, "new_path");
-        req.data = extract_json_data(json);
-        req.role = extract_json_number(params, "role");
+    bool ok = parse_json_request(
+        "{\"operation\":\"fs_grow\",\"session_id\":\"S1\",\"request_id\":\"7\",\"extra\":[1,{\"x\":null},true],"
+        "\"parameters\":{\"total_size\":1099511627776,\"max_files\":5000,\"role\":1,\"path\":\"/a\"}}", req);
+    if (!ok || req.op != OP_FS_GROW || req.session_id != "S1" || req.request_id != "7" ||
+        req.total_size != (1ULL << 40) || req.max_files != 5000 || req.role != 1 || req.path != "/a") {
+        cerr << "FAILED: Well-formed request parsed wrong" << endl;
+        failures++;
+    }
+
+    // Test 2: Escapes, including quotes and braces inside strings
+    cout << "\nTest 2: Escaped quotes and control characters..." << endl;
+    req = JSONRequest();
+    ok = parse_json_request("{\"operation\":\"file_create\",\"parameters\":{\"path\":\"/q\\\"}{\\\".txt\","
+                            "\"data\":\"tab\\there\\nback\\\\slash\\/\\u0041\\u00e9\\u20ac\"}}", req);
+    if (!ok || req.path != "/q\"}{\".txt" || req.data != "tab\there\nback\\slash/A\xc3\xa9\xe2\x82\xac") {
+        cerr << "FAILED: Escapes decoded as '" << req.path << "' / '" << req.data << "'" << endl;
+        failures++;
+    }
+
+    // Test 3: A surrogate pair is one code point, written as 4 bytes of UTF-8
+    cout << "\nTest 3: Surrogate pairs..." << endl;
+    req = JSONRequest();
+    ok = parse_json_request("{\"operation\":\"file_create\",\"path\":\"/\\ud83d\\ude00\\uD834\\uDD1E\"}", req);
+    if (!ok || req.path != "/\xf0\x9f\x98\x80\xf0\x9d\x84\x9e") {
+        cerr << "FAILED: Surrogate pairs decoded as '" << req.path << "'" << endl;
+        failures++;
+    }
+
+    // Test 4: Batches keep their items in order
+    cout << "\nTest 4: Batch..." << endl;
+    req = JSONRequest();
+    ok = parse_json_request("{\"operation\":\"batch\",\"parameters\":{\"operations\":["
+                            "{\"operation\":\"dir_create\",\"parameters\":{\"path\":\"/d\"}},"
+                            "{\"operation\":\"file_create\",\"parameters\":{\"path\":\"/d/f\",\"data\":\"x\"}}],"
+                            "\"atomic\":true}}", req);
+    if (!ok || req.op != OP_BATCH || !req.atomic || req.batch.size() != 2 || req.batch[0].op != OP_DIR_CREATE ||
+        req.batch[1].path != "/d/f" || req.batch[1].data != "x") {
+        cerr << "FAILED: Batch parsed wrong (" << req.batch.size() << " items)" << endl;
+        failures++;
+    }
+
+    // Test 5: Malformed input is refused however much of it parsed
+    cout << "\nTest 5: Malformed requests..." << endl;
+    const char* malformed[] = {
+        "",
+        "   ",
+        "[]",
+        "{\"operation\":\"file_delete\",\"parameters\":{\"path\":\"/mal.txt\"} oops }",
+        "{\"operation\":\"file_delete\",\"path\":\"/mal.txt\"} trailing",
+        "{\"operation\":\"file_delete\",\"path\":\"/mal.txt\"",
+        "{\"operation\":\"file_delete\",\"path\":\"/mal.txt}",
+        "{\"operation\":\"file_delete\",\"path\" \"/mal.txt\"}",
+        "{\"operation\":\"file_delete\",\"path\":\"/mal.txt\",}",
+        "{\"operation\":\"file_delete\",\"path\":\"/bad\\xescape\"}",
+        "{\"operation\":\"file_delete\",\"path\":\"/bad\\u12G4\"}",
+        "{\"operation\":\"file_delete\",\"path\":\"/cut\\u12\"}",
+        "{\"operation\":\"file_delete\",\"path\":nope}",
+        "{\"operation\":\"batch\",\"operations\":[{\"operation\":\"file_delete\",\"path\":\"/a\"},"
+            "{\"operation\":\"file_delete\",\"path\":\"/b\"} x],\"atomic\":true}",
+        "{\"operation\":\"batch\",\"operations\":[{\"operation\":\"file_delete\",\"path\":\"/a\"},]}",
+        "{\"operation\":\"fs_grow\",\"total_size\":99999999999999999999}",
+        "{\"operation\":\"fs_grow\",\"total_size\":18446744073709551616}",
+        "{\"operation\":\"fs_grow\",\"total_size\":1048576.5}",
+        "{\"operation\":\"fs_grow\",\"total_size\":1e9}",
+        "{\"operation\":\"fs_grow\",\"total_size\":-1}",
+        "{\"operation\":\"fs_grow\",\"max_files\":4294967296}",
+        "{\"operation\":\"user_create\",\"role\":-0}",
+        "{\"operation\":\"fs_grow\",\"total_size\":-}",
+    };
+    for (const char* text : malformed) {
+        req = JSONRequest();
+        if (parse_json_request(text, req)) {
+            cerr << "FAILED: Accepted malformed request: " << text << endl;
+            failures++;
+        }
     }
+    req = JSONRequest();
+    if (!parse_json_request("{\"operation\":\"fs_grow\",\"total_size\":18446744073709551615,\"ratio\":-0.5e+2}", req) ||
+        req.total_size != UINT64_MAX) {
+        cerr << "FAILED: Largest total_size or an unused fractional number refused" << endl;
+        failures++;
+    }
+    string deep = "{\"operation\":\"file_delete\",\"x\":" + string(200, '[') + string(200, ']') + "}";
+    req = JSONRequest();
+    if (parse_json_request(deep, req)) {
+        cerr << "FAILED: Accepted nesting past the depth limit" << endl;
+        failures++;
+    }
+
+    cout << "\n========================================" << endl;
+    if (failures == 0) {
+        cout << "  ✓ ALL TESTS PASSED!" << endl;
+    } else {
+        cout << "  ✗ " << failures << " CHECK(S) FAILED" << endl;
+    }
+    cout << "========================================\n" << endl;
+
+    return failures == 0 ? SUCCESS : ERROR_IO_ERROR;
+}
+
+// Appends the response to out; sized up front so it is built in one allocation
+void write_json_response(const JSONResponse& resp, string& out) {
+    out.reserve(out.size() + 96 + resp.operation.size() + resp.request_id.size() + resp.error_message.size() +
+                resp.data.size() + resp.content.size() + resp.content.size() / 8);
+    JSONWriter json(out);
+    json.begin_object();
+    json.key("status").value(resp.status);
+    json.key("operation").value(resp.operation);
+    json.key("request_id").value(resp.request_id);
     
-    return req;
+    if (resp.status == "error") {
+        json.key("error_code").number(resp.error_code);
+        json.key("error_message").value(resp.error_message);
+        if (resp.retry_after_ms) json.key("retry_after_ms").number(resp.retry_after_ms);
+    } else if (resp.has_content || !resp.data.empty()) {
+        json.key("data").begin_object();
+        if (resp.has_content) json.key("content").value(resp.content);
+        if (!resp.data.empty()) json.raw(resp.data);
+        json.end_object();
+    }
+    json.end_object();
 }
 
 string create_json_response(const JSONResponse& resp) {
-    string json = "{";
-    json += "\"status\":\"" + resp.status + "\",";
-    json += "\"operation\":\"" + resp.operation + "\",";
-    json += "\"request_id\":\"" + resp.request_id + "\"";
+    string json;
+    write_json_response(resp, json);
+    return json;
+}
+
+// ============================================================================
+// BINARY PROTOCOL
+// ============================================================================
+
+bool decode_binary_batch(const string& operations, JSONRequest& req);
+
+// Returns false for a message that does not follow protocol.hpp
+bool decode_binary_request(const string& message, JSONRequest& req, bool nested = false) {
+    BinaryReader reader(message.data(), message.size());
+    uint8_t version, code;
+    if (!reader.get_u8(version) || version != BINARY_VERSION || !reader.get_u8(code)) {
+        return false;
+    }
+    // Unknown codes become an unknown operation and get the usual error
+    if (code < OPERATION_COUNT) {
+        set_request_operation(req, OPERATION_NAMES[code]);
+    } else {
+        req.operation = "opcode_" + to_string(code);
+    }
     
-    if (resp.status == "error") {
-        json += ",\"error_code\":" + to_string(resp.error_code);
-        json += ",\"error_message\":\"" + escape_json_string(resp.error_message) + "\"";
-    } else if (!resp.data.empty()) {
-        json += ",\"data\":{" + resp.data + "}";
+    while (!reader.at_end()) {
+        uint8_t tag, type;
+        uint64_t number = 0;
+        string text;
+        if (!reader.next_field(tag, type, text, number)) return false;
+        
+        string* target = request_text_field(req, tag);
+        if (type == FIELD_BYTES && target) *target = move(text);
+        else if (type == FIELD_U64) {
+            if (!set_request_number(req, tag, number)) return false;
+        }
+        else if (type == FIELD_BYTES && tag == TAG_OPERATIONS && !nested && !decode_binary_batch(text, req)) return false;
+    }
+    return true;
+}
+
+// Sub-requests of a batch: u32 length, then a request message, repeated
+bool decode_binary_batch(const string& operations, JSONRequest& req) {
+    size_t offset = 0;
+    while (offset < operations.size()) {
+        if (operations.size() - offset < FRAME_HEADER_SIZE || req.batch.size() >= MAX_BATCH_SIZE) return false;
+        uint32_t length = read_frame_length(operations.data() + offset);
+        offset += FRAME_HEADER_SIZE;
+        if (operations.size() - offset < length) return false;
+        
+        req.batch.emplace_back();
+        if (!decode_binary_request(operations.substr(offset, length), req.batch.back(), true)) return false;
+        offset += length;
     }
+    return true;
+}
+
+// Appends the response to out; the operation and request id are echoed
+// from the request
+void encode_binary_response(const JSONRequest& req, const JSONResponse& resp, string& out) {
+    out.reserve(out.size() + 64 + req.request_id.size() + resp.error_message.size() +
+                resp.content.size() + resp.data.size());
+    BinaryWriter writer(out);
     
-    json += "}";
-    return json;
+    bool success = resp.status != "error";
+    writer.put_u8(BINARY_VERSION);
+    writer.put_u8(req.op);
+    writer.put_u8(success ? 0 : 1);
+    writer.put_u32((uint32_t)(success ? 0 : resp.error_code));
+    writer.put_bytes(TAG_REQUEST_ID, req.request_id);
+    
+    if (!success) {
+        writer.put_bytes(TAG_ERROR_MESSAGE, resp.error_message);
+        if (resp.retry_after_ms) writer.put_number(TAG_RETRY_AFTER_MS, resp.retry_after_ms);
+    } else {
+        if (resp.has_content) writer.put_bytes(TAG_CONTENT, resp.content);
+        if (!resp.data.empty()) {
+            writer.begin_bytes(TAG_RESULT, resp.data.size() + 2);
+            writer.put_raw("{");
+            writer.put_raw(resp.data);
+            writer.put_raw("}");
+        }
+    }
 }
 
+// ============================================================================
+// METRICS
+// ============================================================================
+
+// Where a request spends its time, from admission to the socket
+enum Stage {
+    STAGE_QUEUE,                // Admitted until a worker picks it up (FIFO, locks, ready queue)
+    STAGE_LOOKUP,               // Session lookup
+    STAGE_EXECUTE,              // The handler, including container I/O
+    STAGE_ENCODE,               // Building the response
+    STAGE_SEND,                 // Ordering it and handing it to the socket
+    STAGE_COUNT
+};
+
+const char* const STAGE_NAMES[STAGE_COUNT] = {"queue", "lookup", "execute", "encode", "send"};
+
+enum ServerCounter {
+    COUNTER_NET_RECEIVED,       // Bytes read from client sockets
+    COUNTER_NET_SENT,           // Bytes written to client sockets
+    COUNTER_FILE_WRITTEN,       // File content stored by file_create
+    COUNTER_FILE_READ,          // File content returned by file_read
+    COUNTER_SESSION_HIT,        // Session tokens found in the session table
+    COUNTER_SESSION_MISS,
+    COUNTER_BUFFER_REUSED,      // Responses encoded into a recycled buffer
+    COUNTER_BUFFER_NEW,         // ... or into a new one
+    COUNTER_COUNT
+    // Followed by one error counter per operation code
+};
+
+const char* const COUNTER_NAMES[COUNTER_COUNT] = {
+    "net_received_bytes", "net_sent_bytes", "file_written_bytes", "file_read_bytes",
+    "session_hits", "session_misses", "buffers_reused", "buffers_allocated"
+};
+
+// Histograms: one per operation code (the time in OperationProcessor::process),
+// then one per stage. Nanoseconds.
+Metrics server_metrics(OPERATION_COUNT + STAGE_COUNT, COUNTER_COUNT + OPERATION_COUNT);
+
+// Records the stage that began at started_ns and returns the time it ended
+inline uint64_t record_stage(Stage stage, uint64_t started_ns) {
+    uint64_t now = metrics_now_ns();
+    server_metrics.record(OPERATION_COUNT + stage, now - started_ns);
+    return now;
+}
+
+// ============================================================================
+// CONNECTIONS
+// ============================================================================
+
+const size_t READ_CHUNK_SIZE = 64 * 1024;
+const size_t MAX_SEND_SEGMENTS = 64;                   // iovecs per sendmsg
+const size_t MAX_SPARE_BUFFERS = 4;                    // Recycled response buffers per connection
+const size_t MAX_SPARE_CAPACITY = 1024 * 1024;         // Bigger buffers are freed, not kept
+const size_t MAX_PENDING_OUTPUT = 64 * 1024 * 1024;    // Unsent response bytes before reading pauses
+
+// Sequence number of a response that goes out as soon as it is ready
+const uint64_t UNSEQUENCED = UINT64_MAX;
+const size_t MAX_REQUEST_SIZE = MAX_FRAME_SIZE;
+
+// Protocol a connection speaks (see protocol.hpp)
+enum WireFormat {
+    WIRE_UNKNOWN,               // Nothing but whitespace received yet
+    WIRE_JSON_STREAM,           // Bare JSON objects
+    WIRE_FRAMED,                // Length-prefixed JSON
+    WIRE_BINARY,                // Length-prefixed binary messages
+    WIRE_INVALID                // Unknown preamble or binary version
+};
+
+struct IOThread;
+// Asks the I/O thread that owns fd to resume reading it (any thread)
+void request_resume(IOThread* io, int fd);
+
+/**
+ * One client socket (non-blocking)
+ *
+ * The receive side belongs to the I/O thread that owns the connection.
+ * The send side is shared with the processor thread, which queues
+ * responses, so it is guarded by out_mutex. The socket is only closed
+ * under that mutex, which keeps a late response from reaching a new
+ * connection that reused the descriptor.
+ *
+ * Responses are never copied once encoded: each one is moved into the
+ * send queue as its own segment (behind a frame header segment when the
+ * format is framed) and the queue goes out with a single sendmsg per
+ * flush. Written segments go back to a small spare list, so steady
+ * traffic keeps reusing the same few buffers.
+ *
+ * Backpressure: once a connection has max_in_flight unanswered requests,
+ * or more than MAX_PENDING_OUTPUT bytes its client has not read, the I/O
+ * thread stops reading it and the kernel's socket buffers push back on
+ * the client. Whichever thread brings it back under half of both limits
+ * asks the I/O thread to resume.
+ */
+struct Connection {
+    int fd;
+    int epoll_fd;               // Epoll set of the owning I/O thread
+    IOThread* owner;
+    int max_in_flight;
+
+    // Set by the I/O thread before the first request is queued and never
+    // changed after, so workers read it without a lock
+    WireFormat format = WIRE_UNKNOWN;
+    // A bad frame after negotiation; the I/O thread closes the connection (I/O thread only)
+    bool broken = false;
+
+    // Receive buffer and the state of the scan for the end of the current request
+    string in;
+    size_t scan_pos = 0;
+    int depth = 0;
+    bool in_string = false;
+    bool escaped = false;
+
+    // Requests without a request_id are numbered as they arrive (I/O
+    // thread only); their responses wait in ready until their turn.
+    // Requests with an id are answered as soon as they finish and the
+    // client matches the answer by that id.
+    uint64_t next_sequence = 0;
+
+    atomic<int> in_flight{0};           // Admitted requests not yet answered
+    atomic<bool> paused{false};         // Reading stopped for backpressure (set by the I/O thread)
+
+    mutex out_mutex;
+    deque<string> out;          // Segments waiting for the socket
+    size_t out_pos = 0;         // Bytes of out.front() already sent
+    size_t out_bytes = 0;       // Unsent bytes in out
+    vector<string> spare;
+    bool reading = true;
+    uint32_t events = EPOLLIN;  // Currently registered with epoll
+    bool closed = false;
+    uint64_t next_to_send = 0;
+    map<uint64_t, string> ready;
+
+    Connection(int socket_fd, int epoll, IOThread* io, int in_flight_limit)
+        : fd(socket_fd), epoll_fd(epoll), owner(io), max_in_flight(in_flight_limit) {}
+
+    bool over_limits() {
+        lock_guard<mutex> lock(out_mutex);
+        return in_flight >= max_in_flight || out_bytes >= MAX_PENDING_OUTPUT;
+    }
+
+    // Half of both limits, so a paused connection does not flap
+    bool under_resume_limits_locked() const {
+        return in_flight <= max_in_flight / 2 && out_bytes < MAX_PENDING_OUTPUT / 2;
+    }
+
+    bool under_resume_limits() {
+        lock_guard<mutex> lock(out_mutex);
+        return under_resume_limits_locked();
+    }
+
+    void set_reading(bool enabled) {
+        lock_guard<mutex> lock(out_mutex);
+        reading = enabled;
+        if (!closed) update_events_locked();
+    }
+
+    // Called once the response to an admitted request is queued
+    void request_done() {
+        in_flight--;
+        if (paused && under_resume_limits()) request_resume(owner, fd);
+    }
+
+    // Pulls the next complete request out of the receive buffer
+    bool next_request(string& message) {
+        if (broken) return false;
+        if (format == WIRE_UNKNOWN) detect_format();
+        if (format == WIRE_FRAMED || format == WIRE_BINARY) return next_frame(message);
+        if (format == WIRE_JSON_STREAM) return next_json_object(message);
+        return false;
+    }
+
+    void detect_format() {
+        size_t start = in.find_first_not_of(" \t\r\n");
+        if (start == string::npos) {
+            in.clear();
+            return;
+        }
+        if (in[start] == '{') {
+            format = WIRE_JSON_STREAM;
+            return;
+        }
+        
+        // Wait until the whole preamble (plus the version byte for binary) is in
+        size_t available = in.size() - start;
+        size_t compared = min(available, sizeof(FRAMED_PREAMBLE));
+        bool framed = memcmp(in.data() + start, FRAMED_PREAMBLE, compared) == 0;
+        bool binary = memcmp(in.data() + start, BINARY_PREAMBLE, compared) == 0;
+        if (!framed && !binary) {
+            format = WIRE_INVALID;
+        } else if (framed && available >= sizeof(FRAMED_PREAMBLE)) {
+            format = WIRE_FRAMED;
+            in.erase(0, start + sizeof(FRAMED_PREAMBLE));
+        } else if (binary && available > sizeof(BINARY_PREAMBLE)) {
+            uint8_t client_version = in[start + sizeof(BINARY_PREAMBLE)];
+            uint8_t version = client_version >= BINARY_VERSION ? BINARY_VERSION : 0;
+            in.erase(0, start + sizeof(BINARY_PREAMBLE) + 1);
+            send_raw(string(1, (char)version));
+            format = version != 0 ? WIRE_BINARY : WIRE_INVALID;
+        }
+    }
+
+    // Length-prefixed requests; consumed bytes are dropped once the buffer
+    // holds no further complete frame
+    bool next_frame(string& message) {
+        if (in.size() - scan_pos >= FRAME_HEADER_SIZE) {
+            uint32_t length = read_frame_length(in.data() + scan_pos);
+            if (length > MAX_FRAME_SIZE) {
+                broken = true;
+                return false;
+            }
+            if (in.size() - scan_pos - FRAME_HEADER_SIZE >= length) {
+                message.assign(in, scan_pos + FRAME_HEADER_SIZE, length);
+                scan_pos += FRAME_HEADER_SIZE + length;
+                return true;
+            }
+        }
+        in.erase(0, scan_pos);
+        scan_pos = 0;
+        return false;
+    }
+
+    // Pulls the next complete top-level JSON object out of the receive
+    // buffer. Scan state is kept between reads, so a large request that
+    // arrives in many pieces is scanned only once.
+    bool next_json_object(string& message) {
+        while (scan_pos < in.size()) {
+            char c = in[scan_pos++];
+            if (in_string) {
+                if (escaped) escaped = false;
+                else if (c == '\\') escaped = true;
+                else if (c == '"') in_string = false;
+            } else if (c == '"') {
+                in_string = true;
+            } else if (c == '{') {
+                depth++;
+            } else if (c == '}' && depth > 0 && --depth == 0) {
+                size_t start = in.find('{');
+                message = in.substr(start, scan_pos - start);
+                in.erase(0, scan_pos);
+                scan_pos = 0;
+                return true;
+            }
+        }
+        // Nothing but whitespace between requests
+        if (depth == 0) {
+            in.clear();
+            scan_pos = 0;
+        }
+        return false;
+    }
+
+    // An empty buffer to encode a response into, with capacity left over
+    // from earlier responses when there is one
+    string take_buffer() {
+        lock_guard<mutex> lock(out_mutex);
+        if (spare.empty()) {
+            server_metrics.add(COUNTER_BUFFER_NEW);
+            return string();
+        }
+        server_metrics.add(COUNTER_BUFFER_REUSED);
+        string buffer = move(spare.back());
+        spare.pop_back();
+        return buffer;
+    }
+
+    // Queues the response to request number sequence (or UNSEQUENCED) and
+    // writes as much as the socket takes right now; the owning I/O thread
+    // finishes the rest on EPOLLOUT. A slow operation only holds back the
+    // untagged responses queued after it.
+    void send_response(uint64_t sequence, string&& data) {
+        lock_guard<mutex> lock(out_mutex);
+        if (closed) return;
+
+        if (sequence == UNSEQUENCED) {
+            queue_response(move(data));
+        } else {
+            ready.emplace(sequence, move(data));
+            for (auto next = ready.begin(); next != ready.end() && next->first == next_to_send; next = ready.erase(next)) {
+                queue_response(move(next->second));
+                next_to_send++;
+            }
+        }
+        flush_locked();
+    }
+
+    // out_mutex must be held
+    void queue_response(string&& data) {
+        if (format != WIRE_JSON_STREAM) {
+            string header;
+            append_frame_header(header, data.size());
+            out_bytes += header.size();
+            out.push_back(move(header));
+        }
+        out_bytes += data.size();
+        out.push_back(move(data));
+    }
+
+    // Bytes outside the response sequence (the binary version answer)
+    void send_raw(const string& data) {
+        lock_guard<mutex> lock(out_mutex);
+        if (closed) return;
+        out_bytes += data.size();
+        out.push_back(data);
+        flush_locked();
+    }
+
+    // Returns false if the socket failed; out_mutex must be held
+    bool flush_locked() {
+        while (!out.empty()) {
+            iovec segments[MAX_SEND_SEGMENTS];
+            size_t count = 0;
+            for (auto it = out.begin(); it != out.end() && count < MAX_SEND_SEGMENTS; ++it, ++count) {
+                size_t skip = count == 0 ? out_pos : 0;
+                segments[count].iov_base = (void*)(it->data() + skip);
+                segments[count].iov_len = it->size() - skip;
+            }
+            msghdr message = {};
+            message.msg_iov = segments;
+            message.msg_iovlen = count;
+
+            ssize_t n = sendmsg(fd, &message, MSG_NOSIGNAL);
+            if (n >= 0) {
+                server_metrics.add(COUNTER_NET_SENT, n);
+                out_bytes -= n;
+                consume_sent(n);
+            } else if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            } else {
+                return false;
+            }
+        }
+
+        update_events_locked();
+        if (paused && under_resume_limits_locked()) request_resume(owner, fd);
+        return true;
+    }
+
+    // Read while not paused, write while output is pending; out_mutex must be held
+    void update_events_locked() {
+        uint32_t wanted = (reading ? (uint32_t)EPOLLIN : 0) | (out.empty() ? 0 : (uint32_t)EPOLLOUT);
+        if (wanted == events) return;
+        epoll_event event;
+        event.events = wanted;
+        event.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+        events = wanted;
+    }
+
+    // Drops the segments the last sendmsg finished; out_mutex must be held
+    void consume_sent(size_t sent) {
+        while (!out.empty() && sent >= out.front().size() - out_pos) {
+            sent -= out.front().size() - out_pos;
+            string& done = out.front();
+            if (spare.size() < MAX_SPARE_BUFFERS && done.capacity() <= MAX_SPARE_CAPACITY &&
+                done.capacity() > sizeof(string)) {
+                done.clear();
+                spare.push_back(move(done));
+            }
+            out.pop_front();
+            out_pos = 0;
+        }
+        out_pos += sent;
+    }
+
+    void close_socket() {
+        lock_guard<mutex> lock(out_mutex);
+        if (closed) return;
+        closed = true;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+    }
+};
+
 // ============================================================================
 // FIFO QUEUE SYSTEM
 // ============================================================================
 
+typedef chrono::steady_clock::time_point Deadline;
+
+// No deadline: the request waits as long as it takes
+const Deadline NO_DEADLINE = Deadline::max();
+
 struct QueuedOperation {
     JSONRequest request;
-    int client_socket;
+    shared_ptr<Connection> connection;
+    uint64_t sequence;          // Position among untagged requests, or UNSEQUENCED
+    Deadline deadline;          // Past this it is answered with ERROR_TIMEOUT instead of run
+    uint64_t queued_ns;         // When it was admitted (metrics_now_ns)
+    uint64_t trace_id = 0;      // Sampled for tracing (core/trace.hpp) when not 0
+    uint64_t dequeued_ns = 0;   // Traced requests only: left the FIFO,
+    uint64_t granted_ns = 0;    // and got its locks
+    
+    QueuedOperation(JSONRequest req, shared_ptr<Connection> conn, uint64_t seq = 0,
+                    Deadline due = NO_DEADLINE) 
+        : request(move(req)), connection(move(conn)), sequence(seq), deadline(due),
+          queued_ns(metrics_now_ns()) {}
     
-    QueuedOperation(const JSONRequest& req, int sock) 
-        : request(req), client_socket(sock) {}
+    bool expired() const { return deadline != NO_DEADLINE && chrono::steady_clock::now() > deadline; }
 };
 
 class FIFOQueue {
@@ -197,13 +1132,10 @@ private:
 public:
     FIFOQueue() : shutdown_flag(false) {}
     
-    void enqueue(const QueuedOperation& op) {
+    void enqueue(QueuedOperation&& op) {
         lock_guard<mutex> lock(queue_mutex);
-        operations.push(op);
+        operations.push(move(op));
         queue_cv.notify_one();
-        
-        cout << "[QUEUE] Enqueued: " << op.request.operation 
-             << " (Size: " << operations.size() << ")" << endl;
     }
     
     bool dequeue(QueuedOperation& op) {
@@ -217,7 +1149,7 @@ public:
             return false;
         }
         
-        op = operations.front();
+        op = move(operations.front());
         operations.pop();
         return true;
     }
@@ -229,6 +1161,93 @@ public:
     }
 };
 
+// ============================================================================
+// SCHEDULING CLASSES AND ADMISSION
+// ============================================================================
+
+// Scheduling classes, so quick metadata calls are not stuck behind bulk data
+enum OperationClass {
+    CLASS_INTERACTIVE,          // Lookups, listings and metadata changes
+    CLASS_BULK,                 // File contents and batches
+    CLASS_ADMIN,                // User management and resizes
+    CLASS_COUNT
+};
+
+const char* const CLASS_NAMES[CLASS_COUNT] = {"interactive", "bulk", "admin"};
+
+// Share of the workers each class gets while all of them have work
+const unsigned CLASS_WEIGHTS[CLASS_COUNT] = {8, 3, 1};
+
+OperationClass operation_class(OperationCode op) {
+    switch (op) {
+        case OP_FILE_EXISTS:
+        case OP_FILE_DELETE:
+        case OP_FILE_RENAME:
+        case OP_DIR_CREATE:
+        case OP_DIR_LIST:
+        case OP_DIR_DELETE:
+        case OP_DIR_EXISTS:
+        case OP_GET_STATS:
+        case OP_GET_METADATA:
+        case OP_USER_LOGIN:
+        case OP_USER_LOGOUT:
+        case OP_USER_LIST:
+        case OP_GET_METRICS:
+            return CLASS_INTERACTIVE;
+        case OP_FILE_CREATE:
+        case OP_FILE_READ:
+        case OP_BATCH:
+            return CLASS_BULK;
+        default:
+            return CLASS_ADMIN;
+    }
+}
+
+// How long a client refused with ERROR_BUSY should wait before retrying
+const uint32_t BUSY_RETRY_AFTER_MS = 100;
+
+/**
+ * Server-wide load: what has been admitted and what is waiting where
+ *
+ * Every request is admitted (counted as outstanding) before it is queued
+ * and finished once its response is out. Past max_outstanding a request is
+ * answered with ERROR_BUSY straight from the I/O thread instead of being
+ * queued, so a traffic spike costs one small response per request rather
+ * than unbounded memory. get_metrics reports these
+ * counters.
+ */
+struct ServerLoad {
+    atomic<int64_t> outstanding{0};         // Admitted, not yet answered
+    int64_t max_outstanding = 1024;         // 0 = unbounded
+    atomic<uint64_t> admitted{0};
+    atomic<uint64_t> rejected_busy{0};
+    atomic<uint64_t> expired{0};            // Answered with ERROR_TIMEOUT
+    atomic<int64_t> paused_connections{0};  // Not being read for backpressure
+    atomic<int64_t> ready[CLASS_COUNT] = {};    // Granted their locks, waiting for a worker
+    atomic<int64_t> running{0};             // On a worker
+    atomic<int64_t> peak_outstanding{0};
+
+    bool admit() {
+        int64_t now = ++outstanding;
+        if (now > max_outstanding && max_outstanding > 0) {
+            outstanding--;
+            rejected_busy++;
+            return false;
+        }
+        admitted++;
+        int64_t peak = peak_outstanding.load(memory_order_relaxed);
+        while (now > peak && !peak_outstanding.compare_exchange_weak(peak, now, memory_order_relaxed)) {}
+        return true;
+    }
+
+    void finish() { outstanding--; }
+};
+
+ServerLoad server_load;
+
+// Every mutating operation, for replay and analytics (core/audit_log.hpp)
+AuditLog audit_log;
+
 // ============================================================================
 // OPERATION PROCESSOR
 // ============================================================================
@@ -236,43 +1255,167 @@ public:
 class OperationProcessor {
 private:
     string omni_path;
+    bool require_auth;          // Without it, requests with no valid session run as admin
     
 public:
-    OperationProcessor(const string& path) : omni_path(path) {}
+    OperationProcessor(const string& path, bool auth) : omni_path(path), require_auth(auth) {}
     
+    // Every response carries the operation and request_id it answers, which
+    // is how pipelining clients match responses that finish out of order
     JSONResponse process(const JSONRequest& req) {
-        JSONResponse resp;
-        resp.operation = req.operation;
-        resp.request_id = req.request_id;
+        LOG_DEBUG("[PROCESSOR] Executing: " << req.operation << " | Path: '" << req.path << "'");
         
-        cout << "[PROCESSOR] Executing: " << req.operation << " | Path: '" << req.path << "'" << endl;
-        
-        if (req.operation == "user_login") return process_user_login(req);
-        else if (req.operation == "user_logout") return process_user_logout(req);
-        else if (req.operation == "user_create") return process_user_create(req);
-        else if (req.operation == "user_delete") return process_user_delete(req);
-        else if (req.operation == "user_list") return process_user_list(req);
-        else if (req.operation == "file_create") return process_file_create(req);
-        else if (req.operation == "file_read") return process_file_read(req);
-        else if (req.operation == "file_delete") return process_file_delete(req);
-        else if (req.operation == "file_exists") return process_file_exists(req);
-        else if (req.operation == "file_rename") return process_file_rename(req);
-        else if (req.operation == "dir_create") return process_dir_create(req);
-        else if (req.operation == "dir_list") return process_dir_list(req);
-        else if (req.operation == "dir_delete") return process_dir_delete(req);
-        else if (req.operation == "dir_exists") return process_dir_exists(req);
-        else if (req.operation == "get_stats") return process_get_stats(req);
-        else if (req.operation == "get_metadata") return process_get_metadata(req);
-        else {
-            resp.status = "error";
-            resp.error_code = ERROR_NOT_IMPLEMENTED;
-            resp.error_message = get_error_message(ERROR_NOT_IMPLEMENTED);
+        // The session is looked up once here and copied, so a logout that
+        // runs meanwhile cannot change it under the handler
+        uint64_t started = metrics_now_ns();
+        uint64_t looked_up = started;
+        SessionInfo session("", UserInfo("admin", "", ADMIN, 0), 0);
+        JSONResponse resp;
+        if (needs_session(req.op)) {
+            bool found = active_sessions.validate(req.session_id, session);
+            server_metrics.add(found ? COUNTER_SESSION_HIT : COUNTER_SESSION_MISS);
+            looked_up = record_stage(STAGE_LOOKUP, started);
+            tracer.record(current_trace, "session_lookup", "server", started, looked_up);
+            if (!found && require_auth) {
+                resp.status = "error";
+                resp.operation = req.operation;
+                resp.request_id = req.request_id;
+                resp.error_code = ERROR_INVALID_SESSION;
+                resp.error_message = get_error_message(ERROR_INVALID_SESSION);
+            }
+        }
+        if (resp.status.empty()) {
+            resp = run(req, &session);
+            record_stage(STAGE_EXECUTE, looked_up);
         }
         
+        if (req.op < OPERATION_COUNT) {
+            server_metrics.record(req.op, metrics_now_ns() - started);
+            if (resp.status == "error") server_metrics.add(COUNTER_COUNT + req.op);
+        }
         return resp;
     }
     
 private:
+    static bool needs_session(OperationCode op) {
+        return op != OP_USER_LOGIN && op != OP_GET_METRICS;
+    }
+    
+    // User management and resizing are for admins only
+    static bool admin_only(OperationCode op) {
+        switch (op) {
+            case OP_USER_CREATE: case OP_USER_DELETE: case OP_USER_LIST:
+            case OP_FS_GROW: case OP_FS_SHRINK: case OP_GET_TRACE:
+                return true;
+            default:
+                return false;
+        }
+    }
+    
+    JSONResponse run(const JSONRequest& req, SessionInfo* session) {
+        TRACE_SCOPE(req.op < OPERATION_COUNT ? OPERATION_NAMES[req.op] : "unknown", "handler", req.path);
+        JSONResponse resp = dispatch(req, session);
+        resp.operation = req.operation;
+        resp.request_id = req.request_id;
+        if (req.op == OP_FILE_CREATE && resp.status == "success") {
+            server_metrics.add(COUNTER_FILE_WRITTEN, req.data.size());
+        } else if (req.op == OP_FILE_READ && resp.has_content) {
+            server_metrics.add(COUNTER_FILE_READ, resp.content.size());
+        }
+        return resp;
+    }
+    
+    // Operations that change the file system, users or sessions
+    static bool audited(OperationCode op) {
+        switch (op) {
+            case OP_USER_LOGIN: case OP_USER_LOGOUT: case OP_USER_CREATE: case OP_USER_DELETE:
+            case OP_FILE_CREATE: case OP_FILE_DELETE: case OP_FILE_RENAME:
+            case OP_DIR_CREATE: case OP_DIR_DELETE: case OP_FS_GROW: case OP_FS_SHRINK:
+                return true;
+            default:
+                return false;
+        }
+    }
+    
+    // Batch items come through here one by one, so each is audited on its own
+    JSONResponse dispatch(const JSONRequest& req, SessionInfo* session) {
+        if (!audited(req.op) || !audit_log.is_open()) return execute(req, session);
+        
+        uint64_t started_us = audit_now_us();
+        auto started = chrono::steady_clock::now();
+        JSONResponse resp = execute(req, session);
+        
+        AuditEvent event;
+        event.op = req.op;
+        event.result = resp.status == "success" ? SUCCESS : resp.error_code;
+        event.user = req.op == OP_USER_LOGIN ? string_view(req.username) : string_view(session->user.username);
+        event.time_us = started_us;
+        event.duration_us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - started).count();
+        switch (req.op) {
+            case OP_USER_CREATE:
+                event.path = req.username;
+                event.size = req.role;
+                break;
+            case OP_USER_DELETE:
+                event.path = req.username;
+                break;
+            case OP_FILE_RENAME:
+                event.path = req.old_path;
+                event.path2 = req.new_path;
+                break;
+            case OP_FILE_CREATE:
+                event.path = req.path;
+                event.size = req.data.size();
+                break;
+            case OP_FS_GROW: case OP_FS_SHRINK:
+                event.size = req.total_size;
+                break;
+            default:
+                event.path = req.path;
+                break;
+        }
+        audit_log.append(event);
+        return resp;
+    }
+    
+    JSONResponse execute(const JSONRequest& req, SessionInfo* session) {
+        JSONResponse resp;
+        if (admin_only(req.op) && session->user.role != ADMIN) {
+            resp.status = "error";
+            resp.error_code = ERROR_PERMISSION_DENIED;
+            resp.error_message = get_error_message(ERROR_PERMISSION_DENIED);
+            return resp;
+        }
+        switch (req.op) {
+            case OP_USER_LOGIN:   return process_user_login(req);
+            case OP_USER_LOGOUT:  return process_user_logout(req, session);
+            case OP_USER_CREATE:  return process_user_create(req);
+            case OP_USER_DELETE:  return process_user_delete(req);
+            case OP_USER_LIST:    return process_user_list(req);
+            case OP_FILE_CREATE:  return process_file_create(req, session);
+            case OP_FILE_READ:    return process_file_read(req, session);
+            case OP_FILE_DELETE:  return process_file_delete(req, session);
+            case OP_FILE_EXISTS:  return process_file_exists(req, session);
+            case OP_FILE_RENAME:  return process_file_rename(req, session);
+            case OP_DIR_CREATE:   return process_dir_create(req, session);
+            case OP_DIR_LIST:     return process_dir_list(req, session);
+            case OP_DIR_DELETE:   return process_dir_delete(req, session);
+            case OP_DIR_EXISTS:   return process_dir_exists(req, session);
+            case OP_GET_STATS:    return process_get_stats(req, session);
+            case OP_GET_METADATA: return process_get_metadata(req, session);
+            case OP_GET_METRICS:  return process_get_metrics(req);
+            case OP_GET_TRACE:    return process_get_trace();
+            case OP_FS_GROW:      return process_fs_grow(req, session);
+            case OP_FS_SHRINK:    return process_fs_shrink(req, session);
+            case OP_BATCH:        return process_batch(req, session);
+            default:
+                resp.status = "error";
+                resp.error_code = ERROR_NOT_IMPLEMENTED;
+                resp.error_message = get_error_message(ERROR_NOT_IMPLEMENTED);
+                return resp;
+        }
+    }
+    
     JSONResponse process_user_login(const JSONRequest& req) {
         JSONResponse resp;
         void* session = nullptr;
@@ -280,8 +1423,10 @@ private:
         int result = user_login(&session, req.username, req.password, omni_path);
         
         if (result == SUCCESS) {
+            unique_ptr<SessionInfo> login((SessionInfo*)session);
             resp.status = "success";
-            resp.data = "\"session_id\":\"session_" + escape_json_string(req.username) + "\"";
+            JSONWriter json(resp.data);
+            json.key("session_id").value(login->session_id);
         } else {
             resp.status = "error";
             resp.error_code = result;
@@ -291,18 +1436,28 @@ private:
         return resp;
     }
     
-    JSONResponse process_user_logout(const JSONRequest& req) {
+    JSONResponse process_user_logout(const JSONRequest& req, SessionInfo* session) {
         JSONResponse resp;
-        resp.status = "success";
-        resp.data = "\"message\":\"Logged out successfully\"";
+        
+        int result = user_logout(session);
+        
+        if (result == SUCCESS || !require_auth) {
+            resp.status = "success";
+            resp.data = "\"message\":\"Logged out successfully\"";
+        } else {
+            resp.status = "error";
+            resp.error_code = result;
+            resp.error_message = get_error_message(result);
+        }
+        
         return resp;
     }
     
     JSONResponse process_user_create(const JSONRequest& req) {
         JSONResponse resp;
         
-        cout << "[USER_CREATE] Username: " << req.username 
-             << ", Role: " << req.role << endl;
+        LOG_DEBUG("[USER_CREATE] Username: " << req.username 
+               << ", Role: " << req.role);
         
         int result = user_create(omni_path, req.username, req.password, req.role);
         
@@ -321,7 +1476,7 @@ private:
     JSONResponse process_user_delete(const JSONRequest& req) {
         JSONResponse resp;
         
-        cout << "[USER_DELETE] Username: " << req.username << endl;
+        LOG_DEBUG("[USER_DELETE] Username: " << req.username);
         
         int result = user_delete(omni_path, req.username);
         
@@ -345,21 +1500,19 @@ private:
         
         if (result == SUCCESS) {
             resp.status = "success";
-            string users_json = "\"users\":[";
-            for (size_t i = 0; i < users.size(); i++) {
-                string username_str = string(users[i].username);
-                string actual_password = get_user_password(username_str);
-                
-                users_json += "{";
-                users_json += "\"username\":\"" + escape_json_string(username_str) + "\",";
-                users_json += "\"role\":" + to_string(users[i].role) + ",";
-                users_json += "\"password\":\"" + escape_json_string(actual_password) + "\",";
-                users_json += "\"password_hash\":\"" + escape_json_string(string(users[i].password_hash)) + "\"";
-                users_json += "}";
-                if (i < users.size() - 1) users_json += ",";
+            JSONWriter json(resp.data);
+            json.reserve(16 + users.size() * (80 + sizeof(users[0].username) + sizeof(users[0].password_hash)));
+            json.key("users").begin_array();
+            for (const UserInfo& user : users) {
+                string_view username(user.username, strnlen(user.username, sizeof(user.username)));
+                json.begin_object();
+                json.key("username").value(username);
+                json.key("role").number(user.role);
+                json.key("password").value(get_user_password(string(username)));
+                json.key("password_hash").value(string_view(user.password_hash, strnlen(user.password_hash, sizeof(user.password_hash))));
+                json.end_object();
             }
-            users_json += "]";
-            resp.data = users_json;
+            json.end_array();
         } else {
             resp.status = "error";
             resp.error_code = result;
@@ -369,13 +1522,10 @@ private:
         return resp;
     }
     
-    JSONResponse process_file_create(const JSONRequest& req) {
+    JSONResponse process_file_create(const JSONRequest& req, SessionInfo* session) {
         JSONResponse resp;
         
-        SessionInfo dummy_session("session_1", UserInfo("admin", "", ADMIN, 0), time(nullptr));
-        void* session = &dummy_session;
-        
-        cout << "[FILE_CREATE] Path: '" << req.path << "'" << endl;
+        LOG_DEBUG("[FILE_CREATE] Path: '" << req.path << "'");
         
         int result = file_create(session, req.path, req.data);
         
@@ -391,21 +1541,20 @@ private:
         return resp;
     }
     
-    JSONResponse process_file_read(const JSONRequest& req) {
+    JSONResponse process_file_read(const JSONRequest& req, SessionInfo* session) {
         JSONResponse resp;
         
-        SessionInfo dummy_session("session_1", UserInfo("admin", "", ADMIN, 0), time(nullptr));
-        void* session = &dummy_session;
         string content;
         
-        cout << "[FILE_READ] Path: '" << req.path << "'" << endl;
+        LOG_DEBUG("[FILE_READ] Path: '" << req.path << "'");
         
         int result = file_read(session, req.path, content);
         
         if (result == SUCCESS) {
             resp.status = "success";
-            resp.data = "\"content\":\"" + escape_json_string(content) + "\"";
-            cout << "[FILE_READ] Success, content length: " << content.length() << " bytes" << endl;
+            resp.content = move(content);
+            resp.has_content = true;
+            LOG_DEBUG("[FILE_READ] Success, content length: " << resp.content.length() << " bytes");
         } else {
             resp.status = "error";
             resp.error_code = result;
@@ -415,12 +1564,9 @@ private:
         return resp;
     }
     
-    JSONResponse process_file_delete(const JSONRequest& req) {
+    JSONResponse process_file_delete(const JSONRequest& req, SessionInfo* session) {
         JSONResponse resp;
         
-        SessionInfo dummy_session("session_1", UserInfo("admin", "", ADMIN, 0), time(nullptr));
-        void* session = &dummy_session;
-        
         int result = file_delete(session, req.path);
         
         if (result == SUCCESS) {
@@ -435,12 +1581,9 @@ private:
         return resp;
     }
     
-    JSONResponse process_file_exists(const JSONRequest& req) {
+    JSONResponse process_file_exists(const JSONRequest& req, SessionInfo* session) {
         JSONResponse resp;
         
-        SessionInfo dummy_session("session_1", UserInfo("admin", "", ADMIN, 0), time(nullptr));
-        void* session = &dummy_session;
-        
         int result = file_exists(session, req.path);
         
         resp.status = "success";
@@ -449,12 +1592,9 @@ private:
         return resp;
     }
     
-    JSONResponse process_file_rename(const JSONRequest& req) {
+    JSONResponse process_file_rename(const JSONRequest& req, SessionInfo* session) {
         JSONResponse resp;
         
-        SessionInfo dummy_session("session_1", UserInfo("admin", "", ADMIN, 0), time(nullptr));
-        void* session = &dummy_session;
-        
         int result = file_rename(session, req.old_path, req.new_path);
         
         if (result == SUCCESS) {
@@ -469,19 +1609,107 @@ private:
         return resp;
     }
     
-    JSONResponse process_dir_create(const JSONRequest& req) {
+    JSONResponse process_dir_create(const JSONRequest& req, SessionInfo* session) {
+        JSONResponse resp;
+        
+        LOG_DEBUG("[DIR_CREATE] Path: '" << req.path << "'");
+        
+        int result = dir_create(session, req.path);
+        
+        if (result == SUCCESS) {
+            resp.status = "success";
+            resp.data = "\"message\":\"Directory created successfully\"";
+        } else {
+            resp.status = "error";
+            resp.error_code = result;
+            resp.error_message = get_error_message(result);
+        }
+        
+        return resp;
+    }
+    
+    JSONResponse process_dir_list(const JSONRequest& req, SessionInfo* session) {
+        JSONResponse resp;
+        
+        vector<FileEntry> children;
+        
+        LOG_DEBUG("[DIR_LIST] Path: '" << req.path << "'");
+        
+        int result = dir_list(session, req.path, children);
+        
+        if (result == SUCCESS) {
+            resp.status = "success";
+            // One pass to size the listing, one to write it
+            size_t estimate = 16;
+            for (const FileEntry& child : children) {
+                estimate += 56 + strnlen(child.name, sizeof(child.name));
+            }
+            JSONWriter json(resp.data);
+            json.reserve(estimate);
+            json.key("files").begin_array();
+            for (const FileEntry& child : children) {
+                json.begin_object();
+                json.key("name").value(string_view(child.name, strnlen(child.name, sizeof(child.name))));
+                json.key("type").value(child.type == DIRECTORY ? "directory" : "file");
+                json.key("size").number(child.size);
+                json.end_object();
+            }
+            json.end_array();
+            
+            LOG_DEBUG("[DIR_LIST] Found " << children.size() << " items");
+        } else {
+            resp.status = "error";
+            resp.error_code = result;
+            resp.error_message = get_error_message(result);
+        }
+        
+        return resp;
+    }
+    
+    JSONResponse process_dir_delete(const JSONRequest& req, SessionInfo* session) {
+        JSONResponse resp;
+        
+        int result = dir_delete(session, req.path);
+        
+        if (result == SUCCESS) {
+            resp.status = "success";
+            resp.data = "\"message\":\"Directory deleted successfully\"";
+        } else {
+            resp.status = "error";
+            resp.error_code = result;
+            resp.error_message = get_error_message(result);
+        }
+        
+        return resp;
+    }
+    
+    JSONResponse process_dir_exists(const JSONRequest& req, SessionInfo* session) {
+        JSONResponse resp;
+        
+        int result = dir_exists(session, req.path);
+        
+        resp.status = "success";
+        resp.data = "\"exists\":" + string(result == SUCCESS ? "true" : "false");
+        
+        return resp;
+    }
+    
+    JSONResponse process_get_stats(const JSONRequest& req, SessionInfo* session) {
         JSONResponse resp;
         
-        SessionInfo dummy_session("session_1", UserInfo("admin", "", ADMIN, 0), time(nullptr));
-        void* session = &dummy_session;
-        
-        cout << "[DIR_CREATE] Path: '" << req.path << "'" << endl;
+        FSStats stats(0, 0, 0);
         
-        int result = dir_create(session, req.path);
+        int result = get_stats(session, stats);
         
         if (result == SUCCESS) {
             resp.status = "success";
-            resp.data = "\"message\":\"Directory created successfully\"";
+            JSONWriter json(resp.data);
+            json.key("total_size").number(stats.total_size);
+            json.key("used_space").number(stats.used_space);
+            json.key("free_space").number(stats.free_space);
+            json.key("total_files").number(stats.total_files);
+            json.key("total_directories").number(stats.total_directories);
+            json.key("active_sessions").number(stats.active_sessions);
         } else {
             resp.status = "error";
             resp.error_code = result;
@@ -491,52 +1719,173 @@ private:
         return resp;
     }
     
-    JSONResponse process_dir_list(const JSONRequest& req) {
+    // Server load, counters and latency histograms; needs no session.
+    // "format":"prometheus" returns the same as Prometheus text in content.
+    JSONResponse process_get_metrics(const JSONRequest& req) {
         JSONResponse resp;
+        resp.status = "success";
+        if (req.format == "prometheus") {
+            resp.content = prometheus_metrics();
+            resp.has_content = true;
+            return resp;
+        }
         
-        SessionInfo dummy_session("session_1", UserInfo("admin", "", ADMIN, 0), time(nullptr));
-        void* session = &dummy_session;
-        vector<FileEntry> children;
-        
-        cout << "[DIR_LIST] Path: '" << req.path << "'" << endl;
+        JSONWriter json(resp.data);
+        json.key("outstanding").number((int64_t)server_load.outstanding);
+        json.key("max_outstanding").number(server_load.max_outstanding);
+        json.key("peak_outstanding").number((int64_t)server_load.peak_outstanding);
+        json.key("waiting").number(waiting_requests());
+        json.key("running").number((int64_t)server_load.running);
+        json.key("admitted").number((uint64_t)server_load.admitted);
+        json.key("rejected_busy").number((uint64_t)server_load.rejected_busy);
+        json.key("expired").number((uint64_t)server_load.expired);
+        json.key("paused_connections").number((int64_t)server_load.paused_connections);
+        json.key("sessions").number((uint64_t)active_sessions.size());
+        json.key("sessions_expired").number(active_sessions.expired_total());
+        json.key("ready").begin_object();
+        for (int cls = 0; cls < CLASS_COUNT; cls++) {
+            json.key(CLASS_NAMES[cls]).number((int64_t)server_load.ready[cls]);
+        }
+        json.end_object();
         
-        int result = dir_list(session, req.path, children);
+        json.key("counters").begin_object();
+        for (int counter = 0; counter < COUNTER_COUNT; counter++) {
+            json.key(COUNTER_NAMES[counter]).number(server_metrics.counter(counter));
+        }
+        json.end_object();
+        
+        // Operations that have run at least once
+        json.key("operations").begin_object();
+        for (int op = 0; op < OPERATION_COUNT; op++) {
+            HistogramSnapshot latency = server_metrics.histogram(op);
+            if (latency.count == 0) continue;
+            json.key(OPERATION_NAMES[op]).begin_object();
+            json.key("errors").number(server_metrics.counter(COUNTER_COUNT + op));
+            write_latency(json, latency);
+            json.end_object();
+        }
+        json.end_object();
         
-        if (result == SUCCESS) {
-            resp.status = "success";
-            string files = "\"files\":[";
-            for (size_t i = 0; i < children.size(); i++) {
-                files += "{";
-                files += "\"name\":\"" + escape_json_string(string(children[i].name)) + "\",";
-                files += "\"type\":\"" + string(children[i].type == DIRECTORY ? "directory" : "file") + "\",";
-                files += "\"size\":" + to_string(children[i].size);
-                files += "}";
-                if (i < children.size() - 1) files += ",";
-            }
-            files += "]";
-            resp.data = files;
-            
-            cout << "[DIR_LIST] Found " << children.size() << " items" << endl;
-        } else {
+        json.key("stages").begin_object();
+        for (int stage = 0; stage < STAGE_COUNT; stage++) {
+            json.key(STAGE_NAMES[stage]).begin_object();
+            write_latency(json, server_metrics.histogram(OPERATION_COUNT + stage));
+            json.end_object();
+        }
+        json.end_object();
+        return resp;
+    }
+    
+    // Spans of the sampled requests as Chrome trace-event JSON, in content
+    // (load it in chrome://tracing or ui.perfetto.dev); admins only
+    JSONResponse process_get_trace() {
+        JSONResponse resp;
+        if (!tracer.enabled()) {
             resp.status = "error";
-            resp.error_code = result;
-            resp.error_message = get_error_message(result);
+            resp.error_code = ERROR_INVALID_OPERATION;
+            resp.error_message = "Tracing is off (set trace_sample_rate in the [server] config)";
+            return resp;
         }
-        
+        resp.status = "success";
+        resp.content = tracer.export_chrome();
+        resp.has_content = true;
         return resp;
     }
     
-    JSONResponse process_dir_delete(const JSONRequest& req) {
+    // Admitted requests still in the FIFO or waiting for their locks
+    static int64_t waiting_requests() {
+        int64_t waiting = server_load.outstanding - server_load.running;
+        for (int cls = 0; cls < CLASS_COUNT; cls++) waiting -= server_load.ready[cls];
+        return max<int64_t>(0, waiting);
+    }
+    
+    // Members of a latency object, in nanoseconds
+    static void write_latency(JSONWriter& json, const HistogramSnapshot& latency) {
+        json.key("count").number(latency.count);
+        json.key("mean_ns").number((uint64_t)latency.mean());
+        json.key("p50_ns").number(latency.percentile(0.50));
+        json.key("p90_ns").number(latency.percentile(0.90));
+        json.key("p99_ns").number(latency.percentile(0.99));
+        json.key("p999_ns").number(latency.percentile(0.999));
+        json.key("max_ns").number(latency.maximum);
+    }
+    
+    static string prometheus_metrics() {
+        string out;
+        out.reserve(64 * 1024);
+        
+        prometheus_header(out, "ofs_operation_duration_seconds", "histogram",
+                          "Time to authenticate and run a request, by operation.");
+        for (int op = 0; op < OPERATION_COUNT; op++) {
+            prometheus_histogram(out, "ofs_operation_duration_seconds", string("op=\"") + OPERATION_NAMES[op] + "\"",
+                                 server_metrics.histogram(op));
+        }
+        prometheus_header(out, "ofs_operation_errors_total", "counter", "Requests answered with an error, by operation.");
+        for (int op = 0; op < OPERATION_COUNT; op++) {
+            prometheus_value(out, "ofs_operation_errors_total", string("op=\"") + OPERATION_NAMES[op] + "\"",
+                             server_metrics.counter(COUNTER_COUNT + op));
+        }
+        prometheus_header(out, "ofs_stage_duration_seconds", "histogram",
+                          "Time requests spend in each stage of the server.");
+        for (int stage = 0; stage < STAGE_COUNT; stage++) {
+            prometheus_histogram(out, "ofs_stage_duration_seconds", string("stage=\"") + STAGE_NAMES[stage] + "\"",
+                                 server_metrics.histogram(OPERATION_COUNT + stage));
+        }
+        
+        struct { const char* name; ServerCounter counter; const char* help; } counters[] = {
+            {"ofs_net_received_bytes_total", COUNTER_NET_RECEIVED, "Bytes read from client sockets."},
+            {"ofs_net_sent_bytes_total", COUNTER_NET_SENT, "Bytes written to client sockets."},
+            {"ofs_file_written_bytes_total", COUNTER_FILE_WRITTEN, "File content stored by file_create."},
+            {"ofs_file_read_bytes_total", COUNTER_FILE_READ, "File content returned by file_read."},
+        };
+        for (auto& c : counters) {
+            prometheus_header(out, c.name, "counter", c.help);
+            prometheus_value(out, c.name, "", server_metrics.counter(c.counter));
+        }
+        prometheus_header(out, "ofs_session_lookups_total", "counter", "Session token lookups, by whether the token was found.");
+        prometheus_value(out, "ofs_session_lookups_total", "result=\"hit\"", server_metrics.counter(COUNTER_SESSION_HIT));
+        prometheus_value(out, "ofs_session_lookups_total", "result=\"miss\"", server_metrics.counter(COUNTER_SESSION_MISS));
+        prometheus_header(out, "ofs_response_buffers_total", "counter", "Response buffers, by whether a recycled one was used.");
+        prometheus_value(out, "ofs_response_buffers_total", "source=\"reused\"", server_metrics.counter(COUNTER_BUFFER_REUSED));
+        prometheus_value(out, "ofs_response_buffers_total", "source=\"new\"", server_metrics.counter(COUNTER_BUFFER_NEW));
+        
+        struct { const char* name; const char* type; double value; const char* help; } load[] = {
+            {"ofs_requests_admitted_total", "counter", (double)server_load.admitted, "Requests admitted to the queue."},
+            {"ofs_requests_rejected_total", "counter", (double)server_load.rejected_busy, "Requests refused with ERROR_BUSY."},
+            {"ofs_requests_expired_total", "counter", (double)server_load.expired, "Requests answered with ERROR_TIMEOUT."},
+            {"ofs_requests_outstanding", "gauge", (double)server_load.outstanding, "Requests admitted and not yet answered."},
+            {"ofs_requests_outstanding_peak", "gauge", (double)server_load.peak_outstanding, "Most requests outstanding at once."},
+            {"ofs_requests_waiting", "gauge", (double)waiting_requests(), "Requests in the FIFO or waiting for locks."},
+            {"ofs_requests_running", "gauge", (double)server_load.running, "Requests on a worker."},
+            {"ofs_connections_paused", "gauge", (double)server_load.paused_connections, "Connections not being read for backpressure."},
+            {"ofs_sessions", "gauge", (double)active_sessions.size(), "Open sessions."},
+            {"ofs_sessions_expired_total", "counter", (double)active_sessions.expired_total(), "Sessions ended by a timeout."},
+        };
+        for (auto& l : load) {
+            prometheus_header(out, l.name, l.type, l.help);
+            prometheus_value(out, l.name, "", l.value);
+        }
+        prometheus_header(out, "ofs_requests_ready", "gauge", "Requests holding their locks and waiting for a worker, by class.");
+        for (int cls = 0; cls < CLASS_COUNT; cls++) {
+            prometheus_value(out, "ofs_requests_ready", string("class=\"") + CLASS_NAMES[cls] + "\"",
+                             (double)server_load.ready[cls]);
+        }
+        return out;
+    }
+    
+    JSONResponse process_get_metadata(const JSONRequest& req, SessionInfo* session) {
         JSONResponse resp;
         
-        SessionInfo dummy_session("session_1", UserInfo("admin", "", ADMIN, 0), time(nullptr));
-        void* session = &dummy_session;
+        FileMetadata meta("", FileEntry("", Entry_FILE, 0, 0, "", 0));
         
-        int result = dir_delete(session, req.path);
+        int result = get_metadata(session, req.path, meta);
         
         if (result == SUCCESS) {
             resp.status = "success";
-            resp.data = "\"message\":\"Directory deleted successfully\"";
+            JSONWriter json(resp.data);
+            json.key("size").number(meta.entry.size);
+            json.key("blocks_used").number(meta.blocks_used);
+            json.key("owner").value(string_view(meta.entry.owner, strnlen(meta.entry.owner, sizeof(meta.entry.owner))));
         } else {
             resp.status = "error";
             resp.error_code = result;
@@ -545,37 +1894,38 @@ private:
         
         return resp;
     }
-    
-    JSONResponse process_dir_exists(const JSONRequest& req) {
+
+    // Resizes run on a worker thread holding X locks on "/" and "users"
+    // (lock_plan), so every other request sees the container either before
+    // or after the resize
+    JSONResponse process_fs_grow(const JSONRequest& req, SessionInfo* session) {
         JSONResponse resp;
         
-        SessionInfo dummy_session("session_1", UserInfo("admin", "", ADMIN, 0), time(nullptr));
-        void* session = &dummy_session;
+        LOG_INFO("[FS_GROW] Size: " << req.total_size << ", Files: " << req.max_files
+              << ", Users: " << req.max_users);
         
-        int result = dir_exists(session, req.path);
+        int result = fs_grow(session, req.total_size, req.max_files, req.max_users);
         
-        resp.status = "success";
-        resp.data = "\"exists\":" + string(result == SUCCESS ? "true" : "false");
+        if (result == SUCCESS) {
+            resp = resize_response(session, "File system grown successfully");
+        } else {
+            resp.status = "error";
+            resp.error_code = result;
+            resp.error_message = get_error_message(result);
+        }
         
         return resp;
     }
     
-    JSONResponse process_get_stats(const JSONRequest& req) {
+    JSONResponse process_fs_shrink(const JSONRequest& req, SessionInfo* session) {
         JSONResponse resp;
         
-        SessionInfo dummy_session("session_1", UserInfo("admin", "", ADMIN, 0), time(nullptr));
-        void* session = &dummy_session;
-        FSStats stats(0, 0, 0);
+        LOG_INFO("[FS_SHRINK] Size: " << req.total_size);
         
-        int result = get_stats(session, stats);
+        int result = fs_shrink(session, req.total_size);
         
         if (result == SUCCESS) {
-            resp.status = "success";
-            resp.data = "\"total_size\":" + to_string(stats.total_size) + ",";
-            resp.data += "\"used_space\":" + to_string(stats.used_space) + ",";
-            resp.data += "\"free_space\":" + to_string(stats.free_space) + ",";
-            resp.data += "\"total_files\":" + to_string(stats.total_files) + ",";
-            resp.data += "\"total_directories\":" + to_string(stats.total_directories);
+            resp = resize_response(session, "File system shrunk successfully");
         } else {
             resp.status = "error";
             resp.error_code = result;
@@ -585,109 +1935,486 @@ private:
         return resp;
     }
     
-    JSONResponse process_get_metadata(const JSONRequest& req) {
+    JSONResponse resize_response(void* session, const string& message) {
         JSONResponse resp;
+        FSStats stats(0, 0, 0);
+        get_stats(session, stats);
         
-        SessionInfo dummy_session("session_1", UserInfo("admin", "", ADMIN, 0), time(nullptr));
-        void* session = &dummy_session;
-        FileMetadata meta("", FileEntry("", Entry_FILE, 0, 0, "", 0));
+        resp.status = "success";
+        JSONWriter json(resp.data);
+        json.key("message").value(message);
+        json.key("total_size").number(stats.total_size);
+        json.key("free_space").number(stats.free_space);
+        return resp;
+    }
+    /**
+     * Runs the items of a batch in order, in the batch's single queue slot
+     * and under one lock plan covering every item.
+     *
+     * Normally each item reports its own result and a failure does not
+     * stop the rest. An atomic batch stops at the first failure, undoes the
+     * items that succeeded (newest first) and fails as a whole. Only
+     * operations that can be undone are accepted in an atomic batch. A
+     * deleted file or directory comes back with its original owner,
+     * permissions and times.
+     */
+    // Items run under the batch's session
+    JSONResponse process_batch(const JSONRequest& req, SessionInfo* session) {
+        JSONResponse resp;
         
-        int result = get_metadata(session, req.path, meta);
+        LOG_DEBUG("[BATCH] " << req.batch.size() << " operation(s)" << (req.atomic ? ", atomic" : ""));
         
-        if (result == SUCCESS) {
-            resp.status = "success";
-            resp.data = "\"size\":" + to_string(meta.entry.size) + ",";
-            resp.data += "\"blocks_used\":" + to_string(meta.blocks_used) + ",";
-            resp.data += "\"owner\":\"" + escape_json_string(string(meta.entry.owner)) + "\"";
-        } else {
-            resp.status = "error";
-            resp.error_code = result;
-            resp.error_message = get_error_message(result);
+        if (req.atomic) {
+            for (size_t i = 0; i < req.batch.size(); i++) {
+                if (!undoable(req.batch[i].op)) {
+                    resp.status = "error";
+                    resp.error_code = ERROR_INVALID_OPERATION;
+                    resp.error_message = "Operation " + to_string(i) + " (" + req.batch[i].operation +
+                                         ") cannot be part of an atomic batch";
+                    return resp;
+                }
+            }
+        }
+        
+        vector<UndoStep> undo_log;
+        uint64_t succeeded = 0;
+        JSONWriter json(resp.data);
+        json.key("results").begin_array();
+        
+        for (size_t i = 0; i < req.batch.size(); i++) {
+            const JSONRequest& item = req.batch[i];
+            UndoStep undo;
+            bool reversible = req.atomic && plan_undo(item, session, undo);
+            
+            JSONResponse item_resp;
+            if (item.op == OP_BATCH) {
+                item_resp.operation = item.operation;
+                item_resp.request_id = item.request_id;
+                item_resp.status = "error";
+                item_resp.error_code = ERROR_INVALID_OPERATION;
+                item_resp.error_message = "Batches cannot be nested";
+            } else {
+                item_resp = run(item, session);
+            }
+            
+            if (item_resp.status == "error" && req.atomic) {
+                roll_back(undo_log, session);
+                resp.status = "error";
+                resp.error_code = item_resp.error_code;
+                resp.error_message = "Operation " + to_string(i) + " (" + item.operation + ") failed: " +
+                                     item_resp.error_message + "; " + to_string(undo_log.size()) +
+                                     " earlier operation(s) rolled back";
+                resp.data.clear();
+                return resp;
+            }
+            if (item_resp.status != "error") succeeded++;
+            if (reversible && item_resp.status != "error") undo_log.push_back(move(undo));
+            
+            write_json_response(item_resp, json.element());
         }
         
+        json.end_array();
+        json.key("succeeded").number(succeeded);
+        json.key("failed").number((uint64_t)req.batch.size() - succeeded);
+        resp.status = "success";
         return resp;
     }
+    
+    static bool undoable(OperationCode op) {
+        switch (op) {
+            case OP_FILE_CREATE: case OP_FILE_DELETE: case OP_FILE_RENAME:
+            case OP_DIR_CREATE: case OP_DIR_DELETE: case OP_USER_CREATE:
+            case OP_FILE_READ: case OP_FILE_EXISTS: case OP_DIR_LIST: case OP_DIR_EXISTS:
+            case OP_GET_STATS: case OP_GET_METADATA: case OP_USER_LIST: case OP_GET_METRICS:
+            case OP_GET_TRACE:
+                return true;
+            default:
+                return false;
+        }
+    }
+    
+    // The operation that reverses a batch item; undoing a delete also puts
+    // back the metadata of the entry it recreates
+    struct UndoStep {
+        JSONRequest request;
+        bool restore = false;
+        FileEntry saved;
+    };
+    
+    // Fills undo with what reverses item, captured before item runs. False
+    // when item changes nothing that needs reversing.
+    bool plan_undo(const JSONRequest& item, SessionInfo* session, UndoStep& undo) {
+        JSONRequest& reverse = undo.request;
+        switch (item.op) {
+            case OP_FILE_CREATE:
+                reverse.op = OP_FILE_DELETE;
+                reverse.path = item.path;
+                break;
+            case OP_FILE_DELETE:
+            case OP_DIR_DELETE: {
+                FileMetadata meta("", FileEntry());
+                if (get_metadata(session, item.path, meta) != SUCCESS) return false;
+                if (item.op == OP_FILE_DELETE && file_read(session, item.path, reverse.data) != SUCCESS) return false;
+                reverse.op = item.op == OP_FILE_DELETE ? OP_FILE_CREATE : OP_DIR_CREATE;
+                reverse.path = item.path;
+                undo.restore = true;
+                undo.saved = meta.entry;
+                break;
+            }
+            case OP_FILE_RENAME:
+                reverse.op = OP_FILE_RENAME;
+                reverse.old_path = item.new_path;
+                reverse.new_path = item.old_path;
+                break;
+            case OP_DIR_CREATE:
+                reverse.op = OP_DIR_DELETE;
+                reverse.path = item.path;
+                break;
+            case OP_USER_CREATE:
+                reverse.op = OP_USER_DELETE;
+                reverse.username = item.username;
+                break;
+            default:
+                return false;
+        }
+        reverse.operation = OPERATION_NAMES[reverse.op];
+        return true;
+    }
+    
+    void roll_back(const vector<UndoStep>& undo_log, SessionInfo* session) {
+        for (auto undo = undo_log.rbegin(); undo != undo_log.rend(); ++undo) {
+            JSONResponse result = dispatch(undo->request, session);
+            if (result.status == "error") {
+                LOG_ERROR("[BATCH] Rollback " << undo->request.operation << " failed: " << result.error_message);
+            } else if (undo->restore) {
+                int restored = restore_metadata(session, undo->request.path, undo->saved);
+                if (restored != SUCCESS) {
+                    LOG_ERROR("[BATCH] Rollback could not restore metadata of " << undo->request.path << ": "
+                              << get_error_message(restored));
+                }
+            }
+        }
+        LOG_INFO("[BATCH] Rolled back " << undo_log.size() << " operation(s)");
+    }
 };
 
 // ============================================================================
-// PROCESSOR THREAD
+// WORKER POOL
 // ============================================================================
 
-void fifo_processor_thread(FIFOQueue* queue, OperationProcessor* processor) {
-    cout << "[PROCESSOR] Started" << endl;
-    
-    while (true) {
-        QueuedOperation op(JSONRequest(), 0);
-        
-        if (!queue->dequeue(op)) {
-            break;
+/**
+ * Runs tasks with weighted fair sharing between operation classes
+ *
+ * Each class has its own FIFO. A free worker takes the next task from the
+ * non-empty class that has had the least service for its weight (stride
+ * scheduling), so while every class is busy, interactive work gets 8 of
+ * every 12 starts and bulk uploads can never take all of them. A class
+ * that was idle rejoins at the current pass instead of cashing in the
+ * time it was away.
+ */
+class WorkerPool {
+private:
+    static const uint64_t STRIDE_SCALE = 1 << 20;
+
+    vector<thread> workers;
+    deque<function<void()>> tasks[CLASS_COUNT];
+    uint64_t pass[CLASS_COUNT] = {};
+    uint64_t current_pass = 0;
+    mutex tasks_mutex;
+    condition_variable tasks_cv;
+    bool stopping;
+
+public:
+    WorkerPool() : stopping(false) {}
+
+    void start(unsigned count) {
+        stopping = false;
+        for (unsigned i = 0; i < count; i++) {
+            workers.push_back(thread(&WorkerPool::worker_loop, this));
         }
-        
-        JSONResponse response = processor->process(op.request);
-        string json_response = create_json_response(response);
-        
-        send(op.client_socket, json_response.c_str(), json_response.length(), 0);
-        
-        cout << "[PROCESSOR] Completed: " << op.request.operation << endl;
     }
-}
+
+    // Tasks of one class start in submission order
+    void submit(OperationClass cls, function<void()> task) {
+        lock_guard<mutex> lock(tasks_mutex);
+        if (tasks[cls].empty()) pass[cls] = max(pass[cls], current_pass);
+        tasks[cls].push_back(move(task));
+        server_load.ready[cls]++;
+        tasks_cv.notify_one();
+    }
+
+    // Runs what is already queued, then joins the workers
+    void shutdown() {
+        {
+            lock_guard<mutex> lock(tasks_mutex);
+            stopping = true;
+            tasks_cv.notify_all();
+        }
+        for (auto& t : workers) {
+            if (t.joinable()) t.join();
+        }
+        workers.clear();
+    }
+
+private:
+    // Non-empty class with the lowest pass, or CLASS_COUNT; tasks_mutex held
+    int next_class() const {
+        int best = CLASS_COUNT;
+        for (int cls = 0; cls < CLASS_COUNT; cls++) {
+            if (!tasks[cls].empty() && (best == CLASS_COUNT || pass[cls] < pass[best])) best = cls;
+        }
+        return best;
+    }
+
+    void worker_loop() {
+        Tracer::name_thread("worker");
+        while (true) {
+            function<void()> task;
+            {
+                unique_lock<mutex> lock(tasks_mutex);
+                tasks_cv.wait(lock, [this] { return next_class() != CLASS_COUNT || stopping; });
+                int cls = next_class();
+                if (cls == CLASS_COUNT) return;
+                task = move(tasks[cls].front());
+                tasks[cls].pop_front();
+                server_load.ready[cls]--;
+                current_pass = pass[cls];
+                pass[cls] += STRIDE_SCALE / CLASS_WEIGHTS[cls];
+            }
+            task();
+        }
+    }
+};
 
 // ============================================================================
-// CLIENT HANDLER
+// PROCESSOR THREAD
 // ============================================================================
 
-void client_handler_thread(int client_socket, FIFOQueue* queue) {
-    cout << "[CLIENT] Connected: socket " << client_socket << endl;
+// Key for the user table and sessions; path keys always start with '/'
+const string USERS_LOCK_KEY = "users";
+
+// Locks an operation needs before it may run (see core/lock_manager.hpp)
+vector<LockRequest> lock_plan(const JSONRequest& req) {
+    vector<LockRequest> plan;
+    switch (req.op) {
+        case OP_FILE_READ:
+        case OP_FILE_EXISTS:
+        case OP_GET_METADATA:
+        case OP_DIR_LIST:
+        case OP_DIR_EXISTS:
+            plan_path_lock(plan, req.path, LOCK_S);
+            break;
+        case OP_FILE_CREATE:
+        case OP_FILE_DELETE:
+        case OP_DIR_CREATE:
+        case OP_DIR_DELETE:
+            plan_path_lock(plan, req.path, LOCK_X);
+            break;
+        case OP_FILE_RENAME:
+            plan_path_lock(plan, req.old_path, LOCK_X);
+            plan_path_lock(plan, req.new_path, LOCK_X);
+            break;
+        case OP_USER_LOGIN:
+        case OP_USER_LOGOUT:
+        case OP_USER_LIST:
+            plan.push_back({USERS_LOCK_KEY, LOCK_S});
+            break;
+        case OP_USER_CREATE:
+        case OP_USER_DELETE:
+            plan.push_back({USERS_LOCK_KEY, LOCK_X});
+            break;
+        case OP_GET_STATS:
+            plan_path_lock(plan, "/", LOCK_S);
+            plan.push_back({USERS_LOCK_KEY, LOCK_S});
+            break;
+        case OP_GET_METRICS:
+        case OP_GET_TRACE:
+            // Counters and spans only, nothing to lock
+            break;
+        case OP_BATCH:
+            // Everything any item touches, held for the whole batch
+            for (const JSONRequest& item : req.batch) {
+                vector<LockRequest> item_plan = lock_plan(item);
+                plan.insert(plan.end(), item_plan.begin(), item_plan.end());
+            }
+            break;
+        default:
+            // fs_grow, fs_shrink and anything unknown get the whole file system
+            plan_path_lock(plan, "/", LOCK_X);
+            plan.push_back({USERS_LOCK_KEY, LOCK_X});
+            break;
+    }
+    return plan;
+}
+
+void send_operation_response(const QueuedOperation& op, const JSONResponse& response) {
+    uint64_t started = metrics_now_ns();
+    string encoded = op.connection->take_buffer();
+    if (op.connection->format == WIRE_BINARY) {
+        encode_binary_response(op.request, response, encoded);
+    } else {
+        write_json_response(response, encoded);
+    }
+    uint64_t encoded_at = record_stage(STAGE_ENCODE, started);
+    
+    op.connection->send_response(op.sequence, move(encoded));
+    uint64_t sent_at = record_stage(STAGE_SEND, encoded_at);
+    
+    if (op.trace_id) {
+        const char* name = op.request.op < OPERATION_COUNT ? OPERATION_NAMES[op.request.op] : "unknown";
+        tracer.record(op.trace_id, "encode", "net", started, encoded_at);
+        tracer.record(op.trace_id, "send", "net", encoded_at, sent_at);
+        tracer.record(op.trace_id, name, "request", op.queued_ns, sent_at, op.request.path, TRACE_REQUEST);
+    }
+}
+
+// Queue wait of a traced request, split into its FIFO, lock and ready parts
+void trace_queue_wait(const QueuedOperation& op, uint64_t started_ns) {
+    tracer.record(op.trace_id, "queue", "request", op.queued_ns, started_ns, string_view(), TRACE_REQUEST);
+    if (op.dequeued_ns == 0) return;
+    tracer.record(op.trace_id, "fifo", "request", op.queued_ns, op.dequeued_ns, string_view(), TRACE_REQUEST);
+    if (op.granted_ns == 0) return;
+    tracer.record(op.trace_id, "locks", "request", op.dequeued_ns, op.granted_ns, string_view(), TRACE_REQUEST);
+    tracer.record(op.trace_id, "ready", "request", op.granted_ns, started_ns, string_view(), TRACE_REQUEST);
+}
+
+void execute_operation(OperationProcessor* processor, const QueuedOperation& op) {
+    uint64_t started = record_stage(STAGE_QUEUE, op.queued_ns);
+    if (op.trace_id) trace_queue_wait(op, started);
+    current_trace = op.trace_id;
+    server_load.running++;
+    if (op.expired()) {
+        JSONResponse response;
+        response.status = "error";
+        response.operation = op.request.operation;
+        response.request_id = op.request.request_id;
+        response.error_code = ERROR_TIMEOUT;
+        response.error_message = get_error_message(ERROR_TIMEOUT);
+        send_operation_response(op, response);
+        server_load.expired++;
+        LOG_DEBUG("[PROCESSOR] Expired: " << op.request.operation);
+    } else {
+        send_operation_response(op, processor->process(op.request));
+        LOG_DEBUG("[PROCESSOR] Completed: " << op.request.operation);
+    }
     
-    char buffer[4096];
+    server_load.running--;
+    current_trace = 0;
+    server_load.finish();
+    op.connection->request_done();
+}
+
+/**
+ * Dispatches the queue in FIFO order. Each operation's path locks are
+ * queued here, in queue order, so conflicting operations (a write and
+ * anything else on the same entry or directory) still run in the order
+ * they arrived. Once its locks are granted an operation goes to the
+ * worker pool under its class, and the pool decides which of the
+ * runnable operations gets the next free worker. Nothing waits for a
+ * lock on a worker.
+ */
+void fifo_processor_thread(FIFOQueue* queue, OperationProcessor* processor,
+                           WorkerPool* pool, LockManager* locks) {
+    Tracer::name_thread("processor");
+    LOG_INFO("[PROCESSOR] Started");
     
     while (true) {
-        memset(buffer, 0, sizeof(buffer));
-        int bytes = recv(client_socket, buffer, sizeof(buffer) - 1, 0);
+        QueuedOperation next(JSONRequest(), nullptr);
         
-        if (bytes <= 0) {
-            cout << "[CLIENT] Disconnected: socket " << client_socket << endl;
+        if (!queue->dequeue(next)) {
             break;
         }
         
-        buffer[bytes] = '\0';
+        shared_ptr<QueuedOperation> op = make_shared<QueuedOperation>(move(next));
+        if (op->trace_id) op->dequeued_ns = metrics_now_ns();
+        if (op->expired()) {
+            execute_operation(processor, *op);
+            continue;
+        }
         
-        JSONRequest request = parse_json_request(string(buffer));
-        queue->enqueue(QueuedOperation(request, client_socket));
+        OperationClass cls = operation_class(op->request.op);
+        locks->enqueue(lock_plan(op->request), [processor, pool, locks, cls, op](uint64_t ticket) {
+            if (op->trace_id) op->granted_ns = metrics_now_ns();
+            pool->submit(cls, [processor, locks, ticket, op] {
+                LockGuard guard(*locks, ticket);
+                execute_operation(processor, *op);
+            });
+        });
     }
-    
-    close(client_socket);
 }
 
 // ============================================================================
 // SERVER
 // ============================================================================
 
+// Each I/O thread multiplexes its share of the connections with epoll
+struct IOThread {
+    int epoll_fd = -1;
+    int wake_fd = -1;           // eventfd: new connections, resumes or shutdown
+    thread worker;
+    mutex pending_mutex;
+    vector<int> pending;        // Accepted sockets waiting to be registered
+    vector<int> resumed;        // Paused connections that are back under their limits
+    unordered_map<int, shared_ptr<Connection>> connections;
+};
+
+bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+void wake(int event_fd) {
+    uint64_t one = 1;
+    ssize_t ignored = write(event_fd, &one, sizeof(one));
+    (void)ignored;
+}
+
+void request_resume(IOThread* io, int fd) {
+    {
+        lock_guard<mutex> lock(io->pending_mutex);
+        io->resumed.push_back(fd);
+    }
+    wake(io->wake_fd);
+}
+
 class OFSServer {
 private:
     int server_socket;
     int port;
-    bool running;
+    int max_connections;
+    atomic<bool> running;
+    atomic<int> active_connections;
+    int accept_epoll;
+    int stop_fd;
     FIFOQueue queue;
+    chrono::seconds queue_timeout;      // 0 = requests never expire
+    int max_in_flight;                  // Per connection, before reading pauses
     OperationProcessor* processor;
     thread processor_thread_obj;
-    vector<thread> client_threads;
+    WorkerPool workers;
+    LockManager path_locks;
+    vector<unique_ptr<IOThread>> io_threads;
 
 public:
-    OFSServer(int port_num, const string& omni_path) 
-        : server_socket(-1), port(port_num), running(false) {
-        processor = new OperationProcessor(omni_path);
+    OFSServer(const Config& config, const string& omni_path) 
+        : server_socket(-1), port(config.server.port), max_connections(config.server.max_connections),
+          running(false), active_connections(0), accept_epoll(-1), stop_fd(eventfd(0, EFD_NONBLOCK)),
+          queue_timeout(max(0, config.server.queue_timeout)),
+          max_in_flight(max(1, config.server.max_in_flight)) {
+        server_load.max_outstanding = max(0, config.server.max_queue_depth);
+        processor = new OperationProcessor(omni_path, config.security.require_auth);
     }
     
     ~OFSServer() {
         stop();
         delete processor;
+        close(stop_fd);
     }
     
     bool start() {
         server_socket = socket(AF_INET, SOCK_STREAM, 0);
         if (server_socket < 0) {
-            cerr << "[ERROR] Cannot create socket" << endl;
+            LOG_ERROR("[ERROR] Cannot create socket");
             return false;
         }
         
@@ -701,69 +2428,384 @@ public:
         server_addr.sin_port = htons(port);
         
         if (::bind(server_socket, (sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-            cerr << "[ERROR] Cannot bind to port " << port << endl;
+            LOG_ERROR("[ERROR] Cannot bind to port " << port);
             close(server_socket);
             return false;
         }
         
-        if (listen(server_socket, 20) < 0) {
-            cerr << "[ERROR] Cannot listen" << endl;
+        if (listen(server_socket, SOMAXCONN) < 0 || !set_nonblocking(server_socket)) {
+            LOG_ERROR("[ERROR] Cannot listen");
             close(server_socket);
             return false;
         }
         
         running = true;
-        processor_thread_obj = thread(fifo_processor_thread, &queue, processor);
+        // One worker per core, and a few even on small machines so one slow
+        // operation does not stall the rest
+        unsigned worker_count = max(4u, thread::hardware_concurrency());
+        workers.start(worker_count);
+        processor_thread_obj = thread(fifo_processor_thread, &queue, processor, &workers, &path_locks);
+        
+        // A few I/O threads serve every connection; they never block on a client
+        unsigned thread_count = max(1u, min(4u, thread::hardware_concurrency()));
+        for (unsigned i = 0; i < thread_count; i++) {
+            unique_ptr<IOThread> io(new IOThread());
+            io->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+            io->wake_fd = eventfd(0, EFD_NONBLOCK);
+            epoll_event event;
+            event.events = EPOLLIN;
+            event.data.fd = io->wake_fd;
+            epoll_ctl(io->epoll_fd, EPOLL_CTL_ADD, io->wake_fd, &event);
+            io->worker = thread(&OFSServer::io_loop, this, io.get());
+            io_threads.push_back(move(io));
+        }
         
+        app_log.flush();
         cout << "\n========================================" << endl;
         cout << "  OFS SERVER RUNNING" << endl;
         cout << "  Port: " << port << endl;
+        cout << "  I/O threads: " << thread_count << ", workers: " << worker_count
+             << ", max connections: " << max_connections << endl;
+        cout << "  Max queued requests: " << server_load.max_outstanding
+             << ", max in flight per connection: " << max_in_flight << endl;
         cout << "========================================\n" << endl;
         
-        while (running) {
-            sockaddr_in client_addr;
-            socklen_t client_len = sizeof(client_addr);
-            
-            int client_socket = accept(server_socket, (sockaddr*)&client_addr, &client_len);
-            
-            if (client_socket < 0) continue;
-            
-            client_threads.push_back(thread(client_handler_thread, client_socket, &queue));
-        }
-        
+        accept_loop();
         return true;
     }
     
+    // Safe to call from a signal handler: only flips the flag and wakes the accept loop
+    void request_stop() {
+        running = false;
+        wake(stop_fd);
+    }
+    
     void stop() {
-        if (!running) return;
         running = false;
         queue.shutdown();
         
-        if (server_socket >= 0) close(server_socket);
+        if (server_socket >= 0) {
+            close(server_socket);
+            server_socket = -1;
+        }
+        if (accept_epoll >= 0) {
+            close(accept_epoll);
+            accept_epoll = -1;
+        }
         if (processor_thread_obj.joinable()) processor_thread_obj.join();
+        workers.shutdown();
+        
+        // The processor has sent its last response; now stop the I/O threads
+        for (auto& io : io_threads) {
+            wake(io->wake_fd);
+            if (io->worker.joinable()) io->worker.join();
+            for (auto& entry : io->connections) entry.second->close_socket();
+            for (int fd : io->pending) close(fd);
+            close(io->wake_fd);
+            close(io->epoll_fd);
+        }
+        io_threads.clear();
+    }
+
+private:
+    void accept_loop() {
+        accept_epoll = epoll_create1(EPOLL_CLOEXEC);
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = server_socket;
+        epoll_ctl(accept_epoll, EPOLL_CTL_ADD, server_socket, &event);
+        event.data.fd = stop_fd;
+        epoll_ctl(accept_epoll, EPOLL_CTL_ADD, stop_fd, &event);
+        
+        size_t next_thread = 0;
+        while (running) {
+            epoll_event ready[2];
+            int count = epoll_wait(accept_epoll, ready, 2, -1);
+            if (count < 0 && errno != EINTR) break;
+            
+            while (running) {
+                int client_socket = accept4(server_socket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (client_socket < 0) break;
+                
+                if (active_connections >= max_connections) {
+                    reject(client_socket);
+                    continue;
+                }
+                active_connections++;
+                
+                // Round-robin; the I/O thread registers the socket itself
+                IOThread* io = io_threads[next_thread++ % io_threads.size()].get();
+                {
+                    lock_guard<mutex> lock(io->pending_mutex);
+                    io->pending.push_back(client_socket);
+                }
+                wake(io->wake_fd);
+            }
+        }
+    }
+    
+    void reject(int client_socket) {
+        JSONResponse resp;
+        resp.status = "error";
+        resp.error_code = ERROR_INVALID_OPERATION;
+        resp.error_message = "Connection limit reached (" + to_string(max_connections) + ")";
+        string json = create_json_response(resp);
+        send(client_socket, json.c_str(), json.length(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        close(client_socket);
+        LOG_WARN("[NET] Rejected connection: limit of " << max_connections << " reached");
+    }
+    
+    void io_loop(IOThread* io) {
+        Tracer::name_thread("io");
+        vector<epoll_event> ready(256);
+        vector<char> buffer(READ_CHUNK_SIZE);
         
-        for (auto& t : client_threads) {
-            if (t.joinable()) t.join();
+        while (running) {
+            int count = epoll_wait(io->epoll_fd, ready.data(), ready.size(), -1);
+            if (count < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            
+            for (int i = 0; i < count; i++) {
+                int fd = ready[i].data.fd;
+                if (fd == io->wake_fd) {
+                    uint64_t ignored;
+                    while (read(io->wake_fd, &ignored, sizeof(ignored)) > 0) {}
+                    register_pending(io);
+                    resume_reading(io, buffer);
+                    continue;
+                }
+                
+                auto found = io->connections.find(fd);
+                if (found == io->connections.end()) continue;
+                shared_ptr<Connection> conn = found->second;
+                
+                bool keep = !(ready[i].events & (EPOLLERR | EPOLLHUP));
+                if (keep && (ready[i].events & EPOLLOUT)) {
+                    lock_guard<mutex> lock(conn->out_mutex);
+                    keep = conn->flush_locked();
+                }
+                if (keep && (ready[i].events & EPOLLIN)) {
+                    keep = receive(conn, buffer);
+                }
+                if (!keep) disconnect(io, conn);
+            }
+        }
+    }
+    
+    void disconnect(IOThread* io, const shared_ptr<Connection>& conn) {
+        LOG_INFO("[NET] Disconnected: socket " << conn->fd);
+        if (conn->paused) server_load.paused_connections--;
+        conn->close_socket();
+        io->connections.erase(conn->fd);
+        active_connections--;
+    }
+    
+    // Picks up the requests a paused connection still has buffered, then
+    // reads from it again
+    void resume_reading(IOThread* io, vector<char>& buffer) {
+        vector<int> sockets;
+        {
+            lock_guard<mutex> lock(io->pending_mutex);
+            sockets.swap(io->resumed);
+        }
+        
+        for (int fd : sockets) {
+            auto found = io->connections.find(fd);
+            if (found == io->connections.end()) continue;
+            shared_ptr<Connection> conn = found->second;
+            if (!conn->paused || !conn->under_resume_limits()) continue;
+            
+            conn->paused = false;
+            server_load.paused_connections--;
+            conn->set_reading(true);
+            if (!receive(conn, buffer)) disconnect(io, conn);
+        }
+    }
+    
+    void register_pending(IOThread* io) {
+        vector<int> sockets;
+        {
+            lock_guard<mutex> lock(io->pending_mutex);
+            sockets.swap(io->pending);
+        }
+        
+        for (int fd : sockets) {
+            shared_ptr<Connection> conn = make_shared<Connection>(fd, io->epoll_fd, io, max_in_flight);
+            epoll_event event;
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            if (epoll_ctl(io->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+                close(fd);
+                active_connections--;
+                continue;
+            }
+            io->connections[fd] = conn;
+            LOG_INFO("[NET] Connected: socket " << fd << " (" << active_connections.load() << " open)");
+        }
+    }
+    
+    // Reads everything available and queues every complete request as
+    // soon as it is in, so a pipelining client never has more than one
+    // partial request buffered. Stops reading once the connection has to
+    // pause. Returns false when the connection should be closed.
+    bool receive(const shared_ptr<Connection>& conn, vector<char>& buffer) {
+        while (true) {
+            if (!queue_buffered(conn)) return false;
+            if (conn->paused) return true;
+            
+            ssize_t bytes = recv(conn->fd, buffer.data(), buffer.size(), 0);
+            if (bytes < 0 && errno == EINTR) continue;
+            if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+            if (bytes <= 0) return false;
+            server_metrics.add(COUNTER_NET_RECEIVED, bytes);
+            conn->in.append(buffer.data(), bytes);
+        }
+    }
+    
+    // Admits and queues the complete requests in conn->in, or answers them
+    // busy, until the connection reaches its limits; false on a bad stream
+    bool queue_buffered(const shared_ptr<Connection>& conn) {
+        string message;
+        while (!conn->paused && conn->next_request(message)) {
+            uint64_t trace_id = tracer.sample();
+            uint64_t parse_start = trace_id ? metrics_now_ns() : 0;
+            JSONRequest request;
+            bool parsed = true;
+            if (conn->format != WIRE_BINARY) {
+                parsed = parse_json_request(message, request);
+            } else if (!decode_binary_request(message, request)) {
+                conn->broken = true;
+                break;
+            }
+            if (trace_id) tracer.record(trace_id, "parse", "net", parse_start, metrics_now_ns(), request.path);
+            uint64_t sequence = request.request_id.empty() ? conn->next_sequence++ : UNSEQUENCED;
+            
+            if (!parsed) {
+                // Whatever was parsed before the error is not run, batch items included
+                JSONResponse invalid;
+                invalid.status = "error";
+                invalid.operation = request.operation;
+                invalid.request_id = request.request_id;
+                invalid.error_code = ERROR_INVALID_OPERATION;
+                invalid.error_message = "Malformed request";
+                request.batch.clear();
+                send_operation_response(QueuedOperation(move(request), conn, sequence), invalid);
+            } else if (!server_load.admit()) {
+                JSONResponse busy;
+                busy.status = "error";
+                busy.operation = request.operation;
+                busy.request_id = request.request_id;
+                busy.error_code = ERROR_BUSY;
+                busy.error_message = get_error_message(ERROR_BUSY);
+                busy.retry_after_ms = BUSY_RETRY_AFTER_MS;
+                send_operation_response(QueuedOperation(move(request), conn, sequence), busy);
+            } else {
+                conn->in_flight++;
+                Deadline deadline = queue_timeout.count() > 0 ? chrono::steady_clock::now() + queue_timeout
+                                                              : NO_DEADLINE;
+                QueuedOperation op(move(request), conn, sequence, deadline);
+                op.trace_id = trace_id;
+                queue.enqueue(move(op));
+            }
+            // Busy answers count too: a client that never reads them must not grow out
+            if (conn->over_limits()) pause(conn);
+        }
+        
+        if (conn->format == WIRE_INVALID || conn->broken) {
+            LOG_WARN("[NET] Malformed request stream on socket " << conn->fd);
+            return false;
+        }
+        if (conn->in.size() > MAX_REQUEST_SIZE + FRAME_HEADER_SIZE + READ_CHUNK_SIZE) {
+            LOG_WARN("[NET] Request over " << MAX_REQUEST_SIZE << " bytes on socket " << conn->fd);
+            return false;
         }
+        return true;
+    }
+    
+    // Stops reading until request_done or a flush brings the connection
+    // back under half its limits; the client's socket buffers fill up and
+    // its writes block
+    void pause(const shared_ptr<Connection>& conn) {
+        conn->paused = true;
+        server_load.paused_connections++;
+        conn->set_reading(false);
+        // Everything may have finished before paused was visible
+        if (conn->under_resume_limits()) request_resume(conn->owner, conn->fd);
     }
 };
 
+OFSServer* active_server = nullptr;
+
+void handle_shutdown_signal(int) {
+    if (active_server) active_server->request_stop();
+}
+
 // ============================================================================
 // MAIN
 // ============================================================================
 
+// What the span ring still holds at shutdown, for a look after the fact
+void write_trace_file(const string& path) {
+    string trace = tracer.export_chrome();
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file || fwrite(trace.data(), 1, trace.size(), file) != trace.size()) {
+        LOG_ERROR("[ERROR] Cannot write trace " << path);
+    } else {
+        LOG_INFO("[SERVER] Wrote trace to " << path << " (" << tracer.recorded() << " spans recorded)");
+    }
+    if (file) fclose(file);
+}
+
 int main() {
     string omni_path = "../compiled/test.omni";
+    string config_path = "../compiled/default.uconf";
+    
+    Config config;
+    if (!config.load(config_path)) {
+        cerr << "[SERVER] Using default server settings" << endl;
+    }
+    app_log.set_level(Logger::parse_level(config.server.log_level, LOG_LEVEL_INFO));
     
     void* fs_instance = nullptr;
-    if (fs_init(&fs_instance, omni_path.c_str(), nullptr) != SUCCESS) {
+    if (fs_init(&fs_instance, omni_path.c_str(), config_path.c_str()) != SUCCESS) {
         cerr << "Failed to initialize file system" << endl;
         return 1;
     }
     
-    OFSServer server(8080, omni_path);
+    // A freshly formatted container has no users; without the configured
+    // admin nobody could log in
+    vector<UserInfo> users;
+    if (!config.security.admin_username.empty() && user_list(omni_path, users) == SUCCESS &&
+        none_of(users.begin(), users.end(), [&](const UserInfo& user) {
+            return config.security.admin_username == user.username;
+        })) {
+        user_create(omni_path, config.security.admin_username, config.security.admin_password, ADMIN);
+    }
+    if (config.server.audit_log) audit_log.open(omni_path);
+    tracer.configure(config.server.trace_sample_rate, max(0, config.server.trace_buffer));
+    active_sessions.set_timeouts(max(0, config.security.session_idle_timeout),
+                                 max(0, config.security.session_lifetime));
+    
+    OFSServer server(config, omni_path);
+    active_server = &server;
+    
+    // No SA_RESTART, so a blocked epoll_wait() returns once a signal arrives
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_shutdown_signal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    
     server.start();
+    server.stop();
+    active_server = nullptr;
     
+    audit_log.close();
+    if (tracer.enabled()) write_trace_file(omni_path + ".trace.json");
+    app_log.flush();
+    cout << "\n[SERVER] Shutting down..." << endl;
     fs_shutdown(fs_instance);
     return 0;
-}
\ No newline at end of file
+}
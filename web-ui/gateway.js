@@ -30,6 +30,12 @@ class OFSGatewayHTTP {
 
         console.log("[Proxy → Gateway] Response:", data);
 
+        // The server answers pipelined requests out of order; the proxy
+        // routes by request_id, so anything else is a routing bug
+        if (data.request_id && data.request_id !== requestId) {
+            throw new Error(`Response for ${data.request_id} delivered to ${requestId}`);
+        }
+
         if (data.status === "success") return data;
         throw new Error(data.error_message || "Unknown error");
     }
@@ -99,6 +105,13 @@ class OFSGatewayHTTP {
         return this.sendRequest("dir_exists", { path });
     }
 
+    // Several operations in one round trip, e.g. a folder upload:
+    // batch([{ operation: "file_create", parameters: { path, data } }, ...])
+    // With atomic set, the first failure undoes the rest and the call throws.
+    async batch(operations, atomic = false) {
+        return this.sendRequest("batch", { operations, atomic });
+    }
+
     // Information operations
     async getStats() {
         return this.sendRequest("get_stats", {});
@@ -12,42 +12,133 @@ app.use(express.json());
 // LOGGING
 console.log("Starting HTTP → TCP proxy...");
 
-app.post("/", (req, res) => {
-    console.log("\n=== Incoming HTTP Request ===");
-    console.log(req.body);
+// Requests share a few connections to the C++ server. The server answers
+// each request as soon as it finishes, so responses are matched to the
+// waiting HTTP request by request_id rather than by order. Browser ids can
+// collide, so each request goes out under a proxy id and the caller's id is
+// put back on the response.
+//
+// The server stops reading a connection while max_in_flight (64 by default)
+// of its requests are unanswered, so requests go to the least busy of
+// SERVER_CONNECTIONS connections instead of all queueing behind one limit.
+// Each of them counts against the server's max_connections.
+const SERVER_CONNECTIONS = 4;
+// An HTTP request that has no answer by then fails with 504
+const REQUEST_TIMEOUT_MS = 30000;
 
-    const client = new net.Socket();
+let nextId = 1;
+const upstreams = [];
 
-    client.connect(TCP_PORT, TCP_HOST, () => {
-        console.log("Connected to C++ server");
-        const json = JSON.stringify(req.body);
-        console.log("Sending:", json);
-        client.write(json);
-    });
+for (let i = 0; i < SERVER_CONNECTIONS; i++) {
+    upstreams.push({ socket: null, buffer: "", pending: new Map() });  // proxy request_id -> { res, requestId, timer }
+}
+
+function finish(upstream, proxyId, status, response) {
+    const waiting = upstream.pending.get(proxyId);
+    if (!waiting) return false;
+    upstream.pending.delete(proxyId);
+    clearTimeout(waiting.timer);
+    waiting.res.status(status).json({ ...response, request_id: waiting.requestId });
+    return true;
+}
+
+function failPending(upstream, status, response) {
+    for (const proxyId of [...upstream.pending.keys()]) {
+        finish(upstream, proxyId, status, response);
+    }
+}
 
-    client.on("data", (data) => {
-        console.log("=== C++ Server Response ===");
-        console.log(data.toString());
-
-        try {
-            res.json(JSON.parse(data.toString()));
-        } catch (err) {
-            res.status(500).json({
-                status: "error",
-                error_message: "Invalid JSON from C++ server"
-            });
+// Splits complete top-level JSON objects off the front of the buffer
+function takeObjects(upstream) {
+    const objects = [];
+    let depth = 0, inString = false, escaped = false, start = -1;
+    let consumed = 0;
+    const buffer = upstream.buffer;
+    for (let i = 0; i < buffer.length; i++) {
+        const c = buffer[i];
+        if (inString) {
+            if (escaped) escaped = false;
+            else if (c === "\\") escaped = true;
+            else if (c === '"') inString = false;
+        } else if (c === '"') {
+            inString = true;
+        } else if (c === "{") {
+            if (depth++ === 0) start = i;
+        } else if (c === "}" && depth > 0 && --depth === 0) {
+            objects.push(buffer.slice(start, i + 1));
+            consumed = i + 1;
         }
+    }
+    upstream.buffer = buffer.slice(consumed);
+    return objects;
+}
 
-        client.destroy();
+function connectServer(upstream) {
+    if (upstream.socket) return upstream.socket;
+
+    const server = new net.Socket();
+    upstream.socket = server;
+    server.setEncoding("utf8");
+    server.connect(TCP_PORT, TCP_HOST, () => console.log("Connected to C++ server"));
+
+    server.on("data", (data) => {
+        upstream.buffer += data;
+        for (const text of takeObjects(upstream)) {
+            console.log("=== C++ Server Response ===");
+            console.log(text);
+
+            let response;
+            try {
+                response = JSON.parse(text);
+            } catch (err) {
+                console.log("Invalid JSON from C++ server");
+                continue;
+            }
+
+            // No request_id: the reply is about the connection (such as the
+            // connection limit), so it answers everything sent on it
+            if (!response.request_id) {
+                failPending(upstream, 503, response);
+                continue;
+            }
+            if (!finish(upstream, response.request_id, 200, response)) {
+                console.log("No outstanding request for", response.request_id);
+            }
+        }
     });
 
-    client.on("error", (err) => {
+    server.on("error", (err) => {
         console.log("TCP ERROR:", err);
-        res.status(500).json({
+    });
+
+    server.on("close", () => {
+        upstream.socket = null;
+        upstream.buffer = "";
+        failPending(upstream, 500, { status: "error", error_message: "C++ Server unreachable" });
+    });
+
+    return server;
+}
+
+app.post("/", (req, res) => {
+    console.log("\n=== Incoming HTTP Request ===");
+    console.log(req.body);
+
+    const upstream = upstreams.reduce((best, u) => (u.pending.size < best.pending.size ? u : best));
+    const proxyId = `proxy_${nextId++}`;
+    const timer = setTimeout(() => {
+        console.log("No answer for", proxyId, "in", REQUEST_TIMEOUT_MS, "ms");
+        finish(upstream, proxyId, 504, {
             status: "error",
-            error_message: "C++ Server unreachable"
+            operation: req.body.operation || "",
+            error_message: "C++ server did not answer in time",
         });
-    });
+    }, REQUEST_TIMEOUT_MS);
+    upstream.pending.set(proxyId, { res, requestId: req.body.request_id || "", timer });
+
+    const json = JSON.stringify({ ...req.body, request_id: proxyId });
+    console.log("Sending:", json);
+    connectServer(upstream).write(json);
 });
 
 app.listen(3000, () => {